@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stddef.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <io.h>
@@ -21,13 +22,18 @@ void s_io_cb(struct ev_loop *loop, ev_io *w, int revents)
 }
 
 static
-int s_get_revents(void *zsock, int events)
+int s_get_revents(ev_zsock_t *wz)
 {
         int revents = 0;
+        int events = wz->events;
+
+        // msgs already taken off zsock but not handed to cb yet
+        if (wz->pending)
+                return events;
 
         int zmq_events;
         size_t optlen = sizeof(zmq_events);
-        int rc = zmq_getsockopt(zsock, ZMQ_EVENTS, &zmq_events, &optlen);
+        int rc = zmq_getsockopt(wz->zsock, ZMQ_EVENTS, &zmq_events, &optlen);
 
         if (rc==-1) {
                 // on error, make callback get called
@@ -42,16 +48,82 @@ int s_get_revents(void *zsock, int events)
         return revents;
 }
 
+// spin budget never adapts below spin_ns >> SPIN_MIN_SHIFT
+#define SPIN_MIN_SHIFT  3
+// clock is read once per SPIN_CLOCK_EVERY polls
+#define SPIN_CLOCK_EVERY 32
+// loop polls other watchers and runs due timers once per slice of spin
+#define SPIN_SLICE_NS   10000
+
+static
+unsigned long long s_now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// poll zsock for one slice of the budget. Returns events found, 0 once
+// budget is spent, or -1 if it isn't spent yet.
+static
+int s_spin(ev_zsock_t *wz)
+{
+        unsigned long long now, end;
+        int revents, i = 0;
+
+        now = s_now_ns();
+        if (wz->spin_end == 0) {
+                if (wz->spin_cur == 0 || wz->spin_cur > wz->spin_ns)
+                        wz->spin_cur = wz->spin_ns;
+                wz->spin_end = now + wz->spin_cur;
+        }
+        end = now + SPIN_SLICE_NS;
+        if (end > wz->spin_end)
+                end = wz->spin_end;
+
+        for (;;) {
+                revents = s_get_revents(wz);
+                if (revents) {
+                        wz->spin_hit_cnt ++;
+                        wz->spin_cur = wz->spin_ns;
+                        wz->spin_end = 0;
+                        return revents;
+                }
+                if (++ i % SPIN_CLOCK_EVERY == 0 && (now = s_now_ns()) >= end)
+                        break;
+        }
+        if (now < wz->spin_end)
+                return -1;
+
+        // traffic is sparse, spin less next time
+        wz->spin_miss_cnt ++;
+        wz->spin_end = 0;
+        if (wz->spin_cur > (wz->spin_ns >> SPIN_MIN_SHIFT))
+                wz->spin_cur >>= 1;
+        return 0;
+}
+
+// Spinning is sliced, the loop goes round without blocking between slices
+// so that other watchers and timers are served. It's skipped while other
+// watchers are pending already.
 static
 void s_prepare_cb(struct ev_loop *loop, ev_prepare *w, int revents)
 {
         ev_zsock_t *wz = (ev_zsock_t *)
                 (((char *)w) - offsetof(ev_zsock_t, w_prepare));
 
-        revents = s_get_revents(wz->zsock, wz->events);
+        revents = s_get_revents(wz);
+        if (!revents && wz->spin_ns) {
+                if (ev_pending_count(loop))
+                        wz->spin_end = 0;
+                else
+                        revents = s_spin(wz);
+        }
         if (revents) {
                 // idle ensures that libev will not block
                 ev_idle_start(loop, &wz->w_idle);
+        } else {
+                wz->sleep_cnt ++;
         }
 }
 
@@ -63,7 +135,7 @@ void s_check_cb(struct ev_loop *loop, ev_check *w, int revents)
 
         ev_idle_stop(loop, &wz->w_idle);
 
-        revents = s_get_revents(wz->zsock, wz->events);
+        revents = s_get_revents(wz);
         if (revents)
         {
                 wz->cb(loop, wz, revents);
@@ -76,6 +148,13 @@ ev_zsock_init(ev_zsock_t *wz, ev_zsock_cbfn cb, void *zsock, int events)
         wz->cb = cb;
         wz->zsock = zsock;
         wz->events = events;
+        wz->pending = 0;
+        wz->spin_ns = 0;
+        wz->spin_cur = 0;
+        wz->spin_end = 0;
+        wz->spin_hit_cnt = 0;
+        wz->spin_miss_cnt = 0;
+        wz->sleep_cnt = 0;
 
         ev_prepare *pw_prepare = &wz->w_prepare;
         ev_prepare_init(pw_prepare, s_prepare_cb);
@@ -19,8 +19,16 @@ struct ev_zsock_t
         ev_zsock_cbfn   cb;       // read-only
         void            *zsock;   // read-only
         int             events;   // read-only
+        int             pending;  // rw, non-zero keeps events raised
+        unsigned int    spin_ns;  // rw, busy-poll budget before sleep, 0: off
+
+        unsigned long   spin_hit_cnt;   // read-only, events found by spinning
+        unsigned long   spin_miss_cnt;  // read-only, budgets spent in vain
+        unsigned long   sleep_cnt;      // read-only, loop may block for it
 
         // private
+        unsigned int    spin_cur; // budget adapted to recent hits/misses
+        unsigned long long spin_end; // of budget being spent, 0: none
         ev_prepare w_prepare;
         ev_check w_check;
         ev_idle w_idle;
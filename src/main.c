@@ -9,6 +9,11 @@
 #include <assert.h>
 #include <string.h>
 #include "msg.pb-c.h"
+#include "pez_dispatch.h"
+
+static pez_dispatch_t main_dispatch;
+static pez_dispatch_t foo_dispatch;
+static pez_dispatch_t bar_dispatch;
 
 /*
  * send heart beat message
@@ -18,7 +23,7 @@ send_heart_beat_message(const char *trgt, const char *src, char *str) {
     Msg msg = MSG__INIT;
     HeartBeat hb_msg = HEART_BEAT__INIT;
     size_t len;
-    void *buf = NULL;
+    uint8_t buf[INPROC_MAX_MSG_SIZE];   /* no malloc per send */
     status rc = EOK;
 
     if (!src || !trgt) {
@@ -37,10 +42,9 @@ send_heart_beat_message(const char *trgt, const char *src, char *str) {
     msg.trgt = (char *)trgt;
 
     len = msg__get_packed_size(&msg);
-    buf = malloc(len);
-    if (!buf) {
-        printf("%s: unable to alloc mem\n", __func__);
-        rc = ENOMEM;
+    if (len > sizeof(buf)) {
+        printf("%s: msg too big(%zu bytes)\n", __func__, len);
+        rc = EMSGSIZE;
         goto end;
     }
     msg__pack(&msg, buf);
@@ -55,99 +59,107 @@ send_heart_beat_message(const char *trgt, const char *src, char *str) {
     }
 
 end:
-    if (buf) {
-        free(buf);
-    }
     return rc;
 }
 
+/*
+ * send msg1 by fixed-layout codec. No packing needed.
+ */
 static status
-common_msg_handler(void * thread_name, uint8_t *buf, size_t size) {
-    Msg *msg;
+send_msg1_message(const char *trgt, const char *src, int32_t value) {
+    uint8_t buf[sizeof(main_msg1_t)] PEZ_CODEC_ALIGNED;
+    main_msg1_t *msg1;
+    status rc;
 
-    if (!thread_name || !buf || size <= 0) {
+    msg1 = main_msg1_init_sub(buf, sizeof(buf), 0);
+    if (!msg1) {
+        printf("%s: unable to init msg1\n", __func__);
         return EINVAL;
     }
+    msg1->value = value;
 
-    msg = msg__unpack(NULL, size, buf);
-    if (msg == NULL) {
-        printf("%s:%s failed to unpack messag\n", __func__, thread_name);
-        return EINVAL;
+    rc = pez_ipc_msg_send (trgt, src, buf, sizeof(buf));
+    if (rc != EOK) {
+        printf("%s: failed to send msg1 from %s to %s\n",
+                __func__,
+                src,
+                trgt);
     }
+    return rc;
+}
 
-    switch (msg->type) {
-        case MSGTYPE__HEARTBEAT:
-            printf("%s recvd heartbeat msg from %s, val:%s\n",
-                    thread_name,
-                    msg->src,
-                    msg->hb->substr);
-            break;
-        default:
-            printf("%s:%s unknown msg type\n", __func__, thread_name);
-    }
+/*
+ * Decode protobuf msg. Called by pez dispatch only when handler needs body.
+ */
+static void *
+msg_decode(const uint8_t *buf, size_t size) {
+    return msg__unpack(NULL, size, buf);
+}
 
-    msg__free_unpacked(msg, NULL);
-    return EOK;
+static void
+msg_free(void *body) {
+    msg__free_unpacked((Msg *)body, NULL);
 }
 
 /*
- * main thread ipc handler
+ * heart beat handler
  */
 static void
-main_thread_ipc_handler(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
-    void *socket;
-    socket = wz->zsock;
-    status rc;
-    uint8_t buffer[MSG_BUF_SIZE] = {0};
-    size_t size;
-
-    rc = pez_ipc_msg_recv(socket, buffer, MSG_BUF_SIZE, &size);
-    if (rc != EOK) {
-        printf("%s: main thread failed to recv message\n", __func__);
-    }
+heart_beat_handler(pez_dispatch_msg_t *dmsg, void *thread_name) {
+    Msg *msg;
 
-    rc = common_msg_handler("main thread", buffer, size);
-    if (rc != EOK) {
-        printf("%s: main thread failed to parse msg\n", __func__);
+    msg = pez_dispatch_body(dmsg);
+    if (msg == NULL || msg->hb == NULL) {
+        printf("%s:%s failed to unpack messag\n", __func__,
+               (char *)thread_name);
+        return;
     }
+    printf("%s recvd heartbeat msg from %s, val:%s\n",
+            (char *)thread_name,
+            msg->src,
+            msg->hb->substr);
 }
 
+/*
+ * msg1 handler. Fields are read in place.
+ */
 static void
-foo_thread_ipc_handler(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
-    void *socket;
-    socket = wz->zsock;
-    status rc;
-    uint8_t buffer[MSG_BUF_SIZE] = {0};
-    size_t size;
+msg1_handler(pez_dispatch_msg_t *dmsg, void *thread_name) {
+    const main_msg1_t *msg1;
 
-    rc = pez_ipc_msg_recv(socket, buffer, MSG_BUF_SIZE, &size);
-    if (rc != EOK) {
-        printf("%s: foo thread failed to recv message\n", __func__);
-    }
-
-    rc = common_msg_handler("foo thread", buffer, size);
-    if (rc != EOK) {
-        printf("%s: foo thread failed to parse msg\n", __func__);
+    msg1 = main_msg1_view(dmsg->buf, dmsg->size);
+    if (!msg1) {
+        printf("%s:%s invalid msg1\n", __func__, (char *)thread_name);
+        return;
     }
+    printf("%s recvd msg1, val:%d\n", (char *)thread_name, msg1->value);
 }
 
-static void
-bar_thread_ipc_handler(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
-    void *socket;
-    socket = wz->zsock;
+/*
+ * Register msg handlers of a thread and attach it to pez
+ */
+static status
+thread_ipc_init(pez_dispatch_t *d, struct ev_loop *loop, const char *id,
+                char *thread_name) {
     status rc;
-    uint8_t buffer[MSG_BUF_SIZE] = {0};
-    size_t size;
 
-    rc = pez_ipc_msg_recv(socket, buffer, MSG_BUF_SIZE, &size);
+    rc = pez_dispatch_init(d, id);
     if (rc != EOK) {
-        printf("%s: bar thread failed to recv message\n", __func__);
+        return rc;
     }
-
-    rc = common_msg_handler("bar thread", buffer, size);
+    rc = pez_dispatch_register(d, PEZ_DISPATCH_FMT_PROTOBUF,
+                               MSGTYPE__HEARTBEAT, heart_beat_handler,
+                               msg_decode, msg_free, thread_name);
     if (rc != EOK) {
-        printf("%s: bar thread failed to parse msg\n", __func__);
+        return rc;
     }
+    rc = pez_dispatch_register(d, PEZ_DISPATCH_FMT_CODEC,
+                               MAIN_MSG_MSG1, msg1_handler,
+                               NULL, NULL, thread_name);
+    if (rc != EOK) {
+        return rc;
+    }
+    return pez_dispatch_attach(d, loop, id);
 }
 
 static void
@@ -180,6 +192,11 @@ foo_thread_timeout_cb (struct ev_loop *loop, ev_timer *w, int revents) {
     if (rc != EOK) {
         printf("%s: foo failed to send hb msg\n", __func__);
     }
+
+    rc = send_msg1_message("main", "foo", 1);
+    if (rc != EOK) {
+        printf("%s: foo failed to send msg1\n", __func__);
+    }
 }
 
 static void
@@ -204,7 +221,7 @@ void * pez_foo_thread (void *arg) {
     struct ev_loop *loop = ev_loop_new (0);
     assert (loop != NULL);
 
-    rc = pez_ipc_thread_init_rx(loop, "foo", foo_thread_ipc_handler);
+    rc = thread_ipc_init(&foo_dispatch, loop, "foo", "foo thread");
     if (rc != EOK) {
         printf("foo thread failed to init ipc\n");
         return NULL;
@@ -230,7 +247,7 @@ void * pez_bar_thread (void *arg) {
     struct ev_loop *loop = ev_loop_new (0);
     assert (loop != NULL);
 
-    rc = pez_ipc_thread_init_rx(loop, "bar", bar_thread_ipc_handler);
+    rc = thread_ipc_init(&bar_dispatch, loop, "bar", "bar thread");
     if (rc != EOK) {
         printf("bar thread failed to init ipc\n");
         return NULL;
@@ -262,7 +279,7 @@ int main() {
     /* Enable debug */
     //pez_ipc_enable_debug();
 
-    rtn = pez_ipc_thread_init_rx(loop, "main", main_thread_ipc_handler);
+    rtn = thread_ipc_init(&main_dispatch, loop, "main", "main thread");
     if (rtn != EOK) {
         printf("main thread failed to init ipc\n");
         return -1;
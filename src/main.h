@@ -1,6 +1,7 @@
 #ifndef MAIN_H
 #define MAIN_H
 #include <errno.h>
+#include "pez_codec.h"
 typedef int    status;
 
 /*
@@ -28,6 +29,23 @@ typedef enum {
     FOREACH_MSG(GENERATE_ENUM)
 }MAIN_MSG_TYPE;
 
+/*
+ * Fixed layout of msgs sent by pez codec instead of protobuf. Fields can
+ * only be appended, bump version of PEZ_CODEC_DEFINE when doing so.
+ */
+#define FOREACH_MSG1_FIELD(FIELD, ARRAY)        \
+        FIELD(int32_t, subtype)     \
+        FIELD(int32_t, value)     \
+        FIELD(int32_t, foo)
+
+#define FOREACH_MSG2_FIELD(FIELD, ARRAY)        \
+        FIELD(int32_t, subtype)     \
+        ARRAY(char, str, 28)     \
+        ARRAY(char, substr, 32)
+
+PEZ_CODEC_DEFINE(main_msg1, MAIN_MSG_MSG1, 1, FOREACH_MSG1_FIELD)
+PEZ_CODEC_DEFINE(main_msg2, MAIN_MSG_MSG2, 1, FOREACH_MSG2_FIELD)
+
 /*
  * New thread should be added at here
  */
@@ -0,0 +1,414 @@
+#ifndef PEZ_HPP
+#define PEZ_HPP
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <new>
+#include <span>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "pez_ipc.h"
+#include "pez_codec.h"
+
+/*
+ * C++20 binding of pez ipc, header only.
+ *
+ *      pez::endpoint ep(loop, "worker");
+ *
+ *      ep.on<main_msg1_t>([](const main_msg1_t &m) { ... });
+ *      ep.send<main_msg1_t>("peer", [](main_msg1_t &m) { m.value = 1; });
+ *
+ *      pez::task serve(pez::endpoint &ep) {
+ *          for (;;) {
+ *              pez::message msg = co_await ep.recv();
+ *              ...
+ *          }
+ *      }
+ *
+ * Messages are received as pez::message, a move-only owner of the zmq
+ * frame, so they're never copied. Typed sends and handlers use fixed-layout
+ * types made by PEZ_CODEC_DEFINE, handlers read them in place.
+ *
+ * An endpoint receives only while somebody consumes: a handler, or a
+ * coroutine waiting in co_await ep.recv(). Otherwise msgs stay queued and
+ * the endpoint's ev_zsock is stopped. Waiters are resumed by the endpoint's
+ * libev loop, in the order they started waiting, before any handler.
+ *
+ * Like the C API, an endpoint belongs to the thread which opened it.
+ */
+
+namespace pez {
+
+/*
+ * Failure of a call that can't return pez_status, i.e. a constructor.
+ */
+class error : public std::system_error {
+public:
+    error(pez_status rc, const char *what)
+        : std::system_error(rc, std::generic_category(), what) {}
+};
+
+template <typename T>
+concept codec_msg = std::is_trivially_copyable_v<T> &&
+                    requires { pez_codec_traits<T>::type; };
+
+/*
+ * Received msg. Owns a reference to zmq frame, moving hands it over.
+ */
+class message {
+public:
+    message() noexcept {
+        zmq_msg_init(&view_.frame);
+    }
+
+    explicit message(pez_msg_view_t &view) noexcept {
+        zmq_msg_init(&view_.frame);
+        take(view);
+    }
+
+    message(message &&other) noexcept {
+        zmq_msg_init(&view_.frame);
+        take(other.view_);
+    }
+
+    message &operator=(message &&other) noexcept {
+        if (this != &other) {
+            take(other.view_);
+        }
+        return *this;
+    }
+
+    message(const message &) = delete;
+    message &operator=(const message &) = delete;
+
+    ~message() {
+        pez_ipc_msg_release(&view_);
+    }
+
+    const std::byte *data() const noexcept {
+        return reinterpret_cast<const std::byte *>(view_.data);
+    }
+
+    std::size_t size() const noexcept {
+        return view_.size;
+    }
+
+    std::span<const std::byte> bytes() const noexcept {
+        return {data(), size()};
+    }
+
+    explicit operator bool() const noexcept {
+        return view_.data != nullptr;
+    }
+
+    /* type of fixed-layout msg, -1 if it isn't one */
+    int32_t type() const noexcept {
+        return pez_codec_type(view_.data, view_.size);
+    }
+
+    /* msg read in place as T, nullptr if it isn't a T or isn't aligned */
+    template <codec_msg T>
+    const T *as() const noexcept {
+        return static_cast<const T *>(
+            pez_codec_view(view_.data, view_.size, pez_codec_traits<T>::type,
+                           pez_codec_traits<T>::version, sizeof(T)));
+    }
+
+    /* another owner of the same frame, content isn't copied */
+    message share() const noexcept {
+        message         m;
+        pez_msg_view_t  view;
+
+        if (view_.data &&
+            pez_ipc_msg_retain(const_cast<pez_msg_view_t *>(&view_),
+                               &view) == EOK) {
+            m.take(view);
+        }
+        return m;
+    }
+
+    pez_msg_view_t *native() noexcept {
+        return &view_;
+    }
+
+private:
+    /* data may point into zmq_msg_t itself, so it's found again after move */
+    void take(pez_msg_view_t &from) noexcept {
+        zmq_msg_move(&view_.frame, &from.frame);
+        view_.off = from.off;
+        view_.size = from.size;
+        view_.data = from.data ? static_cast<const uint8_t *>(
+                         zmq_msg_data(&view_.frame)) + view_.off : nullptr;
+        pez_ipc_msg_release(&from);
+        zmq_msg_init(&from.frame);
+    }
+
+    pez_msg_view_t  view_{};
+};
+
+/*
+ * Fire and forget coroutine, runs until its first co_await right away and
+ * frees itself when it finishes.
+ */
+struct task {
+    struct promise_type {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/*
+ * Named endpoint, closed on destruction. Not movable, its address is the
+ * ev_zsock data. Without loop it only sends. Without domain it's in the
+ * default one.
+ */
+class endpoint {
+public:
+    class recv_awaiter;
+
+    endpoint(pez_domain_t *dom, struct ev_loop *loop, const char *id)
+        : loop_(loop) {
+        ep_ = pez_domain_endpoint_open(dom, loop, id,
+                                       loop ? &endpoint::zsock_cb : nullptr,
+                                       this);
+        if (!ep_) {
+            throw error(EINVAL, "pez: endpoint open");
+        }
+        wz_ = pez_ipc_endpoint_zsock(ep_);
+        pause();
+    }
+
+    endpoint(struct ev_loop *loop, const char *id)
+        : endpoint(pez_domain_default(), loop, id) {}
+
+    explicit endpoint(const char *id) : endpoint(nullptr, id) {}
+
+    endpoint(const endpoint &) = delete;
+    endpoint &operator=(const endpoint &) = delete;
+
+    ~endpoint() {
+        pez_ipc_endpoint_close(ep_);
+    }
+
+    const char *name() const noexcept {
+        return pez_ipc_endpoint_name(ep_);
+    }
+
+    pez_endpoint_t *native() const noexcept {
+        return ep_;
+    }
+
+    pez_status send(const char *trgt, const void *buf, std::size_t size) {
+        return pez_ipc_endpoint_send(ep_, trgt, const_cast<void *>(buf), size);
+    }
+
+    pez_status send(const char *trgt, std::span<const std::byte> buf) {
+        return send(trgt, buf.data(), buf.size());
+    }
+
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    pez_status send(const char *trgt, const T &msg) {
+        return send(trgt, &msg, sizeof(T));
+    }
+
+    /* build T in place, header filled, then let fill set the fields */
+    template <codec_msg T, typename F>
+        requires std::is_invocable_v<F, T &>
+    pez_status send(const char *trgt, F &&fill) {
+        alignas(PEZ_CODEC_ALIGN) unsigned char buf[sizeof(T)];
+        T   *msg;
+
+        msg = static_cast<T *>(pez_codec_init(buf, sizeof(buf),
+                                              pez_codec_traits<T>::type,
+                                              pez_codec_traits<T>::version,
+                                              sizeof(T)));
+        std::forward<F>(fill)(*msg);
+        return send(trgt, buf, sizeof(buf));
+    }
+
+    /* parts are received apart by pez_ipc_msg_recvv(), or as one msg */
+    template <typename... Ts>
+        requires (sizeof...(Ts) <= PEZ_IPC_IOV_MAX &&
+                  (std::is_trivially_copyable_v<Ts> && ...))
+    pez_status send_parts(const char *trgt, const Ts &...parts) {
+        struct iovec iov[] = {
+            {const_cast<Ts *>(&parts), sizeof(Ts)}...
+        };
+
+        return pez_ipc_endpoint_sendv(ep_, trgt, iov, sizeof...(Ts));
+    }
+
+    /* handle fixed-layout msgs of type T, read in place */
+    template <codec_msg T, typename F>
+        requires std::is_invocable_v<F, const T &>
+    void on(F &&fn) {
+        uint16_t type = pez_codec_traits<T>::type;
+
+        if (handler_.size() <= type) {
+            handler_.resize(type + 1);
+        }
+        handler_[type] = [this, fn = std::forward<F>(fn)](const message &m) {
+            alignas(PEZ_CODEC_ALIGN) unsigned char buf[INPROC_MAX_MSG_SIZE];
+            const T *msg = m.as<T>();
+
+            /* frames of zmq aren't always aligned, small ones are copied */
+            if (!msg && m.size() <= sizeof(buf)) {
+                std::memcpy(buf, m.data(), m.size());
+                msg = static_cast<const T *>(
+                    pez_codec_view(buf, m.size(), pez_codec_traits<T>::type,
+                                   pez_codec_traits<T>::version, sizeof(T)));
+            }
+            if (msg) {
+                fn(*msg);
+            } else {
+                drop_cnt_ ++;
+            }
+        };
+        resume();
+    }
+
+    /* handle msgs no typed handler takes */
+    template <typename F>
+        requires std::is_invocable_v<F, message &&>
+    void on_message(F &&fn) {
+        fallback_ = std::forward<F>(fn);
+        resume();
+    }
+
+    /* co_await next msg, empty on recv error */
+    recv_awaiter recv() noexcept;
+
+    uint64_t drop_count() const noexcept {
+        return drop_cnt_;
+    }
+
+    class recv_awaiter {
+    public:
+        explicit recv_awaiter(endpoint &ep) noexcept : ep_(ep) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+            handle_ = h;
+            next_ = nullptr;
+            *ep_.wait_tail_ = this;
+            ep_.wait_tail_ = &next_;
+            ep_.resume();
+        }
+
+        message await_resume() noexcept {
+            return std::move(msg_);
+        }
+
+    private:
+        friend class endpoint;
+
+        endpoint                &ep_;
+        message                 msg_;
+        std::coroutine_handle<> handle_;
+        recv_awaiter            *next_ = nullptr;
+    };
+
+private:
+    static void zsock_cb(struct ev_loop *, ev_zsock_t *wz, int) {
+        static_cast<endpoint *>(wz->data)->readable();
+    }
+
+    bool consumed() const noexcept {
+        return wait_head_ || fallback_ || !handler_.empty();
+    }
+
+    void pause() noexcept {
+        if (wz_ && !paused_ && !consumed()) {
+            ev_zsock_stop(loop_, wz_);
+            paused_ = true;
+        }
+    }
+
+    void resume() noexcept {
+        if (wz_ && paused_) {
+            ev_zsock_start(loop_, wz_);
+            paused_ = false;
+        }
+    }
+
+    void readable() {
+        ev_zsock_t      *wz = wz_;
+        pez_msg_view_t  view;
+        recv_awaiter    *w;
+        pez_status      rc;
+
+        if (!consumed()) {
+            pause();
+            return;
+        }
+        rc = pez_ipc_msg_recv_view(wz_->zsock, &view);
+        if (rc == ETIMEDOUT) {
+            /* expired, dropped and counted by pez */
+            return;
+        }
+        if (rc == EBADMSG) {
+            /* pointer msg, pez released its object, waiters keep waiting */
+            drop_cnt_ ++;
+            return;
+        }
+        message msg = rc == EOK ? message(view) : message();
+
+        if ((w = wait_head_)) {
+            wait_head_ = w->next_;
+            if (!wait_head_) {
+                wait_tail_ = &wait_head_;
+            }
+            w->msg_ = std::move(msg);
+            /* last, the coroutine may destroy this endpoint */
+            pez_ipc_trace_begin(wz);
+            w->handle_.resume();
+            pez_ipc_trace_end(wz);
+            return;
+        }
+        if (!msg) {
+            drop_cnt_ ++;
+            return;
+        }
+        int32_t type = msg.type();
+
+        pez_ipc_trace_begin(wz);
+        if (type >= 0 && (std::size_t)type < handler_.size() &&
+            handler_[type]) {
+            handler_[type](msg);
+        } else if (fallback_) {
+            fallback_(std::move(msg));
+        } else {
+            drop_cnt_ ++;
+        }
+        pez_ipc_trace_end(wz);
+    }
+
+    struct ev_loop                                  *loop_;
+    pez_endpoint_t                                  *ep_ = nullptr;
+    ev_zsock_t                                      *wz_ = nullptr;
+    bool                                            paused_ = false;
+    recv_awaiter                                    *wait_head_ = nullptr;
+    recv_awaiter                                    **wait_tail_ = &wait_head_;
+    std::vector<std::function<void(const message &)>> handler_;
+    std::function<void(message &&)>                 fallback_;
+    uint64_t                                        drop_cnt_ = 0;
+};
+
+inline endpoint::recv_awaiter
+endpoint::recv() noexcept {
+    return recv_awaiter(*this);
+}
+
+} /* namespace pez */
+#endif /* PEZ_HPP */
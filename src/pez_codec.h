@@ -0,0 +1,193 @@
+#ifndef PEZ_CODEC_H
+#define PEZ_CODEC_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Fixed-layout codec.
+ *
+ * Messages are plain C structs generated from a field X-macro. The sender
+ * fills the struct in place in its send buffer, the receiver reads fields
+ * in place from the received buffer. There is no encode or decode step.
+ *
+ * Every message starts with pez_codec_hdr_t. Its first byte is
+ * PEZ_CODEC_TAG(0x00), which is never the first byte of a protobuf
+ * encoding(field number 0 is invalid), so fixed-layout and protobuf
+ * messages can be mixed on the same endpoint:
+ *
+ *      if (pez_codec_is_fixed(buf, size)) {
+ *          read in place
+ *      } else {
+ *          msg__unpack()
+ *      }
+ *
+ * A schema is an X-macro taking two generators, one for scalar fields and
+ * one for fixed size arrays:
+ *
+ *      #define FOREACH_FOO_FIELD(FIELD, ARRAY)     \
+ *              FIELD(int32_t, value)               \
+ *              ARRAY(char, name, 24)
+ *
+ *      PEZ_CODEC_DEFINE(foo, FOO_TYPE, 1, FOREACH_FOO_FIELD)
+ *
+ * which generates foo_t, foo_init(), foo_init_sub() and foo_view(), and in
+ * C++ also pez_codec_traits<foo_t>. foo_init_sub() also sets the subtype
+ * in hdr, which routing rules match. Fields must be naturally aligned(checked at
+ * compile time) and may only be appended. Bump version when appending,
+ * receivers accept the same or a newer version.
+ */
+
+#define PEZ_CODEC_TAG           (0x00)
+#define PEZ_CODEC_MAGIC         (0xE5)
+#define PEZ_CODEC_ALIGN         (8)
+
+/* Use it on receive buffers which are read in place */
+#define PEZ_CODEC_ALIGNED       __attribute__((aligned(PEZ_CODEC_ALIGN)))
+
+typedef struct {
+    uint8_t             tag;        /* PEZ_CODEC_TAG */
+    uint8_t             magic;      /* PEZ_CODEC_MAGIC */
+    uint16_t            version;    /* layout version of this type */
+    uint16_t            type;       /* message type */
+    uint16_t            flags;      /* reserved, 0 */
+    uint32_t            size;       /* size of the whole message */
+    uint32_t            subtype;    /* matched by routing rules, 0: none */
+} __attribute__((aligned(PEZ_CODEC_ALIGN))) pez_codec_hdr_t;
+
+#ifdef __cplusplus
+#define PEZ_CODEC_STATIC_ASSERT     static_assert
+#define PEZ_CODEC_ALIGNOF           alignof
+
+/* type and version of NAME_t, for typed sends and handlers of pez.hpp */
+template <typename T> struct pez_codec_traits;
+
+#define PEZ_CODEC_GEN_TRAITS(NAME, TYPE, VERSION)                           \
+    template <> struct pez_codec_traits<NAME##_t> {                         \
+        static constexpr uint16_t type = (TYPE);                            \
+        static constexpr uint16_t version = (VERSION);                      \
+    };
+#else
+#define PEZ_CODEC_STATIC_ASSERT     _Static_assert
+#define PEZ_CODEC_ALIGNOF           _Alignof
+#define PEZ_CODEC_GEN_TRAITS(NAME, TYPE, VERSION)
+#endif
+
+#define PEZ_CODEC_GEN_FIELD(TYPE, NAME)             TYPE NAME;
+#define PEZ_CODEC_GEN_ARRAY(TYPE, NAME, COUNT)      TYPE NAME[COUNT];
+
+#define PEZ_CODEC_GEN_FIELD_CHECK(TYPE, NAME)                               \
+        PEZ_CODEC_STATIC_ASSERT(offsetof(pez_codec_self_t, NAME) %          \
+                                PEZ_CODEC_ALIGNOF(TYPE) == 0,               \
+                                "pez codec: " #NAME " is not aligned");
+#define PEZ_CODEC_GEN_ARRAY_CHECK(TYPE, NAME, COUNT)                        \
+        PEZ_CODEC_GEN_FIELD_CHECK(TYPE, NAME)
+
+/*
+ * Generate NAME_t, NAME_init(), NAME_init_sub() and NAME_view() for schema
+ * FOREACH_FIELD.
+ */
+#define PEZ_CODEC_DEFINE(NAME, TYPE, VERSION, FOREACH_FIELD)                \
+    typedef struct {                                                        \
+        pez_codec_hdr_t hdr;                                                \
+        FOREACH_FIELD(PEZ_CODEC_GEN_FIELD, PEZ_CODEC_GEN_ARRAY)             \
+    } __attribute__((packed, aligned(PEZ_CODEC_ALIGN))) NAME##_t;           \
+                                                                            \
+    static inline void                                                      \
+    NAME##_layout_check(void) {                                             \
+        typedef NAME##_t pez_codec_self_t;                                  \
+        FOREACH_FIELD(PEZ_CODEC_GEN_FIELD_CHECK, PEZ_CODEC_GEN_ARRAY_CHECK) \
+    }                                                                       \
+                                                                            \
+    static inline NAME##_t *                                                \
+    NAME##_init(void *buf, size_t size) {                                   \
+        return (NAME##_t *)pez_codec_init(buf, size, TYPE, VERSION,         \
+                                          sizeof(NAME##_t));                \
+    }                                                                       \
+                                                                            \
+    static inline NAME##_t *                                                \
+    NAME##_init_sub(void *buf, size_t size, uint32_t subtype) {             \
+        NAME##_t *msg = NAME##_init(buf, size);                             \
+                                                                            \
+        if (msg) {                                                          \
+            msg->hdr.subtype = subtype;                                     \
+        }                                                                   \
+        return msg;                                                         \
+    }                                                                       \
+                                                                            \
+    static inline const NAME##_t *                                          \
+    NAME##_view(const void *buf, size_t size) {                             \
+        return (const NAME##_t *)pez_codec_view(buf, size, TYPE, VERSION,  \
+                                                sizeof(NAME##_t));          \
+    }                                                                       \
+                                                                            \
+    PEZ_CODEC_GEN_TRAITS(NAME, TYPE, VERSION)
+
+/*
+ * Tell fixed-layout message from protobuf one by the first byte.
+ */
+static inline int
+pez_codec_is_fixed(const void *buf, size_t size) {
+    const pez_codec_hdr_t *hdr = (const pez_codec_hdr_t *)buf;
+
+    if (!buf || size < sizeof(pez_codec_hdr_t)) {
+        return 0;
+    }
+    return hdr->tag == PEZ_CODEC_TAG && hdr->magic == PEZ_CODEC_MAGIC;
+}
+
+/*
+ * Message type of a fixed-layout message. -1 if it isn't one.
+ */
+static inline int32_t
+pez_codec_type(const void *buf, size_t size) {
+    if (!pez_codec_is_fixed(buf, size)) {
+        return -1;
+    }
+    return ((const pez_codec_hdr_t *)buf)->type;
+}
+
+/*
+ * Zero the message and fill its header. NULL if buf is too small or isn't
+ * aligned.
+ */
+static inline void *
+pez_codec_init(void *buf, size_t size, uint16_t type, uint16_t version,
+               size_t msg_size) {
+    pez_codec_hdr_t *hdr = (pez_codec_hdr_t *)buf;
+
+    if (!buf || size < msg_size ||
+        ((uintptr_t)buf % PEZ_CODEC_ALIGN) != 0) {
+        return NULL;
+    }
+    memset(buf, 0, msg_size);
+    hdr->tag = PEZ_CODEC_TAG;
+    hdr->magic = PEZ_CODEC_MAGIC;
+    hdr->version = version;
+    hdr->type = type;
+    hdr->size = (uint32_t)msg_size;
+    return buf;
+}
+
+/*
+ * Check a received buffer and return it as the message itself. NULL if it
+ * isn't the expected type, is older than version, is truncated or isn't
+ * aligned.
+ */
+static inline const void *
+pez_codec_view(const void *buf, size_t size, uint16_t type, uint16_t version,
+               size_t msg_size) {
+    const pez_codec_hdr_t *hdr = (const pez_codec_hdr_t *)buf;
+
+    if (!pez_codec_is_fixed(buf, size) ||
+        ((uintptr_t)buf % PEZ_CODEC_ALIGN) != 0) {
+        return NULL;
+    }
+    if (hdr->type != type || hdr->version < version ||
+        hdr->size < msg_size || hdr->size > size) {
+        return NULL;
+    }
+    return buf;
+}
+
+#endif /* PEZ_CODEC_H */
@@ -0,0 +1,289 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zmq.h>
+#include "pez_ipc.h"
+#include "pez_codec.h"
+#include "pez_dispatch.h"
+
+/* protobuf key of field 1 with varint wire type */
+#define PEZ_DISPATCH_PB_TYPE_KEY    (0x08)
+#define PEZ_DISPATCH_PB_VARINT_MAX  (10)
+
+static uint64_t
+pez_dispatch_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Init dispatch table. No handler registered.
+ */
+pez_status
+pez_dispatch_init(pez_dispatch_t *d, const char *name) {
+    if (!d || !name) {
+        return EINVAL;
+    }
+    memset(d, 0, sizeof(*d));
+    strncpy(d->name, name, PEZ_DISPATCH_NAME_MAX_LEN - 1);
+    return EOK;
+}
+
+/*
+ * Register handler for type of msgs of format. decode/free_fn are used only
+ * when handler asks for the body by pez_dispatch_body(). Both can be NULL
+ * for fixed-layout msgs which are read in place.
+ */
+pez_status
+pez_dispatch_register(pez_dispatch_t *d,
+                      pez_dispatch_format_t format,
+                      int32_t type,
+                      pez_dispatch_handler_fn handler,
+                      pez_dispatch_decode_fn decode,
+                      pez_dispatch_free_fn free_fn,
+                      void *arg) {
+    pez_dispatch_entry_t *e;
+
+    if (!d || !handler || format >= PEZ_DISPATCH_FMT_NUM ||
+        type < 0 || type >= PEZ_DISPATCH_MAX_TYPE) {
+        return EINVAL;
+    }
+    e = &d->entry[format][type];
+    memset(e, 0, sizeof(*e));
+    e->handler = handler;
+    e->decode = decode;
+    e->free = free_fn;
+    e->arg = arg;
+    return EOK;
+}
+
+/*
+ * Msgs of type of format will be dropped afterwards.
+ */
+pez_status
+pez_dispatch_unregister(pez_dispatch_t *d,
+                        pez_dispatch_format_t format,
+                        int32_t type) {
+    if (!d || format >= PEZ_DISPATCH_FMT_NUM ||
+        type < 0 || type >= PEZ_DISPATCH_MAX_TYPE) {
+        return EINVAL;
+    }
+    memset(&d->entry[format][type], 0, sizeof(d->entry[format][type]));
+    return EOK;
+}
+
+/*
+ * Register rx thread whose incoming msgs are dispatched by d.
+ */
+pez_status
+pez_dispatch_attach(pez_dispatch_t *d,
+                    struct ev_loop *loop,
+                    const char *rx_id) {
+    if (!d) {
+        return EINVAL;
+    }
+    return pez_ipc_thread_init_rx_ex(loop, rx_id, pez_dispatch_ev_cb, d);
+}
+
+/*
+ * Get msg type and its format without decoding the msg.
+ * Fixed-layout msg carries it in header. For protobuf the envelope must have
+ * type as field 1(like Msg in msg.proto), which protobuf-c packs first.
+ */
+int32_t
+pez_dispatch_peek(const uint8_t *buf,
+                  size_t size,
+                  pez_dispatch_format_t *format) {
+    uint64_t    val = 0;
+    size_t      i;
+
+    if (!buf || size == 0) {
+        return PEZ_DISPATCH_TYPE_INVAL;
+    }
+    if (pez_codec_is_fixed(buf, size)) {
+        *format = PEZ_DISPATCH_FMT_CODEC;
+        return pez_codec_type(buf, size);
+    }
+    *format = PEZ_DISPATCH_FMT_PROTOBUF;
+    if (buf[0] != PEZ_DISPATCH_PB_TYPE_KEY) {
+        return PEZ_DISPATCH_TYPE_INVAL;
+    }
+    for (i = 1; i < size && i <= PEZ_DISPATCH_PB_VARINT_MAX; i ++) {
+        val |= (uint64_t)(buf[i] & 0x7F) << (7 * (i - 1));
+        if (!(buf[i] & 0x80)) {
+            /* negative or oversized types are never registered */
+            return val > INT32_MAX ? PEZ_DISPATCH_TYPE_INVAL : (int32_t)val;
+        }
+    }
+    return PEZ_DISPATCH_TYPE_INVAL;
+}
+
+/*
+ * Same as pez_dispatch_peek(), whatever format msg is of.
+ */
+int32_t
+pez_dispatch_peek_type(const uint8_t *buf, size_t size) {
+    pez_dispatch_format_t format;
+
+    return pez_dispatch_peek(buf, size, &format);
+}
+
+/*
+ * Decode body of msg by registered decoder. Decoded only once, freed after
+ * handler returns. NULL if no decoder or decode failed.
+ */
+void *
+pez_dispatch_body(pez_dispatch_msg_t *msg) {
+    pez_dispatch_entry_t *e;
+
+    if (!msg) {
+        return NULL;
+    }
+    if (msg->body) {
+        return msg->body;
+    }
+    e = &msg->dispatch->entry[msg->format][msg->type];
+    if (!e->decode) {
+        return NULL;
+    }
+    msg->body = e->decode(msg->buf, msg->size);
+    if (msg->body) {
+        e->decode_cnt ++;
+    }
+    return msg->body;
+}
+
+/*
+ * Dispatch one received msg. buf needn't be aligned, misaligned fixed-layout
+ * msgs are copied so that handlers can read them in place. Small ones are
+ * copied on stack, ones bigger than INPROC_MAX_MSG_SIZE into an aligned heap
+ * buffer, freed once handled. They are counted as errors if it can't be
+ * allocated.
+ */
+void
+pez_dispatch_msg(pez_dispatch_t *d, const uint8_t *buf, size_t size) {
+    uint8_t                 buffer[INPROC_MAX_MSG_SIZE] PEZ_CODEC_ALIGNED;
+    uint8_t                 *copy = NULL;
+    pez_dispatch_msg_t      msg;
+    pez_dispatch_entry_t    *e;
+    pez_dispatch_format_t   format;
+    uint64_t                start, cost;
+    int32_t                 type;
+
+    type = pez_dispatch_peek(buf, size, &format);
+    if (type < 0) {
+        d->err_cnt ++;
+        return;
+    }
+    if (type >= PEZ_DISPATCH_MAX_TYPE || !d->entry[format][type].handler) {
+        d->drop_cnt ++;
+        return;
+    }
+    e = &d->entry[format][type];
+
+    if (format == PEZ_DISPATCH_FMT_CODEC &&
+        ((uintptr_t)buf % PEZ_CODEC_ALIGN) != 0) {
+        if (size <= sizeof(buffer)) {
+            memcpy(buffer, buf, size);
+            buf = buffer;
+        } else if (posix_memalign((void **)&copy, PEZ_CODEC_ALIGN,
+                                  size) == 0) {
+            memcpy(copy, buf, size);
+            buf = copy;
+        } else {
+            d->err_cnt ++;
+            return;
+        }
+    }
+
+    msg.dispatch = d;
+    msg.format = format;
+    msg.type = type;
+    msg.buf = buf;
+    msg.size = size;
+    msg.body = NULL;
+
+    start = pez_dispatch_now_ns();
+    e->handler(&msg, e->arg);
+    if (msg.body && e->free) {
+        e->free(msg.body);
+    }
+    cost = pez_dispatch_now_ns() - start;
+    free(copy);
+
+    e->cnt ++;
+    e->time_ns += cost;
+    if (cost > e->time_max_ns) {
+        e->time_max_ns = cost;
+    }
+}
+
+/*
+ * ev_zsock callback of threads attached by pez_dispatch_attach(). Msgs are
+ * dispatched in place, only misaligned fixed-layout ones are copied, see
+ * pez_dispatch_msg().
+ */
+void
+pez_dispatch_ev_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    pez_dispatch_t  *d = (pez_dispatch_t *)wz->data;
+    pez_msg_view_t  view;
+    pez_status      rc;
+
+    rc = pez_ipc_msg_recv_view(wz->zsock, &view);
+    if (rc == ETIMEDOUT) {
+        /* expired, dropped and counted by pez */
+        return;
+    }
+    if (rc == EBADMSG) {
+        /* pointer msg, has no type to dispatch on, pez released its object */
+        d->drop_cnt ++;
+        return;
+    }
+    if (rc != EOK) {
+        d->err_cnt ++;
+        return;
+    }
+    pez_ipc_trace_begin(wz);
+    pez_dispatch_msg(d, view.data, view.size);
+    pez_ipc_trace_end(wz);
+    pez_ipc_msg_release(&view);
+}
+
+/*
+ * Print per-type counters and timing
+ */
+void
+pez_dispatch_counter_print(pez_dispatch_t *d) {
+    static const char       *format_name[PEZ_DISPATCH_FMT_NUM] = {
+        "protobuf", "codec",
+    };
+    pez_dispatch_entry_t    *e;
+    int32_t                 f, i;
+
+    if (!d) {
+        return;
+    }
+    printf("dispatch %s: drop:%llu, err:%llu\n",
+           d->name,
+           (unsigned long long)d->drop_cnt,
+           (unsigned long long)d->err_cnt);
+    for (f = 0; f < PEZ_DISPATCH_FMT_NUM; f ++) {
+        for (i = 0; i < PEZ_DISPATCH_MAX_TYPE; i ++) {
+            e = &d->entry[f][i];
+            if (!e->handler) {
+                continue;
+            }
+            printf("dispatch %s: %s type %d: cnt:%llu, decode:%llu, "
+                   "avg:%lluns, max:%lluns\n",
+                   d->name,
+                   format_name[f],
+                   i,
+                   (unsigned long long)e->cnt,
+                   (unsigned long long)e->decode_cnt,
+                   (unsigned long long)(e->cnt ? e->time_ns / e->cnt : 0),
+                   (unsigned long long)e->time_max_ns);
+        }
+    }
+}
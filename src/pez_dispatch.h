@@ -0,0 +1,103 @@
+#ifndef PEZ_DISPATCH_H
+#define PEZ_DISPATCH_H
+#include <stdint.h>
+#include "pez_ipc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-type handler dispatch.
+ *
+ * A thread registers one handler per wire format and message type. When a
+ * message arrives only its format and type are peeked(codec header or
+ * protobuf field 1), then the handler is looked up in O(1). Codec and
+ * protobuf types are separate namespaces, each format has its own table.
+ * The body is decoded only if the handler calls pez_dispatch_body().
+ * Unhandled types are dropped without decoding.
+ */
+
+#define PEZ_DISPATCH_MAX_TYPE       (256)
+
+#define PEZ_DISPATCH_NAME_MAX_LEN   (32)
+
+#define PEZ_DISPATCH_TYPE_INVAL     (-1)
+
+typedef enum {
+    PEZ_DISPATCH_FMT_PROTOBUF,      /* type in field 1 of envelope */
+    PEZ_DISPATCH_FMT_CODEC,         /* fixed-layout, type in codec hdr */
+    PEZ_DISPATCH_FMT_NUM,
+} pez_dispatch_format_t;
+
+typedef struct pez_dispatch_s pez_dispatch_t;
+
+typedef struct {
+    pez_dispatch_t          *dispatch;
+    pez_dispatch_format_t   format;
+    int32_t                 type;
+    const uint8_t           *buf;
+    size_t                  size;
+    void                    *body;      /* decoded body, NULL until asked */
+} pez_dispatch_msg_t;
+
+typedef void (*pez_dispatch_handler_fn)(pez_dispatch_msg_t *msg, void *arg);
+
+typedef void * (*pez_dispatch_decode_fn)(const uint8_t *buf, size_t size);
+
+typedef void (*pez_dispatch_free_fn)(void *body);
+
+typedef struct {
+    pez_dispatch_handler_fn handler;
+    pez_dispatch_decode_fn  decode;     /* NULL if read in place */
+    pez_dispatch_free_fn    free;
+    void                    *arg;
+    uint64_t                cnt;        /* handled msgs */
+    uint64_t                decode_cnt; /* bodies decoded */
+    uint64_t                time_ns;    /* time spent in handler */
+    uint64_t                time_max_ns;
+} pez_dispatch_entry_t;
+
+struct pez_dispatch_s {
+    char                    name[PEZ_DISPATCH_NAME_MAX_LEN];
+    uint64_t                drop_cnt;   /* no handler, or pointer msg */
+    uint64_t                err_cnt;    /* recv, peek or copy failed */
+    pez_dispatch_entry_t    entry[PEZ_DISPATCH_FMT_NUM][PEZ_DISPATCH_MAX_TYPE];
+};
+
+pez_status pez_dispatch_init(pez_dispatch_t *d, const char *name);
+
+pez_status pez_dispatch_register(pez_dispatch_t *d,
+                                 pez_dispatch_format_t format,
+                                 int32_t type,
+                                 pez_dispatch_handler_fn handler,
+                                 pez_dispatch_decode_fn decode,
+                                 pez_dispatch_free_fn free_fn,
+                                 void *arg);
+
+pez_status pez_dispatch_unregister(pez_dispatch_t *d,
+                                   pez_dispatch_format_t format,
+                                   int32_t type);
+
+pez_status pez_dispatch_attach(pez_dispatch_t *d,
+                               struct ev_loop *loop,
+                               const char *rx_id);
+
+int32_t pez_dispatch_peek_type(const uint8_t *buf, size_t size);
+
+int32_t pez_dispatch_peek(const uint8_t *buf,
+                          size_t size,
+                          pez_dispatch_format_t *format);
+
+void pez_dispatch_msg(pez_dispatch_t *d, const uint8_t *buf, size_t size);
+
+void * pez_dispatch_body(pez_dispatch_msg_t *msg);
+
+void pez_dispatch_ev_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents);
+
+void pez_dispatch_counter_print(pez_dispatch_t *d);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* PEZ_DISPATCH_H */
@@ -1,4 +1,8 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -6,7 +10,14 @@
 #include <pthread.h>
 #include "pez_ipc.h"
 #include "ev_zsock.h"
+#include "pez_journal.h"
+#include "pez_trace.h"
+#include "pez_codec.h"
 #include <assert.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "pez_rtcheck.h"
 #ifdef __APPLE__
 #include <mach/error.h>
 #else
@@ -17,28 +28,360 @@
 #define PEZ_THREAD_ID_MAX_LEN     (32)
 #define PEZ_THREAD_ID_INVAL       (-1)
 
+#define PEZ_DOMAIN_MAX_NUM        (16)
+#define PEZ_DOMAIN_NAME_MAX_LEN   (32)
+
+/* domain never allocates in hot paths, see PEZ_RT_PREALLOC */
+#define PEZ_IPC_RT(pez)           ((pez)->cfg.rt_flags & PEZ_RT_PREALLOC)
+
+/* error in hot path, printf() may allocate so real-time domains count it */
+#define PEZ_IPC_HOT_ERR(pez, ...)                                            \
+    do {                                                                     \
+        if (PEZ_IPC_RT(pez)) {                                               \
+            __atomic_add_fetch(&(pez)->rt_hot_err_cnt, 1, __ATOMIC_RELAXED); \
+        } else {                                                             \
+            printf(__VA_ARGS__);                                             \
+        }                                                                    \
+    } while (0)
+
 #define PEZ_STRING_1_LINE_LEN     (60)
 #define PEZ_STRING_SUFFIX_LEN     (PEZ_THREAD_ID_MAX_LEN * 3)
 
+/* frames after trgt id frame: optional pez hdr and data */
+#define PEZ_MSG_PART_MAX          (PEZ_IPC_IOV_MAX + 1)     /* hdr + data */
+
+/*
+ * pez hdr. Optional frame sent before data frame. Msgs without any pez
+ * feature have no hdr. A msg of more than one frame always starts with it.
+ */
+#define PEZ_HDR_MAGIC             (0xE7)
+#define PEZ_HDR_VERSION           (1)
+
+#define PEZ_HDR_F_BATCH           (0x0001)  /* data is coalesced msgs */
+#define PEZ_HDR_F_KEY             (0x0002)  /* key is valid */
+#define PEZ_HDR_F_TIMER           (0x0004)  /* held by router until due */
+#define PEZ_HDR_F_DEADLINE        (0x0008)  /* deadline_ns is valid */
+#define PEZ_HDR_F_CONFLATE        (0x0010)  /* replaces pending msg of key */
+#define PEZ_HDR_F_PARTS           (0x0020)  /* data is in several frames */
+#define PEZ_HDR_F_PTR             (0x0040)  /* data is a pez_ptr_t */
+#define PEZ_HDR_F_TRACE           (0x0080)  /* trace_id is valid */
+#define PEZ_HDR_F_SRC             (0x0100)  /* src id frame follows hdr */
+
+/* ops of ctrl msgs, i.e. msgs sent to router itself(empty trgt id) */
+#define PEZ_CTRL_GROUP_JOIN       (1)
+#define PEZ_CTRL_GROUP_LEAVE      (2)
+#define PEZ_CTRL_TIMER_CANCEL     (3)
+#define PEZ_CTRL_HELLO            (4)       /* rx thread is connected */
+#define PEZ_CTRL_BYE              (5)       /* endpoint is closed */
+#define PEZ_CTRL_BRIDGE           (6)       /* bridge is set up */
+#define PEZ_CTRL_ROUTE            (7)       /* routing table is replaced */
+#define PEZ_CTRL_STOP             (8)       /* wakes router to stop */
+
+typedef struct {
+    uint8_t             magic;
+    uint8_t             version;
+    uint16_t            flags;
+    uint32_t            cnt;            /* msgs carried */
+    uint16_t            op;             /* ctrl msgs only */
+    uint16_t            reserved;
+    uint32_t            delay_ms;       /* PEZ_HDR_F_TIMER only */
+    uint32_t            period_ms;      /* PEZ_HDR_F_TIMER only, 0: once */
+    uint32_t            reserved2;
+    uint64_t            key;
+    uint64_t            timer_id;
+    uint64_t            deadline_ns;    /* CLOCK_MONOTONIC, dropped after */
+    uint64_t            trace_id;       /* sampled msg, see pez_trace.h */
+} pez_hdr_t;
+
+/*
+ * Coalesced msgs. Each msg is prefixed by pez_batch_rec_t and aligned to
+ * PEZ_BATCH_ALIGN, so receivers can read fixed-layout msgs in place.
+ */
+#define PEZ_BATCH_TRGT_MAX        (8)       /* open batches per sender */
+#define PEZ_BATCH_ALIGN           (8)
+#define PEZ_BATCH_REC_SIZE(len)   ((sizeof(pez_batch_rec_t) + (len) +        \
+                                    PEZ_BATCH_ALIGN - 1) &                   \
+                                    ~(size_t)(PEZ_BATCH_ALIGN - 1))
+
+typedef struct {
+    uint32_t            len;
+    uint32_t            reserved;
+} pez_batch_rec_t;
+
+typedef struct {
+    int32_t             trgt_id;        /* PEZ_THREAD_ID_INVAL if unused */
+    uint32_t            cnt;
+    size_t              len;
+    uint64_t            first_ns;       /* when 1st msg was appended */
+    uint8_t             *buf;
+} pez_batch_t;
+
+typedef struct pez_domain_s pez_t;
+
 typedef struct {
     pthread_t           tid;
+    pez_t               *dom;           /* domain it belongs to */
     struct ev_zsock_t   pez_ev_zsock;
+    struct ev_loop      *loop;
     char                identity[PEZ_THREAD_ID_MAX_LEN];
     uint64_t            recv_cnt;       /* increase by thread itself */
     uint64_t            snd_cnt;        /* increate by thread itself */
     uint64_t            rt_recv_cnt;    /* increase by router */
     uint64_t            rt_snd_cnt;     /* increase by router */
+    uint64_t            expire_cnt;     /* increase by thread itself */
+    uint64_t            ptr_drop_cnt;   /* pointer msgs recvd as plain ones */
+    uint64_t            rt_expire_cnt;  /* increase by router */
+    uint64_t            rt_shed_cnt;    /* increase by router */
+    uint64_t            rt_conflate_cnt;/* increase by router */
+    uint32_t            shed_depth;     /* 0: no load shedding */
+    int                 declared;       /* id known, thread not registered */
+    int                 rt_online;      /* router got hello from thread */
+    uint64_t            open_gen;       /* times id was opened */
+    uint64_t            rt_gen;         /* open_gen of last hello */
+    uint32_t            rt_defer_num;   /* msgs held until online */
+    uint64_t            rt_defer_drop_cnt;
+    /* durable queue, owned by router once set */
+    pez_journal_t       *journal;
+    uint32_t            journal_depth;  /* 0: journal only while offline */
+    /* send side coalescing, owned by thread itself */
+    pez_batch_t         *batch;         /* NULL if coalescing is off */
+    size_t              batch_max_size;
+    uint64_t            batch_max_delay_ns;
+    uint64_t            batch_snd_cnt;  /* batch frames sent */
+    uint32_t            timer_seq;      /* for timer ids */
+    ev_prepare          batch_watcher;  /* flush at end of loop iteration */
+    /* msg being received, owned by thread itself */
+    zmq_msg_t           rx_msg;
+    int                 rx_batch;       /* rx_msg is coalesced msgs */
+    size_t              rx_off;
+    uint32_t            rx_left;        /* msgs left in rx_msg */
+    uint64_t            rx_deadline_ns; /* of rx_msg, 0: none */
+    zmq_msg_t           rx_part[PEZ_IPC_IOV_MAX];   /* msg sent by sendv */
+    int                 rx_part_cnt;
+    int                 rx_ptr;         /* rx_msg is a pez_ptr_t */
+    /* tracing, owned by thread itself */
+    pez_trace_ring_t    *trace;         /* read by dumper */
+    uint64_t            rx_trace_id;    /* of msg being handled, 0: none */
+    uint32_t            trace_cnt;      /* msgs sent since last sampled */
+    uint64_t            trace_seq;
+    /* bridge, msgs to it are forwarded into another domain */
+    pez_t               *bridge;        /* domain they go to */
+    void                *bridge_sock;   /* owned by router once online */
+    int                 rt_bridge;      /* router took bridge_sock over */
 } pez_thd_t;
 
+/*
+ * Msg held by router thread
+ */
+typedef struct {
+    zmq_msg_t           src;
+    zmq_msg_t           trgt;
+    zmq_msg_t           part[PEZ_MSG_PART_MAX];
+    int                 part_cnt;
+    pez_hdr_t           hdr;            /* valid if has_hdr */
+    int                 has_hdr;
+} pez_rt_msg_t;
+
+/*
+ * Timing wheel of router thread. PEZ_WHEEL_LEVELS levels of PEZ_WHEEL_SIZE
+ * slots, one tick is 1ms. Timers beyond the last level are parked in it and
+ * re-cascaded until due.
+ */
+#define PEZ_WHEEL_BITS            (6)
+#define PEZ_WHEEL_SIZE            (1 << PEZ_WHEEL_BITS)
+#define PEZ_WHEEL_MASK            (PEZ_WHEEL_SIZE - 1)
+#define PEZ_WHEEL_LEVELS          (4)
+#define PEZ_WHEEL_SPAN            (1ULL << (PEZ_WHEEL_BITS * PEZ_WHEEL_LEVELS))
+#define PEZ_TIMER_HASH_SIZE       (4096)    /* power of 2 */
+#define PEZ_TIMER_FREE_MAX        (1024)    /* timers cached for reuse */
+
+typedef struct pez_tlink_s {
+    struct pez_tlink_s  *next;
+    struct pez_tlink_s  *prev;
+} pez_tlink_t;
+
+typedef struct pez_timer_s {
+    pez_tlink_t         link;           /* must be 1st */
+    struct pez_timer_s  *hnext;         /* id hash chain */
+    uint64_t            id;
+    uint64_t            expire;         /* tick */
+    uint32_t            period;         /* ticks, 0: once */
+    int                 level;          /* of wheel it's in */
+    pez_rt_msg_t        msg;
+} pez_timer_t;
+
+typedef struct {
+    uint64_t            base_ns;        /* time of tick 0 */
+    uint64_t            now;            /* current tick */
+    pez_tlink_t         slot[PEZ_WHEEL_LEVELS][PEZ_WHEEL_SIZE];
+    uint32_t            level0_num;     /* timers in level 0 */
+    uint32_t            num;
+    pez_timer_t         *hash[PEZ_TIMER_HASH_SIZE];
+    pez_timer_t         *free_list;
+    uint32_t            free_num;
+    uint32_t            free_max;       /* cached, beyond are freed */
+    uint64_t            fire_cnt;
+    uint64_t            cancel_cnt;
+} pez_wheel_t;
+
+/*
+ * Conflated msgs held by router. At most one per (trgt, key), kept in order
+ * of arrival per trgt. They're sent once trgt has less than
+ * PEZ_CONFLATE_DEPTH msgs not handled yet.
+ */
+#define PEZ_CONFLATE_DEPTH        (2)
+#define PEZ_CONFLATE_HASH_SIZE    (4096)    /* power of 2 */
+#define PEZ_CONFLATE_FREE_MAX     (1024)    /* entries cached for reuse */
+
+typedef struct pez_conflate_entry_s {
+    pez_tlink_t         link;           /* must be 1st */
+    struct pez_conflate_entry_s *hnext;
+    int32_t             trgt;
+    uint64_t            key;
+    pez_rt_msg_t        msg;
+} pez_conflate_entry_t;
+
+typedef struct {
+    pez_tlink_t         list[PEZ_THREAD_MAX_NUM];   /* per trgt */
+    int32_t             trgt[PEZ_THREAD_MAX_NUM];   /* lists not empty */
+    uint32_t            trgt_num;
+    pez_conflate_entry_t *hash[PEZ_CONFLATE_HASH_SIZE];
+    pez_conflate_entry_t *free_list;
+    uint32_t            free_num;
+    uint32_t            free_max;
+    uint32_t            num;
+} pez_conflate_t;
+
+/*
+ * Journaled msgs are replayed while trgt has less than journal_depth msgs
+ * not handled, at most PEZ_JOURNAL_REPLAY_BATCH per router loop. Appends
+ * of all journals are synced together at most every PEZ_JOURNAL_COMMIT_NS.
+ */
+#define PEZ_JOURNAL_REPLAY_BATCH  (256)
+#define PEZ_JOURNAL_COMMIT_NS     (1000000ULL)
+
+/*
+ * Msgs to thread which isn't online yet are held by router, up to
+ * PEZ_DEFER_MAX per thread.
+ */
+#define PEZ_DEFER_MAX             (4096)
+
+typedef struct {
+    pez_tlink_t         link;           /* must be 1st */
+    pez_rt_msg_t        msg;
+} pez_defer_t;
+
+/*
+ * Group of threads sharing one name. Msgs sent to the group name are routed
+ * to one member by policy. Members are changed by router thread only.
+ */
+#define PEZ_GROUP_MAX_NUM         (64)
+#define PEZ_GROUP_MEMBER_MAX      (64)
+#define PEZ_GROUP_VNODE_NUM       (16)      /* points per member on ring */
+
 typedef struct {
-    void                *zmq_ctx;
+    uint32_t            hash;
+    int32_t             id;             /* numerical id of member */
+} pez_ring_node_t;
+
+typedef struct {
+    char                name[PEZ_THREAD_ID_MAX_LEN];
+    pez_group_policy_t  policy;
+    /* owned by router thread */
+    int32_t             member[PEZ_GROUP_MEMBER_MAX];
+    int                 member_num;
+    uint32_t            rr_next;
+    pez_ring_node_t     ring[PEZ_GROUP_MEMBER_MAX * PEZ_GROUP_VNODE_NUM];
+    int                 ring_num;
+    uint64_t            rt_cnt;         /* msgs routed to members */
+    uint64_t            rt_drop_cnt;    /* msgs dropped, no member */
+} pez_group_t;
+
+/*
+ * Routing rules compiled into an open addressing hash table, at most half
+ * full. A msg is looked up once per kind of match the table has, so at
+ * most PEZ_ROUTE_MATCH_NUM times however many rules there are. Caller
+ * builds it, puts it on route_pend and hands it over by PEZ_CTRL_ROUTE.
+ * Router only takes tables it finds on route_pend, and owns them then.
+ */
+#define PEZ_ROUTE_MATCH_NUM       (4)       /* combinations of PEZ_ROUTE_M_* */
+#define PEZ_ROUTE_TABLE_MIN       (16)      /* slots, power of 2 */
+
+typedef struct {
+    int                 used;
+    uint32_t            match;
+    uint16_t            type;
+    uint32_t            subtype;        /* 0 unless matched */
+    uint64_t            key;            /* 0 unless matched */
+    pez_route_action_t  action;
+    char                trgt[PEZ_THREAD_ID_MAX_LEN];
+    size_t              trgt_len;
+} pez_route_entry_t;
+
+typedef struct pez_route_table_s {
+    struct pez_route_table_s *next;     /* on route_pend */
+    uint32_t            mask;           /* slots - 1 */
+    uint32_t            rule_num;
+    uint32_t            match_num[PEZ_ROUTE_MATCH_NUM];
+    pez_route_entry_t   entry[];
+} pez_route_table_t;
+
+struct pez_domain_s {
+    char                name[PEZ_DOMAIN_NAME_MAX_LEN];
+    char                addr[PEZ_DOMAIN_NAME_MAX_LEN + 16];    /* of router */
+    int                 idx;            /* in pez_domain */
+    pez_config_t        cfg;
     pthread_t           tid_router;
     unsigned int        thread_num;
     pthread_mutex_t     lock;
+    pthread_cond_t      ready_cond;     /* router bound or thread online */
+    int                 router_ready;
     pez_thd_t           thd[PEZ_THREAD_MAX_NUM];
-} pez_t;
+    pez_group_t         *group[PEZ_GROUP_MAX_NUM];
+    unsigned int        group_num;
+    pez_wheel_t         wheel;          /* owned by router thread */
+    pez_conflate_t      conflate;       /* owned by router thread */
+    pez_tlink_t         defer[PEZ_THREAD_MAX_NUM];  /* owned by router */
+    pez_defer_t         *defer_free;    /* real-time only, chained by next */
+    uint64_t            rt_pool_empty_cnt;  /* router pools found used up */
+    uint64_t            rt_hot_err_cnt;     /* hot path errors, atomic */
+    unsigned int        journal_num;
+    int32_t             journal_id[PEZ_THREAD_MAX_NUM]; /* of journal_num */
+    uint64_t            journal_commit_ns;  /* owned by router thread */
+    uint64_t            rt_ptr_drop_cnt;    /* pointer msgs not delivered */
+    unsigned int        rt_bridge_num;  /* owned by router thread */
+    pez_route_table_t   *route;         /* owned by router thread */
+    pez_route_table_t   *route_pend;    /* not taken by router yet, by lock */
+    uint32_t            rt_route_rule_num;  /* of route */
+    uint64_t            rt_redirect_cnt;
+    uint64_t            rt_mirror_cnt;
+    uint64_t            rt_route_drop_cnt;
+    pez_trace_ring_t    *rt_trace;      /* written by router thread */
+    int                 fini;           /* set by pez_domain_fini() */
+    int                 rt_stop;        /* owned by router thread */
+};
+
+/*
+ * Domains are created but never freed, pez_domain_fini() only stops their
+ * routers. The default one, which APIs without domain handle use, is always
+ * the 1st.
+ */
+static pez_t pez_dflt = {.name = "default", .addr = INPROC_ADDRESS};
+
+static pez_t *pez_domain[PEZ_DOMAIN_MAX_NUM] = {&pez_dflt};
+
+static unsigned int pez_domain_num = 1;
+
+static pthread_mutex_t pez_domain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* one zmq context for all domains, inproc only works within a context */
+static void *pez_zmq_ctx;
 
-static pez_t pez;
+static pez_config_t pez_zmq_ctx_cfg;    /* which pez_zmq_ctx is set up by */
+
+static pthread_mutex_t pez_zmq_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t pez_trace_rate;         /* 1 of pez_trace_rate msgs, 0: off */
 
 static int pez_debug_flag = 0;
 
@@ -133,20 +476,103 @@ pez_ipc_hexdump(const char *suffix, const char* data, size_t len)
 }
 
 /*
- * Print counters managed by router thread.
+ * Print counters managed by router thread of domain.
  */
 void
-pez_ipc_router_counter_print()
+pez_domain_counter_print(pez_domain_t *pez)
 {
-    int32_t     i;
+    int32_t         i;
+    pez_journal_t   *j;
+
+    if (pez != &pez_dflt) {
+        printf("rt counter:domain %s:\n", pez->name);
+    }
+    for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
+        if (strnlen(pez->thd[i].identity, PEZ_THREAD_ID_MAX_LEN) != 0) {
+            printf("rt counter:%s: recv:%llu, send:%llu, expired:%llu, "
+                   "shed:%llu, conflated:%llu, deferred:%u, "
+                   "deferred drop:%llu, expired at recv:%llu, "
+                   "pointers released at recv:%llu\n",
+                         pez->thd[i].identity,
+                         pez->thd[i].rt_recv_cnt,
+                         pez->thd[i].rt_snd_cnt,
+                         pez->thd[i].rt_expire_cnt,
+                         pez->thd[i].rt_shed_cnt,
+                         pez->thd[i].rt_conflate_cnt,
+                         pez->thd[i].rt_defer_num,
+                         pez->thd[i].rt_defer_drop_cnt,
+                         pez->thd[i].expire_cnt,
+                         pez->thd[i].ptr_drop_cnt);
+        }
+    }
+    for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
+        j = __atomic_load_n(&pez->thd[i].journal, __ATOMIC_ACQUIRE);
+        if (j) {
+            printf("rt counter:%s: journal: pending:%llu, appended:%llu, "
+                   "replayed:%llu, commits:%llu, recycled:%llu\n",
+                   pez->thd[i].identity,
+                   j->rec_num,
+                   j->append_cnt,
+                   j->read_cnt,
+                   __atomic_load_n(&j->commit_cnt, __ATOMIC_RELAXED),
+                   j->recycle_cnt);
+        }
+    }
     for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
-        if (strnlen(pez.thd[i].identity, PEZ_THREAD_ID_MAX_LEN) != 0) {
-            printf("rt counter:%s: recv:%llu, send:%llu\n",
-                         pez.thd[i].identity,
-                         pez.thd[i].rt_recv_cnt,
-                         pez.thd[i].rt_snd_cnt);
+        if (pez->thd[i].pez_ev_zsock.spin_ns) {
+            printf("rt counter:%s: busy poll: spin hit:%lu, spin miss:%lu, "
+                   "sleep:%lu\n",
+                   pez->thd[i].identity,
+                   pez->thd[i].pez_ev_zsock.spin_hit_cnt,
+                   pez->thd[i].pez_ev_zsock.spin_miss_cnt,
+                   pez->thd[i].pez_ev_zsock.sleep_cnt);
         }
     }
+    printf("rt counter:conflated msgs pending:%u\n", pez->conflate.num);
+    printf("rt counter:pointer msgs released undelivered:%llu\n",
+                 pez->rt_ptr_drop_cnt);
+    printf("rt counter:timers: pending:%u, fired:%llu, cancelled:%llu\n",
+                 pez->wheel.num,
+                 pez->wheel.fire_cnt,
+                 pez->wheel.cancel_cnt);
+    if (__atomic_load_n(&pez->rt_route_rule_num, __ATOMIC_RELAXED)) {
+        printf("rt counter:route rules:%u, redirected:%llu, mirrored:%llu, "
+               "dropped:%llu\n",
+                     __atomic_load_n(&pez->rt_route_rule_num,
+                                     __ATOMIC_RELAXED),
+                     pez->rt_redirect_cnt,
+                     pez->rt_mirror_cnt,
+                     pez->rt_route_drop_cnt);
+    }
+    if (PEZ_IPC_RT(pez)) {
+        printf("rt counter:real-time pools: size:%u, found used up:%llu, "
+               "hot path errors:%llu\n",
+                     pez->cfg.rt_pool_size,
+                     pez->rt_pool_empty_cnt,
+                     __atomic_load_n(&pez->rt_hot_err_cnt,
+                                     __ATOMIC_RELAXED));
+    }
+    for (i = 0; i < pez->group_num; i ++) {
+        printf("rt counter:group %s: members:%d, routed:%llu, dropped:%llu\n",
+                     pez->group[i]->name,
+                     pez->group[i]->member_num,
+                     pez->group[i]->rt_cnt,
+                     pez->group[i]->rt_drop_cnt);
+    }
+}
+
+/*
+ * Print counters of all domains.
+ */
+void
+pez_ipc_router_counter_print()
+{
+    unsigned int i, num;
+
+    num = __atomic_load_n(&pez_domain_num, __ATOMIC_ACQUIRE);
+    for (i = 0; i < num; i ++) {
+        pez_domain_counter_print(pez_domain[i]);
+    }
 }
 
 /*
@@ -154,11 +580,11 @@ pez_ipc_router_counter_print()
  * will be returned.
  */
 static void
-pez_ipc_index_get_bystr(const char *str, int32_t *id) {
+pez_ipc_index_get_bystr(pez_t *pez, const char *str, int32_t *id) {
     int32_t i = 0;
 
     for ( ; i < PEZ_THREAD_MAX_NUM; i ++) {
-        if (!strncmp(pez.thd[i].identity, str, PEZ_THREAD_ID_MAX_LEN)) {
+        if (!strncmp(pez->thd[i].identity, str, PEZ_THREAD_ID_MAX_LEN)) {
             *id = i;
             break;
         }
@@ -169,58 +595,93 @@ pez_ipc_index_get_bystr(const char *str, int32_t *id) {
 }
 
 /*
- * Find numerical id for given linux thread id.
+ * Find group by name. NULL if there isn't.
+ * Groups are never removed, so no lock is needed to read them.
  */
-static void
-pez_ipc_index_get_bythdid(pthread_t tid, int32_t *id)
-{
-    int32_t i = 0;
-    for ( ; i < pez.thread_num; i ++) {
-        if (pez.thd[i].tid == tid) {
-            *id = i;
-            break;
+static pez_group_t *
+pez_ipc_group_get_bystr(pez_t *pez, const char *str) {
+    unsigned int    i, num;
+
+    num = __atomic_load_n(&pez->group_num, __ATOMIC_ACQUIRE);
+    for (i = 0; i < num; i ++) {
+        if (!strncmp(pez->group[i]->name, str, PEZ_THREAD_ID_MAX_LEN)) {
+            return pez->group[i];
         }
     }
-    if (i == pez.thread_num) {
-        *id = PEZ_THREAD_ID_INVAL;
+    return NULL;
+}
+
+/*
+ * Find endpoint owning zmq socket, in any domain. A thread can own several
+ * endpoints, so the thread id can't tell. Last one found is cached per
+ * thread, which is the common case of one rx endpoint per thread.
+ */
+static pez_thd_t *
+pez_ipc_thd_get_bysock(void *socket)
+{
+    static __thread pez_thd_t   *last;
+    unsigned int                d, num;
+    int32_t                     i;
+    pez_t                       *pez;
+
+    if (last && last->pez_ev_zsock.zsock == socket) {
+        return last;
+    }
+    num = __atomic_load_n(&pez_domain_num, __ATOMIC_ACQUIRE);
+    for (d = 0; d < num; d ++) {
+        pez = pez_domain[d];
+        for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
+            if (pez->thd[i].pez_ev_zsock.zsock == socket) {
+                last = &pez->thd[i];
+                return last;
+            }
+        }
     }
+    return NULL;
 }
+
 /*
- * Find registered identity based on current thread id
+ * Find registered identity based on current thread id. If the thread owns
+ * several endpoints, the first one is returned, default domain first. Get
+ * its domain by pez_ipc_endpoint_get() and pez_ipc_endpoint_domain().
  */
 char *
 pez_ipc_identity_get()
 {
-    int32_t     i = 0;
-    pthread_t   tid;
-    char        *p = "null";
+    unsigned int    d, num;
+    int32_t         i;
+    pthread_t       tid;
+    pez_t           *pez;
+
     tid = pthread_self();
-    for ( ; i < pez.thread_num; i ++) {
-        if (pez.thd[i].tid == tid) {
-            p = pez.thd[i].identity;
-            break;
+    num = __atomic_load_n(&pez_domain_num, __ATOMIC_ACQUIRE);
+    for (d = 0; d < num; d ++) {
+        pez = pez_domain[d];
+        /* all slots, ids given back leave holes */
+        for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
+            if (pez->thd[i].tid == tid &&
+                __atomic_load_n(&pez->thd[i].identity[0], __ATOMIC_ACQUIRE)) {
+                return pez->thd[i].identity;
+            }
         }
     }
-    if (i == pez.thread_num) {
-        p = "NULL";
-    }
-    return p;
+    return "NULL";
 }
 
 /*
  * Increase counters
  */
 static void
-pez_ipc_router_count(char *trgt, char *src)
+pez_ipc_router_count(pez_t *pez, char *trgt, char *src, uint32_t cnt)
 {
     int32_t     id = 0;;
-    pez_ipc_index_get_bystr(trgt, &id);
+    pez_ipc_index_get_bystr(pez, trgt, &id);
     if (id != PEZ_THREAD_ID_INVAL) {
-        pez.thd[id].rt_recv_cnt ++;
+        pez->thd[id].rt_recv_cnt += cnt;
     }
-    pez_ipc_index_get_bystr(src, &id);
+    pez_ipc_index_get_bystr(pez, src, &id);
     if (id != PEZ_THREAD_ID_INVAL) {
-        pez.thd[id].rt_snd_cnt ++;
+        pez->thd[id].rt_snd_cnt += cnt;
     }
 }
 
@@ -229,14 +690,15 @@ pez_ipc_router_count(char *trgt, char *src)
  * PEZ_THREAD_ID_INVAL will be returned.
  */
 static void
-pez_ipc_index_alloc(const char *str, int32_t *id) {
+pez_ipc_index_alloc(pez_t *pez, const char *str, int32_t *id) {
     int32_t     i = 0;
-    pthread_mutex_lock(&pez.lock);
+    pthread_mutex_lock(&pez->lock);
     for ( ; i < PEZ_THREAD_MAX_NUM; i ++) {
-        if (strnlen(pez.thd[i].identity, PEZ_THREAD_ID_MAX_LEN) == 0) {
-            strncpy(pez.thd[i].identity, str, PEZ_THREAD_ID_MAX_LEN);
+        if (strnlen(pez->thd[i].identity, PEZ_THREAD_ID_MAX_LEN) == 0) {
+            strncpy(pez->thd[i].identity, str, PEZ_THREAD_ID_MAX_LEN);
+            pez->thd[i].dom = pez;
             *id = i;
-            pez.thread_num ++;
+            pez->thread_num ++;
             //printf("pez ipc: alloc id %d for %s\n", i, str);
             break;
         }
@@ -244,395 +706,4578 @@ pez_ipc_index_alloc(const char *str, int32_t *id) {
     if (i == PEZ_THREAD_MAX_NUM) {
         *id = PEZ_THREAD_ID_INVAL;
     }
-    pthread_mutex_unlock(&pez.lock);
+    pthread_mutex_unlock(&pez->lock);
 }
 
 /*
- * Get zmq context.
- * One zmq context is enough and a must:
- *      1. You should create and use exactly one context in your process.
- *      2. One zmq context allows per gigabyte of data in or out per second.
+ * Give back id allocated but never used, when setting it up failed.
+ * Lookups don't take lock, the name is cut off at its 1st byte.
  */
-static void *
-pez_ipc_get_zmq_ctx() {
-    pthread_mutex_lock(&pez.lock);
-    if (pez.zmq_ctx == NULL) {
-        pez.zmq_ctx = zmq_ctx_new();
-        assert (pez.zmq_ctx != NULL);
-    }
-    pthread_mutex_unlock(&pez.lock);
-    return pez.zmq_ctx;
+static void
+pez_ipc_index_free(pez_t *pez, int32_t id) {
+    pthread_mutex_lock(&pez->lock);
+    __atomic_store_n(&pez->thd[id].identity[0], '\0', __ATOMIC_RELEASE);
+    pez->thread_num --;
+    pthread_mutex_unlock(&pez->lock);
 }
 
+#ifdef __linux__
 /*
- * Send msg to router thread. router thread will route it.
- * TODO: Broadcasting message should be added.
+ * Get cpus of numa node from sysfs, e.g. "0-3,8-11"
  */
-pez_status
-pez_ipc_msg_send (const char *trgt, const char *src, void *buf, size_t size) {
-    pez_status  rtn;
-    int32_t     trgt_id, src_id;
-    char        suffix[PEZ_STRING_SUFFIX_LEN] = {0};
+static pez_status
+pez_ipc_numa_cpuset(int node, cpu_set_t *set) {
+    char        path[64];
+    FILE        *fp;
+    int         lo, hi, c, n;
 
-    if(!buf || !trgt || !src) {
+    CPU_ZERO(set);
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/node/node%d/cpulist", node);
+    fp = fopen(path, "r");
+    if (!fp) {
+        printf("pez ipc: unknown numa node %d\n", node);
         return EINVAL;
     }
+    while ((n = fscanf(fp, "%d", &lo)) == 1) {
+        hi = lo;
+        c = fgetc(fp);
+        if (c == '-') {
+            if (fscanf(fp, "%d", &hi) != 1) {
+                break;
+            }
+            c = fgetc(fp);
+        }
+        for ( ; lo <= hi && lo < CPU_SETSIZE; lo ++) {
+            CPU_SET(lo, set);
+        }
+        if (c != ',') {
+            break;
+        }
+    }
+    fclose(fp);
+    return CPU_COUNT(set) ? EOK : EINVAL;
+}
 
-    pez_ipc_index_get_bystr(trgt, &trgt_id);
-    if (trgt_id == PEZ_THREAD_ID_INVAL) {
-        printf("pez ipc: invalid trgt thread name(%s)\n", trgt);
-        return EINVAL;
+/*
+ * Get cpu set for cpu or numa node. cpu takes precedence. ENOENT if both
+ * are any.
+ */
+static pez_status
+pez_ipc_cpuset_get(int cpu, int numa_node, cpu_set_t *set) {
+    if (cpu != PEZ_CPU_ANY) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            return EINVAL;
+        }
+        CPU_ZERO(set);
+        CPU_SET(cpu, set);
+        return EOK;
     }
-    pez_ipc_index_get_bystr(src, &src_id);
-    if (src_id == PEZ_THREAD_ID_INVAL) {
-        printf("pez ipc: invalid src thread name(%s)\n", src);
-        return EINVAL;
+    if (numa_node != PEZ_NUMA_ANY) {
+        return pez_ipc_numa_cpuset(numa_node, set);
     }
+    return ENOENT;
+}
+#endif /* __linux__ */
 
-    if (pez.thd[src_id].tid != pthread_self()) {
-        printf("pez ipc:src is incorrect\n");
-        return EINVAL;
-    }
+/*
+ * Apply zmq options of config to new zmq context. Must be done before any
+ * socket is created.
+ */
+static void
+pez_ipc_zmq_ctx_config(void *zmq_ctx, const pez_config_t *cfg) {
+    int i;
 
-    /* 1st: send target id frame */
-    rtn = zmq_send(pez.thd[src_id].pez_ev_zsock.zsock,
-                   trgt,
-                   strnlen(trgt,PEZ_THREAD_ID_MAX_LEN),
-                   ZMQ_SNDMORE);
-    if (rtn == -1) {
-        printf("pez ipc:send trgt id frame failed: %s\n", strerror(errno));
-        return rtn;
+    if (cfg->zmq_io_threads > 0) {
+        zmq_ctx_set(zmq_ctx, ZMQ_IO_THREADS, cfg->zmq_io_threads);
     }
-
-    /* 2nd: send data frame */
-    rtn = zmq_send(pez.thd[src_id].pez_ev_zsock.zsock,
-                   buf,
-                   size,
-                   0);
-    if (rtn != size) {
-        printf("pez ipc: msg send failed(sent %d bytes)\n", rtn);
-        return rtn;
+    if (cfg->zmq_max_sockets > 0) {
+        zmq_ctx_set(zmq_ctx, ZMQ_MAX_SOCKETS, cfg->zmq_max_sockets);
     }
-
-    /* count sent msg number. Count only by thread itself, no lock needed */
-    pez.thd[src_id].snd_cnt ++;
-    if (pez_debug_flag) {
-        snprintf(suffix, PEZ_STRING_SUFFIX_LEN, "pez msg snd(%s)", src);
-        pez_ipc_hexdump(suffix, buf, size);
-        printf("%s: snd cnt: %llu\n", src, pez.thd[src_id].snd_cnt);
+    if (cfg->zmq_thread_sched_policy >= 0) {
+        zmq_ctx_set(zmq_ctx, ZMQ_THREAD_SCHED_POLICY,
+                    cfg->zmq_thread_sched_policy);
+        zmq_ctx_set(zmq_ctx, ZMQ_THREAD_PRIORITY,
+                    cfg->zmq_thread_sched_priority);
+    }
+    for (i = 0; i < 64; i ++) {
+        if (cfg->zmq_thread_cpu_mask & (1ULL << i)) {
+            zmq_ctx_set(zmq_ctx, ZMQ_THREAD_AFFINITY_CPU_ADD, i);
+        }
     }
+}
 
-    return EOK;
+/*
+ * Get zmq context, it's configured by cfg of the domain which gets it 1st.
+ * One zmq context is enough and a must:
+ *      1. You should create and use exactly one context in your process.
+ *      2. One zmq context allows per gigabyte of data in or out per second.
+ */
+static void *
+pez_ipc_get_zmq_ctx(const pez_config_t *cfg) {
+    pthread_mutex_lock(&pez_zmq_ctx_lock);
+    if (pez_zmq_ctx == NULL) {
+        pez_zmq_ctx = zmq_ctx_new();
+        assert (pez_zmq_ctx != NULL);
+        pez_ipc_zmq_ctx_config(pez_zmq_ctx, cfg);
+        pez_zmq_ctx_cfg = *cfg;
+    }
+    pthread_mutex_unlock(&pez_zmq_ctx_lock);
+    return pez_zmq_ctx;
 }
 
 /*
- * recv message
+ * Whether zmq options of cfg can be met by zmq context, if there is one
+ * already. Options left to zmq default in cfg are met by any. EINVAL if
+ * they differ, the context can't be changed once it has sockets.
  */
-pez_status
-pez_ipc_msg_recv(void *socket,
-                 void *buf,
-                 size_t buffer_size,
-                 size_t *rtn_size) {
-    int32_t     id = 0;
-    pez_status  rc;
-    char        suffix[PEZ_STRING_SUFFIX_LEN] = {0};
+static pez_status
+pez_ipc_zmq_ctx_check(const pez_config_t *cfg) {
+    const pez_config_t  *cur = &pez_zmq_ctx_cfg;
+    pez_status          rc = EOK;
 
-    if (!socket || !buf || !rtn_size || (buffer_size == 0)) {
-        printf("invalid params recvd\n");
-        return EINVAL;
+    pthread_mutex_lock(&pez_zmq_ctx_lock);
+    if (pez_zmq_ctx == NULL) {
+        goto end;
     }
-
-    rc = zmq_recv(socket, buf, buffer_size, 0);
-    if (rc == -1) {
-        printf("%s: err:%s\n", __func__, strerror(errno));
-    } else if (rc == 0) {
-        printf("%s: recvd 0 byte msg\n", __func__);
+    if ((cfg->zmq_io_threads > 0 &&
+         cfg->zmq_io_threads != cur->zmq_io_threads) ||
+        (cfg->zmq_max_sockets > 0 &&
+         cfg->zmq_max_sockets != cur->zmq_max_sockets) ||
+        (cfg->zmq_thread_sched_policy >= 0 &&
+         (cfg->zmq_thread_sched_policy != cur->zmq_thread_sched_policy ||
+          cfg->zmq_thread_sched_priority !=
+          cur->zmq_thread_sched_priority)) ||
+        (cfg->zmq_thread_cpu_mask != 0 &&
+         cfg->zmq_thread_cpu_mask != cur->zmq_thread_cpu_mask)) {
+        printf("pez ipc: zmq ctx is set up by other options already\n");
+        rc = EINVAL;
     }
 
-    *rtn_size = rc;
-
-    /* count recv msg number. No lock needed */
-    pez_ipc_index_get_bythdid(pthread_self(), &id);
-    pez.thd[id].recv_cnt ++;
-    if (pez_debug_flag) {
-        snprintf(suffix, PEZ_STRING_SUFFIX_LEN, "pez msg recv(%s)",
-                 pez.thd[id].identity);
-        pez_ipc_hexdump(suffix, buf, *rtn_size);
-        printf("%s: recv cnt: %llu\n",
-                     pez.thd[id].identity,
-                     pez.thd[id].recv_cnt);
-    }
+end:
+    pthread_mutex_unlock(&pez_zmq_ctx_lock);
+    return rc;
+}
 
-    return EOK;
+/*
+ * Get monotonic time in ns
+ */
+static uint64_t
+pez_ipc_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 /*
- * Didn't create zmq socket. Monitor only
+ * Allocate trace ring if there's none yet. Only its owner thread calls it.
  */
-pez_status
-pez_ipc_thread_init_tx(const char *tx_id) {
-    void        *socket = NULL;
-    pez_status  rc;
-    void        *zmq_ctx = NULL;
-    int32_t     id;
+static pez_status
+pez_ipc_trace_ring_alloc(pez_trace_ring_t **ring) {
+    pez_trace_ring_t *r;
 
-    if (!tx_id) {
-        printf("pez ipc:invalid id recvd in tx creation\n");
-        return EINVAL;
+    if (*ring) {
+        return EOK;
     }
-
-    pez_ipc_index_get_bystr(tx_id, &id);
-    if (id != PEZ_THREAD_ID_INVAL) {
-        printf("pez ipc: don't invoke this API twice for same id. Previous"
-               " call is by %s\n", pez.thd[id].identity);
-        return EINVAL;
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        return ENOMEM;
     }
+    __atomic_store_n(ring, r, __ATOMIC_RELEASE);
+    return EOK;
+}
 
-    pez_ipc_index_alloc(tx_id, &id);
-    if (id == PEZ_THREAD_ID_INVAL) {
-        printf("pez ipc: no room for new tx thread(%s) allocation\n", tx_id);
-        return ENOMEM;
+/*
+ * Record trace event into ring of current thread, which is allocated on
+ * first use unless real-time domain did it at open.
+ */
+static void
+pez_ipc_trace(pez_trace_ring_t **ring, uint32_t kind, uint64_t trace_id) {
+    if (pez_ipc_trace_ring_alloc(ring) != EOK) {
+        return;
     }
+    pez_trace_record(*ring, kind, trace_id, pez_ipc_now_ns());
+}
 
-    pez.thd[id].tid = pthread_self();
+/*
+ * Trace id of msg thd is about to send, 0 if it's not sampled. Msgs sent
+ * while handling a traced msg carry on its trace id, as its next hop.
+ */
+static uint64_t
+pez_ipc_trace_sample(pez_thd_t *thd) {
+    uint32_t rate = __atomic_load_n(&pez_trace_rate, __ATOMIC_RELAXED);
 
-    zmq_ctx = pez_ipc_get_zmq_ctx();
-    if (!zmq_ctx) {
-        printf("pez ipc: null zmq ctx recvd\n");
-        return EINVAL;
+    if (rate == 0) {
+        return 0;
     }
-
-    socket = zmq_socket(zmq_ctx, ZMQ_DEALER);
-    if (socket == NULL) {
-        printf("unable to create ZMQ_DEALER socket: %s\n", strerror(errno));
-        return errno;
+    if (thd->rx_trace_id) {
+        return thd->rx_trace_id;
     }
-
-    /* set zmq id */
-    rc = zmq_setsockopt (socket,
-                         ZMQ_IDENTITY,
-                         tx_id,
-                         sizeof(int));
-    if (rc == -1) {
-        printf("unable to set ZMQ ID for thread %s:%s\n",
-                    tx_id,
-                    strerror(errno));
-        return errno;
+    if (++ thd->trace_cnt < rate) {
+        return 0;
     }
+    thd->trace_cnt = 0;
+    /* unique across domains */
+    return ((uint64_t)(thd->dom->idx * PEZ_THREAD_MAX_NUM +
+                       (thd - thd->dom->thd) + 1) << 48) | ++ thd->trace_seq;
+}
 
-    /* connect to router thread */
-    rc = zmq_connect(socket, INPROC_ADDRESS);
-    if (rc == -1) {
-        printf("unable to connect router for thread %s:%s\n",
-                    tx_id,
-                    strerror(errno));
-        return errno;
+/*
+ * Find domain and numerical id of src owned by current thread. Endpoints
+ * of one thread are told apart by name, which can be reused in other
+ * domains by other threads.
+ * zmq sockets aren't thread safe, only owner can send by them.
+ */
+static pez_status
+pez_ipc_index_get_bysrc(const char *src, pez_t **dom, int32_t *id) {
+    unsigned int    d, num;
+    int             found = 0;
+    pez_t           *pez;
+
+    num = __atomic_load_n(&pez_domain_num, __ATOMIC_ACQUIRE);
+    for (d = 0; d < num; d ++) {
+        pez = pez_domain[d];
+        pez_ipc_index_get_bystr(pez, src, id);
+        if (*id == PEZ_THREAD_ID_INVAL) {
+            continue;
+        }
+        if (pez->thd[*id].tid == pthread_self()) {
+            *dom = pez;
+            return EOK;
+        }
+        found = 1;
+    }
+    if (!found) {
+        printf("pez ipc: invalid src thread name(%s)\n", src);
+    } else {
+        printf("pez ipc:src is incorrect\n");
     }
+    *id = PEZ_THREAD_ID_INVAL;
+    return EINVAL;
+}
 
-    /* save socket to pez */
-    pez.thd[id].pez_ev_zsock.zsock = socket;
+/* hdr of untraced pointer msgs, zmq refers to it rather than copying */
+static const pez_hdr_t pez_ipc_ptr_hdr = {
+    .magic = PEZ_HDR_MAGIC,
+    .version = PEZ_HDR_VERSION,
+    .flags = PEZ_HDR_F_PTR,
+    .cnt = 1,
+};
 
-    return EOK;
+/*
+ * Fill pez hdr
+ */
+static void
+pez_ipc_hdr_init(pez_hdr_t *hdr, uint16_t flags, uint32_t cnt) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = PEZ_HDR_MAGIC;
+    hdr->version = PEZ_HDR_VERSION;
+    hdr->flags = flags;
+    hdr->cnt = cnt;
 }
 
+/*
+ * Receive and drop remaining frames of current msg.
+ */
+static void
+pez_ipc_msg_drain(void *socket) {
+    zmq_msg_t   frame;
+    int         more;
+    size_t      optlen = sizeof(more);
+
+    zmq_msg_init(&frame);
+    while (zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &optlen) == 0 &&
+           more) {
+        if (zmq_msg_recv(&frame, socket, 0) == -1) {
+            break;
+        }
+    }
+    zmq_msg_close(&frame);
+}
 
 /*
- * Do zmq socket creation and connect.
+ * Send frames of one msg to router thread by socket: trgt id, optional pez
+ * hdr, then one data frame per iov.
  */
-pez_status
+static pez_status
+pez_ipc_frames_sendv_sock(pez_t *pez, void *socket,
+                          const char *trgt,
+                          const pez_hdr_t *hdr,
+                          const struct iovec *iov,
+                          int iov_cnt) {
+    pez_status  rtn, err;
+    int         i;
+
+    /* 1st: send target id frame */
+    rtn = zmq_send(socket, trgt, strnlen(trgt, PEZ_THREAD_ID_MAX_LEN),
+                   ZMQ_SNDMORE);
+    if (rtn == -1) {
+        err = errno;
+        PEZ_IPC_HOT_ERR(pez, "pez ipc:send trgt id frame failed: %s\n",
+                        strerror(err));
+        return err;
+    }
+
+    /* 2nd: send pez hdr frame if any */
+    if (hdr == &pez_ipc_ptr_hdr) {
+        rtn = zmq_send_const(socket, hdr, sizeof(*hdr), ZMQ_SNDMORE);
+    } else if (hdr) {
+        rtn = zmq_send(socket, hdr, sizeof(*hdr), ZMQ_SNDMORE);
+    }
+    if (hdr && rtn == -1) {
+        err = errno;
+        PEZ_IPC_HOT_ERR(pez, "pez ipc:send hdr frame failed: %s\n",
+                        strerror(err));
+        return err;
+    }
+
+    /* 3rd: send data frames */
+    for (i = 0; i < iov_cnt; i ++) {
+        rtn = zmq_send(socket, iov[i].iov_base, iov[i].iov_len,
+                       i == iov_cnt - 1 ? 0 : ZMQ_SNDMORE);
+        if (rtn != iov[i].iov_len) {
+            err = errno;
+            PEZ_IPC_HOT_ERR(pez, "pez ipc: msg send failed(sent %d bytes)\n",
+                            rtn);
+            return err;
+        }
+    }
+    return EOK;
+}
+
+/*
+ * Send frames of one msg by socket of src_id. Only the thread owning
+ * src_id can call it.
+ */
+static pez_status
+pez_ipc_frames_sendv(pez_t *pez, int32_t src_id,
+                     const char *trgt,
+                     const pez_hdr_t *hdr,
+                     const struct iovec *iov,
+                     int iov_cnt) {
+    return pez_ipc_frames_sendv_sock(pez, pez->thd[src_id].pez_ev_zsock.zsock,
+                                     trgt, hdr, iov, iov_cnt);
+}
+
+/*
+ * Send msg of one data frame to router thread.
+ */
+static pez_status
+pez_ipc_frames_send(pez_t *pez, int32_t src_id,
+                    const char *trgt,
+                    const pez_hdr_t *hdr,
+                    const void *buf,
+                    size_t size) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = size;
+    return pez_ipc_frames_sendv(pez, src_id, trgt, hdr, &iov, 1);
+}
+
+/*
+ * Send coalesced msgs in one frame. A single msg is sent as it is. If it
+ * fails the msgs are kept and sent by the next flush.
+ */
+static pez_status
+pez_ipc_batch_flush(pez_t *pez, int32_t src_id, pez_batch_t *b) {
+    pez_hdr_t       hdr;
+    pez_batch_rec_t *rec;
+    pez_status      rc;
+    const char      *trgt;
+
+    if (b->cnt == 0) {
+        b->trgt_id = PEZ_THREAD_ID_INVAL;
+        return EOK;
+    }
+    trgt = pez->thd[b->trgt_id].identity;
+    if (b->cnt == 1) {
+        rec = (pez_batch_rec_t *)b->buf;
+        rc = pez_ipc_frames_send(pez, src_id, trgt, NULL, rec + 1, rec->len);
+    } else {
+        pez_ipc_hdr_init(&hdr, PEZ_HDR_F_BATCH, b->cnt);
+        rc = pez_ipc_frames_send(pez, src_id, trgt, &hdr, b->buf, b->len);
+    }
+    if (rc != EOK) {
+        PEZ_IPC_HOT_ERR(pez, "pez ipc: %s failed to flush %u coalesced msgs "
+                        "to %s: %s\n", pez->thd[src_id].identity, b->cnt,
+                        trgt, strerror(rc));
+        return rc;
+    }
+    pez->thd[src_id].batch_snd_cnt ++;
+    b->trgt_id = PEZ_THREAD_ID_INVAL;
+    b->cnt = 0;
+    b->len = 0;
+    return rc;
+}
+
+/*
+ * Flush all open batches of src_id
+ */
+static pez_status
+pez_ipc_batch_flush_all(pez_t *pez, int32_t src_id) {
+    pez_status  rc, rtn = EOK;
+    int         i;
+
+    if (!pez->thd[src_id].batch) {
+        return EOK;
+    }
+    for (i = 0; i < PEZ_BATCH_TRGT_MAX; i ++) {
+        rc = pez_ipc_batch_flush(pez, src_id, &pez->thd[src_id].batch[i]);
+        if (rc != EOK) {
+            rtn = rc;
+        }
+    }
+    return rtn;
+}
+
+/*
+ * Flush the batch of trgt_id, so that a msg which isn't coalesced doesn't
+ * overtake msgs to the same trgt. All are flushed for a group or an
+ * unknown trgt.
+ */
+static pez_status
+pez_ipc_batch_flush_trgt(pez_t *pez, int32_t src_id, int32_t trgt_id) {
+    pez_thd_t   *thd = &pez->thd[src_id];
+    int         i;
+
+    if (!thd->batch) {
+        return EOK;
+    }
+    if (trgt_id == PEZ_THREAD_ID_INVAL) {
+        return pez_ipc_batch_flush_all(pez, src_id);
+    }
+    for (i = 0; i < PEZ_BATCH_TRGT_MAX; i ++) {
+        if (thd->batch[i].trgt_id == trgt_id) {
+            return pez_ipc_batch_flush(pez, src_id, &thd->batch[i]);
+        }
+    }
+    return EOK;
+}
+
+/*
+ * Append msg to the batch of trgt_id. Batch is flushed when it's full or
+ * its 1st msg has waited too long. Msgs too big for a batch are sent
+ * right away after the batch in front of them. Msg isn't taken if a batch
+ * in the way can't be flushed.
+ */
+static pez_status
+pez_ipc_batch_send(pez_t *pez, int32_t src_id,
+                   int32_t trgt_id,
+                   const void *buf,
+                   size_t size) {
+    pez_thd_t       *thd = &pez->thd[src_id];
+    pez_batch_t     *b = NULL, *unused = NULL, *oldest = NULL;
+    pez_batch_rec_t *rec;
+    size_t          rec_size = PEZ_BATCH_REC_SIZE(size);
+    uint64_t        now;
+    pez_status      rc;
+    int             i;
+
+    for (i = 0; i < PEZ_BATCH_TRGT_MAX; i ++) {
+        if (thd->batch[i].trgt_id == trgt_id) {
+            b = &thd->batch[i];
+            break;
+        }
+        if (thd->batch[i].trgt_id == PEZ_THREAD_ID_INVAL) {
+            if (!unused) {
+                unused = &thd->batch[i];
+            }
+        } else if (!oldest || thd->batch[i].first_ns < oldest->first_ns) {
+            oldest = &thd->batch[i];
+        }
+    }
+
+    if (rec_size > thd->batch_max_size) {
+        if (b && (rc = pez_ipc_batch_flush(pez, src_id, b)) != EOK) {
+            return rc;
+        }
+        return pez_ipc_frames_send(pez, src_id, pez->thd[trgt_id].identity, NULL,
+                                   buf, size);
+    }
+
+    if (!b) {
+        /* no room for a new trgt, give the oldest batch away */
+        if (!unused) {
+            if ((rc = pez_ipc_batch_flush(pez, src_id, oldest)) != EOK) {
+                return rc;
+            }
+            unused = oldest;
+        }
+        b = unused;
+    } else if (b->len + rec_size > thd->batch_max_size) {
+        if ((rc = pez_ipc_batch_flush(pez, src_id, b)) != EOK) {
+            return rc;
+        }
+    }
+
+    now = pez_ipc_now_ns();
+    if (b->cnt == 0) {
+        b->trgt_id = trgt_id;
+        b->first_ns = now;
+    }
+    rec = (pez_batch_rec_t *)(b->buf + b->len);
+    rec->len = size;
+    rec->reserved = 0;
+    memcpy(rec + 1, buf, size);
+    b->len += rec_size;
+    b->cnt ++;
+
+    /* msg is taken, if flushing fails now it's retried later */
+    if (b->len >= thd->batch_max_size ||
+        now - b->first_ns >= thd->batch_max_delay_ns) {
+        pez_ipc_batch_flush(pez, src_id, b);
+    }
+    return EOK;
+}
+
+/*
+ * Flush coalesced msgs at the end of each loop iteration, i.e. before
+ * the loop of sender goes to sleep.
+ */
+static void
+pez_ipc_batch_prepare_cb(struct ev_loop *loop, ev_prepare *w, int revents) {
+    pez_thd_t *thd = (pez_thd_t *)
+        (((char *)w) - offsetof(pez_thd_t, batch_watcher));
+
+    pez_ipc_batch_flush_all(thd->dom, thd - thd->dom->thd);
+}
+
+/*
+ * Free batches of src_id
+ */
+static void
+pez_ipc_batch_free(pez_t *pez, int32_t src_id) {
+    pez_thd_t   *thd = &pez->thd[src_id];
+    int         i;
+
+    if (!thd->batch) {
+        return;
+    }
+    if (thd->loop) {
+        ev_prepare_stop(thd->loop, &thd->batch_watcher);
+    }
+    for (i = 0; i < PEZ_BATCH_TRGT_MAX; i ++) {
+        if (thd->batch[i].cnt) {
+            printf("pez ipc: %s dropped %u unflushed msgs\n",
+                   thd->identity, thd->batch[i].cnt);
+        }
+        free(thd->batch[i].buf);
+    }
+    free(thd->batch);
+    thd->batch = NULL;
+}
+
+/*
+ * Coalesce small msgs sent by src per trgt. Coalesced msgs are sent in one
+ * frame when
+ *      1. the loop of src finishes current iteration(rx threads only)
+ *      2. batch reaches max_size bytes
+ *      3. 1st msg in batch has waited for max_delay_us, checked on send
+ *      4. pez_ipc_msg_flush() is called
+ * Threads without loop(tx only) depend on 2-4. Must be called by src thread.
+ */
+pez_status
+pez_ipc_coalesce_enable(const char *src,
+                        size_t max_size,
+                        uint32_t max_delay_us) {
+    pez_t       *pez;
+    pez_thd_t   *thd;
+    int32_t     id;
+    pez_status  rc;
+    int         i;
+
+    if (!src || max_size < 2 * PEZ_BATCH_REC_SIZE(1)) {
+        return EINVAL;
+    }
+    rc = pez_ipc_index_get_bysrc(src, &pez, &id);
+    if (rc != EOK) {
+        return rc;
+    }
+    thd = &pez->thd[id];
+
+    pez_ipc_batch_flush_all(pez, id);
+    pez_ipc_batch_free(pez, id);
+
+    thd->batch = calloc(PEZ_BATCH_TRGT_MAX, sizeof(pez_batch_t));
+    if (!thd->batch) {
+        return ENOMEM;
+    }
+    for (i = 0; i < PEZ_BATCH_TRGT_MAX; i ++) {
+        thd->batch[i].trgt_id = PEZ_THREAD_ID_INVAL;
+        thd->batch[i].buf = malloc(max_size);
+        if (!thd->batch[i].buf) {
+            pez_ipc_batch_free(pez, id);
+            return ENOMEM;
+        }
+    }
+    thd->batch_max_size = max_size;
+    thd->batch_max_delay_ns = (uint64_t)max_delay_us * 1000;
+
+    if (thd->loop) {
+        ev_prepare_init(&thd->batch_watcher, pez_ipc_batch_prepare_cb);
+        ev_prepare_start(thd->loop, &thd->batch_watcher);
+    }
+    return EOK;
+}
+
+/*
+ * Flush pending msgs and stop coalescing. Must be called by src thread.
+ */
+pez_status
+pez_ipc_coalesce_disable(const char *src) {
+    pez_t       *pez;
+    int32_t     id;
+    pez_status  rc;
+
+    if (!src) {
+        return EINVAL;
+    }
+    rc = pez_ipc_index_get_bysrc(src, &pez, &id);
+    if (rc != EOK) {
+        return rc;
+    }
+    /* kept on, so that nothing is lost if they can't be sent now */
+    rc = pez_ipc_batch_flush_all(pez, id);
+    if (rc != EOK) {
+        return rc;
+    }
+    pez_ipc_batch_free(pez, id);
+    return EOK;
+}
+
+/*
+ * Send all msgs coalesced by src now. Must be called by src thread.
+ */
+pez_status
+pez_ipc_msg_flush(const char *src) {
+    pez_t       *pez;
+    int32_t     id;
+    pez_status  rc;
+
+    if (!src) {
+        return EINVAL;
+    }
+    rc = pez_ipc_index_get_bysrc(src, &pez, &id);
+    if (rc != EOK) {
+        return rc;
+    }
+    return pez_ipc_batch_flush_all(pez, id);
+}
+
+/*
+ * Send msg of src_id to router thread. trgt can be a thread or a group.
+ * Msgs with pez hdr, of several frames or to a group aren't coalesced.
+ */
+static pez_status
+pez_ipc_msg_sendv_byid(pez_t *pez, int32_t src_id,
+                       const char *trgt,
+                       const pez_hdr_t *hdr,
+                       const struct iovec *iov,
+                       int iov_cnt) {
+    pez_status  rtn;
+    int32_t     trgt_id;
+    char        suffix[PEZ_STRING_SUFFIX_LEN] = {0};
+    const char  *src = pez->thd[src_id].identity;
+    pez_hdr_t   trace_hdr;
+    uint64_t    trace_id;
+    int         i;
+
+    if (!iov || !trgt) {
+        return EINVAL;
+    }
+    for (i = 0; i < iov_cnt; i ++) {
+        if (!iov[i].iov_base) {
+            return EINVAL;
+        }
+    }
+
+    pez_ipc_index_get_bystr(pez, trgt, &trgt_id);
+    if (trgt_id == PEZ_THREAD_ID_INVAL && !pez_ipc_group_get_bystr(pez, trgt)) {
+        printf("pez ipc: invalid trgt thread name(%s)\n", trgt);
+        return EINVAL;
+    }
+
+    PEZ_RT_HOT_BEGIN(PEZ_IPC_RT(pez));
+    /*
+     * Sampled msg needs hdr for trace id, so it's never coalesced. It's
+     * still sent after the batch of its trgt, tracing mustn't reorder.
+     */
+    trace_id = pez_ipc_trace_sample(&pez->thd[src_id]);
+    if (trace_id) {
+        if (hdr) {
+            trace_hdr = *hdr;
+        } else {
+            pez_ipc_hdr_init(&trace_hdr, 0, 1);
+        }
+        trace_hdr.flags |= PEZ_HDR_F_TRACE;
+        trace_hdr.trace_id = trace_id;
+        hdr = &trace_hdr;
+        /* before router may see it */
+        pez_ipc_trace(&pez->thd[src_id].trace, PEZ_TRACE_SEND, trace_id);
+    }
+
+    if (pez->thd[src_id].batch && !hdr && iov_cnt == 1 &&
+        trgt_id != PEZ_THREAD_ID_INVAL) {
+        rtn = pez_ipc_batch_send(pez, src_id, trgt_id, iov[0].iov_base,
+                                 iov[0].iov_len);
+    } else {
+        /* after msgs coalesced before it, or per pair fifo is broken */
+        rtn = pez_ipc_batch_flush_trgt(pez, src_id, trgt_id);
+        if (rtn == EOK) {
+            rtn = pez_ipc_frames_sendv(pez, src_id, trgt, hdr, iov, iov_cnt);
+        }
+    }
+    PEZ_RT_HOT_END(PEZ_IPC_RT(pez));
+    if (rtn != EOK) {
+        return rtn;
+    }
+
+    /* count sent msg number. Count only by thread itself, no lock needed */
+    pez->thd[src_id].snd_cnt ++;
+    if (pez_debug_flag) {
+        snprintf(suffix, PEZ_STRING_SUFFIX_LEN, "pez msg snd(%s)", src);
+        for (i = 0; i < iov_cnt; i ++) {
+            pez_ipc_hexdump(suffix, iov[i].iov_base, iov[i].iov_len);
+        }
+        printf("%s: snd cnt: %llu\n", src, pez->thd[src_id].snd_cnt);
+    }
+
+    return EOK;
+}
+
+/*
+ * Same as pez_ipc_msg_sendv_byid, src is given by its name and must be
+ * owned by current thread.
+ */
+static pez_status
+pez_ipc_msg_sendv_internal(const char *trgt,
+                           const char *src,
+                           const pez_hdr_t *hdr,
+                           const struct iovec *iov,
+                           int iov_cnt) {
+    pez_t       *pez;
+    pez_status  rtn;
+    int32_t     src_id;
+
+    if (!src) {
+        return EINVAL;
+    }
+    rtn = pez_ipc_index_get_bysrc(src, &pez, &src_id);
+    if (rtn != EOK) {
+        return rtn;
+    }
+    return pez_ipc_msg_sendv_byid(pez, src_id, trgt, hdr, iov, iov_cnt);
+}
+
+static pez_status
+pez_ipc_msg_send_internal(const char *trgt,
+                          const char *src,
+                          const pez_hdr_t *hdr,
+                          void *buf,
+                          size_t size) {
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    return pez_ipc_msg_sendv_internal(trgt, src, hdr, &iov, 1);
+}
+
+/*
+ * Send msg to router thread. router thread will route it.
+ * TODO: Broadcasting message should be added.
+ */
+pez_status
+pez_ipc_msg_send (const char *trgt, const char *src, void *buf, size_t size) {
+    return pez_ipc_msg_send_internal(trgt, src, NULL, buf, size);
+}
+
+static pez_status
+pez_ipc_msg_sendv_parts(pez_t *pez, int32_t src_id,
+                        const char *trgt,
+                        const struct iovec *iov,
+                        int iov_cnt) {
+    pez_hdr_t hdr;
+
+    if (iov_cnt <= 0 || iov_cnt > PEZ_IPC_IOV_MAX) {
+        return EINVAL;
+    }
+    if (iov_cnt == 1) {
+        return pez_ipc_msg_sendv_byid(pez, src_id, trgt, NULL, iov, 1);
+    }
+    pez_ipc_hdr_init(&hdr, PEZ_HDR_F_PARTS, 1);
+    return pez_ipc_msg_sendv_byid(pez, src_id, trgt, &hdr, iov, iov_cnt);
+}
+
+/*
+ * Send msg made of iov_cnt parts, e.g. a hdr and a payload, without joining
+ * them first. Each part is a frame of its own, router forwards them intact
+ * and pez_ipc_msg_recvv() gets them back as parts.
+ */
+pez_status
+pez_ipc_msg_sendv(const char *trgt,
+                  const char *src,
+                  const struct iovec *iov,
+                  int iov_cnt) {
+    pez_t       *pez;
+    int32_t     src_id;
+    pez_status  rc;
+
+    if (!src) {
+        return EINVAL;
+    }
+    rc = pez_ipc_index_get_bysrc(src, &pez, &src_id);
+    if (rc != EOK) {
+        return rc;
+    }
+    return pez_ipc_msg_sendv_parts(pez, src_id, trgt, iov, iov_cnt);
+}
+
+/*
+ * Send msg with a key. Msgs to a PEZ_GROUP_POLICY_KEY group with same key
+ * go to same member as long as members don't change.
+ */
+pez_status
+pez_ipc_msg_send_key(const char *trgt,
+                     const char *src,
+                     uint64_t key,
+                     void *buf,
+                     size_t size) {
+    pez_hdr_t   hdr;
+
+    pez_ipc_hdr_init(&hdr, PEZ_HDR_F_KEY, 1);
+    hdr.key = key;
+    return pez_ipc_msg_send_internal(trgt, src, &hdr, buf, size);
+}
+
+/*
+ * Send msg which is dropped, by router or by pez_ipc_msg_recv(), once it's
+ * older than ttl_us. Such msgs are also shed when trgt is overloaded, see
+ * pez_ipc_shed_set().
+ */
+pez_status
+pez_ipc_msg_send_ttl(const char *trgt,
+                     const char *src,
+                     void *buf,
+                     size_t size,
+                     uint32_t ttl_us) {
+    pez_hdr_t hdr;
+
+    pez_ipc_hdr_init(&hdr, PEZ_HDR_F_DEADLINE, 1);
+    hdr.deadline_ns = pez_ipc_now_ns() + (uint64_t)ttl_us * 1000ULL;
+    return pez_ipc_msg_send_internal(trgt, src, &hdr, buf, size);
+}
+
+/*
+ * Send state update. If an older msg with same key to trgt is still held by
+ * router, it's replaced in place, so a slow trgt gets only the latest value
+ * per key.
+ */
+pez_status
+pez_ipc_msg_send_conflate(const char *trgt,
+                          const char *src,
+                          uint64_t key,
+                          void *buf,
+                          size_t size) {
+    pez_hdr_t hdr;
+
+    pez_ipc_hdr_init(&hdr, PEZ_HDR_F_CONFLATE | PEZ_HDR_F_KEY, 1);
+    hdr.key = key;
+    return pez_ipc_msg_send_internal(trgt, src, &hdr, buf, size);
+}
+
+/*
+ * Sockets threads post msgs by, one per domain they post into. Made on
+ * first post and closed when thread exits.
+ */
+static __thread void *pez_post_sock[PEZ_DOMAIN_MAX_NUM];
+
+static pthread_key_t pez_post_key;
+
+static pthread_once_t pez_post_once = PTHREAD_ONCE_INIT;
+
+static void
+pez_ipc_post_sock_close(void *arg) {
+    void    **sock = arg;
+    int     i;
+
+    for (i = 0; i < PEZ_DOMAIN_MAX_NUM; i ++) {
+        if (sock[i]) {
+            zmq_close(sock[i]);
+            sock[i] = NULL;
+        }
+    }
+}
+
+static void
+pez_ipc_post_key_create() {
+    pthread_key_create(&pez_post_key, pez_ipc_post_sock_close);
+}
+
+/*
+ * Socket current thread posts into domain by. It has no identity of its
+ * own, router takes src of each msg from the msg itself.
+ */
+static void *
+pez_ipc_post_sock_get(pez_t *pez) {
+    void    *socket = pez_post_sock[pez->idx];
+    void    *zmq_ctx;
+
+    if (socket) {
+        return socket;
+    }
+    pthread_once(&pez_post_once, pez_ipc_post_key_create);
+    zmq_ctx = pez_ipc_get_zmq_ctx(&pez->cfg);
+    if (!zmq_ctx) {
+        printf("pez ipc: null zmq ctx recvd\n");
+        return NULL;
+    }
+    socket = zmq_socket(zmq_ctx, ZMQ_DEALER);
+    if (!socket) {
+        printf("pez ipc: unable to create post socket: %s\n",
+               strerror(errno));
+        return NULL;
+    }
+    if (zmq_connect(socket, pez->addr) == -1) {
+        printf("pez ipc: unable to connect post socket to %s: %s\n",
+               pez->name, strerror(errno));
+        zmq_close(socket);
+        return NULL;
+    }
+    pez_post_sock[pez->idx] = socket;
+    pthread_setspecific(pez_post_key, pez_post_sock);
+    return socket;
+}
+
+/*
+ * Send msg as src from any thread, src needn't have an endpoint in this
+ * thread, or at all. Thread safe, e.g. for workers of a thread pool.
+ * Router takes the msg as sent by src. It's ordered with other msgs posted
+ * by the same thread, but not with msgs sent by src's own endpoint. Posted
+ * msgs aren't coalesced or traced. The thread owning src's endpoint sends
+ * as usual.
+ */
+pez_status
+pez_domain_msg_post(pez_domain_t *pez,
+                    const char *trgt,
+                    const char *src,
+                    void *buf,
+                    size_t size) {
+    struct iovec    iov[2];
+    pez_hdr_t       hdr;
+    void            *socket;
+    int32_t         id;
+
+    /* empty trgt is router itself */
+    if (!pez || !trgt || !src || !buf || trgt[0] == '\0' ||
+        strnlen(src, PEZ_THREAD_ID_MAX_LEN) == 0 ||
+        strnlen(src, PEZ_THREAD_ID_MAX_LEN) == PEZ_THREAD_ID_MAX_LEN) {
+        return EINVAL;
+    }
+    iov[1].iov_base = buf;
+    iov[1].iov_len = size;
+
+    pez_ipc_index_get_bystr(pez, src, &id);
+    if (id != PEZ_THREAD_ID_INVAL &&
+        pez->thd[id].tid == pthread_self() &&
+        pez->thd[id].pez_ev_zsock.zsock) {
+        return pez_ipc_msg_sendv_byid(pez, id, trgt, NULL, &iov[1], 1);
+    }
+
+    pez_ipc_index_get_bystr(pez, trgt, &id);
+    if (id == PEZ_THREAD_ID_INVAL && !pez_ipc_group_get_bystr(pez, trgt)) {
+        printf("pez ipc: invalid trgt thread name(%s)\n", trgt);
+        return EINVAL;
+    }
+    socket = pez_ipc_post_sock_get(pez);
+    if (!socket) {
+        return ENOTCONN;
+    }
+    pez_ipc_hdr_init(&hdr, PEZ_HDR_F_SRC, 1);
+    iov[0].iov_base = (void *)src;
+    iov[0].iov_len = strnlen(src, PEZ_THREAD_ID_MAX_LEN);
+    return pez_ipc_frames_sendv_sock(pez, socket, trgt, &hdr, iov, 2);
+}
+
+pez_status
+pez_ipc_msg_post(const char *trgt, const char *src, void *buf, size_t size) {
+    return pez_domain_msg_post(&pez_dflt, trgt, src, buf, size);
+}
+
+static uint32_t pez_ipc_key_hash(uint64_t key);
+
+static uint32_t
+pez_ipc_route_hash(uint32_t match,
+                   uint16_t type,
+                   uint32_t subtype,
+                   uint64_t key) {
+    return pez_ipc_key_hash(key ^ (((uint64_t)subtype << 32 |
+                                    (uint64_t)type << 2 | match) *
+                                   0x9E3779B97F4A7C15ULL));
+}
+
+/*
+ * Slot of rule matching exactly, or the empty one it would go to.
+ */
+static pez_route_entry_t *
+pez_ipc_route_slot(const pez_route_table_t *tab,
+                   uint32_t match,
+                   uint16_t type,
+                   uint32_t subtype,
+                   uint64_t key) {
+    const pez_route_entry_t *e;
+    uint32_t                h;
+
+    for (h = pez_ipc_route_hash(match, type, subtype, key); ; h ++) {
+        e = &tab->entry[h & tab->mask];
+        if (!e->used || (e->match == match && e->type == type &&
+                         e->subtype == subtype && e->key == key)) {
+            return (pez_route_entry_t *)e;
+        }
+    }
+}
+
+/*
+ * Most specific rule for msg, NULL if none.
+ */
+static const pez_route_entry_t *
+pez_ipc_route_find(const pez_route_table_t *tab,
+                   uint16_t type,
+                   uint32_t subtype,
+                   const uint64_t *key) {
+    static const uint32_t   order[PEZ_ROUTE_MATCH_NUM] = {
+        PEZ_ROUTE_M_SUBTYPE | PEZ_ROUTE_M_KEY,
+        PEZ_ROUTE_M_SUBTYPE,
+        PEZ_ROUTE_M_KEY,
+        0,
+    };
+    const pez_route_entry_t *e;
+    uint32_t                m;
+    int                     i;
+
+    for (i = 0; i < PEZ_ROUTE_MATCH_NUM; i ++) {
+        m = order[i];
+        if (tab->match_num[m] == 0 || ((m & PEZ_ROUTE_M_KEY) && !key)) {
+            continue;
+        }
+        e = pez_ipc_route_slot(tab, m, type,
+                               (m & PEZ_ROUTE_M_SUBTYPE) ? subtype : 0,
+                               (m & PEZ_ROUTE_M_KEY) ? *key : 0);
+        if (e->used) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Build routing table of rules. Two rules matching the same are invalid.
+ * rule_num is at most PEZ_ROUTE_RULE_MAX, so size doesn't wrap.
+ */
+static pez_status
+pez_ipc_route_compile(const pez_route_rule_t *rules,
+                      int rule_num,
+                      pez_route_table_t **out) {
+    const pez_route_rule_t  *r;
+    pez_route_table_t       *tab;
+    pez_route_entry_t       *e;
+    uint32_t                size = PEZ_ROUTE_TABLE_MIN;
+    size_t                  len = 0;
+    int                     i;
+
+    while (size < (uint32_t)rule_num * 2) {
+        size <<= 1;
+    }
+    tab = calloc(1, sizeof(*tab) + sizeof(tab->entry[0]) * size);
+    if (!tab) {
+        return ENOMEM;
+    }
+    tab->mask = size - 1;
+    for (i = 0; i < rule_num; i ++) {
+        r = &rules[i];
+        if (r->action != PEZ_ROUTE_DROP) {
+            len = r->trgt ? strnlen(r->trgt, PEZ_THREAD_ID_MAX_LEN) : 0;
+        }
+        if ((r->match & ~(PEZ_ROUTE_M_SUBTYPE | PEZ_ROUTE_M_KEY)) ||
+            (r->action != PEZ_ROUTE_REDIRECT &&
+             r->action != PEZ_ROUTE_MIRROR &&
+             r->action != PEZ_ROUTE_DROP) ||
+            (r->action != PEZ_ROUTE_DROP &&
+             (len == 0 || len == PEZ_THREAD_ID_MAX_LEN))) {
+            printf("pez ipc: invalid routing rule %d\n", i);
+            goto err;
+        }
+        e = pez_ipc_route_slot(tab, r->match, r->type,
+                               (r->match & PEZ_ROUTE_M_SUBTYPE) ?
+                               r->subtype : 0,
+                               (r->match & PEZ_ROUTE_M_KEY) ? r->key : 0);
+        if (e->used) {
+            printf("pez ipc: routing rule %d matches as another one\n", i);
+            goto err;
+        }
+        e->used = 1;
+        e->match = r->match;
+        e->type = r->type;
+        e->subtype = (r->match & PEZ_ROUTE_M_SUBTYPE) ? r->subtype : 0;
+        e->key = (r->match & PEZ_ROUTE_M_KEY) ? r->key : 0;
+        e->action = r->action;
+        if (r->action != PEZ_ROUTE_DROP) {
+            memcpy(e->trgt, r->trgt, len);
+            e->trgt_len = len;
+        }
+        tab->match_num[r->match] ++;
+    }
+    tab->rule_num = rule_num;
+    *out = tab;
+    return EOK;
+
+err:
+    free(tab);
+    return EINVAL;
+}
+
+/*
+ * Take tab off route_pend. 0 if it isn't there, it was never handed over
+ * or is taken already.
+ */
+static int
+pez_ipc_route_unpend(pez_t *pez, pez_route_table_t *tab) {
+    pez_route_table_t   **p;
+    int                 found = 0;
+
+    pthread_mutex_lock(&pez->lock);
+    for (p = &pez->route_pend; *p; p = &(*p)->next) {
+        if (*p == tab) {
+            *p = tab->next;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pez->lock);
+    return found;
+}
+
+/*
+ * Replace routing rules of domain, 0 rules clears them, more than
+ * PEZ_ROUTE_RULE_MAX is EINVAL. Rules are compiled here, router swaps the
+ * table in once it gets it. That isn't ordered with msgs sent by endpoints
+ * of the calling thread, ones sent before or right after may be routed by
+ * either table.
+ */
+pez_status
+pez_domain_route_set(pez_domain_t *pez,
+                     const pez_route_rule_t *rules,
+                     int rule_num) {
+    pez_route_table_t   *tab = NULL;
+    pez_hdr_t           hdr;
+    struct iovec        iov;
+    void                *socket;
+    pez_status          rc;
+
+    if (!pez || rule_num < 0 || rule_num > PEZ_ROUTE_RULE_MAX ||
+        (rule_num && !rules)) {
+        return EINVAL;
+    }
+    if (rule_num) {
+        rc = pez_ipc_route_compile(rules, rule_num, &tab);
+        if (rc != EOK) {
+            return rc;
+        }
+    }
+    socket = pez_ipc_post_sock_get(pez);
+    if (!socket) {
+        free(tab);
+        return ENOTCONN;
+    }
+    if (tab) {
+        pthread_mutex_lock(&pez->lock);
+        tab->next = pez->route_pend;
+        pez->route_pend = tab;
+        pthread_mutex_unlock(&pez->lock);
+    }
+    pez_ipc_hdr_init(&hdr, 0, 1);
+    hdr.op = PEZ_CTRL_ROUTE;
+    iov.iov_base = &tab;
+    iov.iov_len = sizeof(tab);
+    rc = pez_ipc_frames_sendv_sock(pez, socket, "", &hdr, &iov, 1);
+    if (rc != EOK && pez_ipc_route_unpend(pez, tab)) {
+        free(tab);
+    }
+    return rc;
+}
+
+pez_status
+pez_ipc_route_set(const pez_route_rule_t *rules, int rule_num) {
+    return pez_domain_route_set(&pez_dflt, rules, rule_num);
+}
+
+/*
+ * Hand object over to trgt, only the pointer is routed. On success trgt
+ * owns it and must release it by pez_ipc_ptr_release(). If router can't
+ * deliver it, router releases it. On failure src still owns it.
+ */
+pez_status
+pez_ipc_msg_send_ptr(const char *trgt, const char *src, const pez_ptr_t *ptr) {
+    if (!ptr || !ptr->obj || !ptr->release) {
+        return EINVAL;
+    }
+    return pez_ipc_msg_send_internal(trgt, src, &pez_ipc_ptr_hdr,
+                                     (void *)ptr, sizeof(*ptr));
+}
+
+/*
+ * Give object of pointer msg back to its owner, e.g. its pool.
+ */
+void
+pez_ipc_ptr_release(pez_ptr_t *ptr) {
+    if (!ptr || !ptr->obj || !ptr->release) {
+        return;
+    }
+    ptr->release(ptr->obj, ptr->arg);
+    ptr->obj = NULL;
+}
+
+/*
+ * Let router shed msgs with deadline to thread id while more than max_depth
+ * msgs routed to it are not handled yet. 0 turns it off.
+ */
+pez_status
+pez_domain_shed_set(pez_domain_t *pez, const char *id, uint32_t max_depth) {
+    int32_t idx;
+
+    if (!pez || !id) {
+        return EINVAL;
+    }
+    pez_ipc_index_get_bystr(pez, id, &idx);
+    if (idx == PEZ_THREAD_ID_INVAL) {
+        printf("pez ipc: invalid thread id(%s)\n", id);
+        return EINVAL;
+    }
+    __atomic_store_n(&pez->thd[idx].shed_depth, max_depth, __ATOMIC_RELAXED);
+    return EOK;
+}
+
+pez_status
+pez_ipc_shed_set(const char *id, uint32_t max_depth) {
+    return pez_domain_shed_set(&pez_dflt, id, max_depth);
+}
+
+/*
+ * Let thread id busy-poll its inbox for up to spin_us before its loop
+ * sleeps, trading a core for wakeup latency. Budget shrinks while polls
+ * find nothing and is restored by the next hit. Loop still serves its other
+ * watchers and timers while spinning, every few us. 0 turns it off, more
+ * than PEZ_BUSY_POLL_MAX_US is EINVAL. Must be called by the thread itself
+ * after pez_ipc_thread_init_rx().
+ */
+pez_status
+pez_ipc_busy_poll_set(const char *id, uint32_t spin_us) {
+    pez_t   *pez;
+    int32_t idx;
+
+    if (!id || spin_us > PEZ_BUSY_POLL_MAX_US) {
+        return EINVAL;
+    }
+    if (pez_ipc_index_get_bysrc(id, &pez, &idx) != EOK ||
+        !pez->thd[idx].pez_ev_zsock.cb) {
+        printf("pez ipc: busy poll can't be set for thread id(%s)\n", id);
+        return EINVAL;
+    }
+    pez->thd[idx].pez_ev_zsock.spin_ns = spin_us * 1000U;
+    return EOK;
+}
+
+/*
+ * Trace 1 of sample_rate msgs, see pez_trace.h. 0 turns it off. Events
+ * recorded so far are kept.
+ */
+void
+pez_ipc_trace_enable(uint32_t sample_rate) {
+    __atomic_store_n(&pez_trace_rate, sample_rate, __ATOMIC_RELAXED);
+}
+
+/*
+ * Mark start of handling msg just received on wz, by its handler.
+ */
+void
+pez_ipc_trace_begin(ev_zsock_t *wz) {
+    pez_thd_t *thd = (pez_thd_t *)pez_ipc_endpoint_of(wz);
+
+    if (thd && thd->rx_trace_id) {
+        pez_ipc_trace(&thd->trace, PEZ_TRACE_HANDLER_BEGIN, thd->rx_trace_id);
+    }
+}
+
+/*
+ * Mark end of handling msg. Msgs sent after it don't carry its trace id.
+ */
+void
+pez_ipc_trace_end(ev_zsock_t *wz) {
+    pez_thd_t *thd = (pez_thd_t *)pez_ipc_endpoint_of(wz);
+
+    if (thd && thd->rx_trace_id) {
+        pez_ipc_trace(&thd->trace, PEZ_TRACE_HANDLER_END, thd->rx_trace_id);
+        thd->rx_trace_id = 0;
+    }
+}
+
+/*
+ * Write events recorded by all threads of all domains as Chrome trace JSON.
+ * Tracks of domains other than the default one are prefixed by domain name.
+ * Can be called by any thread while msgs flow.
+ */
+#define PEZ_TRACE_NAME_LEN  (PEZ_DOMAIN_NAME_MAX_LEN + PEZ_THREAD_ID_MAX_LEN)
+
+pez_status
+pez_ipc_trace_dump(const char *path) {
+    pez_trace_ring_t    **rings;
+    const char          **names;
+    char                (*buf)[PEZ_TRACE_NAME_LEN];
+    unsigned int        d, num;
+    int                 i, t = 0;
+    pez_status          rc;
+    pez_t               *pez;
+
+    num = __atomic_load_n(&pez_domain_num, __ATOMIC_ACQUIRE);
+    rings = malloc(sizeof(*rings) * num * (PEZ_THREAD_MAX_NUM + 1));
+    names = malloc(sizeof(*names) * num * (PEZ_THREAD_MAX_NUM + 1));
+    buf = malloc(sizeof(*buf) * num * (PEZ_THREAD_MAX_NUM + 1));
+    if (!rings || !names || !buf) {
+        rc = ENOMEM;
+        goto end;
+    }
+    for (d = 0; d < num; d ++) {
+        pez = pez_domain[d];
+        for (i = 0; i <= PEZ_THREAD_MAX_NUM; i ++, t ++) {
+            if (i < PEZ_THREAD_MAX_NUM) {
+                rings[t] = __atomic_load_n(&pez->thd[i].trace,
+                                           __ATOMIC_ACQUIRE);
+            } else {
+                rings[t] = __atomic_load_n(&pez->rt_trace, __ATOMIC_ACQUIRE);
+            }
+            if (!rings[t]) {
+                names[t] = NULL;
+                continue;
+            }
+            snprintf(buf[t], sizeof(buf[t]), "%s%s%s",
+                     pez == &pez_dflt ? "" : pez->name,
+                     pez == &pez_dflt ? "" : "/",
+                     i < PEZ_THREAD_MAX_NUM ? pez->thd[i].identity : "router");
+            names[t] = buf[t];
+        }
+    }
+    rc = pez_trace_dump(path, rings, names, t);
+
+end:
+    free(rings);
+    free(names);
+    free(buf);
+    return rc;
+}
+
+/*
+ * Declare thread id which registers later. Msgs can be sent to it right
+ * away, router holds them until it registers.
+ */
+pez_status
+pez_domain_thread_declare(pez_domain_t *pez, const char *id) {
+    int32_t idx;
+
+    if (!pez || !id || strnlen(id, PEZ_THREAD_ID_MAX_LEN) == 0) {
+        return EINVAL;
+    }
+    if (pez_ipc_group_get_bystr(pez, id)) {
+        printf("pez ipc: %s is a group name\n", id);
+        return EINVAL;
+    }
+    pez_ipc_index_get_bystr(pez, id, &idx);
+    if (idx != PEZ_THREAD_ID_INVAL) {
+        return EOK;
+    }
+    pez_ipc_index_alloc(pez, id, &idx);
+    if (idx == PEZ_THREAD_ID_INVAL) {
+        printf("pez ipc: no room for new thread(%s) declaration\n", id);
+        return ENOMEM;
+    }
+    __atomic_store_n(&pez->thd[idx].declared, 1, __ATOMIC_RELEASE);
+    return EOK;
+}
+
+pez_status
+pez_ipc_thread_declare(const char *id) {
+    return pez_domain_thread_declare(&pez_dflt, id);
+}
+
+/*
+ * Give thread id a durable queue in dir. Msgs to id are appended to it
+ * while id isn't registered, while more than max_depth msgs routed to id are
+ * not handled(0: only while not registered), and while older ones are still
+ * in it. They're replayed in order once id catches up. Msgs left in dir by
+ * previous run are replayed too.
+ * id needn't be registered yet, it's declared so that msgs can be sent to
+ * it. Should be called before msgs are sent to id, it can't be turned off.
+ */
+pez_status
+pez_domain_journal_enable(pez_domain_t *pez,
+                          const char *id,
+                          const char *dir,
+                          uint32_t max_depth) {
+    pez_journal_t   *j;
+    int32_t         idx;
+    pez_status      rc;
+
+    if (!dir) {
+        return EINVAL;
+    }
+    rc = pez_domain_thread_declare(pez, id);
+    if (rc != EOK) {
+        return rc;
+    }
+    pez_ipc_index_get_bystr(pez, id, &idx);
+
+    j = malloc(sizeof(*j));
+    if (!j) {
+        return ENOMEM;
+    }
+    /* held while opening, so dir of id is never opened twice */
+    pthread_mutex_lock(&pez->lock);
+    if (pez->thd[idx].journal) {
+        rc = EEXIST;
+        goto end;
+    }
+    rc = pez_journal_open(j, dir, id);
+    if (rc != EOK) {
+        goto end;
+    }
+    pez->thd[idx].journal_depth = max_depth;
+    __atomic_store_n(&pez->thd[idx].journal, j, __ATOMIC_RELEASE);
+    /* router walks journal_id[] up to journal_num */
+    pez->journal_id[pez->journal_num] = idx;
+    __atomic_store_n(&pez->journal_num, pez->journal_num + 1,
+                     __ATOMIC_RELEASE);
+    j = NULL;
+
+end:
+    pthread_mutex_unlock(&pez->lock);
+    free(j);
+    return rc;
+}
+
+pez_status
+pez_ipc_journal_enable(const char *id, const char *dir, uint32_t max_depth) {
+    return pez_domain_journal_enable(&pez_dflt, id, dir, max_depth);
+}
+
+/*
+ * Whether all threads of NULL terminated ids are online. Called with lock.
+ */
+static int
+pez_ipc_ready(pez_t *pez, const char *const *ids) {
+    int32_t idx;
+
+    for ( ; *ids; ids ++) {
+        pez_ipc_index_get_bystr(pez, *ids, &idx);
+        if (idx == PEZ_THREAD_ID_INVAL ||
+            !__atomic_load_n(&pez->thd[idx].rt_online, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Wait until all threads of NULL terminated ids are registered and known by
+ * router, i.e. msgs to them are delivered without being held. timeout_ms < 0
+ * waits forever. ETIMEDOUT if some aren't ready in time.
+ */
+pez_status
+pez_domain_wait_ready(pez_domain_t *pez,
+                      const char *const *ids,
+                      int timeout_ms) {
+    struct timespec ts;
+    pez_status      rc = EOK;
+
+    if (!pez || !ids) {
+        return EINVAL;
+    }
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += timeout_ms / 1000;
+        ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec ++;
+            ts.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&pez->lock);
+    while (!pez_ipc_ready(pez, ids) && rc == EOK) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&pez->ready_cond, &pez->lock);
+        } else {
+            rc = pthread_cond_timedwait(&pez->ready_cond, &pez->lock, &ts);
+        }
+    }
+    if (rc == ETIMEDOUT && pez_ipc_ready(pez, ids)) {
+        rc = EOK;
+    }
+    pthread_mutex_unlock(&pez->lock);
+    return rc;
+}
+
+pez_status
+pez_ipc_wait_ready(const char *const *ids, int timeout_ms) {
+    return pez_domain_wait_ready(&pez_dflt, ids, timeout_ms);
+}
+
+/*
+ * Create group. Threads join it by pez_ipc_group_join(). Group name shares
+ * namespace with thread names.
+ */
+pez_status
+pez_domain_group_create(pez_domain_t *pez,
+                        const char *group,
+                        pez_group_policy_t policy) {
+    pez_group_t *g;
+    int32_t     id;
+
+    if (!pez || !group || strnlen(group, PEZ_THREAD_ID_MAX_LEN) == 0 ||
+        policy > PEZ_GROUP_POLICY_KEY) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&pez->lock);
+    pez_ipc_index_get_bystr(pez, group, &id);
+    if (id != PEZ_THREAD_ID_INVAL || pez_ipc_group_get_bystr(pez, group)) {
+        pthread_mutex_unlock(&pez->lock);
+        printf("pez ipc: name %s is in use\n", group);
+        return EEXIST;
+    }
+    if (pez->group_num == PEZ_GROUP_MAX_NUM) {
+        pthread_mutex_unlock(&pez->lock);
+        printf("pez ipc: no room for new group(%s)\n", group);
+        return ENOMEM;
+    }
+    g = calloc(1, sizeof(*g));
+    if (!g) {
+        pthread_mutex_unlock(&pez->lock);
+        return ENOMEM;
+    }
+    strncpy(g->name, group, PEZ_THREAD_ID_MAX_LEN);
+    g->policy = policy;
+    pez->group[pez->group_num] = g;
+    __atomic_store_n(&pez->group_num, pez->group_num + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pez->lock);
+    return EOK;
+}
+
+pez_status
+pez_ipc_group_create(const char *group, pez_group_policy_t policy) {
+    return pez_domain_group_create(&pez_dflt, group, policy);
+}
+
+/*
+ * Ask router to add/remove member to/from group of member's domain.
+ */
+static pez_status
+pez_ipc_group_ctrl_send(const char *group, const char *member, uint16_t op) {
+    pez_t       *pez;
+    pez_hdr_t   hdr;
+    int32_t     id;
+    pez_status  rc;
+
+    if (!group || !member) {
+        return EINVAL;
+    }
+    rc = pez_ipc_index_get_bysrc(member, &pez, &id);
+    if (rc != EOK) {
+        return rc;
+    }
+    if (!pez_ipc_group_get_bystr(pez, group)) {
+        printf("pez ipc: invalid group name(%s)\n", group);
+        return EINVAL;
+    }
+    pez_ipc_hdr_init(&hdr, 0, 1);
+    hdr.op = op;
+    return pez_ipc_frames_send(pez, id, "", &hdr, group,
+                               strnlen(group, PEZ_THREAD_ID_MAX_LEN));
+}
+
+/*
+ * Join group. Must be called by member thread. It takes effect once router
+ * handles it, msgs to group before that may be routed to other members or
+ * dropped if there is no member. Closing member's endpoint leaves all its
+ * groups, msgs to them go to other members from then on.
+ */
+pez_status
+pez_ipc_group_join(const char *group, const char *member) {
+    return pez_ipc_group_ctrl_send(group, member, PEZ_CTRL_GROUP_JOIN);
+}
+
+/*
+ * Leave group. Must be called by member thread. Msgs already routed to
+ * member are still delivered to it.
+ */
+pez_status
+pez_ipc_group_leave(const char *group, const char *member) {
+    return pez_ipc_group_ctrl_send(group, member, PEZ_CTRL_GROUP_LEAVE);
+}
+
+/*
+ * Hand msg to router timing wheel. It's sent to trgt after delay_ms, then
+ * every period_ms if period_ms isn't 0.
+ */
+static pez_status
+pez_ipc_msg_send_timer(const char *trgt,
+                       const char *src,
+                       void *buf,
+                       size_t size,
+                       uint32_t delay_ms,
+                       uint32_t period_ms,
+                       uint64_t *timer_id) {
+    pez_t       *pez;
+    pez_hdr_t   hdr;
+    int32_t     src_id;
+    pez_status  rc;
+
+    if (!src) {
+        return EINVAL;
+    }
+    rc = pez_ipc_index_get_bysrc(src, &pez, &src_id);
+    if (rc != EOK) {
+        return rc;
+    }
+    pez_ipc_hdr_init(&hdr, PEZ_HDR_F_TIMER, 1);
+    hdr.delay_ms = delay_ms;
+    hdr.period_ms = period_ms;
+    hdr.timer_id = ((uint64_t)(src_id + 1) << 32) |
+                   ++ pez->thd[src_id].timer_seq;
+    rc = pez_ipc_msg_send_internal(trgt, src, &hdr, buf, size);
+    if (rc == EOK && timer_id) {
+        *timer_id = hdr.timer_id;
+    }
+    return rc;
+}
+
+/*
+ * Send msg to trgt after delay_ms. Router holds the msg, so no timer is
+ * needed in the loop of src. timer_id, if not NULL, can be used to cancel.
+ */
+pez_status
+pez_ipc_msg_send_after(const char *trgt,
+                       const char *src,
+                       void *buf,
+                       size_t size,
+                       uint32_t delay_ms,
+                       uint64_t *timer_id) {
+    return pez_ipc_msg_send_timer(trgt, src, buf, size, delay_ms, 0,
+                                  timer_id);
+}
+
+/*
+ * Send msg to trgt after delay_ms then every period_ms until cancelled.
+ */
+pez_status
+pez_ipc_msg_send_every(const char *trgt,
+                       const char *src,
+                       void *buf,
+                       size_t size,
+                       uint32_t delay_ms,
+                       uint32_t period_ms,
+                       uint64_t *timer_id) {
+    if (period_ms == 0) {
+        return EINVAL;
+    }
+    return pez_ipc_msg_send_timer(trgt, src, buf, size, delay_ms, period_ms,
+                                  timer_id);
+}
+
+/*
+ * Cancel delayed or periodic msg. Must be called by the thread which set it
+ * up. Nothing happens if it's sent already.
+ */
+pez_status
+pez_ipc_timer_cancel(const char *src, uint64_t timer_id) {
+    pez_t       *pez;
+    pez_hdr_t   hdr;
+    int32_t     id;
+    pez_status  rc;
+
+    if (!src) {
+        return EINVAL;
+    }
+    rc = pez_ipc_index_get_bysrc(src, &pez, &id);
+    if (rc != EOK) {
+        return rc;
+    }
+    pez_ipc_hdr_init(&hdr, 0, 1);
+    hdr.op = PEZ_CTRL_TIMER_CANCEL;
+    hdr.timer_id = timer_id;
+    return pez_ipc_frames_send(pez, id, "", &hdr, "", 0);
+}
+
+static void
+pez_ipc_rx_init(pez_thd_t *thd) {
+    int i;
+
+    zmq_msg_init(&thd->rx_msg);
+    for (i = 0; i < PEZ_IPC_IOV_MAX; i ++) {
+        zmq_msg_init(&thd->rx_part[i]);
+    }
+    thd->rx_part_cnt = 0;
+}
+
+static void
+pez_ipc_rx_parts_close(pez_thd_t *thd) {
+    int i;
+
+    for (i = 0; i < thd->rx_part_cnt; i ++) {
+        zmq_msg_close(&thd->rx_part[i]);
+        zmq_msg_init(&thd->rx_part[i]);
+    }
+    thd->rx_part_cnt = 0;
+}
+
+/*
+ * Join parts of msg sent by sendv into thd->rx_msg, for receivers which
+ * want one buffer.
+ */
+static void
+pez_ipc_rx_parts_gather(pez_thd_t *thd) {
+    uint8_t     *p;
+    size_t      size = 0;
+    int         i;
+
+    for (i = 0; i < thd->rx_part_cnt; i ++) {
+        size += zmq_msg_size(&thd->rx_part[i]);
+    }
+    zmq_msg_close(&thd->rx_msg);
+    zmq_msg_init_size(&thd->rx_msg, size);
+    p = zmq_msg_data(&thd->rx_msg);
+    for (i = 0; i < thd->rx_part_cnt; i ++) {
+        memcpy(p, zmq_msg_data(&thd->rx_part[i]),
+               zmq_msg_size(&thd->rx_part[i]));
+        p += zmq_msg_size(&thd->rx_part[i]);
+    }
+    pez_ipc_rx_parts_close(thd);
+}
+
+/*
+ * Take next msg off socket into thd->rx_msg. If it starts with a pez hdr
+ * frame, the hdr tells how many msgs the data frame carries, or that data
+ * is in several frames, which are kept in thd->rx_part.
+ */
+static pez_status
+pez_ipc_rx_next(pez_thd_t *thd, void *socket) {
+    pez_hdr_t   hdr;
+
+    if (zmq_msg_recv(&thd->rx_msg, socket, 0) == -1) {
+        return errno;
+    }
+    thd->rx_off = 0;
+    thd->rx_left = 1;
+    thd->rx_batch = 0;
+    thd->rx_deadline_ns = 0;
+    thd->rx_ptr = 0;
+    thd->rx_trace_id = 0;
+    if (!zmq_msg_more(&thd->rx_msg)) {
+        return EOK;
+    }
+
+    /* 1st frame of multi-frame msg is pez hdr */
+    if (zmq_msg_size(&thd->rx_msg) != sizeof(hdr)) {
+        goto err;
+    }
+    memcpy(&hdr, zmq_msg_data(&thd->rx_msg), sizeof(hdr));
+    if (hdr.magic != PEZ_HDR_MAGIC || hdr.version != PEZ_HDR_VERSION) {
+        goto err;
+    }
+    if (hdr.flags & PEZ_HDR_F_DEADLINE) {
+        thd->rx_deadline_ns = hdr.deadline_ns;
+    }
+    if (hdr.flags & PEZ_HDR_F_TRACE) {
+        thd->rx_trace_id = hdr.trace_id;
+        pez_ipc_trace(&thd->trace, PEZ_TRACE_RX, hdr.trace_id);
+    }
+    if (hdr.flags & PEZ_HDR_F_PARTS) {
+        /* keep the parts, frames beyond PEZ_IPC_IOV_MAX are dropped */
+        do {
+            if (zmq_msg_recv(&thd->rx_part[thd->rx_part_cnt], socket,
+                             0) == -1) {
+                pez_ipc_rx_parts_close(thd);
+                thd->rx_left = 0;
+                return errno;
+            }
+        } while (zmq_msg_more(&thd->rx_part[thd->rx_part_cnt ++]) &&
+                 thd->rx_part_cnt < PEZ_IPC_IOV_MAX);
+        pez_ipc_msg_drain(socket);
+        return EOK;
+    }
+    if (zmq_msg_recv(&thd->rx_msg, socket, 0) == -1) {
+        thd->rx_left = 0;
+        return errno;
+    }
+    if (hdr.flags & PEZ_HDR_F_BATCH) {
+        thd->rx_batch = 1;
+        thd->rx_left = hdr.cnt;
+    }
+    thd->rx_ptr = !!(hdr.flags & PEZ_HDR_F_PTR);
+    pez_ipc_msg_drain(socket);
+    return EOK;
+
+err:
+    PEZ_IPC_HOT_ERR(thd->dom, "pez ipc: %s recvd invalid pez hdr\n",
+                    thd->identity);
+    pez_ipc_msg_drain(socket);
+    thd->rx_left = 0;
+    return EPROTO;
+}
+
+/*
+ * Pop one msg out of thd->rx_msg.
+ */
+static pez_status
+pez_ipc_rx_pop(pez_thd_t *thd, const uint8_t **data, size_t *size) {
+    const uint8_t   *p = zmq_msg_data(&thd->rx_msg);
+    size_t          len = zmq_msg_size(&thd->rx_msg);
+    pez_batch_rec_t rec;
+
+    thd->rx_left --;
+    thd->pez_ev_zsock.pending = (thd->rx_left != 0);
+    if (!thd->rx_batch) {
+        *data = p;
+        *size = len;
+        return EOK;
+    }
+
+    if (thd->rx_off + sizeof(rec) > len) {
+        goto err;
+    }
+    memcpy(&rec, p + thd->rx_off, sizeof(rec));
+    if (thd->rx_off + sizeof(rec) + rec.len > len) {
+        goto err;
+    }
+    *data = p + thd->rx_off + sizeof(rec);
+    *size = rec.len;
+    thd->rx_off += PEZ_BATCH_REC_SIZE(rec.len);
+    return EOK;
+
+err:
+    printf("pez ipc: %s recvd truncated batch\n", thd->identity);
+    thd->rx_left = 0;
+    thd->pez_ev_zsock.pending = 0;
+    return EPROTO;
+}
+
+/*
+ * Find thread owning socket and make sure a msg is there to be handed out.
+ */
+static pez_status
+pez_ipc_rx_prepare(void *socket, pez_thd_t **thd_out) {
+    pez_status      rc;
+    pez_thd_t       *thd;
+
+    thd = pez_ipc_thd_get_bysock(socket);
+    if (!thd || thd->tid != pthread_self()) {
+        printf("%s: recv by unregistered thread\n", __func__);
+        return EINVAL;
+    }
+
+    if (thd->rx_left == 0) {
+        PEZ_RT_HOT_BEGIN(PEZ_IPC_RT(thd->dom));
+        rc = pez_ipc_rx_next(thd, socket);
+        PEZ_RT_HOT_END(PEZ_IPC_RT(thd->dom));
+        if (rc != EOK) {
+            printf("%s: err:%s\n", __func__, strerror(rc));
+            return rc;
+        }
+    }
+    *thd_out = thd;
+    return EOK;
+}
+
+/*
+ * Check msg just popped and count it.
+ */
+static pez_status
+pez_ipc_rx_done(pez_thd_t *thd, const uint8_t *data, size_t size) {
+    char            suffix[PEZ_STRING_SUFFIX_LEN] = {0};
+
+    if (thd->rx_deadline_ns && pez_ipc_now_ns() > thd->rx_deadline_ns) {
+        /* nobody cares any more, don't let it hold up the thread */
+        thd->expire_cnt ++;
+        return ETIMEDOUT;
+    }
+    if (size == 0) {
+        printf("%s: recvd 0 byte msg\n", __func__);
+    }
+
+    /* count recv msg number. No lock needed */
+    thd->recv_cnt ++;
+    if (pez_debug_flag) {
+        snprintf(suffix, PEZ_STRING_SUFFIX_LEN, "pez msg recv(%s)",
+                 thd->identity);
+        pez_ipc_hexdump(suffix, (const char *)data, size);
+        printf("%s: recv cnt: %llu\n",
+                     thd->identity,
+                     thd->recv_cnt);
+    }
+    return EOK;
+}
+
+/*
+ * Get next msg for thread owning socket. data points into thd->rx_msg.
+ */
+static pez_status
+pez_ipc_rx_get(void *socket,
+               pez_thd_t **thd_out,
+               const uint8_t **data,
+               size_t *size) {
+    pez_status      rc;
+    pez_thd_t       *thd;
+
+    rc = pez_ipc_rx_prepare(socket, &thd);
+    if (rc != EOK) {
+        return rc;
+    }
+    if (thd->rx_part_cnt) {
+        pez_ipc_rx_parts_gather(thd);
+    }
+    rc = pez_ipc_rx_pop(thd, data, size);
+    if (rc != EOK) {
+        return rc;
+    }
+    rc = pez_ipc_rx_done(thd, *data, *size);
+    if (rc != EOK) {
+        return rc;
+    }
+    *thd_out = thd;
+    return EOK;
+}
+
+/*
+ * Pointer msg got by a receiver which doesn't take objects. Object is
+ * released, otherwise nobody would.
+ */
+static pez_status
+pez_ipc_rx_ptr_drop(pez_thd_t *thd, const uint8_t *data, size_t size) {
+    pez_ptr_t   ptr;
+
+    if (size == sizeof(ptr)) {
+        memcpy(&ptr, data, sizeof(ptr));
+        pez_ipc_ptr_release(&ptr);
+    }
+    thd->ptr_drop_cnt ++;
+    printf("pez ipc: %s recvd pointer msg as plain one, released it\n",
+           thd->identity);
+    return EBADMSG;
+}
+
+/*
+ * recv message. Coalesced msgs are handed out one by one.
+ * ETIMEDOUT if msg is past its deadline, it's dropped and nothing is copied.
+ * EMSGSIZE if msg is bigger than buffer, only buffer_size bytes are copied.
+ * EBADMSG if it's a pointer msg, its object is released, see
+ * pez_ipc_msg_recv_ptr().
+ */
+pez_status
+pez_ipc_msg_recv(void *socket,
+                 void *buf,
+                 size_t buffer_size,
+                 size_t *rtn_size) {
+    pez_status      rc;
+    pez_thd_t       *thd;
+    const uint8_t   *data;
+    size_t          size;
+
+    if (!socket || !buf || !rtn_size || (buffer_size == 0)) {
+        printf("invalid params recvd\n");
+        return EINVAL;
+    }
+    *rtn_size = 0;
+
+    rc = pez_ipc_rx_get(socket, &thd, &data, &size);
+    if (rc != EOK) {
+        return rc;
+    }
+    if (thd->rx_ptr) {
+        return pez_ipc_rx_ptr_drop(thd, data, size);
+    }
+    if (size > buffer_size) {
+        printf("%s: %zu bytes msg truncated to %zu\n", thd->identity,
+               size, buffer_size);
+        memcpy(buf, data, buffer_size);
+        *rtn_size = buffer_size;
+        return EMSGSIZE;
+    }
+    memcpy(buf, data, size);
+    *rtn_size = size;
+    return EOK;
+}
+
+/*
+ * recv message without copying it. view points into zmq frame, which is
+ * referenced by view until pez_ipc_msg_release(). Next recv doesn't change
+ * it. Errors are same as pez_ipc_msg_recv().
+ */
+pez_status
+pez_ipc_msg_recv_view(void *socket, pez_msg_view_t *view) {
+    pez_status      rc;
+    pez_thd_t       *thd;
+    const uint8_t   *data;
+    size_t          size;
+
+    if (!socket || !view) {
+        printf("invalid params recvd\n");
+        return EINVAL;
+    }
+    rc = pez_ipc_rx_get(socket, &thd, &data, &size);
+    if (rc != EOK) {
+        return rc;
+    }
+    if (thd->rx_ptr) {
+        return pez_ipc_rx_ptr_drop(thd, data, size);
+    }
+    /* frame content is shared, not copied, unless it's a tiny one */
+    zmq_msg_init(&view->frame);
+    zmq_msg_copy(&view->frame, &thd->rx_msg);
+    view->off = data - (const uint8_t *)zmq_msg_data(&thd->rx_msg);
+    view->data = (const uint8_t *)zmq_msg_data(&view->frame) + view->off;
+    view->size = size;
+    return EOK;
+}
+
+/*
+ * Get another view of same msg, e.g. to hand it over to another thread.
+ * Both views must be released.
+ */
+pez_status
+pez_ipc_msg_retain(pez_msg_view_t *view, pez_msg_view_t *copy) {
+    if (!view || !copy || view == copy) {
+        return EINVAL;
+    }
+    zmq_msg_init(&copy->frame);
+    if (zmq_msg_copy(&copy->frame, &view->frame) == -1) {
+        return errno;
+    }
+    copy->off = view->off;
+    copy->data = (const uint8_t *)zmq_msg_data(&copy->frame) + copy->off;
+    copy->size = view->size;
+    return EOK;
+}
+
+/*
+ * Drop reference of view. It can be called by any thread.
+ */
+void
+pez_ipc_msg_release(pez_msg_view_t *view) {
+    if (!view) {
+        return;
+    }
+    zmq_msg_close(&view->frame);
+    view->data = NULL;
+    view->size = 0;
+}
+
+/*
+ * recv object sent by pez_ipc_msg_send_ptr(), receiver owns it now.
+ * EBADMSG if msg isn't a pointer msg, it's dropped. Other recvs release
+ * objects of pointer msgs and return EBADMSG.
+ */
+pez_status
+pez_ipc_msg_recv_ptr(void *socket, pez_ptr_t *ptr) {
+    pez_status      rc;
+    pez_thd_t       *thd;
+    const uint8_t   *data;
+    size_t          size;
+
+    if (!socket || !ptr) {
+        printf("invalid params recvd\n");
+        return EINVAL;
+    }
+    rc = pez_ipc_rx_get(socket, &thd, &data, &size);
+    if (rc != EOK) {
+        return rc;
+    }
+    if (!thd->rx_ptr || size != sizeof(*ptr)) {
+        printf("pez ipc: %s recvd msg which isn't a pointer\n",
+               thd->identity);
+        return EBADMSG;
+    }
+    memcpy(ptr, data, sizeof(*ptr));
+    return EOK;
+}
+
+/*
+ * recv message as parts it was sent by pez_ipc_msg_sendv(), without copying
+ * them. *part_cnt is size of parts and becomes number of parts got. Msgs
+ * not sent by sendv have one part. Each part must be released.
+ * EMSGSIZE if parts are too few, msg is dropped then.
+ */
+pez_status
+pez_ipc_msg_recvv(void *socket, pez_msg_view_t *parts, int *part_cnt) {
+    pez_status      rc;
+    pez_thd_t       *thd;
+    size_t          size = 0;
+    int             i;
+
+    if (!socket || !parts || !part_cnt || *part_cnt <= 0) {
+        printf("invalid params recvd\n");
+        return EINVAL;
+    }
+    rc = pez_ipc_rx_prepare(socket, &thd);
+    if (rc != EOK) {
+        return rc;
+    }
+    if (thd->rx_part_cnt == 0) {
+        *part_cnt = 1;
+        return pez_ipc_msg_recv_view(socket, &parts[0]);
+    }
+
+    thd->rx_left = 0;
+    thd->pez_ev_zsock.pending = 0;
+    if (thd->rx_part_cnt > *part_cnt) {
+        pez_ipc_rx_parts_close(thd);
+        *part_cnt = 0;
+        return EMSGSIZE;
+    }
+    for (i = 0; i < thd->rx_part_cnt; i ++) {
+        size += zmq_msg_size(&thd->rx_part[i]);
+    }
+    rc = pez_ipc_rx_done(thd, zmq_msg_data(&thd->rx_part[0]), size);
+    if (rc != EOK) {
+        pez_ipc_rx_parts_close(thd);
+        *part_cnt = 0;
+        return rc;
+    }
+    for (i = 0; i < thd->rx_part_cnt; i ++) {
+        zmq_msg_init(&parts[i].frame);
+        zmq_msg_move(&parts[i].frame, &thd->rx_part[i]);
+        parts[i].off = 0;
+        parts[i].data = zmq_msg_data(&parts[i].frame);
+        parts[i].size = zmq_msg_size(&parts[i].frame);
+    }
+    *part_cnt = thd->rx_part_cnt;
+    thd->rx_part_cnt = 0;
+    return EOK;
+}
+
+/*
+ * Let router know msgs can be sent to thread now. Msgs sent to it before
+ * that are held by router.
+ */
+static pez_status
+pez_ipc_hello_send(pez_t *pez, int32_t id) {
+    pez_hdr_t hdr;
+
+    pez_ipc_hdr_init(&hdr, 0, 1);
+    hdr.op = PEZ_CTRL_HELLO;
+    hdr.key = ++ pez->thd[id].open_gen;
+    return pez_ipc_frames_send(pez, id, "", &hdr, "", 0);
+}
+
+/*
+ * Claim id for an endpoint being opened. id declared in advance is taken
+ * over, else allocated. *declared tells which, for pez_ipc_open_undo().
+ */
+static pez_status
+pez_ipc_open_claim(pez_t *pez, const char *name, int32_t *id, int *declared) {
+    if (pez_ipc_group_get_bystr(pez, name)) {
+        printf("pez ipc: %s is a group name\n", name);
+        return EINVAL;
+    }
+
+    *declared = 0;
+    pez_ipc_index_get_bystr(pez, name, id);
+    if (*id != PEZ_THREAD_ID_INVAL) {
+        if (!__atomic_exchange_n(&pez->thd[*id].declared, 0,
+                                 __ATOMIC_ACQ_REL)) {
+            printf("pez ipc: don't invoke this API twice for same id. Previous"
+                   " call is by %s\n", pez->thd[*id].identity);
+            return EINVAL;
+        }
+        *declared = 1;
+        return EOK;
+    }
+
+    pez_ipc_index_alloc(pez, name, id);
+    if (*id == PEZ_THREAD_ID_INVAL) {
+        printf("pez ipc: no room for new thread(%s) allocation\n", name);
+        return ENOMEM;
+    }
+    return EOK;
+}
+
+/*
+ * Open of id failed after claiming it. Close its socket, and hand id back
+ * as it was, declared again or free, so that the name can be opened anew.
+ */
+static void
+pez_ipc_open_undo(pez_t *pez, int32_t id, int declared, void *socket) {
+    pez_thd_t   *thd = &pez->thd[id];
+
+    if (thd->loop && thd->pez_ev_zsock.zsock) {
+        ev_zsock_stop(thd->loop, &thd->pez_ev_zsock);
+    }
+    memset(&thd->pez_ev_zsock, 0, sizeof(thd->pez_ev_zsock));
+    if (socket) {
+        zmq_close(socket);
+    }
+    thd->loop = NULL;
+    thd->tid = 0;
+    if (declared) {
+        __atomic_store_n(&thd->declared, 1, __ATOMIC_RELEASE);
+    } else {
+        pez_ipc_index_free(pez, id);
+    }
+}
+
+/*
+ * Create zmq socket of id, with its name as zmq id, connected to router.
+ */
+static pez_status
+pez_ipc_open_socket(pez_t *pez, void *zmq_ctx, const char *name,
+                    void **socket) {
+    int rc;
+
+    *socket = zmq_socket(zmq_ctx, ZMQ_DEALER);
+    if (!*socket) {
+        rc = errno;
+        printf("unable to create ZMQ_DEALER socket for %s(%s)\n",
+                name,
+                strerror(rc));
+        return rc;
+    }
+
+    /* set zmq id */
+    if (zmq_setsockopt(*socket,
+                       ZMQ_IDENTITY,
+                       name,
+                       strnlen(name, PEZ_THREAD_ID_MAX_LEN)) == -1) {
+        rc = errno;
+        printf("unable to set ZMQ ID for thread %s:%s\n",
+                    name,
+                    strerror(rc));
+        return rc;
+    }
+
+    /* connect to router thread */
+    if (zmq_connect(*socket, pez->addr) == -1) {
+        rc = errno;
+        printf("unable to connect router for thread %s:%s\n",
+                    name,
+                    strerror(rc));
+        return rc;
+    }
+    return EOK;
+}
+
+/*
+ * Didn't create zmq socket. Monitor only
+ */
+static pez_status
+pez_ipc_init_tx(pez_t *pez, const char *tx_id) {
+    void        *socket = NULL;
+    pez_status  rc;
+    void        *zmq_ctx = NULL;
+    int32_t     id;
+    int         declared;
+
+    if (!tx_id) {
+        printf("pez ipc:invalid id recvd in tx creation\n");
+        return EINVAL;
+    }
+    zmq_ctx = pez_ipc_get_zmq_ctx(&pez->cfg);
+    if (!zmq_ctx) {
+        printf("pez ipc: null zmq ctx recvd\n");
+        return EINVAL;
+    }
+
+    rc = pez_ipc_open_claim(pez, tx_id, &id, &declared);
+    if (rc != EOK) {
+        return rc;
+    }
+
+    pez->thd[id].tid = pthread_self();
+    pez_ipc_rx_init(&pez->thd[id]);
+    if (PEZ_IPC_RT(pez) &&
+        pez_ipc_trace_ring_alloc(&pez->thd[id].trace) != EOK) {
+        rc = ENOMEM;
+        goto err;
+    }
+
+    rc = pez_ipc_open_socket(pez, zmq_ctx, tx_id, &socket);
+    if (rc != EOK) {
+        goto err;
+    }
+
+    /* save socket to pez */
+    pez->thd[id].pez_ev_zsock.zsock = socket;
+
+    rc = pez_ipc_hello_send(pez, id);
+    if (rc != EOK) {
+        goto err;
+    }
+    return EOK;
+
+err:
+    pez_ipc_open_undo(pez, id, declared, socket);
+    return rc;
+}
+
+pez_status
+pez_ipc_thread_init_tx(const char *tx_id) {
+    return pez_ipc_init_tx(&pez_dflt, tx_id);
+}
+
+
+/*
+ * Do zmq socket creation and connect.
+ */
+pez_status
 pez_ipc_thread_init_rx(struct ev_loop *loop,
                        const char *rx_id,
                        ev_zsock_cbfn cb) {
+    return pez_ipc_thread_init_rx_ex(loop, rx_id, cb, NULL);
+}
+
+static pez_status
+pez_ipc_init_rx(pez_t *pez,
+                struct ev_loop *loop,
+                const char *rx_id,
+                ev_zsock_cbfn cb,
+                void *data) {
     void        *socket = NULL;
     pez_status  rc;
-    void        *zmq_ctx = NULL;
+    void        *zmq_ctx = NULL;
+    int32_t     id;
+    int         declared;
+
+    zmq_ctx = pez_ipc_get_zmq_ctx(&pez->cfg);
+
+    if (!zmq_ctx || !cb || !loop || !rx_id) {
+        printf("pez ipc:NULL zmq_ctx or input argus recvd\n");
+        return EINVAL;
+    }
+
+    rc = pez_ipc_open_claim(pez, rx_id, &id, &declared);
+    if (rc != EOK) {
+        return rc;
+    }
+
+    pez->thd[id].tid = pthread_self();
+    pez->thd[id].loop = loop;
+    pez_ipc_rx_init(&pez->thd[id]);
+    if (PEZ_IPC_RT(pez) &&
+        pez_ipc_trace_ring_alloc(&pez->thd[id].trace) != EOK) {
+        rc = ENOMEM;
+        goto err;
+    }
+
+    rc = pez_ipc_open_socket(pez, zmq_ctx, rx_id, &socket);
+    if (rc != EOK) {
+        goto err;
+    }
+
+    /* Only need EV_READ event to read incoming msg */
+    ev_zsock_init(&pez->thd[id].pez_ev_zsock, cb, socket, EV_READ);
+    pez->thd[id].pez_ev_zsock.data = data;
+    ev_zsock_start(loop, &pez->thd[id].pez_ev_zsock);
+
+    rc = pez_ipc_hello_send(pez, id);
+    if (rc != EOK) {
+        goto err;
+    }
+    return EOK;
+
+err:
+    pez_ipc_open_undo(pez, id, declared, socket);
+    return rc;
+}
+
+/*
+ * Same as pez_ipc_thread_init_rx. data is saved in ev_zsock_t.data which
+ * cb can get back.
+ */
+pez_status
+pez_ipc_thread_init_rx_ex(struct ev_loop *loop,
+                          const char *rx_id,
+                          ev_zsock_cbfn cb,
+                          void *data) {
+    return pez_ipc_init_rx(&pez_dflt, loop, rx_id, cb, data);
+}
+
+/*
+ * Open endpoint id of domain, owned by current thread. With loop it
+ * receives like pez_ipc_thread_init_rx_ex(), else it only sends. A thread
+ * can own several endpoints, also on one loop and in several domains. NULL
+ * on failure.
+ */
+pez_endpoint_t *
+pez_domain_endpoint_open(pez_domain_t *pez,
+                         struct ev_loop *loop,
+                         const char *id,
+                         ev_zsock_cbfn cb,
+                         void *data) {
+    pez_status  rc;
+    int32_t     idx;
+
+    if (!pez) {
+        return NULL;
+    }
+    if (loop) {
+        rc = pez_ipc_init_rx(pez, loop, id, cb, data);
+    } else {
+        rc = pez_ipc_init_tx(pez, id);
+    }
+    if (rc != EOK) {
+        return NULL;
+    }
+    pez_ipc_index_get_bystr(pez, id, &idx);
+    return (pez_endpoint_t *)&pez->thd[idx];
+}
+
+pez_endpoint_t *
+pez_ipc_endpoint_open(struct ev_loop *loop,
+                      const char *id,
+                      ev_zsock_cbfn cb,
+                      void *data) {
+    return pez_domain_endpoint_open(&pez_dflt, loop, id, cb, data);
+}
+
+/*
+ * Get handle of endpoint id owned by current thread.
+ */
+pez_endpoint_t *
+pez_ipc_endpoint_get(const char *id) {
+    pez_t   *pez;
+    int32_t idx;
+
+    if (!id || pez_ipc_index_get_bysrc(id, &pez, &idx) != EOK) {
+        return NULL;
+    }
+    return (pez_endpoint_t *)&pez->thd[idx];
+}
+
+/*
+ * Close endpoint opened by current thread. Router holds msgs to it again
+ * until same id is opened anew, by any thread.
+ */
+pez_status
+pez_ipc_endpoint_close(pez_endpoint_t *ep) {
+    pez_thd_t   *thd = (pez_thd_t *)ep;
+    pez_t       *pez;
+    int32_t     id;
+    pez_hdr_t   hdr;
+
+    if (!thd || thd->tid != pthread_self() || !thd->pez_ev_zsock.zsock) {
+        return EINVAL;
+    }
+    pez = thd->dom;
+    id = thd - pez->thd;
+    pez_ipc_batch_flush_all(pez, id);
+    pez_ipc_batch_free(pez, id);
+
+    /* router sees it after all msgs sent before */
+    pez_ipc_hdr_init(&hdr, 0, 1);
+    hdr.op = PEZ_CTRL_BYE;
+    hdr.key = thd->open_gen;
+    pez_ipc_frames_send(pez, id, "", &hdr, "", 0);
+
+    if (thd->loop) {
+        ev_zsock_stop(thd->loop, &thd->pez_ev_zsock);
+    }
+    pez_ipc_rx_parts_close(thd);
+    zmq_msg_close(&thd->rx_msg);
+    thd->rx_left = 0;
+    zmq_close(thd->pez_ev_zsock.zsock);
+    memset(&thd->pez_ev_zsock, 0, sizeof(thd->pez_ev_zsock));
+    thd->loop = NULL;
+    thd->tid = 0;
+    __atomic_store_n(&thd->declared, 1, __ATOMIC_RELEASE);
+    return EOK;
+}
+
+/*
+ * Get endpoint which wz of ev_zsock cb belongs to.
+ */
+pez_endpoint_t *
+pez_ipc_endpoint_of(ev_zsock_t *wz) {
+    pez_thd_t       *thd;
+    unsigned int    d, num;
+    pez_t           *pez;
+
+    if (!wz) {
+        return NULL;
+    }
+    thd = (pez_thd_t *)((char *)wz - offsetof(pez_thd_t, pez_ev_zsock));
+    num = __atomic_load_n(&pez_domain_num, __ATOMIC_ACQUIRE);
+    for (d = 0; d < num; d ++) {
+        pez = pez_domain[d];
+        if (thd >= pez->thd && thd < pez->thd + PEZ_THREAD_MAX_NUM) {
+            return (pez_endpoint_t *)thd;
+        }
+    }
+    return NULL;
+}
+
+const char *
+pez_ipc_endpoint_name(pez_endpoint_t *ep) {
+    return ep ? ((pez_thd_t *)ep)->identity : NULL;
+}
+
+pez_domain_t *
+pez_ipc_endpoint_domain(pez_endpoint_t *ep) {
+    return ep ? ((pez_thd_t *)ep)->dom : NULL;
+}
+
+/*
+ * ev_zsock of endpoint, e.g. to stop and start receiving. NULL if it only
+ * sends.
+ */
+ev_zsock_t *
+pez_ipc_endpoint_zsock(pez_endpoint_t *ep) {
+    pez_thd_t *thd = (pez_thd_t *)ep;
+
+    if (!thd || !thd->pez_ev_zsock.cb) {
+        return NULL;
+    }
+    return &thd->pez_ev_zsock;
+}
+
+/*
+ * Send msg from endpoint. Holding the handle is the authority to send, no
+ * name lookup or thread check is done. Only the owner thread should hold
+ * it, zmq sockets aren't thread safe.
+ */
+pez_status
+pez_ipc_endpoint_send(pez_endpoint_t *ep,
+                      const char *trgt,
+                      void *buf,
+                      size_t size) {
+    pez_thd_t       *thd = (pez_thd_t *)ep;
+    struct iovec    iov;
+
+    if (!thd) {
+        return EINVAL;
+    }
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    return pez_ipc_msg_sendv_byid(thd->dom, thd - thd->dom->thd, trgt, NULL,
+                                  &iov, 1);
+}
+
+/*
+ * Same as pez_ipc_msg_sendv() from endpoint.
+ */
+pez_status
+pez_ipc_endpoint_sendv(pez_endpoint_t *ep,
+                       const char *trgt,
+                       const struct iovec *iov,
+                       int iov_cnt) {
+    pez_thd_t *thd = (pez_thd_t *)ep;
+
+    if (!thd) {
+        return EINVAL;
+    }
+    return pez_ipc_msg_sendv_parts(thd->dom, thd - thd->dom->thd, trgt, iov,
+                                   iov_cnt);
+}
+
+/*
+ * Copy id frame into NUL terminated string
+ */
+static void
+pez_ipc_rt_id_get(zmq_msg_t *frame, char *id) {
+    size_t len = zmq_msg_size(frame);
+
+    if (len > PEZ_THREAD_ID_MAX_LEN) {
+        len = PEZ_THREAD_ID_MAX_LEN;
+    }
+    memcpy(id, zmq_msg_data(frame), len);
+    id[len] = '\0';
+}
+
+/*
+ * Release frames still held by msg
+ */
+static void
+pez_ipc_rt_msg_close(pez_rt_msg_t *msg) {
+    int i;
+
+    zmq_msg_close(&msg->src);
+    zmq_msg_close(&msg->trgt);
+    for (i = 0; i < msg->part_cnt; i ++) {
+        zmq_msg_close(&msg->part[i]);
+    }
+    msg->part_cnt = 0;
+}
+
+/*
+ * Release msg which won't be delivered. Object of pointer msg goes back to
+ * its owner, nobody else would release it.
+ */
+static void
+pez_ipc_rt_msg_drop(pez_t *pez, pez_rt_msg_t *msg) {
+    pez_ptr_t ptr;
+
+    if (msg->has_hdr && (msg->hdr.flags & PEZ_HDR_F_PTR) &&
+        msg->part_cnt == 2 && zmq_msg_size(&msg->part[1]) == sizeof(ptr)) {
+        memcpy(&ptr, zmq_msg_data(&msg->part[1]), sizeof(ptr));
+        pez_ipc_ptr_release(&ptr);
+        pez->rt_ptr_drop_cnt ++;
+    }
+    pez_ipc_rt_msg_close(msg);
+}
+
+/*
+ * Msg posted by a thread without endpoint carries its src id in the frame
+ * after hdr, which router takes as src. The hdr goes too if src was all it
+ * was for.
+ */
+static pez_status
+pez_ipc_rt_msg_src_take(pez_rt_msg_t *msg) {
+    int i, skip;
+
+    if (!(msg->hdr.flags & PEZ_HDR_F_SRC)) {
+        return EOK;
+    }
+    if (msg->part_cnt < 3 ||
+        zmq_msg_size(&msg->part[1]) == 0 ||
+        zmq_msg_size(&msg->part[1]) > PEZ_THREAD_ID_MAX_LEN) {
+        return EPROTO;
+    }
+    zmq_msg_move(&msg->src, &msg->part[1]);
+    msg->hdr.flags &= ~PEZ_HDR_F_SRC;
+    skip = (msg->hdr.flags == 0 && msg->part_cnt == 3) ? 2 : 1;
+    for (i = 2 - skip; i + skip < msg->part_cnt; i ++) {
+        zmq_msg_move(&msg->part[i], &msg->part[i + skip]);
+    }
+    msg->part_cnt -= skip;
+    msg->has_hdr = (skip == 1);
+    if (msg->has_hdr) {
+        /* so router of another domain doesn't take it again */
+        memcpy(zmq_msg_data(&msg->part[0]), &msg->hdr, sizeof(msg->hdr));
+    }
+    return EOK;
+}
+
+/*
+ * Recv a whole msg: src id, trgt id, optional pez hdr and data frames.
+ */
+static pez_status
+pez_ipc_rt_msg_recv(pez_t *pez, void *socket, pez_rt_msg_t *msg) {
+    zmq_msg_t   *part;
+    int         more;
+
+    zmq_msg_init(&msg->src);
+    zmq_msg_init(&msg->trgt);
+    msg->part_cnt = 0;
+    msg->has_hdr = 0;
+
+    /* 1st: get ID frame */
+    if (zmq_msg_recv(&msg->src, socket, 0) == -1) {
+        PEZ_IPC_HOT_ERR(pez, "pez ipc: recv ID frame failed: %s\n",
+                        strerror(errno));
+        goto err;
+    }
+    if (!zmq_msg_more(&msg->src)) {
+        PEZ_IPC_HOT_ERR(pez, "pez ipc: no trgt id frame recvd\n");
+        goto err;
+    }
+
+    /* 2nd: Get dest id frame*/
+    if (zmq_msg_recv(&msg->trgt, socket, 0) == -1) {
+        PEZ_IPC_HOT_ERR(pez, "pez ipc: recv trgt id frame failed: %s\n",
+                        strerror(errno));
+        goto err;
+    }
+    more = zmq_msg_more(&msg->trgt);
+
+    /* 3rd: get pez hdr and real data */
+    while (more) {
+        if (msg->part_cnt == PEZ_MSG_PART_MAX) {
+            PEZ_IPC_HOT_ERR(pez, "pez ipc: too many frames recvd\n");
+            goto err;
+        }
+        part = &msg->part[msg->part_cnt];
+        zmq_msg_init(part);
+        msg->part_cnt ++;
+        if (zmq_msg_recv(part, socket, 0) == -1) {
+            PEZ_IPC_HOT_ERR(pez, "pez ipc: recv real data frame failed: "
+                            "%s\n", strerror(errno));
+            goto err;
+        }
+        more = zmq_msg_more(part);
+    }
+    if (msg->part_cnt == 0) {
+        PEZ_IPC_HOT_ERR(pez, "pez ipc: no data frame recvd\n");
+        goto err;
+    }
+
+    if (msg->part_cnt > 1) {
+        if (zmq_msg_size(&msg->part[0]) != sizeof(pez_hdr_t)) {
+            PEZ_IPC_HOT_ERR(pez, "pez ipc: invalid pez hdr recvd\n");
+            goto err;
+        }
+        memcpy(&msg->hdr, zmq_msg_data(&msg->part[0]), sizeof(pez_hdr_t));
+        if (msg->hdr.magic != PEZ_HDR_MAGIC ||
+            msg->hdr.version != PEZ_HDR_VERSION) {
+            PEZ_IPC_HOT_ERR(pez, "pez ipc: invalid pez hdr recvd\n");
+            goto err;
+        }
+        msg->has_hdr = 1;
+        if (pez_ipc_rt_msg_src_take(msg) != EOK) {
+            PEZ_IPC_HOT_ERR(pez, "pez ipc: posted msg without src "
+                            "recvd\n");
+            goto err;
+        }
+    }
+    return EOK;
+
+err:
+    pez_ipc_msg_drain(socket);
+    pez_ipc_rt_msg_close(msg);
+    return EPROTO;
+}
+
+/*
+ * Send msg to its trgt. Frames are moved to zmq, nothing is copied.
+ */
+static pez_status
+pez_ipc_rt_msg_send(pez_t *pez, void *socket, pez_rt_msg_t *msg) {
+    int i, flags, err;
+
+    /* send ID frame */
+    if (zmq_msg_send(&msg->trgt, socket, ZMQ_SNDMORE) == -1) {
+        err = errno;
+        PEZ_IPC_HOT_ERR(pez, "pez ipc: send id frame failed: %s\n",
+                        strerror(err));
+        return err;
+    }
+
+    /* send pez hdr and real data */
+    for (i = 0; i < msg->part_cnt; i ++) {
+        flags = (i == msg->part_cnt - 1) ? 0 : ZMQ_SNDMORE;
+        if (zmq_msg_send(&msg->part[i], socket, flags) == -1) {
+            err = errno;
+            PEZ_IPC_HOT_ERR(pez, "pez ipc: send data frame failed: %s\n",
+                            strerror(err));
+            return err;
+        }
+    }
+    return EOK;
+}
+
+/*
+ * Number of application msgs carried by msg
+ */
+static uint32_t
+pez_ipc_rt_msg_cnt(pez_rt_msg_t *msg) {
+    if (msg->has_hdr && (msg->hdr.flags & PEZ_HDR_F_BATCH)) {
+        return msg->hdr.cnt;
+    }
+    return 1;
+}
+
+/*
+ * FNV-1a
+ */
+static uint32_t
+pez_ipc_hash(const void *data, size_t len, uint32_t seed) {
+    const uint8_t   *p = data;
+    uint32_t        h = 2166136261u ^ seed;
+    size_t          i;
+
+    for (i = 0; i < len; i ++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Spread key over the ring. Keys are often small sequential numbers.
+ */
+static uint32_t
+pez_ipc_key_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static int
+pez_ipc_ring_cmp(const void *a, const void *b) {
+    const pez_ring_node_t *x = a, *y = b;
+
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->id - y->id;
+}
+
+/*
+ * Rebuild consistent hashing ring after members changed. Each member has
+ * PEZ_GROUP_VNODE_NUM points, so only keys of joined/left member move.
+ */
+static void
+pez_ipc_rt_group_ring_build(pez_t *pez, pez_group_t *g) {
+    const char  *name;
+    int         i, v;
+
+    g->ring_num = 0;
+    for (i = 0; i < g->member_num; i ++) {
+        name = pez->thd[g->member[i]].identity;
+        for (v = 0; v < PEZ_GROUP_VNODE_NUM; v ++) {
+            g->ring[g->ring_num].hash =
+                pez_ipc_hash(name, strnlen(name, PEZ_THREAD_ID_MAX_LEN), v);
+            g->ring[g->ring_num].id = g->member[i];
+            g->ring_num ++;
+        }
+    }
+    qsort(g->ring, g->ring_num, sizeof(pez_ring_node_t), pez_ipc_ring_cmp);
+}
+
+/*
+ * Drop id from groups it's member of, once its endpoint is closed. It
+ * joins again when opened anew.
+ */
+static void
+pez_ipc_rt_group_drop(pez_t *pez, int32_t id) {
+    pez_group_t     *g;
+    unsigned int    n;
+    int             i;
+
+    for (n = 0; n < pez->group_num; n ++) {
+        g = pez->group[n];
+        for (i = 0; i < g->member_num; i ++) {
+            if (g->member[i] == id) {
+                g->member[i] = g->member[-- g->member_num];
+                pez_ipc_rt_group_ring_build(pez, g);
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Copy msg. Frames bigger than zmq's inline size are shared, not copied.
+ */
+static void
+pez_ipc_rt_msg_copy(pez_rt_msg_t *dst, pez_rt_msg_t *src) {
+    int i;
+
+    zmq_msg_init(&dst->src);
+    zmq_msg_copy(&dst->src, &src->src);
+    zmq_msg_init(&dst->trgt);
+    zmq_msg_copy(&dst->trgt, &src->trgt);
+    for (i = 0; i < src->part_cnt; i ++) {
+        zmq_msg_init(&dst->part[i]);
+        zmq_msg_copy(&dst->part[i], &src->part[i]);
+    }
+    dst->part_cnt = src->part_cnt;
+    dst->hdr = src->hdr;
+    dst->has_hdr = src->has_hdr;
+}
+
+/*
+ * Move frames of src to dst. src holds empty frames afterwards.
+ */
+static void
+pez_ipc_rt_msg_move(pez_rt_msg_t *dst, pez_rt_msg_t *src) {
+    int i;
+
+    zmq_msg_init(&dst->src);
+    zmq_msg_move(&dst->src, &src->src);
+    zmq_msg_init(&dst->trgt);
+    zmq_msg_move(&dst->trgt, &src->trgt);
+    for (i = 0; i < src->part_cnt; i ++) {
+        zmq_msg_init(&dst->part[i]);
+        zmq_msg_move(&dst->part[i], &src->part[i]);
+        zmq_msg_close(&src->part[i]);
+    }
+    dst->part_cnt = src->part_cnt;
+    dst->hdr = src->hdr;
+    dst->has_hdr = src->has_hdr;
+    src->part_cnt = 0;
+}
+
+static uint64_t
+pez_ipc_rt_wheel_tick(pez_t *pez) {
+    return (pez_ipc_now_ns() - pez->wheel.base_ns) / 1000000ULL;
+}
+
+static void
+pez_ipc_tlink_add(pez_tlink_t *head, pez_tlink_t *link) {
+    link->prev = head->prev;
+    link->next = head;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+static void
+pez_ipc_tlink_del(pez_tlink_t *link) {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->next = link->prev = link;
+}
+
+static void
+pez_ipc_rt_wheel_init(pez_t *pez) {
+    pez_wheel_t *w = &pez->wheel;
+    int         l, i;
+
+    w->base_ns = pez_ipc_now_ns();
+    w->now = 0;
+    for (l = 0; l < PEZ_WHEEL_LEVELS; l ++) {
+        for (i = 0; i < PEZ_WHEEL_SIZE; i ++) {
+            w->slot[l][i].next = w->slot[l][i].prev = &w->slot[l][i];
+        }
+    }
+}
+
+/*
+ * Put timer in the slot matching its expire tick. O(1).
+ */
+static void
+pez_ipc_rt_wheel_add(pez_t *pez, pez_timer_t *t) {
+    pez_wheel_t *w = &pez->wheel;
+    uint64_t    expire = t->expire, delta;
+    int         level;
+
+    if (expire <= w->now) {
+        expire = w->now + 1;
+    }
+    delta = expire - w->now;
+    if (delta >= PEZ_WHEEL_SPAN) {
+        /* park in last level, re-cascaded until due */
+        expire = w->now + PEZ_WHEEL_SPAN - 1;
+        delta = PEZ_WHEEL_SPAN - 1;
+    }
+    for (level = 0; level < PEZ_WHEEL_LEVELS - 1; level ++) {
+        if (delta < (1ULL << (PEZ_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+    pez_ipc_tlink_add(&w->slot[level][(expire >> (PEZ_WHEEL_BITS * level)) &
+                                      PEZ_WHEEL_MASK],
+                      &t->link);
+    t->level = level;
+    if (level == 0) {
+        w->level0_num ++;
+    }
+}
+
+static pez_timer_t **
+pez_ipc_rt_timer_hash(pez_t *pez, uint64_t id) {
+    return &pez->wheel.hash[pez_ipc_key_hash(id) & (PEZ_TIMER_HASH_SIZE - 1)];
+}
+
+static pez_timer_t *
+pez_ipc_rt_timer_find(pez_t *pez, uint64_t id, pez_timer_t ***prev) {
+    pez_timer_t **pp = pez_ipc_rt_timer_hash(pez, id);
+
+    while (*pp && (*pp)->id != id) {
+        pp = &(*pp)->hnext;
+    }
+    if (prev) {
+        *prev = pp;
+    }
+    return *pp;
+}
+
+/*
+ * Release timer and the msg it holds
+ */
+static void
+pez_ipc_rt_timer_free(pez_t *pez, pez_timer_t *t) {
+    pez_wheel_t *w = &pez->wheel;
+    pez_timer_t **pp;
+
+    if (pez_ipc_rt_timer_find(pez, t->id, &pp) == t) {
+        *pp = t->hnext;
+    }
+    pez_ipc_rt_msg_close(&t->msg);
+    w->num --;
+    if (w->free_num < w->free_max) {
+        t->hnext = w->free_list;
+        w->free_list = t;
+        w->free_num ++;
+    } else {
+        free(t);
+    }
+}
+
+/*
+ * Hold msg until it's due. msg is moved into the timer.
+ */
+static void
+pez_ipc_rt_timer_add(pez_t *pez, pez_rt_msg_t *msg) {
+    pez_wheel_t *w = &pez->wheel;
+    pez_timer_t *t, **pp;
+    uint64_t    ns = pez_ipc_now_ns() - w->base_ns;
+    uint64_t    tick = ns / 1000000ULL;
+
+    /* wheel can lag behind when it's empty */
+    if (w->num == 0 && tick > w->now) {
+        w->now = tick;
+    }
+
+    t = w->free_list;
+    if (t) {
+        w->free_list = t->hnext;
+        w->free_num --;
+    } else if (PEZ_IPC_RT(pez)) {
+        /* pool used up, never malloc in real-time domain */
+        pez->rt_pool_empty_cnt ++;
+        pez_ipc_rt_msg_drop(pez, msg);
+        return;
+    } else {
+        t = malloc(sizeof(*t));
+        if (!t) {
+            printf("pez ipc: no mem for timer, msg dropped\n");
+            pez_ipc_rt_msg_drop(pez, msg);
+            return;
+        }
+    }
+    t->id = msg->hdr.timer_id;
+    /* 1st tick not before delay is up, part of current tick is gone */
+    t->expire = (ns + msg->hdr.delay_ms * 1000000ULL + 999999) / 1000000ULL;
+    t->period = msg->hdr.period_ms;
+    pez_ipc_rt_msg_move(&t->msg, msg);
+    pez_ipc_rt_msg_close(msg);
+
+    pp = pez_ipc_rt_timer_hash(pez, t->id);
+    t->hnext = *pp;
+    *pp = t;
+    w->num ++;
+    pez_ipc_rt_wheel_add(pez, t);
+}
+
+/*
+ * Cancel timer. O(1).
+ */
+static void
+pez_ipc_rt_timer_cancel(pez_t *pez, uint64_t id) {
+    pez_timer_t *t;
+
+    t = pez_ipc_rt_timer_find(pez, id, NULL);
+    if (!t) {
+        return;
+    }
+    pez_ipc_tlink_del(&t->link);
+    if (t->level == 0) {
+        pez->wheel.level0_num --;
+    }
+    pez_ipc_rt_timer_free(pez, t);
+    pez->wheel.cancel_cnt ++;
+}
+
+static void pez_ipc_rt_msg_forward(pez_t *pez,
+                                   void *socket,
+                                   pez_rt_msg_t *msg);
+
+/*
+ * Move timers of current slot of level down to lower levels.
+ */
+static void
+pez_ipc_rt_wheel_cascade(pez_t *pez, int level) {
+    pez_wheel_t *w = &pez->wheel;
+    pez_tlink_t *head, list;
+    int         idx;
+
+    idx = (w->now >> (PEZ_WHEEL_BITS * level)) & PEZ_WHEEL_MASK;
+    if (idx == 0 && level + 1 < PEZ_WHEEL_LEVELS) {
+        pez_ipc_rt_wheel_cascade(pez, level + 1);
+    }
+    head = &w->slot[level][idx];
+    if (head->next == head) {
+        return;
+    }
+    /* detach whole slot first, timers may come back to it */
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head->next = head->prev = head;
+    while (list.next != &list) {
+        head = list.next;
+        pez_ipc_tlink_del(head);
+        pez_ipc_rt_wheel_add(pez, (pez_timer_t *)head);
+    }
+}
+
+/*
+ * Advance wheel to current time and send all due msgs.
+ */
+static void
+pez_ipc_rt_wheel_advance(pez_t *pez, void *socket) {
+    pez_wheel_t     *w = &pez->wheel;
+    pez_tlink_t     *head, *link;
+    pez_timer_t     *t;
+    pez_rt_msg_t    msg;
+    uint64_t        tick;
+
+    if (w->num == 0) {
+        return;
+    }
+    tick = pez_ipc_rt_wheel_tick(pez);
+    while (w->now < tick && w->num != 0) {
+        w->now ++;
+        if ((w->now & PEZ_WHEEL_MASK) == 0) {
+            pez_ipc_rt_wheel_cascade(pez, 1);
+        }
+        head = &w->slot[0][w->now & PEZ_WHEEL_MASK];
+        while (head->next != head) {
+            link = head->next;
+            pez_ipc_tlink_del(link);
+            w->level0_num --;
+            t = (pez_timer_t *)link;
+            w->fire_cnt ++;
+            if (t->period) {
+                pez_ipc_rt_msg_copy(&msg, &t->msg);
+                t->expire += t->period;
+                pez_ipc_rt_wheel_add(pez, t);
+                pez_ipc_rt_msg_forward(pez, socket, &msg);
+            } else {
+                pez_ipc_rt_msg_move(&msg, &t->msg);
+                pez_ipc_rt_timer_free(pez, t);
+                pez_ipc_rt_msg_forward(pez, socket, &msg);
+            }
+        }
+    }
+    if (w->num == 0 && tick > w->now) {
+        w->now = tick;
+    }
+}
+
+/*
+ * How long router can sleep in zmq_poll. Wake up every tick while there are
+ * timers in level 0, else at the next level 0 boundary where a cascade may
+ * bring some in.
+ */
+static long
+pez_ipc_rt_wheel_timeout(pez_t *pez) {
+    pez_wheel_t *w = &pez->wheel;
+
+    if (w->num == 0) {
+        return -1;
+    }
+    if (w->level0_num != 0) {
+        return 1;
+    }
+    return PEZ_WHEEL_SIZE - (w->now & PEZ_WHEEL_MASK);
+}
+
+static void pez_ipc_rt_msg_deliver(pez_t *pez,
+                                   void *socket,
+                                   pez_rt_msg_t *msg);
+
+static void
+pez_ipc_rt_defer_init(pez_t *pez) {
+    int i;
+
+    for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
+        pez->defer[i].next = pez->defer[i].prev = &pez->defer[i];
+    }
+}
+
+/*
+ * Hold msg if trgt hasn't said hello yet. Returns 1 if msg is taken.
+ */
+static int
+pez_ipc_rt_defer_hold(pez_t *pez, pez_rt_msg_t *msg, char *trgt) {
+    pez_thd_t   *thd;
+    pez_defer_t *d;
+    int32_t     id;
+
+    pez_ipc_index_get_bystr(pez, trgt, &id);
+    if (id == PEZ_THREAD_ID_INVAL) {
+        return 0;
+    }
+    thd = &pez->thd[id];
+    if (thd->rt_online) {
+        return 0;
+    }
+    if (thd->rt_defer_num == PEZ_DEFER_MAX) {
+        d = NULL;
+    } else if (PEZ_IPC_RT(pez)) {
+        if ((d = pez->defer_free)) {
+            pez->defer_free = (pez_defer_t *)d->link.next;
+        } else {
+            pez->rt_pool_empty_cnt ++;
+        }
+    } else {
+        d = malloc(sizeof(*d));
+    }
+    if (!d) {
+        thd->rt_defer_drop_cnt ++;
+        pez_ipc_rt_msg_drop(pez, msg);
+        return 1;
+    }
+    pez_ipc_rt_msg_move(&d->msg, msg);
+    pez_ipc_rt_msg_close(msg);
+    pez_ipc_tlink_add(&pez->defer[id], &d->link);
+    thd->rt_defer_num ++;
+    return 1;
+}
+
+/*
+ * Thread id is online, send msgs held for it in order.
+ */
+static void
+pez_ipc_rt_defer_flush(pez_t *pez, void *socket, int32_t id) {
+    pez_defer_t     *d;
+    pez_rt_msg_t    msg;
+
+    while (pez->defer[id].next != &pez->defer[id]) {
+        d = (pez_defer_t *)pez->defer[id].next;
+        pez_ipc_tlink_del(&d->link);
+        pez->thd[id].rt_defer_num --;
+        pez_ipc_rt_msg_move(&msg, &d->msg);
+        pez_ipc_rt_msg_close(&d->msg);
+        if (PEZ_IPC_RT(pez)) {
+            d->link.next = (pez_tlink_t *)pez->defer_free;
+            pez->defer_free = d;
+        } else {
+            free(d);
+        }
+        pez_ipc_rt_msg_deliver(pez, socket, &msg);
+    }
+}
+
+/*
+ * Handle ctrl msg sent to router itself
+ */
+static void
+pez_ipc_rt_ctrl_handle(pez_t *pez,
+                       void *socket,
+                       pez_rt_msg_t *msg,
+                       const char *src) {
+    char                name[PEZ_THREAD_ID_MAX_LEN + 1];
+    pez_route_table_t   *tab;
+    pez_group_t         *g;
+    int32_t             id;
+    int                 i;
+
+    if (!msg->has_hdr) {
+        printf("pez ipc: ctrl msg from %s without hdr\n", src);
+        return;
+    }
+    /* sent by any thread, no src */
+    if (msg->hdr.op == PEZ_CTRL_STOP) {
+        /* after msgs fini thread sent before, ignored unless it's asked */
+        pez->rt_stop = __atomic_load_n(&pez->fini, __ATOMIC_ACQUIRE);
+        return;
+    }
+    if (msg->hdr.op == PEZ_CTRL_ROUTE) {
+        if (msg->part_cnt != 2 ||
+            zmq_msg_size(&msg->part[1]) != sizeof(tab)) {
+            printf("pez ipc: invalid routing table recvd\n");
+            return;
+        }
+        /* never trust the pointer itself, only what route_set() left */
+        memcpy(&tab, zmq_msg_data(&msg->part[1]), sizeof(tab));
+        if (tab && !pez_ipc_route_unpend(pez, tab)) {
+            printf("pez ipc: unknown routing table dropped\n");
+            return;
+        }
+        free(pez->route);
+        pez->route = tab;
+        __atomic_store_n(&pez->rt_route_rule_num, tab ? tab->rule_num : 0,
+                         __ATOMIC_RELAXED);
+        return;
+    }
+    pez_ipc_index_get_bystr(pez, src, &id);
+    if (id == PEZ_THREAD_ID_INVAL) {
+        printf("pez ipc: ctrl msg from unknown thread %s\n", src);
+        return;
+    }
+
+    switch (msg->hdr.op) {
+        case PEZ_CTRL_GROUP_JOIN:
+        case PEZ_CTRL_GROUP_LEAVE:
+            pez_ipc_rt_id_get(&msg->part[1], name);
+            g = pez_ipc_group_get_bystr(pez, name);
+            if (!g) {
+                printf("pez ipc: %s: invalid group %s\n", src, name);
+                return;
+            }
+            for (i = 0; i < g->member_num; i ++) {
+                if (g->member[i] == id) {
+                    break;
+                }
+            }
+            if (msg->hdr.op == PEZ_CTRL_GROUP_JOIN) {
+                if (i < g->member_num) {
+                    return;
+                }
+                if (g->member_num == PEZ_GROUP_MEMBER_MAX) {
+                    printf("pez ipc: group %s is full\n", name);
+                    return;
+                }
+                g->member[g->member_num ++] = id;
+            } else {
+                if (i == g->member_num) {
+                    return;
+                }
+                g->member[i] = g->member[-- g->member_num];
+            }
+            pez_ipc_rt_group_ring_build(pez, g);
+            break;
+        case PEZ_CTRL_BRIDGE:
+            if (pez->thd[id].rt_bridge || !pez->thd[id].bridge_sock) {
+                return;
+            }
+            pez->thd[id].rt_bridge = 1;
+            pez->rt_bridge_num ++;
+            /* fall through, it's online like a registered thread */
+        case PEZ_CTRL_HELLO:
+            pez->thd[id].rt_gen = msg->hdr.key;
+            pthread_mutex_lock(&pez->lock);
+            __atomic_store_n(&pez->thd[id].rt_online, 1, __ATOMIC_RELEASE);
+            pthread_cond_broadcast(&pez->ready_cond);
+            pthread_mutex_unlock(&pez->lock);
+            pez_ipc_rt_defer_flush(pez, socket, id);
+            break;
+        case PEZ_CTRL_BYE:
+            /* id may be opened again already, by another socket */
+            if (msg->hdr.key != pez->thd[id].rt_gen) {
+                return;
+            }
+            __atomic_store_n(&pez->thd[id].rt_online, 0, __ATOMIC_RELEASE);
+            pez_ipc_rt_group_drop(pez, id);
+            break;
+        case PEZ_CTRL_TIMER_CANCEL:
+            /* only the thread which set it up */
+            if ((msg->hdr.timer_id >> 32) != (uint64_t)id + 1) {
+                printf("pez ipc: %s: invalid timer %llu\n",
+                       src, msg->hdr.timer_id);
+                return;
+            }
+            pez_ipc_rt_timer_cancel(pez, msg->hdr.timer_id);
+            break;
+        default:
+            printf("pez ipc: unknown ctrl op %u from %s\n",
+                   msg->hdr.op, src);
+    }
+}
+
+/*
+ * Msgs routed to thread but not handled by it yet, including ones router
+ * holds until it registers. It's read without lock, a rough value is good
+ * enough. Bridges hand msgs on right away.
+ */
+static int64_t
+pez_ipc_rt_depth(pez_thd_t *thd) {
+    if (thd->rt_bridge) {
+        return 0;
+    }
+    return (int64_t)(thd->rt_recv_cnt - thd->recv_cnt - thd->expire_cnt) +
+           thd->rt_defer_num;
+}
+
+/*
+ * Pick an online member of group for msg. PEZ_THREAD_ID_INVAL if there is
+ * none.
+ */
+static int32_t
+pez_ipc_rt_group_pick(pez_t *pez, pez_group_t *g, pez_rt_msg_t *msg) {
+    pez_thd_t   *thd;
+    int64_t     depth, best_depth = INT64_MAX;
+    int32_t     id, best = PEZ_THREAD_ID_INVAL;
+    uint32_t    h;
+    int         i, lo, hi, mid;
+
+    if (g->member_num == 0) {
+        return PEZ_THREAD_ID_INVAL;
+    }
+
+    switch (g->policy) {
+        case PEZ_GROUP_POLICY_LEAST_DEPTH:
+            /* start from rr_next so that ties are spread */
+            for (i = 0; i < g->member_num; i ++) {
+                thd = &pez->thd[g->member[(g->rr_next + i) % g->member_num]];
+                if (!thd->rt_online) {
+                    continue;
+                }
+                depth = pez_ipc_rt_depth(thd);
+                if (depth < best_depth) {
+                    best_depth = depth;
+                    best = thd - pez->thd;
+                }
+            }
+            g->rr_next ++;
+            return best;
+        case PEZ_GROUP_POLICY_KEY:
+            if (msg->has_hdr && (msg->hdr.flags & PEZ_HDR_F_KEY)) {
+                /* 1st point on ring not before key */
+                h = pez_ipc_key_hash(msg->hdr.key);
+                lo = 0;
+                hi = g->ring_num;
+                while (lo < hi) {
+                    mid = (lo + hi) / 2;
+                    if (g->ring[mid].hash < h) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                /* walk on past offline members, their keys move on */
+                for (i = 0; i < g->ring_num; i ++) {
+                    id = g->ring[(lo + i) % g->ring_num].id;
+                    if (pez->thd[id].rt_online) {
+                        return id;
+                    }
+                }
+                return PEZ_THREAD_ID_INVAL;
+            }
+            /* no key, round robin */
+        default:
+            for (i = 0; i < g->member_num; i ++) {
+                id = g->member[g->rr_next ++ % g->member_num];
+                if (pez->thd[id].rt_online) {
+                    return id;
+                }
+            }
+            return PEZ_THREAD_ID_INVAL;
+    }
+}
+
+/*
+ * Retarget msg sent to a group to one of its members. trgt is updated to
+ * member's id. Msgs to threads are left as they are.
+ */
+static pez_status
+pez_ipc_rt_group_route(pez_t *pez, pez_rt_msg_t *msg, char *trgt) {
+    pez_group_t *g;
+    int32_t     id;
+    size_t      len;
+
+    if (pez->group_num == 0) {
+        return EOK;
+    }
+    g = pez_ipc_group_get_bystr(pez, trgt);
+    if (!g) {
+        return EOK;
+    }
+    id = pez_ipc_rt_group_pick(pez, g, msg);
+    if (id == PEZ_THREAD_ID_INVAL) {
+        g->rt_drop_cnt ++;
+        return ENOENT;
+    }
+    len = strnlen(pez->thd[id].identity, PEZ_THREAD_ID_MAX_LEN);
+    zmq_msg_close(&msg->trgt);
+    zmq_msg_init_size(&msg->trgt, len);
+    memcpy(zmq_msg_data(&msg->trgt), pez->thd[id].identity, len);
+    pez_ipc_rt_id_get(&msg->trgt, trgt);
+    g->rt_cnt ++;
+    return EOK;
+}
+
+static void pez_ipc_rt_msg_deliver(pez_t *pez,
+                                   void *socket,
+                                   pez_rt_msg_t *msg);
+
+static void
+pez_ipc_rt_conflate_init(pez_t *pez) {
+    int i;
+
+    for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
+        pez->conflate.list[i].next = pez->conflate.list[i].prev =
+            &pez->conflate.list[i];
+    }
+}
+
+static pez_conflate_entry_t **
+pez_ipc_rt_conflate_hash(pez_t *pez, int32_t trgt, uint64_t key) {
+    uint32_t h = pez_ipc_key_hash(key) ^ ((uint32_t)trgt * 0x9E3779B1U);
+
+    return &pez->conflate.hash[h & (PEZ_CONFLATE_HASH_SIZE - 1)];
+}
+
+/*
+ * Hold msg if trgt is busy. A pending msg with same key is replaced in
+ * place, keeping its turn. Returns 1 if msg is taken.
+ */
+static int
+pez_ipc_rt_conflate_hold(pez_t *pez, pez_rt_msg_t *msg, char *trgt) {
+    pez_conflate_t          *c = &pez->conflate;
+    pez_conflate_entry_t    *e, **pp;
+    int32_t                 id;
+
+    pez_ipc_index_get_bystr(pez, trgt, &id);
+    if (id == PEZ_THREAD_ID_INVAL) {
+        return 0;
+    }
+    pp = pez_ipc_rt_conflate_hash(pez, id, msg->hdr.key);
+    for (e = *pp; e; e = e->hnext) {
+        if (e->trgt == id && e->key == msg->hdr.key) {
+            pez_ipc_rt_msg_drop(pez, &e->msg);
+            pez_ipc_rt_msg_move(&e->msg, msg);
+            pez_ipc_rt_msg_close(msg);
+            pez->thd[id].rt_conflate_cnt ++;
+            return 1;
+        }
+    }
+    if (c->list[id].next == &c->list[id] &&
+        pez_ipc_rt_depth(&pez->thd[id]) < PEZ_CONFLATE_DEPTH) {
+        return 0;
+    }
+
+    e = c->free_list;
+    if (e) {
+        c->free_list = e->hnext;
+        c->free_num --;
+    } else if (PEZ_IPC_RT(pez)) {
+        /* send it now rather than lose it */
+        pez->rt_pool_empty_cnt ++;
+        return 0;
+    } else {
+        e = malloc(sizeof(*e));
+        if (!e) {
+            /* send it now rather than lose it */
+            return 0;
+        }
+    }
+    e->trgt = id;
+    e->key = msg->hdr.key;
+    pez_ipc_rt_msg_move(&e->msg, msg);
+    pez_ipc_rt_msg_close(msg);
+    e->hnext = *pp;
+    *pp = e;
+    if (c->list[id].next == &c->list[id]) {
+        c->trgt[c->trgt_num ++] = id;
+    }
+    pez_ipc_tlink_add(&c->list[id], &e->link);
+    c->num ++;
+    return 1;
+}
+
+/*
+ * Send held msgs to trgts which have caught up. Only trgts holding msgs
+ * are looked at.
+ */
+static void
+pez_ipc_rt_conflate_flush(pez_t *pez, void *socket) {
+    pez_conflate_t          *c = &pez->conflate;
+    pez_conflate_entry_t    *e, **pp;
+    pez_rt_msg_t            msg;
+    uint32_t                i = 0;
+    int32_t                 id;
+
+    while (i < c->trgt_num) {
+        id = c->trgt[i];
+        while (c->list[id].next != &c->list[id] &&
+               pez_ipc_rt_depth(&pez->thd[id]) < PEZ_CONFLATE_DEPTH) {
+            e = (pez_conflate_entry_t *)c->list[id].next;
+            pez_ipc_tlink_del(&e->link);
+            for (pp = pez_ipc_rt_conflate_hash(pez, id, e->key); *pp != e;
+                 pp = &(*pp)->hnext) {
+            }
+            *pp = e->hnext;
+            c->num --;
+            pez_ipc_rt_msg_move(&msg, &e->msg);
+            pez_ipc_rt_msg_close(&e->msg);
+            if (c->free_num < c->free_max) {
+                e->hnext = c->free_list;
+                c->free_list = e;
+                c->free_num ++;
+            } else {
+                free(e);
+            }
+            pez_ipc_rt_msg_deliver(pez, socket, &msg);
+        }
+        if (c->list[id].next == &c->list[id]) {
+            c->trgt[i] = c->trgt[-- c->trgt_num];
+        } else {
+            i ++;
+        }
+    }
+}
+
+/*
+ * Append msg to journal of trgt if trgt is offline or behind, or if older
+ * msgs are still in journal. Returns 1 if msg is taken.
+ */
+static int
+pez_ipc_rt_journal_hold(pez_t *pez, pez_rt_msg_t *msg, char *trgt) {
+    struct iovec    iov[PEZ_MSG_PART_MAX + 1];
+    pez_thd_t       *thd;
+    pez_journal_t   *j;
+    pez_status      rc;
+    int32_t         id;
+    int             i;
+
+    if (__atomic_load_n(&pez->journal_num, __ATOMIC_RELAXED) == 0) {
+        return 0;
+    }
+    pez_ipc_index_get_bystr(pez, trgt, &id);
+    if (id == PEZ_THREAD_ID_INVAL) {
+        return 0;
+    }
+    thd = &pez->thd[id];
+    j = __atomic_load_n(&thd->journal, __ATOMIC_ACQUIRE);
+    if (!j || (msg->has_hdr && (msg->hdr.flags & PEZ_HDR_F_PTR))) {
+        /* pointers don't outlive the process, held in memory instead */
+        return 0;
+    }
+    if (thd->rt_online && pez_journal_empty(j) &&
+        (thd->journal_depth == 0 ||
+         pez_ipc_rt_depth(thd) < thd->journal_depth)) {
+        return 0;
+    }
+
+    iov[0].iov_base = zmq_msg_data(&msg->src);
+    iov[0].iov_len = zmq_msg_size(&msg->src);
+    for (i = 0; i < msg->part_cnt; i ++) {
+        iov[i + 1].iov_base = zmq_msg_data(&msg->part[i]);
+        iov[i + 1].iov_len = zmq_msg_size(&msg->part[i]);
+    }
+    rc = pez_journal_append(j, iov, msg->part_cnt + 1);
+    if (rc != EOK) {
+        PEZ_IPC_HOT_ERR(pez, "pez ipc: %s: journal append failed: %s\n",
+                        trgt, strerror(rc));
+        return 0;
+    }
+    pez_ipc_rt_msg_close(msg);
+    return 1;
+}
+
+/*
+ * Rebuild msg to thd out of journal record.
+ */
+static pez_status
+pez_ipc_rt_journal_msg_get(pez_thd_t *thd, pez_rt_msg_t *msg) {
+    struct iovec    iov[PEZ_MSG_PART_MAX + 1];
+    int             cnt = PEZ_MSG_PART_MAX + 1, i;
+    size_t          len;
+    pez_status      rc;
+
+    rc = pez_journal_peek(thd->journal, iov, &cnt);
+    if (rc != EOK) {
+        return rc;
+    }
+    if (cnt < 2) {
+        return EPROTO;
+    }
+    zmq_msg_init_size(&msg->src, iov[0].iov_len);
+    memcpy(zmq_msg_data(&msg->src), iov[0].iov_base, iov[0].iov_len);
+    len = strnlen(thd->identity, PEZ_THREAD_ID_MAX_LEN);
+    zmq_msg_init_size(&msg->trgt, len);
+    memcpy(zmq_msg_data(&msg->trgt), thd->identity, len);
+    for (i = 1; i < cnt; i ++) {
+        zmq_msg_init_size(&msg->part[i - 1], iov[i].iov_len);
+        memcpy(zmq_msg_data(&msg->part[i - 1]), iov[i].iov_base,
+               iov[i].iov_len);
+    }
+    msg->part_cnt = cnt - 1;
+    msg->has_hdr = 0;
+    if (msg->part_cnt > 1 && iov[1].iov_len == sizeof(pez_hdr_t)) {
+        memcpy(&msg->hdr, iov[1].iov_base, sizeof(pez_hdr_t));
+        msg->has_hdr = 1;
+    }
+    return EOK;
+}
+
+/*
+ * Replay journaled msgs to trgts which are online and caught up, and hand
+ * journals to the flusher if it's time to sync them. Router never waits
+ * for the disk.
+ */
+static void
+pez_ipc_rt_journal_run(pez_t *pez, void *socket) {
+    pez_thd_t       *thd;
+    pez_journal_t   *j;
+    pez_rt_msg_t    msg;
+    uint64_t        now;
+    uint32_t        depth;
+    unsigned int    i, num;
+    int             budget, commit;
+
+    num = __atomic_load_n(&pez->journal_num, __ATOMIC_ACQUIRE);
+    if (num == 0) {
+        return;
+    }
+    now = pez_ipc_now_ns();
+    commit = (now - pez->journal_commit_ns >= PEZ_JOURNAL_COMMIT_NS);
+    for (i = 0; i < num; i ++) {
+        thd = &pez->thd[pez->journal_id[i]];
+        j = thd->journal;
+        depth = thd->journal_depth ? thd->journal_depth :
+                                     PEZ_JOURNAL_REPLAY_BATCH;
+        budget = PEZ_JOURNAL_REPLAY_BATCH;
+        while (thd->rt_online && !pez_journal_empty(j) && budget -- > 0 &&
+               pez_ipc_rt_depth(thd) < depth) {
+            if (pez_ipc_rt_journal_msg_get(thd, &msg) != EOK) {
+                printf("pez ipc: %s: bad journal record dropped\n",
+                       thd->identity);
+                pez_journal_pop(j);
+                continue;
+            }
+            pez_journal_pop(j);
+            pez_ipc_rt_msg_deliver(pez, socket, &msg);
+        }
+        /* EBUSY: last one is still being synced, dirty is kept */
+        if (commit) {
+            pez_journal_commit_async(j);
+        }
+    }
+    if (commit) {
+        pez->journal_commit_ns = now;
+    }
+}
+
+/*
+ * Whether router must wake up soon for journals.
+ */
+static int
+pez_ipc_rt_journal_busy(pez_t *pez) {
+    pez_thd_t       *thd;
+    unsigned int    i, num;
+
+    num = __atomic_load_n(&pez->journal_num, __ATOMIC_ACQUIRE);
+    for (i = 0; i < num; i ++) {
+        thd = &pez->thd[pez->journal_id[i]];
+        if (thd->journal->dirty ||
+            (thd->rt_online && !pez_journal_empty(thd->journal))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Close journals, pending records stay in their dirs for next run.
+ */
+static void
+pez_ipc_rt_journal_close(pez_t *pez) {
+    pez_journal_t   *j;
+    unsigned int    i, num;
+
+    num = __atomic_load_n(&pez->journal_num, __ATOMIC_ACQUIRE);
+    for (i = 0; i < num; i ++) {
+        j = pez->thd[pez->journal_id[i]].journal;
+        pez_journal_close(j);
+    }
+}
+
+/*
+ * Drop msg which is past its deadline, or which may be shed while trgt is
+ * overloaded. Msgs without deadline are never dropped here.
+ */
+static pez_status
+pez_ipc_rt_msg_admit(pez_t *pez, pez_rt_msg_t *msg, char *trgt) {
+    pez_thd_t   *thd;
+    int32_t     id;
+    uint32_t    depth;
+
+    if (!msg->has_hdr || !(msg->hdr.flags & PEZ_HDR_F_DEADLINE)) {
+        return EOK;
+    }
+    pez_ipc_index_get_bystr(pez, trgt, &id);
+    if (id == PEZ_THREAD_ID_INVAL) {
+        return EOK;
+    }
+    thd = &pez->thd[id];
+    if (pez_ipc_now_ns() > msg->hdr.deadline_ns) {
+        thd->rt_expire_cnt ++;
+        return ETIMEDOUT;
+    }
+    depth = __atomic_load_n(&thd->shed_depth, __ATOMIC_RELAXED);
+    if (depth && pez_ipc_rt_depth(thd) >= depth) {
+        thd->rt_shed_cnt ++;
+        return EBUSY;
+    }
+    return EOK;
+}
+
+/*
+ * Route msg to its trgt, rules aside. msg is released.
+ */
+static void
+pez_ipc_rt_msg_route(pez_t *pez, void *socket, pez_rt_msg_t *msg) {
+    char        trgt_id[PEZ_THREAD_ID_MAX_LEN + 1] = {0};
+    pez_status  rc;
     int32_t     id;
 
-    zmq_ctx = pez_ipc_get_zmq_ctx();
+    pez_ipc_rt_id_get(&msg->trgt, trgt_id);
+
+    /* anycast: pick a member if trgt is a group */
+    rc = pez_ipc_rt_group_route(pez, msg, trgt_id);
+    if (rc != EOK) {
+        pez_ipc_rt_msg_drop(pez, msg);
+        return;
+    }
+
+    rc = pez_ipc_rt_msg_admit(pez, msg, trgt_id);
+    if (rc != EOK) {
+        pez_ipc_rt_msg_drop(pez, msg);
+        return;
+    }
+
+    /* zmq would drop it silently */
+    if (msg->has_hdr && (msg->hdr.flags & PEZ_HDR_F_PTR)) {
+        pez_ipc_index_get_bystr(pez, trgt_id, &id);
+        if (id == PEZ_THREAD_ID_INVAL) {
+            pez_ipc_rt_msg_drop(pez, msg);
+            return;
+        }
+    }
 
-    if (!zmq_ctx || !cb || !loop || !rx_id) {
-        printf("pez ipc:NULL zmq_ctx or input argus recvd\n");
-        return EINVAL;
+    if (msg->has_hdr && (msg->hdr.flags & PEZ_HDR_F_CONFLATE) &&
+        pez_ipc_rt_conflate_hold(pez, msg, trgt_id)) {
+        return;
     }
+    if (pez_ipc_rt_journal_hold(pez, msg, trgt_id)) {
+        return;
+    }
+    if (pez_ipc_rt_defer_hold(pez, msg, trgt_id)) {
+        return;
+    }
+    pez_ipc_rt_msg_deliver(pez, socket, msg);
+}
 
-    pez_ipc_index_get_bystr(rx_id, &id);
-    if (id != PEZ_THREAD_ID_INVAL) {
-        printf("pez ipc: don't invoke this API twice for same id. Previous"
-               " call is by %s\n", pez.thd[id].identity);
-        return EINVAL;
+/*
+ * Point msg to trgt of rule. Names fit in a zmq frame, nothing allocated.
+ */
+static void
+pez_ipc_rt_trgt_set(pez_rt_msg_t *msg, const pez_route_entry_t *e) {
+    zmq_msg_close(&msg->trgt);
+    zmq_msg_init_size(&msg->trgt, e->trgt_len);
+    memcpy(zmq_msg_data(&msg->trgt), e->trgt, e->trgt_len);
+}
+
+/*
+ * Apply routing rules to msg, then route it. Only fixed-layout msgs are
+ * matched, coalesced and pointer msgs have no codec hdr of their own.
+ * msg is released.
+ */
+static void
+pez_ipc_rt_msg_forward(pez_t *pez, void *socket, pez_rt_msg_t *msg) {
+    const pez_route_entry_t *e;
+    pez_codec_hdr_t         chdr;
+    zmq_msg_t               *data;
+    pez_rt_msg_t            copy;
+    int                     has_key;
+
+    if (!pez->route ||
+        (msg->has_hdr &&
+         (msg->hdr.flags & (PEZ_HDR_F_BATCH | PEZ_HDR_F_PTR)))) {
+        goto route;
+    }
+    data = &msg->part[msg->has_hdr ? 1 : 0];
+    if (!pez_codec_is_fixed(zmq_msg_data(data), zmq_msg_size(data))) {
+        goto route;
+    }
+    memcpy(&chdr, zmq_msg_data(data), sizeof(chdr));
+    has_key = msg->has_hdr && (msg->hdr.flags & PEZ_HDR_F_KEY);
+    e = pez_ipc_route_find(pez->route, chdr.type, chdr.subtype,
+                           has_key ? &msg->hdr.key : NULL);
+    if (!e) {
+        goto route;
     }
 
-    pez_ipc_index_alloc(rx_id, &id);
-    if (id == PEZ_THREAD_ID_INVAL) {
-        printf("pez ipc: no room for new rx thread(%s) allocation\n", rx_id);
-        return ENOMEM;
+    switch (e->action) {
+        case PEZ_ROUTE_REDIRECT:
+            pez_ipc_rt_trgt_set(msg, e);
+            pez->rt_redirect_cnt ++;
+            break;
+        case PEZ_ROUTE_MIRROR:
+            /* frames are shared, not copied */
+            pez_ipc_rt_msg_copy(&copy, msg);
+            pez_ipc_rt_trgt_set(&copy, e);
+            pez->rt_mirror_cnt ++;
+            pez_ipc_rt_msg_route(pez, socket, &copy);
+            break;
+        case PEZ_ROUTE_DROP:
+            pez->rt_route_drop_cnt ++;
+            pez_ipc_rt_msg_drop(pez, msg);
+            return;
     }
 
-    pez.thd[id].tid = pthread_self();
+route:
+    pez_ipc_rt_msg_route(pez, socket, msg);
+}
 
-    socket = zmq_socket(zmq_ctx, ZMQ_DEALER);
-    if (!socket) {
-        printf("unable to create ZMQ_DEALER socket for %s(%s)\n",
-                rx_id,
-                strerror(errno));
-        return errno;
+/*
+ * Msg passed on by bridge isn't held again by router of other domain for
+ * its timer, it's due already.
+ */
+static void
+pez_ipc_rt_bridge_hdr(pez_rt_msg_t *msg) {
+    if (!msg->has_hdr || !(msg->hdr.flags & PEZ_HDR_F_TIMER)) {
+        return;
     }
+    msg->hdr.flags &= ~PEZ_HDR_F_TIMER;
+    msg->hdr.delay_ms = 0;
+    msg->hdr.period_ms = 0;
+    /* frame may be shared with a periodic timer, so it's replaced */
+    zmq_msg_close(&msg->part[0]);
+    zmq_msg_init_size(&msg->part[0], sizeof(msg->hdr));
+    memcpy(zmq_msg_data(&msg->part[0]), &msg->hdr, sizeof(msg->hdr));
+}
 
-    /* set zmq id */
-    rc = zmq_setsockopt (socket,
-                         ZMQ_IDENTITY,
-                         rx_id,
-                         strnlen(rx_id,PEZ_THREAD_ID_MAX_LEN));
-    if (rc == -1) {
-        printf("unable to set ZMQ ID for thread %s:%s\n",
-                    rx_id,
-                    strerror(errno));
-        return errno;
+/*
+ * Send msg to thread, or to other domain if trgt is a bridge, and count it.
+ * msg is released.
+ */
+static void
+pez_ipc_rt_msg_deliver(pez_t *pez, void *socket, pez_rt_msg_t *msg) {
+    char        trgt_id[PEZ_THREAD_ID_MAX_LEN + 1] = {0};
+    char        src_id[PEZ_THREAD_ID_MAX_LEN + 1] = {0};
+    uint32_t    cnt;
+    uint64_t    trace_id;
+    pez_status  rc;
+    int32_t     id;
+    int         i;
+
+    pez_ipc_rt_id_get(&msg->src, src_id);
+    pez_ipc_rt_id_get(&msg->trgt, trgt_id);
+    cnt = pez_ipc_rt_msg_cnt(msg);
+
+    /* bridged id, msg goes on to router of other domain */
+    if (pez->rt_bridge_num != 0) {
+        pez_ipc_index_get_bystr(pez, trgt_id, &id);
+        if (id != PEZ_THREAD_ID_INVAL && pez->thd[id].rt_bridge) {
+            socket = pez->thd[id].bridge_sock;
+            pez_ipc_rt_bridge_hdr(msg);
+        }
     }
 
-    /* connect to router thread */
-    rc = zmq_connect(socket, INPROC_ADDRESS);
-    if (rc == -1) {
-        printf("unable to connect router for thread %s:%s\n",
-                    rx_id,
-                    strerror(errno));
-        return errno;
+    if (pez_debug_flag) {
+        pez_ipc_hexdump("rt(src id)", src_id, strlen(src_id));
+        pez_ipc_hexdump("rt(trgt id)", trgt_id, strlen(trgt_id));
+        for (i = 0; i < msg->part_cnt; i ++) {
+            pez_ipc_hexdump("rt(data)",
+                            zmq_msg_data(&msg->part[i]),
+                            zmq_msg_size(&msg->part[i]));
+        }
     }
 
-    /* Only need EV_READ event to read incoming msg */
-    ev_zsock_init(&pez.thd[id].pez_ev_zsock, cb, socket, EV_READ);
-    ev_zsock_start(loop, &pez.thd[id].pez_ev_zsock);
+    /*
+     * Send msg
+     */
+    trace_id = (msg->has_hdr && (msg->hdr.flags & PEZ_HDR_F_TRACE)) ?
+               msg->hdr.trace_id : 0;
+    rc = pez_ipc_rt_msg_send(pez, socket, msg);
+    pez_ipc_rt_msg_close(msg);
+    if (rc != EOK) {
+        return;
+    }
+    if (trace_id) {
+        pez_ipc_trace(&pez->rt_trace, PEZ_TRACE_RT_SEND, trace_id);
+    }
+    /* Count */
+    pez_ipc_router_count(pez, trgt_id, src_id, cnt);
 
-    return EOK;
+    if (pez_debug_flag) {
+        pez_domain_counter_print(pez);
+    }
+}
+
+/*
+ * How long router can sleep in zmq_poll. Held conflated and journaled msgs
+ * are checked every ms, trgts don't tell router when they catch up.
+ */
+static long
+pez_ipc_rt_poll_timeout(pez_t *pez) {
+    long timeout = pez_ipc_rt_wheel_timeout(pez);
+
+    if ((pez->conflate.num != 0 || pez_ipc_rt_journal_busy(pez)) &&
+        (timeout < 0 || timeout > 1)) {
+        timeout = 1;
+    }
+    return timeout;
 }
 
 /*
  * router thread
  */
 static void * pez_ipc_router_thread(void *arg) {
-    void        *socket_router;
-    pez_status  rc;
-    char        buffer[INPROC_MAX_MSG_SIZE] = {0};
-    char        trgt_id[PEZ_THREAD_ID_MAX_LEN] = {0};
-    char        src_id[PEZ_THREAD_ID_MAX_LEN] = {0};
-    int         i, recvd_size;
-    int         len_src_id = -1, len_trgt_id = -1;
+    pez_t               *pez = arg;
+    void                *socket_router;
+    pez_status          rc;
+    pez_rt_msg_t        msg;
+    char                trgt_id[PEZ_THREAD_ID_MAX_LEN + 1] = {0};
+    char                src_id[PEZ_THREAD_ID_MAX_LEN + 1] = {0};
+    int                 one = 1;
+    int32_t             i;
+    pez_route_table_t   *tab;
 
     /* socket type of router thread should be ZMQ_ROUTER */
-    socket_router = zmq_socket(pez_ipc_get_zmq_ctx(), ZMQ_ROUTER);
+    socket_router = zmq_socket(pez_ipc_get_zmq_ctx(&pez->cfg), ZMQ_ROUTER);
     assert(socket_router != NULL);
 
-    rc = zmq_bind(socket_router, INPROC_ADDRESS);
+    /* endpoint reopened under same id takes over its identity */
+    rc = zmq_setsockopt(socket_router, ZMQ_ROUTER_HANDOVER, &one, sizeof(one));
+    assert(rc != -1);
+
+    rc = zmq_bind(socket_router, pez->addr);
     assert(rc != -1);
 
+    pez_ipc_rt_wheel_init(pez);
+    pez_ipc_rt_conflate_init(pez);
+    pez_ipc_rt_defer_init(pez);
+
+    /* threads can connect now */
+    pthread_mutex_lock(&pez->lock);
+    pez->router_ready = 1;
+    pthread_cond_broadcast(&pez->ready_cond);
+    pthread_mutex_unlock(&pez->lock);
+
     zmq_pollitem_t items [] = {
         {socket_router, 0, ZMQ_POLLIN, 0}
     };
 
-    while (1) {
-        zmq_poll(items, sizeof(items)/sizeof(zmq_pollitem_t), -1);
+    while (!pez->rt_stop) {
+        zmq_poll(items, sizeof(items)/sizeof(zmq_pollitem_t),
+                 pez_ipc_rt_poll_timeout(pez));
+        PEZ_RT_HOT_BEGIN(PEZ_IPC_RT(pez));
         if (items[0].revents & ZMQ_POLLIN) {
             /*
              * Recv msg
              */
-            /* 1st: get ID frame */
-            rc = zmq_recv (socket_router, &src_id, PEZ_THREAD_ID_MAX_LEN, 0);
-            if (rc == -1) {
-                printf("pez ipc: recv ID frame failed: %s\n", strerror(errno));
-                continue;
+            rc = pez_ipc_rt_msg_recv(pez, socket_router, &msg);
+            if (rc == EOK) {
+                if (msg.has_hdr && (msg.hdr.flags & PEZ_HDR_F_TRACE)) {
+                    pez_ipc_trace(&pez->rt_trace, PEZ_TRACE_RT_RECV,
+                                  msg.hdr.trace_id);
+                }
+                pez_ipc_rt_id_get(&msg.trgt, trgt_id);
+                if (trgt_id[0] == '\0') {
+                    /* msgs to router itself, not in hot path */
+                    PEZ_RT_HOT_END(PEZ_IPC_RT(pez));
+                    pez_ipc_rt_id_get(&msg.src, src_id);
+                    pez_ipc_rt_ctrl_handle(pez, socket_router, &msg, src_id);
+                    pez_ipc_rt_msg_close(&msg);
+                    PEZ_RT_HOT_BEGIN(PEZ_IPC_RT(pez));
+                } else if (msg.has_hdr && (msg.hdr.flags & PEZ_HDR_F_TIMER) &&
+                           (msg.hdr.delay_ms || msg.hdr.period_ms)) {
+                    /* delayed or periodic, held until due */
+                    pez_ipc_rt_timer_add(pez, &msg);
+                } else {
+                    pez_ipc_rt_msg_forward(pez, socket_router, &msg);
+                }
             }
-            len_src_id = rc;
+        }
+        /* send all msgs due by now */
+        pez_ipc_rt_wheel_advance(pez, socket_router);
+        pez_ipc_rt_conflate_flush(pez, socket_router);
+        PEZ_RT_HOT_END(PEZ_IPC_RT(pez));
+        pez_ipc_rt_journal_run(pez, socket_router);
+    }
 
-            if (pez_debug_flag) {
-                pez_ipc_hexdump("rt(src id)",
-                                 (const char*)src_id,
-                                 len_src_id);
-            }
+    /* msgs still held by router are dropped with their sockets */
+    pez_ipc_rt_journal_close(pez);
+    for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
+        if (pez->thd[i].rt_bridge) {
+            zmq_close(pez->thd[i].bridge_sock);
+        }
+    }
+    /* tables of route_set() calls racing with fini aren't taken */
+    free(pez->route);
+    pez->route = NULL;
+    pthread_mutex_lock(&pez->lock);
+    while ((tab = pez->route_pend) != NULL) {
+        pez->route_pend = tab->next;
+        free(tab);
+    }
+    pthread_mutex_unlock(&pez->lock);
+    zmq_close(socket_router);
+    return NULL;
+}
 
-            /* 2nd: Get dest id frame*/
-            rc = zmq_recv (socket_router, &trgt_id, PEZ_THREAD_ID_MAX_LEN, 0);
-            if (rc == -1) {
-                printf("pez ipc: recv trgt id frame failed: %s\n",
-                        strerror(errno));
-                continue;
-            }
-            len_trgt_id = rc;
+/*
+ * Create router thread. It should be invoked only once.
+ */
+static pez_status
+pez_ipc_create_router_thread(pez_t *pez) {
+    const pez_config_t  *cfg = &pez->cfg;
+    pthread_attr_t      attr;
+    struct sched_param  param;
+    pez_status          rc = ENOENT;
+#ifdef __linux__
+    cpu_set_t           set;
+#endif
 
-            if (pez_debug_flag) {
-                pez_ipc_hexdump("rt(trgt id)",
-                                 (const char*)trgt_id,
-                                 len_trgt_id);
-            }
+    pthread_attr_init(&attr);
 
-            /* 3rd: get real data */
-            rc = zmq_recv (socket_router, buffer, INPROC_MAX_MSG_SIZE, 0);
-            if (rc == -1) {
-                printf("pez ipc: recv real data frame failed: %s\n", 
-                        strerror(errno));
-                continue;
-            }
-            recvd_size = rc;
+    /* placement: next to its heaviest producers */
+#ifdef __linux__
+    rc = pez_ipc_cpuset_get(cfg->router_cpu, cfg->router_numa_node, &set);
+    if (rc == EOK) {
+        rc = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+#else
+    if (cfg->router_cpu != PEZ_CPU_ANY ||
+        cfg->router_numa_node != PEZ_NUMA_ANY) {
+        rc = ENOTSUP;
+    }
+#endif
+    if (rc != EOK && rc != ENOENT) {
+        printf("pez ipc: invalid router placement: %s\n", strerror(rc));
+        goto end;
+    }
 
-            if (pez_debug_flag) {
-                pez_ipc_hexdump("rt(data)",
-                                 (const char*)buffer,
-                                 recvd_size);
-            }
+    if (cfg->router_sched_policy != SCHED_OTHER) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = cfg->router_sched_priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, cfg->router_sched_policy);
+        rc = pthread_attr_setschedparam(&attr, &param);
+        if (rc != 0) {
+            printf("pez ipc: invalid router sched param: %s\n",
+                   strerror(rc));
+            goto end;
+        }
+    }
 
-            /*
-             * Send msg
-             */
-            /* send ID frame */
-            rc = zmq_send(socket_router, &trgt_id, len_trgt_id, ZMQ_SNDMORE);
-            if (rc == -1) {
-                printf("pez ipc: send id frame failed: %s\n", strerror(errno));
-                continue;
-            }
+    rc = pthread_create(&pez->tid_router, &attr, pez_ipc_router_thread, pez);
+    if (rc != 0) {
+        printf("pez ipc: create router thread failed: %s\n", strerror(rc));
+    }
 
-            /* send real data */
-            rc = zmq_send(socket_router, buffer, recvd_size, 0);
-            if (rc == -1) {
-                printf("pez ipc: send data frame failed: %s\n",
-                        strerror(errno));
-                continue;
-            }
-            /* Count */
-            pez_ipc_router_count(trgt_id, src_id);
+end:
+    pthread_attr_destroy(&attr);
+    return rc;
+}
 
-            if (pez_debug_flag) {
-                pez_ipc_router_counter_print();
-            }
+/*
+ * Default config: nothing pinned, default scheduling and zmq options.
+ */
+void
+pez_ipc_config_init(pez_config_t *cfg) {
+    if (!cfg) {
+        return;
+    }
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->router_cpu = PEZ_CPU_ANY;
+    cfg->router_numa_node = PEZ_NUMA_ANY;
+    cfg->router_sched_policy = SCHED_OTHER;
+    cfg->zmq_thread_sched_policy = -1;
+}
+
+/*
+ * Turn cfg into real-time one: router runs SCHED_FIFO at router_priority,
+ * memory is locked and hot paths never allocate.
+ */
+void
+pez_ipc_config_rt(pez_config_t *cfg, int router_priority) {
+    if (!cfg) {
+        return;
+    }
+    cfg->router_sched_policy = SCHED_FIFO;
+    cfg->router_sched_priority = router_priority;
+    cfg->rt_flags = PEZ_RT_MLOCK | PEZ_RT_PREALLOC;
+    cfg->rt_pool_size = PEZ_RT_POOL_SIZE;
+}
+
+/*
+ * Fill free lists of router pools. Entries are touched now so their pages
+ * don't fault in the first time they hold a msg. Real-time domains cache
+ * all of them, others the usual few.
+ */
+static pez_status
+pez_ipc_rt_pool_init(pez_t *pez) {
+    pez_timer_t             *t;
+    pez_conflate_entry_t    *e;
+    pez_defer_t             *d;
+    uint32_t                i;
+
+    pez->wheel.free_max = PEZ_TIMER_FREE_MAX;
+    pez->conflate.free_max = PEZ_CONFLATE_FREE_MAX;
+    if (!PEZ_IPC_RT(pez)) {
+        return EOK;
+    }
+    if (pez->cfg.rt_pool_size == 0) {
+        pez->cfg.rt_pool_size = PEZ_RT_POOL_SIZE;
+    }
+    pez->wheel.free_max = pez->cfg.rt_pool_size;
+    pez->conflate.free_max = pez->cfg.rt_pool_size;
+    for (i = 0; i < pez->cfg.rt_pool_size; i ++) {
+        t = malloc(sizeof(*t));
+        e = malloc(sizeof(*e));
+        d = malloc(sizeof(*d));
+        if (!t || !e || !d) {
+            free(t);
+            free(e);
+            free(d);
+            printf("pez ipc: no mem for real-time pools\n");
+            return ENOMEM;
         }
+        memset(t, 0, sizeof(*t));
+        memset(e, 0, sizeof(*e));
+        memset(d, 0, sizeof(*d));
+        t->hnext = pez->wheel.free_list;
+        pez->wheel.free_list = t;
+        pez->wheel.free_num ++;
+        e->hnext = pez->conflate.free_list;
+        pez->conflate.free_list = e;
+        pez->conflate.free_num ++;
+        d->link.next = (pez_tlink_t *)pez->defer_free;
+        pez->defer_free = d;
     }
+    return pez_ipc_trace_ring_alloc(&pez->rt_trace);
 }
 
 /*
- * Create router thread. It should be invoked only once.
+ * Init domain and create its router thread with cfg.
  */
 static pez_status
-pez_ipc_create_router_thread() {
-    pez_status rc;
+pez_ipc_domain_init(pez_t *pez, const pez_config_t *cfg) {
+    pez_status  rc;
+    int32_t     i;
+
+    /* zmq ctx is shared, options of 1st domain hold for all */
+    rc = pez_ipc_zmq_ctx_check(cfg);
+    if (rc != EOK) {
+        return rc;
+    }
+    pez->cfg = *cfg;
+    for (i = 0; i < PEZ_THREAD_MAX_NUM; i ++) {
+        pez->thd[i].dom = pez;
+    }
+
+    /* process wide, before pools so they're locked as well */
+    if ((cfg->rt_flags & PEZ_RT_MLOCK) &&
+        mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        rc = errno;
+        printf("pez ipc: mlockall failed: %s\n", strerror(rc));
+        return rc;
+    }
+    /* router isn't running yet, it owns them from its start on */
+    rc = pez_ipc_rt_pool_init(pez);
+    if (rc != EOK) {
+        return rc;
+    }
 
-    rc = pthread_create(&pez.tid_router, NULL, pez_ipc_router_thread, NULL);
+    rc = pthread_mutex_init(&pez->lock, NULL);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = pthread_cond_init(&pez->ready_cond, NULL);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = pez_ipc_create_router_thread(pez);
     if (rc != 0) {
-        printf("pez ipc: create router thread failed: %s\n", strerror(errno));
         return rc;
     }
+
+    /* don't let threads connect before router binds */
+    pthread_mutex_lock(&pez->lock);
+    while (!pez->router_ready) {
+        pthread_cond_wait(&pez->ready_cond, &pez->lock);
+    }
+    pthread_mutex_unlock(&pez->lock);
+    return EOK;
+}
+
+/*
+ * Do internal initialization and thread creation with cfg.
+ * router thread takes charge of messages routing.
+ */
+pez_status
+pez_ipc_init_config(const pez_config_t *cfg) {
+    if (!cfg) {
+        return EINVAL;
+    }
+    return pez_ipc_domain_init(&pez_dflt, cfg);
+}
+
+/*
+ * Create domain with router of its own, bound to inproc://pez-<name>.
+ * Names of domains are unique, "default" is taken by the default one. NULL
+ * on failure.
+ */
+pez_domain_t *
+pez_domain_create(const char *name, const pez_config_t *cfg) {
+    pez_t           *pez = NULL;
+    unsigned int    i;
+
+    if (!name || !cfg || strnlen(name, PEZ_DOMAIN_NAME_MAX_LEN) == 0 ||
+        strnlen(name, PEZ_DOMAIN_NAME_MAX_LEN) == PEZ_DOMAIN_NAME_MAX_LEN) {
+        return NULL;
+    }
+    /* held throughout, so names are checked and taken at once */
+    pthread_mutex_lock(&pez_domain_lock);
+    for (i = 0; i < pez_domain_num; i ++) {
+        if (!strcmp(pez_domain[i]->name, name)) {
+            printf("pez ipc: domain %s exists\n", name);
+            goto end;
+        }
+    }
+    if (pez_domain_num == PEZ_DOMAIN_MAX_NUM) {
+        printf("pez ipc: no room for new domain(%s)\n", name);
+        goto end;
+    }
+    pez = calloc(1, sizeof(*pez));
+    if (!pez) {
+        goto end;
+    }
+    strncpy(pez->name, name, PEZ_DOMAIN_NAME_MAX_LEN - 1);
+    snprintf(pez->addr, sizeof(pez->addr), "inproc://pez-%s", name);
+    pez->idx = pez_domain_num;
+    if (pez_ipc_domain_init(pez, cfg) != EOK) {
+        printf("pez ipc: init domain %s failed\n", name);
+        free(pez);
+        pez = NULL;
+        goto end;
+    }
+    pez_domain[pez_domain_num] = pez;
+    __atomic_store_n(&pez_domain_num, pez_domain_num + 1, __ATOMIC_RELEASE);
+
+end:
+    pthread_mutex_unlock(&pez_domain_lock);
+    return pez;
+}
+
+pez_domain_t *
+pez_domain_default() {
+    return &pez_dflt;
+}
+
+const char *
+pez_domain_name(pez_domain_t *dom) {
+    return dom ? dom->name : NULL;
+}
+
+/*
+ * Forward msgs sent to trgt in domain from to trgt in domain to, where they
+ * come from via. trgt is declared in to if it isn't known there. Both names
+ * are taken by the bridge in their domains, msgs sent to via are held by
+ * router of to and never delivered. Bridges go one
+ * way, replies need a bridge of their own.
+ * Router of from sends them on by a socket of its own, and waits while
+ * router of to is behind.
+ */
+pez_status
+pez_domain_bridge(pez_domain_t *from,
+                  const char *trgt,
+                  pez_domain_t *to,
+                  const char *via) {
+    void        *socket = NULL, *ctrl = NULL;
+    int32_t     id, via_id;
+    pez_hdr_t   hdr;
+    pez_status  rc = EOK;
+    int         declared;
+
+    if (!from || !to || from == to || !trgt || !via ||
+        strnlen(trgt, PEZ_THREAD_ID_MAX_LEN) == 0 ||
+        strnlen(via, PEZ_THREAD_ID_MAX_LEN) == 0) {
+        return EINVAL;
+    }
+    if (pez_ipc_group_get_bystr(from, trgt) ||
+        pez_ipc_group_get_bystr(to, via)) {
+        printf("pez ipc: bridge %s to %s: group name\n", trgt, via);
+        return EINVAL;
+    }
+    pez_ipc_index_get_bystr(to, via, &via_id);
+    if (via_id != PEZ_THREAD_ID_INVAL) {
+        printf("pez ipc: %s of domain %s is in use\n", via, to->name);
+        return EEXIST;
+    }
+    /* trgt declared in advance is taken over */
+    pez_ipc_index_get_bystr(from, trgt, &id);
+    if (id != PEZ_THREAD_ID_INVAL &&
+        !__atomic_exchange_n(&from->thd[id].declared, 0, __ATOMIC_ACQ_REL)) {
+        printf("pez ipc: %s of domain %s is in use\n", trgt, from->name);
+        return EEXIST;
+    }
+    declared = (id != PEZ_THREAD_ID_INVAL);
+    if (!declared) {
+        pez_ipc_index_alloc(from, trgt, &id);
+    }
+    pez_ipc_index_alloc(to, via, &via_id);
+    if (id == PEZ_THREAD_ID_INVAL || via_id == PEZ_THREAD_ID_INVAL) {
+        printf("pez ipc: no room for bridge %s to %s\n", trgt, via);
+        rc = ENOMEM;
+        goto err;
+    }
+    /* held by router of to until trgt registers there */
+    rc = pez_domain_thread_declare(to, trgt);
+    if (rc != EOK) {
+        goto err;
+    }
+
+    /* socket connected to router of to, as via */
+    socket = zmq_socket(pez_ipc_get_zmq_ctx(&from->cfg), ZMQ_DEALER);
+    ctrl = zmq_socket(pez_ipc_get_zmq_ctx(&from->cfg), ZMQ_DEALER);
+    if (!socket || !ctrl ||
+        zmq_setsockopt(socket, ZMQ_IDENTITY, via,
+                       strnlen(via, PEZ_THREAD_ID_MAX_LEN)) == -1 ||
+        zmq_connect(socket, to->addr) == -1 ||
+        zmq_setsockopt(ctrl, ZMQ_IDENTITY, trgt,
+                       strnlen(trgt, PEZ_THREAD_ID_MAX_LEN)) == -1 ||
+        zmq_connect(ctrl, from->addr) == -1) {
+        rc = errno;
+        printf("pez ipc: unable to set up bridge %s to %s: %s\n",
+               trgt, via, strerror(rc));
+        goto err;
+    }
+    from->thd[id].bridge = to;
+    from->thd[id].bridge_sock = socket;
+
+    /* router of from takes socket over once it gets this, as trgt */
+    pez_ipc_hdr_init(&hdr, 0, 1);
+    hdr.op = PEZ_CTRL_BRIDGE;
+    if (zmq_send(ctrl, "", 0, ZMQ_SNDMORE) == -1 ||
+        zmq_send(ctrl, &hdr, sizeof(hdr), ZMQ_SNDMORE) == -1 ||
+        zmq_send(ctrl, "", 0, 0) == -1) {
+        rc = errno;
+        printf("pez ipc: unable to set up bridge %s to %s: %s\n",
+               trgt, via, strerror(rc));
+        /* not sent as a whole, router never sees it */
+        from->thd[id].bridge = NULL;
+        from->thd[id].bridge_sock = NULL;
+        goto err;
+    }
+    zmq_close(ctrl);
     return EOK;
+
+err:
+    if (socket) {
+        zmq_close(socket);
+    }
+    if (ctrl) {
+        zmq_close(ctrl);
+    }
+    /* trgt declared in advance stays so, trgt declared in to as well */
+    if (declared) {
+        __atomic_store_n(&from->thd[id].declared, 1, __ATOMIC_RELEASE);
+    } else if (id != PEZ_THREAD_ID_INVAL) {
+        pez_ipc_index_free(from, id);
+    }
+    if (via_id != PEZ_THREAD_ID_INVAL) {
+        pez_ipc_index_free(to, via_id);
+    }
+    return rc;
 }
 
 /*
  * Do internal initialization and thread creation.
  * router thread takes charge of messages routing.
  */
-void
+pez_status
 pez_ipc_init() {
-    pez_status rc;
-    rc = pthread_mutex_init(&pez.lock, NULL);
-    assert(rc == 0);
+    pez_config_t    cfg;
+    pez_status      rc;
+
+    pez_ipc_config_init(&cfg);
+    rc = pez_ipc_init_config(&cfg);
+    if (rc != EOK) {
+        printf("pez ipc: init failed: %s\n", strerror(rc));
+    }
+    return rc;
+}
+
+/*
+ * Stop router of domain and close its journals, so that all they took is
+ * synced. Msgs this thread posted before are routed first. Endpoints of the
+ * domain should be closed before, domain must not be used afterwards.
+ */
+pez_status
+pez_domain_fini(pez_domain_t *pez) {
+    pez_hdr_t       hdr;
+    struct iovec    iov = {NULL, 0};
+    void            *socket;
+    pez_status      rc;
+
+    if (!pez || !pez->router_ready) {
+        return EINVAL;
+    }
+    socket = pez_ipc_post_sock_get(pez);
+    if (!socket) {
+        return ENOTCONN;
+    }
+    if (__atomic_exchange_n(&pez->fini, 1, __ATOMIC_ACQ_REL)) {
+        return EALREADY;
+    }
+    pez_ipc_hdr_init(&hdr, 0, 1);
+    hdr.op = PEZ_CTRL_STOP;
+    rc = pez_ipc_frames_sendv_sock(pez, socket, "", &hdr, &iov, 1);
+    if (rc != EOK) {
+        __atomic_store_n(&pez->fini, 0, __ATOMIC_RELEASE);
+        return rc;
+    }
+    rc = pthread_join(pez->tid_router, NULL);
+    if (rc != 0) {
+        printf("pez ipc: %s: join router thread failed: %s\n",
+               pez->name, strerror(rc));
+        return rc;
+    }
+    zmq_close(socket);
+    pez_post_sock[pez->idx] = NULL;
+    return EOK;
+}
+
+/*
+ * Pin calling thread, which must own id, to cpu or cpus of numa_node.
+ * Coalescing batches of id are then reallocated and touched by the thread
+ * itself. Pages malloc hands out fresh are placed on its numa node by first
+ * touch, reused ones stay where they are. zmq's own buffers aren't moved.
+ * On failure the thread keeps its old affinity and batches.
+ */
+pez_status
+pez_ipc_thread_affinity_set(const char *id, int cpu, int numa_node) {
+#ifdef __linux__
+    pez_t       *pez;
+    pez_thd_t   *thd;
+    cpu_set_t   set, old;
+    int32_t     i;
+    pez_status  rc;
+    int         j;
+    uint8_t     *buf[PEZ_BATCH_TRGT_MAX] = {NULL};
+
+    if (!id) {
+        return EINVAL;
+    }
+    rc = pez_ipc_index_get_bysrc(id, &pez, &i);
+    if (rc != EOK) {
+        return rc;
+    }
+    rc = pez_ipc_cpuset_get(cpu, numa_node, &set);
+    if (rc != EOK) {
+        return rc == ENOENT ? EINVAL : rc;
+    }
+    thd = &pez->thd[i];
+    rc = pez_ipc_batch_flush_all(pez, i);
+    if (rc != EOK) {
+        return rc;
+    }
+    rc = pthread_getaffinity_np(pthread_self(), sizeof(old), &old);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        printf("pez ipc: unable to pin %s: %s\n", id, strerror(rc));
+        return rc;
+    }
 
-    rc = pez_ipc_create_router_thread();
-    assert(rc == EOK);
+    /* allocated after pinning, so first touch places them */
+    for (j = 0; thd->batch && j < PEZ_BATCH_TRGT_MAX; j ++) {
+        buf[j] = malloc(thd->batch_max_size);
+        if (!buf[j]) {
+            while (j -- > 0) {
+                free(buf[j]);
+            }
+            pthread_setaffinity_np(pthread_self(), sizeof(old), &old);
+            return ENOMEM;
+        }
+        memset(buf[j], 0, thd->batch_max_size);
+    }
+    for (j = 0; thd->batch && j < PEZ_BATCH_TRGT_MAX; j ++) {
+        free(thd->batch[j].buf);
+        thd->batch[j].buf = buf[j];
+    }
+    return EOK;
+#else
+    return ENOTSUP;
+#endif
 }
 
 
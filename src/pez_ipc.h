@@ -1,16 +1,202 @@
 #ifndef PEZ_IPC_H
 #define PEZ_IPC_H
+#include <stdint.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <zmq.h>
 #include "ev_zsock.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef int    pez_status;
 
-#define INPROC_ADDRESS          "inproc://channel"
+#define INPROC_ADDRESS          "inproc://channel"  /* of default domain */
 
 #define INPROC_MAX_MSG_SIZE     1024
 
+#define PEZ_IPC_IOV_MAX         7           /* parts of msg sent by sendv */
+
+#define PEZ_BUSY_POLL_MAX_US    (100)       /* spin budget per loop wakeup */
+
 #define EOK                     0
 
-void pez_ipc_init();
+/*
+ * How router picks a member for msgs sent to a group
+ */
+typedef enum {
+    PEZ_GROUP_POLICY_RR,            /* round robin */
+    PEZ_GROUP_POLICY_LEAST_DEPTH,   /* member with fewest msgs queued */
+    PEZ_GROUP_POLICY_KEY,           /* consistent hashing on msg key */
+} pez_group_policy_t;
+
+/*
+ * Content-based routing rule. Router matches fixed-layout msgs(see
+ * pez_codec.h) on their type, and optionally on subtype of codec hdr and
+ * key of pez_ipc_msg_send_key(), whatever trgt the sender picked. The most
+ * specific rule wins: subtype and key, subtype, key, then type only.
+ */
+typedef enum {
+    PEZ_ROUTE_REDIRECT,             /* to rule's trgt instead */
+    PEZ_ROUTE_MIRROR,               /* to sender's trgt and a copy to rule's */
+    PEZ_ROUTE_DROP,
+} pez_route_action_t;
+
+#define PEZ_ROUTE_M_SUBTYPE     (0x1)       /* subtype is matched */
+#define PEZ_ROUTE_M_KEY         (0x2)       /* key is matched */
+
+#define PEZ_ROUTE_RULE_MAX      (4096)      /* rules of a domain */
+
+typedef struct {
+    uint32_t            match;      /* PEZ_ROUTE_M_*, 0: type only */
+    uint16_t            type;
+    uint32_t            subtype;
+    uint64_t            key;
+    pez_route_action_t  action;
+    const char          *trgt;      /* thread or group, unused by drop */
+} pez_route_rule_t;
+
+#define PEZ_CPU_ANY             (-1)
+
+#define PEZ_NUMA_ANY            (-1)
+
+/*
+ * Real-time options of a domain, pez_config_t.rt_flags. With
+ * PEZ_RT_PREALLOC whatever router holds msgs in(timers, conflated and
+ * deferred msgs) comes from rt_pool_size entries each, allocated and
+ * touched at init. Once they're used up msgs are dropped and counted
+ * rather than allocated for. Trace rings are allocated at open too.
+ */
+#define PEZ_RT_MLOCK            (0x0001)    /* mlockall() at init */
+#define PEZ_RT_PREALLOC         (0x0002)    /* no malloc in hot paths */
+
+#define PEZ_RT_POOL_SIZE        (1024)
+
+/*
+ * Init config. Get defaults by pez_ipc_config_init() then change fields.
+ * zmq_* options are taken from the 1st domain, as zmq ctx is shared. Later
+ * domains must leave them default or ask for the same, else their init
+ * fails with EINVAL.
+ */
+typedef struct {
+    int         router_cpu;                 /* PEZ_CPU_ANY: not pinned */
+    int         router_numa_node;           /* used if router_cpu is any */
+    int         router_sched_policy;        /* SCHED_OTHER/FIFO/RR */
+    int         router_sched_priority;
+    int         zmq_io_threads;             /* 0: zmq default */
+    int         zmq_max_sockets;            /* 0: zmq default */
+    int         zmq_thread_sched_policy;    /* -1: zmq default */
+    int         zmq_thread_sched_priority;
+    uint64_t    zmq_thread_cpu_mask;        /* cpus of zmq threads, 0: any */
+    uint32_t    rt_flags;                   /* PEZ_RT_*, 0: none */
+    uint32_t    rt_pool_size;               /* entries of each router pool */
+} pez_config_t;
+
+/*
+ * Borrowed view of a received msg, valid until pez_ipc_msg_release(). It
+ * holds a reference to zmq frame, so don't copy the struct itself, get
+ * another view by pez_ipc_msg_retain().
+ */
+typedef struct {
+    const uint8_t   *data;
+    size_t          size;
+    size_t          off;                        /* of data in frame */
+    zmq_msg_t       frame;
+} pez_msg_view_t;
+
+/*
+ * Object handed over by pointer between threads of the process. release
+ * is called with obj and arg by whoever ends up owning it.
+ */
+typedef void (*pez_ptr_release_fn)(void *obj, void *arg);
+
+typedef struct {
+    void                *obj;
+    pez_ptr_release_fn  release;
+    void                *arg;
+    uint32_t            type;               /* of obj, up to sender */
+    uint32_t            reserved;
+} pez_ptr_t;
+
+/*
+ * Handle of a named endpoint. A thread can own several of them.
+ */
+typedef struct pez_endpoint_s pez_endpoint_t;
+
+/*
+ * Isolated instance of pez: its own names, groups, router thread and
+ * inproc address. Endpoints of different domains can share names and only
+ * reach each other through bridges. APIs without domain handle use the
+ * default domain, APIs taking src or an endpoint use the domain of it.
+ */
+typedef struct pez_domain_s pez_domain_t;
+
+void pez_ipc_config_init(pez_config_t *cfg);
+
+void pez_ipc_config_rt(pez_config_t *cfg, int router_priority);
+
+pez_status pez_ipc_init_config(const pez_config_t *cfg);
+
+pez_status pez_ipc_init();
+
+pez_domain_t * pez_domain_create(const char *name, const pez_config_t *cfg);
+
+pez_domain_t * pez_domain_default();
+
+const char * pez_domain_name(pez_domain_t *dom);
+
+pez_endpoint_t * pez_domain_endpoint_open(pez_domain_t *dom,
+                                          struct ev_loop *loop,
+                                          const char *id,
+                                          ev_zsock_cbfn cb,
+                                          void *data);
+
+pez_status pez_domain_thread_declare(pez_domain_t *dom, const char *id);
+
+pez_status pez_domain_msg_post(pez_domain_t *dom,
+                               const char *trgt,
+                               const char *src,
+                               void *buf,
+                               size_t size);
+
+pez_status pez_domain_wait_ready(pez_domain_t *dom,
+                                 const char *const *ids,
+                                 int timeout_ms);
+
+pez_status pez_domain_group_create(pez_domain_t *dom,
+                                   const char *group,
+                                   pez_group_policy_t policy);
+
+pez_status pez_domain_route_set(pez_domain_t *dom,
+                                const pez_route_rule_t *rules,
+                                int rule_num);
+
+pez_status pez_domain_shed_set(pez_domain_t *dom,
+                               const char *id,
+                               uint32_t max_depth);
+
+pez_status pez_domain_journal_enable(pez_domain_t *dom,
+                                     const char *id,
+                                     const char *dir,
+                                     uint32_t max_depth);
+
+pez_status pez_domain_bridge(pez_domain_t *from,
+                             const char *trgt,
+                             pez_domain_t *to,
+                             const char *via);
+
+void pez_domain_counter_print(pez_domain_t *dom);
+
+pez_status pez_domain_fini(pez_domain_t *dom);
+
+pez_status pez_ipc_thread_affinity_set(const char *id,
+                                       int cpu,
+                                       int numa_node);
+
+pez_status pez_ipc_thread_declare(const char *id);
+
+pez_status pez_ipc_wait_ready(const char *const *ids, int timeout_ms);
 
 pez_status pez_ipc_thread_init_tx(const char *tx_id);
 
@@ -18,19 +204,152 @@ pez_status pez_ipc_thread_init_rx(struct ev_loop *loop,
                                   const char *recv_id,
                                   ev_zsock_cbfn cb);
 
+pez_status pez_ipc_thread_init_rx_ex(struct ev_loop *loop,
+                                     const char *recv_id,
+                                     ev_zsock_cbfn cb,
+                                     void *data);
+
+pez_endpoint_t * pez_ipc_endpoint_open(struct ev_loop *loop,
+                                       const char *id,
+                                       ev_zsock_cbfn cb,
+                                       void *data);
+
+pez_status pez_ipc_endpoint_close(pez_endpoint_t *ep);
+
+pez_endpoint_t * pez_ipc_endpoint_get(const char *id);
+
+pez_endpoint_t * pez_ipc_endpoint_of(ev_zsock_t *wz);
+
+ev_zsock_t * pez_ipc_endpoint_zsock(pez_endpoint_t *ep);
+
+const char * pez_ipc_endpoint_name(pez_endpoint_t *ep);
+
+pez_domain_t * pez_ipc_endpoint_domain(pez_endpoint_t *ep);
+
+pez_status pez_ipc_endpoint_send(pez_endpoint_t *ep,
+                                 const char *trgt,
+                                 void *buf,
+                                 size_t size);
+
+pez_status pez_ipc_endpoint_sendv(pez_endpoint_t *ep,
+                                  const char *trgt,
+                                  const struct iovec *iov,
+                                  int iov_cnt);
+
 pez_status pez_ipc_msg_recv(void *socket,
                             void *buf,
                             size_t buffer_size,
                             size_t *rtn_size);
 
+pez_status pez_ipc_msg_recv_view(void *socket, pez_msg_view_t *view);
+
+pez_status pez_ipc_msg_retain(pez_msg_view_t *view, pez_msg_view_t *copy);
+
+void pez_ipc_msg_release(pez_msg_view_t *view);
+
+pez_status pez_ipc_msg_recvv(void *socket,
+                             pez_msg_view_t *parts,
+                             int *part_cnt);
+
 pez_status pez_ipc_msg_send (const char *trgt,
                              const char *src,
                              void *buf,
                              size_t size);
 
+pez_status pez_ipc_msg_post(const char *trgt,
+                            const char *src,
+                            void *buf,
+                            size_t size);
+
+pez_status pez_ipc_msg_sendv(const char *trgt,
+                             const char *src,
+                             const struct iovec *iov,
+                             int iov_cnt);
+
+pez_status pez_ipc_msg_send_key(const char *trgt,
+                                const char *src,
+                                uint64_t key,
+                                void *buf,
+                                size_t size);
+
+pez_status pez_ipc_msg_send_ttl(const char *trgt,
+                                const char *src,
+                                void *buf,
+                                size_t size,
+                                uint32_t ttl_us);
+
+pez_status pez_ipc_msg_send_conflate(const char *trgt,
+                                     const char *src,
+                                     uint64_t key,
+                                     void *buf,
+                                     size_t size);
+
+pez_status pez_ipc_msg_send_ptr(const char *trgt,
+                                const char *src,
+                                const pez_ptr_t *ptr);
+
+pez_status pez_ipc_msg_recv_ptr(void *socket, pez_ptr_t *ptr);
+
+void pez_ipc_ptr_release(pez_ptr_t *ptr);
+
+pez_status pez_ipc_shed_set(const char *id, uint32_t max_depth);
+
+pez_status pez_ipc_busy_poll_set(const char *id, uint32_t spin_us);
+
+void pez_ipc_trace_enable(uint32_t sample_rate);
+
+void pez_ipc_trace_begin(ev_zsock_t *wz);
+
+void pez_ipc_trace_end(ev_zsock_t *wz);
+
+pez_status pez_ipc_trace_dump(const char *path);
+
+pez_status pez_ipc_journal_enable(const char *id,
+                                  const char *dir,
+                                  uint32_t max_depth);
+
+pez_status pez_ipc_group_create(const char *group, pez_group_policy_t policy);
+
+pez_status pez_ipc_group_join(const char *group, const char *member);
+
+pez_status pez_ipc_group_leave(const char *group, const char *member);
+
+pez_status pez_ipc_route_set(const pez_route_rule_t *rules, int rule_num);
+
+pez_status pez_ipc_msg_send_after(const char *trgt,
+                                  const char *src,
+                                  void *buf,
+                                  size_t size,
+                                  uint32_t delay_ms,
+                                  uint64_t *timer_id);
+
+pez_status pez_ipc_msg_send_every(const char *trgt,
+                                  const char *src,
+                                  void *buf,
+                                  size_t size,
+                                  uint32_t delay_ms,
+                                  uint32_t period_ms,
+                                  uint64_t *timer_id);
+
+pez_status pez_ipc_timer_cancel(const char *src, uint64_t timer_id);
+
+pez_status pez_ipc_coalesce_enable(const char *src,
+                                   size_t max_size,
+                                   uint32_t max_delay_us);
+
+pez_status pez_ipc_coalesce_disable(const char *src);
+
+pez_status pez_ipc_msg_flush(const char *src);
+
+char * pez_ipc_identity_get();
+
 void pez_ipc_router_counter_print();
 
 void pez_ipc_enable_debug();
 
 void pez_ipc_disable_debug();
+
+#ifdef __cplusplus
+}
+#endif
 #endif /* PEZ_IPC_H */
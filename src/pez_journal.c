@@ -0,0 +1,680 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pez_journal.h"
+
+#define PEZ_JOURNAL_MAGIC           (0x4A5A4550)    /* "PEZJ" */
+#define PEZ_JOURNAL_VERSION         (1)
+#define PEZ_JOURNAL_SUFFIX          ".pezj"
+
+/* record size on segment, records are 8 bytes aligned */
+#define PEZ_JOURNAL_REC_SIZE(len)   \
+    ((sizeof(pez_journal_rec_t) + (len) + 7) & ~(size_t)7)
+
+typedef struct {
+    uint32_t            magic;
+    uint32_t            version;
+    uint64_t            seq;
+    uint64_t            rd_off;         /* records before it are read */
+    uint64_t            reserved;
+} pez_journal_seg_hdr_t;
+
+/*
+ * Followed by uint32_t length of each frame, then frames. len 0 marks end
+ * of data in segment, it's written after each record.
+ */
+typedef struct {
+    uint32_t            len;            /* bytes after this hdr */
+    uint16_t            frame_cnt;
+    uint16_t            reserved;
+} pez_journal_rec_t;
+
+struct pez_journal_seg_s {
+    pez_journal_seg_t   *next;
+    uint64_t            seq;
+    int                 fd;
+    uint8_t             *base;
+    size_t              wr_off;
+    size_t              rd_off;
+    int                 dirty;          /* changed since last commit */
+    char                path[PEZ_JOURNAL_PATH_MAX_LEN];
+};
+
+/*
+ * Flusher thread, syncs for async commits of all journals. Each journal is
+ * queued at most once, with dups of its fds, so segments may be unmapped or
+ * recycled meanwhile.
+ */
+static struct {
+    pthread_once_t      once;
+    int                 started;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;           /* journal queued or synced */
+    pez_journal_t       *head;
+    pez_journal_t       *tail;
+} pez_journal_flusher = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void
+pez_journal_seg_path(pez_journal_t *j, uint64_t seq, char *path) {
+    snprintf(path, PEZ_JOURNAL_PATH_MAX_LEN, "%s/%s.%016llx" PEZ_JOURNAL_SUFFIX,
+             j->dir, j->name, (unsigned long long)seq);
+}
+
+static pez_journal_seg_hdr_t *
+pez_journal_seg_hdr(pez_journal_seg_t *seg) {
+    return (pez_journal_seg_hdr_t *)seg->base;
+}
+
+static pez_journal_rec_t *
+pez_journal_seg_rec(pez_journal_seg_t *seg, size_t off) {
+    return (pez_journal_rec_t *)(seg->base + off);
+}
+
+/*
+ * Map segment file, create it if asked.
+ */
+static pez_journal_seg_t *
+pez_journal_seg_map(const char *path, int create) {
+    pez_journal_seg_t   *seg;
+    struct stat         st;
+
+    seg = calloc(1, sizeof(*seg));
+    if (!seg) {
+        return NULL;
+    }
+    strncpy(seg->path, path, PEZ_JOURNAL_PATH_MAX_LEN - 1);
+    seg->fd = open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (seg->fd < 0) {
+        printf("pez journal: open %s failed: %s\n", path, strerror(errno));
+        goto err;
+    }
+    if (create) {
+        if (ftruncate(seg->fd, PEZ_JOURNAL_SEG_SIZE) != 0) {
+            printf("pez journal: resize %s failed: %s\n",
+                   path, strerror(errno));
+            goto err_unlink;
+        }
+    } else if (fstat(seg->fd, &st) != 0 || st.st_size != PEZ_JOURNAL_SEG_SIZE) {
+        printf("pez journal: %s isn't a segment\n", path);
+        goto err_close;
+    }
+    seg->base = mmap(NULL, PEZ_JOURNAL_SEG_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, seg->fd, 0);
+    if (seg->base == MAP_FAILED) {
+        printf("pez journal: map %s failed: %s\n", path, strerror(errno));
+        goto err_unlink;
+    }
+    return seg;
+
+err_unlink:
+    if (create) {
+        unlink(path);
+    }
+err_close:
+    close(seg->fd);
+err:
+    free(seg);
+    return NULL;
+}
+
+static void
+pez_journal_seg_unmap(pez_journal_seg_t *seg, int remove) {
+    munmap(seg->base, PEZ_JOURNAL_SEG_SIZE);
+    close(seg->fd);
+    if (remove) {
+        unlink(seg->path);
+    }
+    free(seg);
+}
+
+/*
+ * Reset segment for appending as seq.
+ */
+static void
+pez_journal_seg_reset(pez_journal_seg_t *seg, uint64_t seq) {
+    pez_journal_seg_hdr_t *hdr = pez_journal_seg_hdr(seg);
+
+    hdr->magic = PEZ_JOURNAL_MAGIC;
+    hdr->version = PEZ_JOURNAL_VERSION;
+    hdr->seq = seq;
+    hdr->rd_off = sizeof(*hdr);
+    seg->seq = seq;
+    seg->rd_off = seg->wr_off = sizeof(*hdr);
+    seg->dirty = 1;
+    memset(pez_journal_seg_rec(seg, seg->wr_off), 0,
+           sizeof(pez_journal_rec_t));
+}
+
+/*
+ * Find end of data of segment left by previous run. Returns records not
+ * read yet, -1 if segment is broken.
+ */
+static int64_t
+pez_journal_seg_scan(pez_journal_seg_t *seg) {
+    pez_journal_seg_hdr_t   *hdr = pez_journal_seg_hdr(seg);
+    pez_journal_rec_t       *rec;
+    size_t                  off = sizeof(*hdr);
+    int64_t                 num = 0;
+
+    if (hdr->magic != PEZ_JOURNAL_MAGIC ||
+        hdr->version != PEZ_JOURNAL_VERSION ||
+        hdr->rd_off < sizeof(*hdr) || hdr->rd_off > PEZ_JOURNAL_SEG_SIZE) {
+        return -1;
+    }
+    while (off + sizeof(*rec) <= PEZ_JOURNAL_SEG_SIZE) {
+        rec = pez_journal_seg_rec(seg, off);
+        if (rec->len == 0 ||
+            off + PEZ_JOURNAL_REC_SIZE(rec->len) > PEZ_JOURNAL_SEG_SIZE) {
+            break;
+        }
+        if (off >= hdr->rd_off) {
+            num ++;
+        }
+        off += PEZ_JOURNAL_REC_SIZE(rec->len);
+    }
+    seg->seq = hdr->seq;
+    seg->wr_off = off;
+    seg->rd_off = hdr->rd_off < off ? hdr->rd_off : off;
+    return num;
+}
+
+/*
+ * Segment read through, keep it for reuse or remove it.
+ */
+static void
+pez_journal_seg_recycle(pez_journal_t *j, pez_journal_seg_t *seg) {
+    j->recycle_cnt ++;
+    if (j->free_num < PEZ_JOURNAL_SEG_FREE_MAX) {
+        seg->next = j->free_list;
+        j->free_list = seg;
+        j->free_num ++;
+        return;
+    }
+    pez_journal_seg_unmap(seg, 1);
+}
+
+/*
+ * Drop read segments off the head, except the one being appended to.
+ */
+static void
+pez_journal_head_trim(pez_journal_t *j) {
+    pez_journal_seg_t *seg;
+
+    while (j->head && j->head != j->tail &&
+           j->head->rd_off == j->head->wr_off) {
+        seg = j->head;
+        j->head = seg->next;
+        pez_journal_seg_recycle(j, seg);
+    }
+}
+
+/*
+ * Add segment to append to. Recycled one is renamed rather than created.
+ */
+static pez_status
+pez_journal_seg_add(pez_journal_t *j) {
+    pez_journal_seg_t   *seg;
+    char                path[PEZ_JOURNAL_PATH_MAX_LEN];
+    int                 err;
+
+    pez_journal_seg_path(j, j->next_seq, path);
+    seg = j->free_list;
+    if (seg) {
+        /* hdr first, a crash leaves seq of hdr and name apart either way */
+        pez_journal_seg_reset(seg, j->next_seq);
+        if (rename(seg->path, path) != 0) {
+            err = errno;
+            printf("pez journal: rename %s failed: %s\n",
+                   seg->path, strerror(err));
+            return err;
+        }
+        j->free_list = seg->next;
+        j->free_num --;
+        strncpy(seg->path, path, PEZ_JOURNAL_PATH_MAX_LEN - 1);
+    } else {
+        seg = pez_journal_seg_map(path, 1);
+        if (!seg) {
+            return EIO;
+        }
+        pez_journal_seg_reset(seg, j->next_seq);
+    }
+    j->next_seq ++;
+    seg->next = NULL;
+    if (j->tail) {
+        j->tail->next = seg;
+    } else {
+        j->head = seg;
+    }
+    j->tail = seg;
+    return EOK;
+}
+
+static int
+pez_journal_seq_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Collect seqs of segments of j in dir, in order. Returns count, -1 on
+ * failure. *seqs is to be freed by caller.
+ */
+static int
+pez_journal_seq_list(pez_journal_t *j, uint64_t **seqs) {
+    DIR                 *d;
+    struct dirent       *e;
+    size_t              len = strlen(j->name);
+    unsigned long long  seq;
+    char                suffix[8];
+    uint64_t            *list = NULL, *p;
+    int                 num = 0, max = 0;
+
+    d = opendir(j->dir);
+    if (!d) {
+        printf("pez journal: open dir %s failed: %s\n",
+               j->dir, strerror(errno));
+        return -1;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, j->name, len) != 0 || e->d_name[len] != '.' ||
+            sscanf(e->d_name + len + 1, "%16llx%7s", &seq, suffix) != 2 ||
+            strcmp(suffix, PEZ_JOURNAL_SUFFIX) != 0) {
+            continue;
+        }
+        if (num == max) {
+            max = max ? max * 2 : 16;
+            p = realloc(list, max * sizeof(*list));
+            if (!p) {
+                free(list);
+                closedir(d);
+                return -1;
+            }
+            list = p;
+        }
+        list[num ++] = seq;
+    }
+    closedir(d);
+    qsort(list, num, sizeof(*list), pez_journal_seq_cmp);
+    *seqs = list;
+    return num;
+}
+
+/*
+ * Open journal name in dir. Records left by previous run are pending.
+ */
+pez_status
+pez_journal_open(pez_journal_t *j, const char *dir, const char *name) {
+    pez_journal_seg_t   *seg;
+    char                path[PEZ_JOURNAL_PATH_MAX_LEN];
+    uint64_t            *seqs = NULL;
+    int64_t             num;
+    int                 i, cnt, err;
+
+    if (!j || !dir || !name || strlen(dir) >= PEZ_JOURNAL_PATH_MAX_LEN ||
+        strlen(name) >= PEZ_JOURNAL_PATH_MAX_LEN) {
+        return EINVAL;
+    }
+    memset(j, 0, sizeof(*j));
+    strncpy(j->dir, dir, PEZ_JOURNAL_PATH_MAX_LEN - 1);
+    strncpy(j->name, name, PEZ_JOURNAL_PATH_MAX_LEN - 1);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        err = errno;
+        printf("pez journal: mkdir %s failed: %s\n", dir, strerror(err));
+        return err;
+    }
+
+    cnt = pez_journal_seq_list(j, &seqs);
+    if (cnt < 0) {
+        return EIO;
+    }
+    for (i = 0; i < cnt; i ++) {
+        /* by name, files skipped here still take their seq */
+        j->next_seq = seqs[i] + 1;
+        pez_journal_seg_path(j, seqs[i], path);
+        seg = pez_journal_seg_map(path, 0);
+        if (!seg) {
+            continue;
+        }
+        num = pez_journal_seg_scan(seg);
+        if (num < 0) {
+            printf("pez journal: %s is broken, skipped\n", path);
+            pez_journal_seg_unmap(seg, 0);
+            continue;
+        }
+        if (seg->seq != seqs[i]) {
+            /* crashed while recycling it, its records were all read */
+            pez_journal_seg_reset(seg, seqs[i]);
+            num = 0;
+        }
+        if (j->tail) {
+            j->tail->next = seg;
+        } else {
+            j->head = seg;
+        }
+        j->tail = seg;
+        j->rec_num += num;
+    }
+    free(seqs);
+    pez_journal_head_trim(j);
+    return EOK;
+}
+
+/*
+ * Unmap all segments. Pending records stay on disk.
+ */
+void
+pez_journal_close(pez_journal_t *j) {
+    pez_journal_seg_t *seg;
+
+    /* async commit in flight holds dups only, wait for it anyway */
+    pthread_mutex_lock(&pez_journal_flusher.lock);
+    while (j->sync_busy) {
+        pthread_cond_wait(&pez_journal_flusher.cond,
+                          &pez_journal_flusher.lock);
+    }
+    pthread_mutex_unlock(&pez_journal_flusher.lock);
+    free(j->sync_fd);
+    j->sync_fd = NULL;
+    j->sync_fd_max = 0;
+
+    pez_journal_commit(j);
+    while ((seg = j->head) != NULL) {
+        j->head = seg->next;
+        pez_journal_seg_unmap(seg, 0);
+    }
+    while ((seg = j->free_list) != NULL) {
+        j->free_list = seg->next;
+        pez_journal_seg_unmap(seg, 0);
+    }
+    j->tail = NULL;
+    j->free_num = 0;
+}
+
+/*
+ * Append record made of iov frames. It's durable after next commit.
+ */
+pez_status
+pez_journal_append(pez_journal_t *j, const struct iovec *iov, int iov_cnt) {
+    pez_journal_seg_t   *seg;
+    pez_journal_rec_t   *rec;
+    uint8_t             *p;
+    size_t              len, rec_size;
+    uint32_t            frame_len;
+    pez_status          rc;
+    int                 i;
+
+    if (iov_cnt <= 0 || iov_cnt > PEZ_JOURNAL_FRAME_MAX) {
+        return EINVAL;
+    }
+    len = iov_cnt * sizeof(uint32_t);
+    for (i = 0; i < iov_cnt; i ++) {
+        len += iov[i].iov_len;
+    }
+    rec_size = PEZ_JOURNAL_REC_SIZE(len);
+    if (rec_size > PEZ_JOURNAL_SEG_SIZE - sizeof(pez_journal_seg_hdr_t)) {
+        return EMSGSIZE;
+    }
+
+    seg = j->tail;
+    if (!seg || seg->wr_off + rec_size > PEZ_JOURNAL_SEG_SIZE) {
+        rc = pez_journal_seg_add(j);
+        if (rc != EOK) {
+            return rc;
+        }
+        seg = j->tail;
+    }
+
+    rec = pez_journal_seg_rec(seg, seg->wr_off);
+    p = (uint8_t *)(rec + 1);
+    for (i = 0; i < iov_cnt; i ++) {
+        frame_len = iov[i].iov_len;
+        memcpy(p, &frame_len, sizeof(frame_len));
+        p += sizeof(frame_len);
+    }
+    for (i = 0; i < iov_cnt; i ++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    /* end mark first, then len makes record valid */
+    if (seg->wr_off + rec_size + sizeof(*rec) <= PEZ_JOURNAL_SEG_SIZE) {
+        memset(pez_journal_seg_rec(seg, seg->wr_off + rec_size), 0,
+               sizeof(*rec));
+    }
+    rec->frame_cnt = iov_cnt;
+    rec->reserved = 0;
+    __atomic_store_n(&rec->len, (uint32_t)len, __ATOMIC_RELEASE);
+
+    seg->wr_off += rec_size;
+    seg->dirty = 1;
+    j->rec_num ++;
+    j->append_cnt ++;
+    j->dirty = 1;
+    return EOK;
+}
+
+/*
+ * Get frames of oldest pending record. They point into the mapping and are
+ * valid until pez_journal_pop(). ENOENT if there is none.
+ */
+pez_status
+pez_journal_peek(pez_journal_t *j, struct iovec *iov, int *iov_cnt) {
+    pez_journal_seg_t   *seg;
+    pez_journal_rec_t   *rec;
+    uint8_t             *p;
+    uint32_t            frame_len;
+    int                 i;
+
+    pez_journal_head_trim(j);
+    seg = j->head;
+    if (!seg || seg->rd_off == seg->wr_off) {
+        return ENOENT;
+    }
+    rec = pez_journal_seg_rec(seg, seg->rd_off);
+    if (rec->frame_cnt > *iov_cnt) {
+        return EMSGSIZE;
+    }
+    p = (uint8_t *)(rec + 1) + rec->frame_cnt * sizeof(uint32_t);
+    for (i = 0; i < rec->frame_cnt; i ++) {
+        memcpy(&frame_len, (uint8_t *)(rec + 1) + i * sizeof(frame_len),
+               sizeof(frame_len));
+        iov[i].iov_base = p;
+        iov[i].iov_len = frame_len;
+        p += frame_len;
+    }
+    *iov_cnt = rec->frame_cnt;
+    return EOK;
+}
+
+/*
+ * Drop oldest pending record.
+ */
+void
+pez_journal_pop(pez_journal_t *j) {
+    pez_journal_seg_t *seg = j->head;
+
+    if (!seg || seg->rd_off == seg->wr_off) {
+        return;
+    }
+    seg->rd_off += PEZ_JOURNAL_REC_SIZE(pez_journal_seg_rec(seg,
+                                                            seg->rd_off)->len);
+    pez_journal_seg_hdr(seg)->rd_off = seg->rd_off;
+    seg->dirty = 1;
+    j->rec_num --;
+    j->read_cnt ++;
+    j->dirty = 1;
+    pez_journal_head_trim(j);
+}
+
+/*
+ * Sync records appended and read since last commit. Pages dirtied through
+ * the mapping are written back by fdatasync() like by msync(MS_SYNC).
+ */
+pez_status
+pez_journal_commit(pez_journal_t *j) {
+    pez_journal_seg_t   *seg;
+    pez_status          rc = EOK;
+
+    if (!j->dirty) {
+        return EOK;
+    }
+    for (seg = j->head; seg; seg = seg->next) {
+        if (!seg->dirty) {
+            continue;
+        }
+        if (fdatasync(seg->fd) != 0) {
+            rc = errno;
+            continue;
+        }
+        seg->dirty = 0;
+    }
+    if (rc != EOK) {
+        printf("pez journal: %s: sync failed: %s\n", j->name, strerror(rc));
+        return rc;
+    }
+    j->dirty = 0;
+    __atomic_add_fetch(&j->commit_cnt, 1, __ATOMIC_RELAXED);
+    return EOK;
+}
+
+static void *
+pez_journal_flusher_thread(void *arg) {
+    pez_journal_t   *j;
+    pez_status      rc;
+    uint32_t        i;
+
+    for (;;) {
+        pthread_mutex_lock(&pez_journal_flusher.lock);
+        while (!pez_journal_flusher.head) {
+            pthread_cond_wait(&pez_journal_flusher.cond,
+                              &pez_journal_flusher.lock);
+        }
+        j = pez_journal_flusher.head;
+        pez_journal_flusher.head = j->sync_next;
+        if (!pez_journal_flusher.head) {
+            pez_journal_flusher.tail = NULL;
+        }
+        pthread_mutex_unlock(&pez_journal_flusher.lock);
+
+        rc = EOK;
+        for (i = 0; i < j->sync_fd_num; i ++) {
+            if (fdatasync(j->sync_fd[i]) != 0) {
+                rc = errno;
+            }
+            close(j->sync_fd[i]);
+        }
+        if (rc != EOK) {
+            printf("pez journal: %s: sync failed: %s\n",
+                   j->name, strerror(rc));
+        } else {
+            __atomic_add_fetch(&j->commit_cnt, 1, __ATOMIC_RELAXED);
+        }
+
+        pthread_mutex_lock(&pez_journal_flusher.lock);
+        j->sync_fd_num = 0;
+        j->sync_err = rc;
+        j->sync_busy = 0;
+        pthread_cond_broadcast(&pez_journal_flusher.cond);
+        pthread_mutex_unlock(&pez_journal_flusher.lock);
+    }
+    return NULL;
+}
+
+static void
+pez_journal_flusher_start(void) {
+    pthread_t   tid;
+    int         rc;
+
+    rc = pthread_create(&tid, NULL, pez_journal_flusher_thread, NULL);
+    if (rc != 0) {
+        printf("pez journal: create flusher failed: %s\n", strerror(rc));
+        return;
+    }
+    pthread_detach(tid);
+    pez_journal_flusher.started = 1;
+}
+
+/*
+ * Like pez_journal_commit(), but the sync is done by flusher thread and
+ * this returns right away. Records are durable once commit_cnt moves on.
+ * EBUSY if last async commit isn't done yet, try again later. Commits
+ * inline if there is no flusher.
+ */
+pez_status
+pez_journal_commit_async(pez_journal_t *j) {
+    pez_journal_seg_t   *seg;
+    int                 *fds;
+    int                 busy, err;
+    uint32_t            num = 0;
+
+    if (!j->dirty) {
+        return EOK;
+    }
+    pthread_once(&pez_journal_flusher.once, pez_journal_flusher_start);
+    if (!pez_journal_flusher.started) {
+        return pez_journal_commit(j);
+    }
+    pthread_mutex_lock(&pez_journal_flusher.lock);
+    busy = j->sync_busy;
+    err = j->sync_err;
+    j->sync_err = EOK;
+    pthread_mutex_unlock(&pez_journal_flusher.lock);
+    if (busy) {
+        return EBUSY;
+    }
+    for (seg = j->head; seg; seg = seg->next) {
+        /* last sync failed, what it had is synced again */
+        if (err != EOK) {
+            seg->dirty = 1;
+        }
+        num += seg->dirty;
+    }
+    if (num > j->sync_fd_max) {
+        fds = realloc(j->sync_fd, num * sizeof(*fds));
+        if (!fds) {
+            return ENOMEM;
+        }
+        j->sync_fd = fds;
+        j->sync_fd_max = num;
+    }
+    j->sync_fd_num = 0;
+    for (seg = j->head; seg; seg = seg->next) {
+        if (!seg->dirty) {
+            continue;
+        }
+        j->sync_fd[j->sync_fd_num] = dup(seg->fd);
+        if (j->sync_fd[j->sync_fd_num] < 0) {
+            /* left dirty for next commit */
+            continue;
+        }
+        j->sync_fd_num ++;
+        seg->dirty = 0;
+    }
+    j->dirty = (j->sync_fd_num < num);
+    if (j->sync_fd_num == 0) {
+        return EOK;
+    }
+
+    pthread_mutex_lock(&pez_journal_flusher.lock);
+    j->sync_busy = 1;
+    j->sync_next = NULL;
+    if (pez_journal_flusher.tail) {
+        pez_journal_flusher.tail->sync_next = j;
+    } else {
+        pez_journal_flusher.head = j;
+    }
+    pez_journal_flusher.tail = j;
+    pthread_cond_broadcast(&pez_journal_flusher.cond);
+    pthread_mutex_unlock(&pez_journal_flusher.lock);
+    return EOK;
+}
@@ -0,0 +1,85 @@
+#ifndef PEZ_JOURNAL_H
+#define PEZ_JOURNAL_H
+#include <stdint.h>
+#include <sys/uio.h>
+#include "pez_ipc.h"
+
+/*
+ * Durable msg journal.
+ *
+ * Records are appended to memory-mapped segment files named
+ * <dir>/<name>.<seq>.pezj and read back in order. Each record is a list of
+ * frames. Appends only touch the mapping, pez_journal_commit() syncs
+ * segments changed since last commit, so many appends share one sync.
+ * pez_journal_commit_async() leaves the sync to a flusher thread shared by
+ * all journals, so the owner never waits for the disk. Segments read
+ * through are recycled for writing instead of being unlinked.
+ *
+ * Replay position is kept in segment hdr, so pending records of a journal
+ * left by a previous run are found again by pez_journal_open(). Delivery is
+ * at least once: records replayed but not committed yet are replayed again
+ * after a crash. Segment name, not its hdr, tells the seq of a segment, so
+ * a crash while one is recycled costs nothing but that segment.
+ *
+ * Router journals msgs after deadline and shed checks, and replays them
+ * without checking again: deadlines are in monotonic time of the run which
+ * sent them, and replay keeps to journal depth of trgt instead of shedding.
+ * Pointer msgs are never journaled, they're held in memory as for trgts
+ * without journal, so they may overtake journaled msgs sent before them.
+ *
+ * Not thread safe, journal is owned by one thread.
+ */
+
+#define PEZ_JOURNAL_SEG_SIZE        (4 << 20)
+#define PEZ_JOURNAL_SEG_FREE_MAX    (2)     /* segments kept for recycling */
+#define PEZ_JOURNAL_FRAME_MAX       (16)    /* frames per record */
+#define PEZ_JOURNAL_PATH_MAX_LEN    (256)
+
+typedef struct pez_journal_seg_s pez_journal_seg_t;
+
+typedef struct pez_journal_s {
+    char                dir[PEZ_JOURNAL_PATH_MAX_LEN];
+    char                name[PEZ_JOURNAL_PATH_MAX_LEN];
+    pez_journal_seg_t   *head;          /* read from */
+    pez_journal_seg_t   *tail;          /* appended to */
+    pez_journal_seg_t   *free_list;
+    uint32_t            free_num;
+    uint64_t            next_seq;
+    uint64_t            rec_num;        /* records not read yet */
+    int                 dirty;          /* appended or read since commit */
+    uint64_t            append_cnt;
+    uint64_t            read_cnt;
+    uint64_t            commit_cnt;     /* by flusher too, atomic */
+    uint64_t            recycle_cnt;
+    /* async commit, guarded by flusher lock while sync_busy */
+    int                 *sync_fd;       /* dups of segments to sync */
+    uint32_t            sync_fd_num;
+    uint32_t            sync_fd_max;
+    int                 sync_busy;      /* handed to flusher */
+    int                 sync_err;       /* of last async commit */
+    struct pez_journal_s *sync_next;
+} pez_journal_t;
+
+pez_status pez_journal_open(pez_journal_t *j,
+                            const char *dir,
+                            const char *name);
+
+void pez_journal_close(pez_journal_t *j);
+
+pez_status pez_journal_append(pez_journal_t *j,
+                              const struct iovec *iov,
+                              int iov_cnt);
+
+pez_status pez_journal_peek(pez_journal_t *j, struct iovec *iov, int *iov_cnt);
+
+void pez_journal_pop(pez_journal_t *j);
+
+pez_status pez_journal_commit(pez_journal_t *j);
+
+pez_status pez_journal_commit_async(pez_journal_t *j);
+
+static inline int
+pez_journal_empty(pez_journal_t *j) {
+    return j->rec_num == 0;
+}
+#endif /* PEZ_JOURNAL_H */
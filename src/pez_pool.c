@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pez_pool.h"
+
+#define PEZ_POOL_NIL                (0xFFFFFFFFU)
+
+/* free list head is idx of 1st free object, tagged against ABA */
+#define PEZ_POOL_HEAD(tag, idx)     (((uint64_t)(tag) << 32) | (idx))
+#define PEZ_POOL_HEAD_IDX(head)     ((uint32_t)(head))
+#define PEZ_POOL_HEAD_TAG(head)     ((uint32_t)((head) >> 32))
+
+typedef struct {
+    pez_pool_t          *pool;
+    uint32_t            idx;
+    uint32_t            next;           /* next free object */
+    uint32_t            in_use;
+} __attribute__((aligned(PEZ_POOL_ALIGN))) pez_pool_obj_hdr_t;
+
+static pez_pool_obj_hdr_t *
+pez_pool_hdr(pez_pool_t *pool, uint32_t idx) {
+    return (pez_pool_obj_hdr_t *)(pool->slab + (size_t)idx * pool->slot_size);
+}
+
+/*
+ * Allocate obj_num objects of obj_size, all free.
+ */
+pez_status
+pez_pool_init(pez_pool_t *pool,
+              const char *name,
+              size_t obj_size,
+              uint32_t obj_num) {
+    pez_pool_obj_hdr_t  *h;
+    uint32_t            i;
+
+    if (!pool || !name || obj_size == 0 || obj_num == 0 ||
+        obj_num == PEZ_POOL_NIL) {
+        return EINVAL;
+    }
+    memset(pool, 0, sizeof(*pool));
+    strncpy(pool->name, name, PEZ_POOL_NAME_MAX_LEN - 1);
+    pool->slot_size = sizeof(pez_pool_obj_hdr_t) +
+                      ((obj_size + PEZ_POOL_ALIGN - 1) &
+                       ~(size_t)(PEZ_POOL_ALIGN - 1));
+    pool->obj_num = obj_num;
+    if (posix_memalign((void **)&pool->slab, 64,
+                       pool->slot_size * obj_num) != 0) {
+        printf("pez pool: %s: no mem for %u objects\n", name, obj_num);
+        return ENOMEM;
+    }
+    for (i = 0; i < obj_num; i ++) {
+        h = pez_pool_hdr(pool, i);
+        h->pool = pool;
+        h->idx = i;
+        h->next = (i + 1 < obj_num) ? i + 1 : PEZ_POOL_NIL;
+        h->in_use = 0;
+    }
+    pool->head = PEZ_POOL_HEAD(0, 0);
+    return EOK;
+}
+
+/*
+ * Free all objects, whether they're put back or not.
+ */
+void
+pez_pool_fini(pez_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+    free(pool->slab);
+    pool->slab = NULL;
+    pool->obj_num = 0;
+}
+
+/*
+ * Take a free object. NULL if there is none, pool never grows.
+ */
+void *
+pez_pool_get(pez_pool_t *pool) {
+    pez_pool_obj_hdr_t  *h;
+    uint64_t            head, next;
+
+    head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+    do {
+        if (PEZ_POOL_HEAD_IDX(head) == PEZ_POOL_NIL) {
+            __atomic_fetch_add(&pool->empty_cnt, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        /* may be taken meanwhile, then tag has changed and cas fails */
+        h = pez_pool_hdr(pool, PEZ_POOL_HEAD_IDX(head));
+        next = PEZ_POOL_HEAD(PEZ_POOL_HEAD_TAG(head) + 1,
+                             __atomic_load_n(&h->next, __ATOMIC_RELAXED));
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, next, 1,
+                                          __ATOMIC_ACQ_REL,
+                                          __ATOMIC_ACQUIRE));
+    h->in_use = 1;
+    __atomic_fetch_add(&pool->get_cnt, 1, __ATOMIC_RELAXED);
+    return h + 1;
+}
+
+/*
+ * Give object back to its pool, by any thread.
+ */
+void
+pez_pool_put(void *obj) {
+    pez_pool_obj_hdr_t  *h;
+    pez_pool_t          *pool;
+    uint64_t            head, next;
+
+    if (!obj) {
+        return;
+    }
+    h = (pez_pool_obj_hdr_t *)obj - 1;
+    pool = h->pool;
+    if (!__atomic_exchange_n(&h->in_use, 0, __ATOMIC_RELAXED)) {
+        printf("pez pool: %s: object %u put twice\n", pool->name, h->idx);
+        return;
+    }
+    head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&h->next, PEZ_POOL_HEAD_IDX(head), __ATOMIC_RELAXED);
+        next = PEZ_POOL_HEAD(PEZ_POOL_HEAD_TAG(head) + 1, h->idx);
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, next, 1,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+    __atomic_fetch_add(&pool->put_cnt, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * pez_ptr_release_fn of pool objects, arg isn't used.
+ */
+void
+pez_pool_release(void *obj, void *arg) {
+    (void)arg;
+    pez_pool_put(obj);
+}
+
+void
+pez_pool_counter_print(pez_pool_t *pool) {
+    uint64_t get_cnt = __atomic_load_n(&pool->get_cnt, __ATOMIC_RELAXED);
+    uint64_t put_cnt = __atomic_load_n(&pool->put_cnt, __ATOMIC_RELAXED);
+
+    printf("pool counter:%s: objects:%u, in use:%llu, got:%llu, put:%llu, "
+           "empty:%llu\n",
+           pool->name,
+           pool->obj_num,
+           get_cnt - put_cnt,
+           get_cnt,
+           put_cnt,
+           __atomic_load_n(&pool->empty_cnt, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,56 @@
+#ifndef PEZ_POOL_H
+#define PEZ_POOL_H
+#include <stdint.h>
+#include <stddef.h>
+#include "pez_ipc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed size object pool.
+ *
+ * One pool per object type, all objects are allocated by pez_pool_init().
+ * Get and put are lock free, so objects can be got by one thread and put
+ * back by another, e.g. by the receiver of a pointer msg or by router when
+ * it drops one. Each object is preceded by a small hdr which leads back to
+ * its pool, so pez_pool_put() only needs the object.
+ *
+ *      pez_ptr_t ptr = {obj, pez_pool_release, NULL, FOO_TYPE};
+ *      pez_ipc_msg_send_ptr("worker", "main", &ptr);
+ */
+
+#define PEZ_POOL_NAME_MAX_LEN       (32)
+#define PEZ_POOL_ALIGN              (16)    /* of objects */
+
+typedef struct {
+    char                name[PEZ_POOL_NAME_MAX_LEN];
+    size_t              slot_size;      /* object and its hdr */
+    uint32_t            obj_num;
+    uint8_t             *slab;
+    uint64_t            head __attribute__((aligned(64)));  /* tag, idx */
+    uint64_t            get_cnt __attribute__((aligned(64)));
+    uint64_t            put_cnt;
+    uint64_t            empty_cnt;      /* get found no free object */
+} pez_pool_t;
+
+pez_status pez_pool_init(pez_pool_t *pool,
+                         const char *name,
+                         size_t obj_size,
+                         uint32_t obj_num);
+
+void pez_pool_fini(pez_pool_t *pool);
+
+void * pez_pool_get(pez_pool_t *pool);
+
+void pez_pool_put(void *obj);
+
+void pez_pool_release(void *obj, void *arg);
+
+void pez_pool_counter_print(pez_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* PEZ_POOL_H */
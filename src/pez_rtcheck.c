@@ -0,0 +1,107 @@
+#ifdef PEZ_RT_CHECK
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pez_rtcheck.h"
+
+/* glibc's own allocator, which the interposed ones go on to */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+
+/* initial-exec, so reading it never allocates, not even the 1st time */
+static __thread int pez_rtcheck_depth
+    __attribute__((tls_model("initial-exec")));
+
+/* armed from start, warming up is asked for */
+static int pez_rtcheck_armed = 1;
+
+/*
+ * Turn checks of all threads on or off.
+ */
+void
+pez_rtcheck_arm(int on) {
+    __atomic_store_n(&pez_rtcheck_armed, on, __ATOMIC_RELAXED);
+}
+
+void
+pez_rtcheck_enter(void) {
+    pez_rtcheck_depth ++;
+}
+
+void
+pez_rtcheck_leave(void) {
+    pez_rtcheck_depth --;
+}
+
+/*
+ * Abort if current thread is in a hot path. Only write(2) is used, stdio
+ * may allocate itself.
+ */
+static void
+pez_rtcheck(const char *fn, size_t size) {
+    char    msg[128];
+    int     len;
+
+    if (pez_rtcheck_depth == 0 ||
+        !__atomic_load_n(&pez_rtcheck_armed, __ATOMIC_RELAXED)) {
+        return;
+    }
+    pez_rtcheck_depth = 0;
+    len = snprintf(msg, sizeof(msg),
+                   "pez rt check: %s(%zu) in real-time hot path\n",
+                   fn, size);
+    if (len > 0) {
+        (void)write(STDERR_FILENO, msg, len);
+    }
+    abort();
+}
+
+void *
+malloc(size_t size) {
+    pez_rtcheck("malloc", size);
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t num, size_t size) {
+    pez_rtcheck("calloc", num * size);
+    return __libc_calloc(num, size);
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    pez_rtcheck("realloc", size);
+    return __libc_realloc(ptr, size);
+}
+
+void *
+memalign(size_t align, size_t size) {
+    pez_rtcheck("memalign", size);
+    return __libc_memalign(align, size);
+}
+
+void *
+aligned_alloc(size_t align, size_t size) {
+    pez_rtcheck("aligned_alloc", size);
+    return __libc_memalign(align, size);
+}
+
+int
+posix_memalign(void **ptr, size_t align, size_t size) {
+    void *p;
+
+    pez_rtcheck("posix_memalign", size);
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    p = __libc_memalign(align, size);
+    if (!p) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+#endif /* PEZ_RT_CHECK */
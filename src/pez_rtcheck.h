@@ -0,0 +1,37 @@
+#ifndef PEZ_RTCHECK_H
+#define PEZ_RTCHECK_H
+
+/*
+ * Real-time check, built in by -DPEZ_RT_CHECK(make RT_CHECK=1).
+ *
+ * malloc() and its kin are interposed for the whole process. Any of them
+ * called by a thread while it's in a hot path of a real-time domain,
+ * e.g. by zmq copying a frame it can't keep inline, aborts the process
+ * with what was asked for. Without PEZ_RT_CHECK hot paths aren't marked
+ * and nothing is interposed.
+ *
+ * zmq pipes queue msgs in chunks and keep one spare chunk. A pipe
+ * allocates until its first chunk is passed, and whenever a burst is
+ * deeper than ever before. Warm up with bursts as deep as expected while
+ * unarmed, then arm:
+ *
+ *      pez_rtcheck_arm(0);
+ *      ... warm up ...
+ *      pez_rtcheck_arm(1);
+ */
+
+#ifdef PEZ_RT_CHECK
+void pez_rtcheck_arm(int on);
+
+void pez_rtcheck_enter(void);
+
+void pez_rtcheck_leave(void);
+
+#define PEZ_RT_HOT_BEGIN(rt)    do { if (rt) pez_rtcheck_enter(); } while (0)
+#define PEZ_RT_HOT_END(rt)      do { if (rt) pez_rtcheck_leave(); } while (0)
+#else
+#define pez_rtcheck_arm(on)     do { } while (0)
+#define PEZ_RT_HOT_BEGIN(rt)    do { } while (0)
+#define PEZ_RT_HOT_END(rt)      do { } while (0)
+#endif /* PEZ_RT_CHECK */
+#endif /* PEZ_RTCHECK_H */
@@ -0,0 +1,546 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <zmq.h>
+#include "pez_ipc.h"
+#include "pez_task.h"
+
+#define PEZ_TASK_DEQUE_SIZE         (1024)      /* power of 2 */
+#define PEZ_TASK_DEQUE_MASK         (PEZ_TASK_DEQUE_SIZE - 1)
+#define PEZ_TASK_ID_MAX_LEN         (32)
+
+typedef struct pez_task_s {
+    pez_task_fn         fn;
+    void                *arg;
+    pez_domain_t        *reply_dom;     /* of reply_to */
+    char                reply_to[PEZ_TASK_ID_MAX_LEN];
+    struct pez_task_s   *next;          /* inbox link */
+} pez_task_t;
+
+/*
+ * Chase-Lev deque. Owner pushes and pops at bottom, others steal at top.
+ */
+typedef struct {
+    int64_t             top;
+    int64_t             bottom;
+    pez_task_t          *buf[PEZ_TASK_DEQUE_SIZE];
+} pez_task_deque_t;
+
+typedef struct {
+    pthread_t           tid;
+    unsigned int        index;
+    char                identity[PEZ_TASK_ID_MAX_LEN];
+    struct ev_loop      *loop;
+    ev_async            wakeup;         /* inbox isn't empty */
+    ev_idle             work;           /* active while there may be tasks */
+    pez_task_deque_t    deque;
+    pthread_mutex_t     lock;           /* protects inbox */
+    pez_task_t          *inbox_head;
+    pez_task_t          *inbox_tail;
+    int                 idle;
+    uint64_t            run_cnt;
+    uint64_t            steal_cnt;
+    uint64_t            drop_cnt;       /* msgs sent to worker */
+} pez_task_worker_t;
+
+typedef struct {
+    unsigned int        thread_num;
+    unsigned int        ready_num;
+    unsigned int        fail_num;       /* threads which couldn't start */
+    int                 stop;
+    unsigned int        rr_next;
+    pthread_mutex_t     lock;
+    pthread_cond_t      ready;
+    pez_task_worker_t   *worker;
+} pez_task_pool_t;
+
+static pez_task_pool_t pez_task_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread pez_task_worker_t *pez_task_self;
+
+/*
+ * Push by owner. ENOBUFS if deque is full.
+ */
+static pez_status
+pez_task_deque_push(pez_task_deque_t *d, pez_task_t *task) {
+    int64_t b, t;
+
+    b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= PEZ_TASK_DEQUE_SIZE) {
+        return ENOBUFS;
+    }
+    __atomic_store_n(&d->buf[b & PEZ_TASK_DEQUE_MASK], task,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return EOK;
+}
+
+/*
+ * Pop by owner. NULL if empty.
+ */
+static pez_task_t *
+pez_task_deque_pop(pez_task_deque_t *d) {
+    pez_task_t  *task = NULL;
+    int64_t     b, t;
+
+    b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t <= b) {
+        task = __atomic_load_n(&d->buf[b & PEZ_TASK_DEQUE_MASK],
+                               __ATOMIC_RELAXED);
+        if (t == b) {
+            /* last one, race with stealers */
+            if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED)) {
+                task = NULL;
+            }
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+/*
+ * Steal by others. NULL if empty or lost the race.
+ */
+static pez_task_t *
+pez_task_deque_steal(pez_task_deque_t *d) {
+    pez_task_t  *task;
+    int64_t     b, t;
+
+    t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+    task = __atomic_load_n(&d->buf[t & PEZ_TASK_DEQUE_MASK],
+                           __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return task;
+}
+
+/*
+ * Take one task from inbox of w. NULL if empty.
+ */
+static pez_task_t *
+pez_task_inbox_get(pez_task_worker_t *w) {
+    pez_task_t *task;
+
+    pthread_mutex_lock(&w->lock);
+    task = w->inbox_head;
+    if (task) {
+        w->inbox_head = task->next;
+        if (!w->inbox_head) {
+            w->inbox_tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return task;
+}
+
+/*
+ * Wake up one idle worker other than self
+ */
+static void
+pez_task_wake_idle(pez_task_worker_t *self) {
+    pez_task_worker_t   *w;
+    unsigned int        i;
+
+    for (i = 1; i < pez_task_pool.thread_num; i ++) {
+        w = &pez_task_pool.worker[(self->index + i) %
+                                  pez_task_pool.thread_num];
+        if (__atomic_load_n(&w->idle, __ATOMIC_ACQUIRE)) {
+            ev_async_send(w->loop, &w->wakeup);
+            return;
+        }
+    }
+}
+
+/*
+ * Run task and send its result back to submitter. Pool threads are in
+ * default domain, results to other domains are posted.
+ */
+static void
+pez_task_run(pez_task_worker_t *w, pez_task_t *task) {
+    uint8_t     result[PEZ_TASK_RESULT_MAX_SIZE];
+    size_t      size;
+    pez_status  rc;
+
+    size = task->fn(task->arg, result, sizeof(result));
+    w->run_cnt ++;
+    if (size > sizeof(result)) {
+        printf("pez task: %s: result too big(%zu)\n", w->identity, size);
+    } else if (size != 0 && task->reply_to[0] != '\0') {
+        if (task->reply_dom == pez_domain_default()) {
+            rc = pez_ipc_msg_send(task->reply_to, w->identity, result, size);
+        } else {
+            rc = pez_domain_msg_post(task->reply_dom, task->reply_to,
+                                     w->identity, result, size);
+        }
+        if (rc != EOK) {
+            printf("pez task: %s: failed to send result to %s\n",
+                   w->identity, task->reply_to);
+        }
+    }
+    free(task);
+}
+
+/*
+ * Run one task per loop iteration, so that msgs and other events of the
+ * worker aren't starved by a long queue. Own deque first, then steal.
+ */
+static void
+pez_task_work_cb(struct ev_loop *loop, ev_idle *iw, int revents) {
+    pez_task_worker_t   *w = iw->data;
+    pez_task_worker_t   *victim;
+    pez_task_t          *task;
+    unsigned int        i;
+
+    task = pez_task_deque_pop(&w->deque);
+    if (!task) {
+        task = pez_task_inbox_get(w);
+    }
+    for (i = 1; !task && i < pez_task_pool.thread_num; i ++) {
+        victim = &pez_task_pool.worker[(w->index + i) %
+                                       pez_task_pool.thread_num];
+        task = pez_task_deque_steal(&victim->deque);
+        if (!task) {
+            task = pez_task_inbox_get(victim);
+        }
+        if (task) {
+            /* victim is busy, more idle workers may help */
+            w->steal_cnt ++;
+            pez_task_wake_idle(w);
+        }
+    }
+    if (!task) {
+        /* nothing to do, let loop sleep until woken up */
+        __atomic_store_n(&w->idle, 1, __ATOMIC_RELEASE);
+        ev_idle_stop(loop, iw);
+        return;
+    }
+    pez_task_run(w, task);
+}
+
+/*
+ * Tasks arrived in inbox. Move them to deque where others can steal them.
+ */
+static void
+pez_task_wakeup_cb(struct ev_loop *loop, ev_async *aw, int revents) {
+    pez_task_worker_t   *w = aw->data;
+    pez_task_t          *task;
+    int                 cnt = 0;
+
+    if (__atomic_load_n(&pez_task_pool.stop, __ATOMIC_ACQUIRE)) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    __atomic_store_n(&w->idle, 0, __ATOMIC_RELEASE);
+    while ((task = pez_task_inbox_get(w)) != NULL) {
+        if (pez_task_deque_push(&w->deque, task) != EOK) {
+            pez_task_run(w, task);
+            continue;
+        }
+        cnt ++;
+    }
+    if (cnt > 1) {
+        pez_task_wake_idle(w);
+    }
+    ev_idle_start(loop, &w->work);
+}
+
+/*
+ * Msgs to pool threads aren't expected, drop them. Objects of pointer msgs
+ * are released by pez_ipc_msg_recv_view().
+ */
+static void
+pez_task_ipc_handler(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    pez_task_worker_t   *w = pez_task_self;
+    pez_msg_view_t      view;
+
+    if (pez_ipc_msg_recv_view(wz->zsock, &view) == EOK) {
+        pez_ipc_msg_release(&view);
+    }
+    if (w) {
+        w->drop_cnt ++;
+    }
+}
+
+/*
+ * Let pool init know whether thread is up
+ */
+static void
+pez_task_thread_started(int ok) {
+    pthread_mutex_lock(&pez_task_pool.lock);
+    if (ok) {
+        pez_task_pool.ready_num ++;
+    } else {
+        pez_task_pool.fail_num ++;
+    }
+    pthread_cond_broadcast(&pez_task_pool.ready);
+    pthread_mutex_unlock(&pez_task_pool.lock);
+}
+
+/*
+ * pool thread
+ */
+static void *
+pez_task_thread(void *arg) {
+    pez_task_worker_t   *w = arg;
+    struct ev_loop      *loop;
+    pez_status          rc;
+
+    loop = ev_loop_new(0);
+    if (!loop) {
+        printf("pez task: unable to create loop for %s\n", w->identity);
+        pez_task_thread_started(0);
+        return NULL;
+    }
+    rc = pez_ipc_thread_init_rx(loop, w->identity, pez_task_ipc_handler);
+    if (rc != EOK) {
+        printf("pez task: %s failed to init ipc\n", w->identity);
+        ev_loop_destroy(loop);
+        pez_task_thread_started(0);
+        return NULL;
+    }
+    w->loop = loop;
+    pez_task_self = w;
+
+    ev_async_init(&w->wakeup, pez_task_wakeup_cb);
+    w->wakeup.data = w;
+    ev_async_start(w->loop, &w->wakeup);
+    ev_idle_init(&w->work, pez_task_work_cb);
+    w->work.data = w;
+    w->idle = 1;
+    pez_task_thread_started(1);
+
+    ev_run(w->loop, 0);
+
+    /* stopped, pool init failed */
+    pez_ipc_endpoint_close(pez_ipc_endpoint_get(w->identity));
+    ev_loop_destroy(w->loop);
+    return NULL;
+}
+
+/*
+ * Stop and join the first started threads of pool, then forget the pool,
+ * so that pez_task_pool_init() can be tried again.
+ */
+static void
+pez_task_pool_stop(unsigned int started) {
+    pez_task_worker_t   *w;
+    unsigned int        i;
+
+    __atomic_store_n(&pez_task_pool.stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < started; i ++) {
+        w = &pez_task_pool.worker[i];
+        if (w->loop) {
+            ev_async_send(w->loop, &w->wakeup);
+        }
+        pthread_join(w->tid, NULL);
+    }
+    for (i = 0; i < pez_task_pool.thread_num; i ++) {
+        pthread_mutex_destroy(&pez_task_pool.worker[i].lock);
+    }
+    free(pez_task_pool.worker);
+    pez_task_pool.worker = NULL;
+    pez_task_pool.thread_num = 0;
+    pez_task_pool.ready_num = 0;
+    pez_task_pool.fail_num = 0;
+    pez_task_pool.rr_next = 0;
+    pez_task_pool.stop = 0;
+}
+
+/*
+ * Create thread_num pool threads. They are registered in pez as
+ * pez_task0..pez_taskN. It should be invoked only once, after pez_ipc_init.
+ */
+pez_status
+pez_task_pool_init(unsigned int thread_num) {
+    pez_task_worker_t   *w;
+    unsigned int        i;
+    pez_status          rc;
+
+    if (thread_num == 0 || thread_num > PEZ_TASK_THREAD_MAX_NUM) {
+        return EINVAL;
+    }
+    if (pez_task_pool.worker) {
+        printf("pez task: pool is created already\n");
+        return EINVAL;
+    }
+    pez_task_pool.worker = calloc(thread_num, sizeof(pez_task_worker_t));
+    if (!pez_task_pool.worker) {
+        return ENOMEM;
+    }
+    pez_task_pool.thread_num = thread_num;
+    for (i = 0; i < thread_num; i ++) {
+        w = &pez_task_pool.worker[i];
+        w->index = i;
+        snprintf(w->identity, PEZ_TASK_ID_MAX_LEN, "pez_task%u", i);
+        pthread_mutex_init(&w->lock, NULL);
+    }
+
+    rc = EOK;
+    for (i = 0; i < thread_num; i ++) {
+        rc = pthread_create(&pez_task_pool.worker[i].tid, NULL,
+                            pez_task_thread, &pez_task_pool.worker[i]);
+        if (rc != 0) {
+            printf("pez task: create thread failed: %s\n", strerror(rc));
+            break;
+        }
+    }
+
+    /* tasks can't be submitted before all loops are up */
+    pthread_mutex_lock(&pez_task_pool.lock);
+    while (pez_task_pool.ready_num + pez_task_pool.fail_num != i) {
+        pthread_cond_wait(&pez_task_pool.ready, &pez_task_pool.lock);
+    }
+    pthread_mutex_unlock(&pez_task_pool.lock);
+    if (rc == EOK && pez_task_pool.fail_num) {
+        rc = EAGAIN;
+    }
+    if (rc != EOK) {
+        pez_task_pool_stop(i);
+        return rc;
+    }
+    return EOK;
+}
+
+static pez_status pez_task_submit_dom(pez_task_fn fn,
+                                      void *arg,
+                                      pez_domain_t *dom,
+                                      const char *reply_to);
+
+/*
+ * Submit task. Result, if any, is sent to the calling thread as a pez msg
+ * from pez_taskN, to its 1st endpoint, in whatever domain that is. Pool
+ * threads drop msgs, so they must say where results go by
+ * pez_task_submit_to().
+ */
+pez_status
+pez_task_submit(pez_task_fn fn, void *arg) {
+    pez_endpoint_t  *ep;
+    char            *id;
+
+    if (pez_task_self) {
+        printf("pez task: %s: submit with a reply target\n",
+               pez_task_self->identity);
+        return EINVAL;
+    }
+    id = pez_ipc_identity_get();
+    if (!strcmp(id, "NULL")) {
+        return pez_task_submit_dom(fn, arg, NULL, NULL);
+    }
+    ep = pez_ipc_endpoint_get(id);
+    return pez_task_submit_dom(fn, arg, pez_ipc_endpoint_domain(ep), id);
+}
+
+/*
+ * Submit task whose result is sent to thread reply_to of default domain.
+ * NULL if result is not wanted. A pool thread can't get results.
+ */
+pez_status
+pez_task_submit_to(pez_task_fn fn, void *arg, const char *reply_to) {
+    return pez_task_submit_dom(fn, arg, pez_domain_default(), reply_to);
+}
+
+/*
+ * Submit task whose result is sent to reply_to of dom.
+ */
+static pez_status
+pez_task_submit_dom(pez_task_fn fn,
+                    void *arg,
+                    pez_domain_t *dom,
+                    const char *reply_to) {
+    pez_task_worker_t   *w;
+    pez_task_t          *task;
+    unsigned int        i;
+
+    if (!fn) {
+        return EINVAL;
+    }
+    if (!pez_task_pool.worker) {
+        printf("pez task: pool isn't created\n");
+        return EINVAL;
+    }
+    if (reply_to) {
+        if (strnlen(reply_to, PEZ_TASK_ID_MAX_LEN) == PEZ_TASK_ID_MAX_LEN) {
+            return EINVAL;
+        }
+        for (i = 0; dom == pez_domain_default() &&
+                    i < pez_task_pool.thread_num; i ++) {
+            if (!strcmp(reply_to, pez_task_pool.worker[i].identity)) {
+                printf("pez task: results can't go to %s\n", reply_to);
+                return EINVAL;
+            }
+        }
+    }
+    task = malloc(sizeof(*task));
+    if (!task) {
+        return ENOMEM;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+    task->reply_dom = dom;
+    task->reply_to[0] = '\0';
+    if (reply_to) {
+        strcpy(task->reply_to, reply_to);
+    }
+
+    /* submitted by pool thread itself: own deque, no lock */
+    w = pez_task_self;
+    if (w && pez_task_deque_push(&w->deque, task) == EOK) {
+        ev_idle_start(w->loop, &w->work);
+        pez_task_wake_idle(w);
+        return EOK;
+    }
+
+    w = &pez_task_pool.worker[__atomic_fetch_add(&pez_task_pool.rr_next, 1,
+                                                 __ATOMIC_RELAXED) %
+                              pez_task_pool.thread_num];
+    pthread_mutex_lock(&w->lock);
+    if (w->inbox_tail) {
+        w->inbox_tail->next = task;
+    } else {
+        w->inbox_head = task;
+    }
+    w->inbox_tail = task;
+    pthread_mutex_unlock(&w->lock);
+    ev_async_send(w->loop, &w->wakeup);
+    return EOK;
+}
+
+/*
+ * Print counters of pool threads
+ */
+void
+pez_task_counter_print() {
+    pez_task_worker_t   *w;
+    unsigned int        i;
+
+    for (i = 0; i < pez_task_pool.thread_num; i ++) {
+        w = &pez_task_pool.worker[i];
+        printf("task counter:%s: run:%llu, stolen:%llu, dropped msgs:%llu\n",
+               w->identity,
+               (unsigned long long)w->run_cnt,
+               (unsigned long long)w->steal_cnt,
+               (unsigned long long)w->drop_cnt);
+    }
+}
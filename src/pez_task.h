@@ -0,0 +1,42 @@
+#ifndef PEZ_TASK_H
+#define PEZ_TASK_H
+#include "pez_ipc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Task executor.
+ *
+ * A pool of pez threads, each running a libev loop and owning a work
+ * stealing deque. Tasks submitted by a pool thread go to its own deque,
+ * others are handed to pool threads round robin. Idle pool threads steal
+ * from busy ones.
+ *
+ * Task writes its result into result buffer and returns its size. If the
+ * size isn't 0 the result is sent as a pez msg to the thread which
+ * submitted the task, so it arrives by the submitter's own ev_zsock cb,
+ * also if that endpoint is in another domain than pool threads(default).
+ * Submitters which aren't registered in pez get no result. Tasks submitted
+ * by tasks name where results go, pool threads can't take them.
+ */
+
+#define PEZ_TASK_THREAD_MAX_NUM     (64)
+
+#define PEZ_TASK_RESULT_MAX_SIZE    (INPROC_MAX_MSG_SIZE)
+
+typedef size_t (*pez_task_fn)(void *arg, void *result, size_t result_size);
+
+pez_status pez_task_pool_init(unsigned int thread_num);
+
+pez_status pez_task_submit(pez_task_fn fn, void *arg);
+
+pez_status pez_task_submit_to(pez_task_fn fn, void *arg, const char *reply_to);
+
+void pez_task_counter_print();
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* PEZ_TASK_H */
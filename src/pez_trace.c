@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pez_trace.h"
+
+/* event of snapshot and the ring(track) it came from */
+typedef struct {
+    pez_trace_event_t   ev;
+    int                 track;
+} pez_trace_item_t;
+
+/* span ending at event of kind, and kind of event it starts at */
+static const struct {
+    const char          *name;
+    int                 from;
+} pez_trace_span[PEZ_TRACE_KIND_NUM] = {
+    [PEZ_TRACE_SEND]            = {NULL, -1},
+    [PEZ_TRACE_RT_RECV]         = {"queued at router", PEZ_TRACE_SEND},
+    [PEZ_TRACE_RT_SEND]         = {"held by router", PEZ_TRACE_RT_RECV},
+    [PEZ_TRACE_RX]              = {"queued at receiver", PEZ_TRACE_RT_SEND},
+    [PEZ_TRACE_HANDLER_BEGIN]   = {"wait for handler", PEZ_TRACE_RX},
+    [PEZ_TRACE_HANDLER_END]     = {"handler", PEZ_TRACE_HANDLER_BEGIN},
+};
+
+/*
+ * Copy events of ring into ev, which has room for PEZ_TRACE_RING_SIZE.
+ * Returns number of events copied, oldest first.
+ */
+uint32_t
+pez_trace_snapshot(const pez_trace_ring_t *ring, pez_trace_event_t *ev) {
+    uint64_t    head, start, valid, i;
+    uint32_t    num = 0;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    start = head > PEZ_TRACE_RING_SIZE ? head - PEZ_TRACE_RING_SIZE : 0;
+    for (i = start; i < head; i ++) {
+        ev[i - start] = ring->ev[i & (PEZ_TRACE_RING_SIZE - 1)];
+    }
+
+    /* slots reused while copying, and the one being written, are torn */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    valid = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    valid = valid >= PEZ_TRACE_RING_SIZE ? valid - PEZ_TRACE_RING_SIZE + 1 : 0;
+    for (i = start; i < head; i ++) {
+        if (i >= valid) {
+            ev[num ++] = ev[i - start];
+        }
+    }
+    return num;
+}
+
+static int
+pez_trace_item_cmp(const void *a, const void *b) {
+    const pez_trace_item_t *x = a, *y = b;
+
+    if (x->ev.trace_id != y->ev.trace_id) {
+        return x->ev.trace_id < y->ev.trace_id ? -1 : 1;
+    }
+    if (x->ev.ts_ns != y->ev.ts_ns) {
+        return x->ev.ts_ns < y->ev.ts_ns ? -1 : 1;
+    }
+    return (int)x->ev.kind - (int)y->ev.kind;
+}
+
+/*
+ * Write name as JSON string, quotes, backslashes and control chars escaped.
+ */
+static void
+pez_trace_str_write(FILE *fp, const char *name) {
+    const unsigned char *c;
+
+    fputc('"', fp);
+    for (c = (const unsigned char *)name; *c; c ++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(fp, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(fp, "\\u%04x", *c);
+        } else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/*
+ * Write events of rings as Chrome trace JSON to path. Track of rings[i] is
+ * named names[i], NULL rings are skipped.
+ */
+pez_status
+pez_trace_dump(const char *path,
+               pez_trace_ring_t *const *rings,
+               const char *const *names,
+               int ring_num) {
+    pez_trace_event_t   *ev;
+    pez_trace_item_t    *items, *a, *b;
+    pez_trace_item_t    *last[PEZ_TRACE_KIND_NUM];
+    size_t              num = 0, i;
+    uint64_t            base = UINT64_MAX;
+    uint32_t            cnt, j;
+    FILE                *fp;
+    int                 t, first = 1, err;
+
+    if (!path || !rings || !names || ring_num <= 0) {
+        return EINVAL;
+    }
+    ev = malloc(sizeof(*ev) * PEZ_TRACE_RING_SIZE);
+    items = malloc(sizeof(*items) * PEZ_TRACE_RING_SIZE * ring_num);
+    if (!ev || !items) {
+        free(ev);
+        free(items);
+        return ENOMEM;
+    }
+    for (t = 0; t < ring_num; t ++) {
+        if (!rings[t]) {
+            continue;
+        }
+        cnt = pez_trace_snapshot(rings[t], ev);
+        for (j = 0; j < cnt; j ++) {
+            items[num].ev = ev[j];
+            items[num].track = t;
+            if (ev[j].ts_ns < base) {
+                base = ev[j].ts_ns;
+            }
+            num ++;
+        }
+    }
+    free(ev);
+    qsort(items, num, sizeof(*items), pez_trace_item_cmp);
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        err = errno;
+        printf("pez trace: open %s failed: %s\n", path, strerror(err));
+        free(items);
+        return err;
+    }
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (t = 0; t < ring_num; t ++) {
+        if (!rings[t]) {
+            continue;
+        }
+        fprintf(fp, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"name\":\"thread_name\",\"args\":{\"name\":",
+                first ? "" : ",\n", t);
+        pez_trace_str_write(fp, names[t] ? names[t] : "");
+        fprintf(fp, "}}");
+        first = 0;
+    }
+    /*
+     * A msg handled by a thread may be sent on with same trace id, so
+     * events of hops interleave. Each span starts at latest event of the
+     * kind before it.
+     */
+    for (i = 0; i < num; i ++) {
+        b = &items[i];
+        if (i == 0 || items[i - 1].ev.trace_id != b->ev.trace_id) {
+            memset(last, 0, sizeof(last));
+        }
+        if (b->ev.kind >= PEZ_TRACE_KIND_NUM) {
+            continue;
+        }
+        last[b->ev.kind] = b;
+        if (pez_trace_span[b->ev.kind].from < 0 ||
+            !(a = last[pez_trace_span[b->ev.kind].from])) {
+            continue;
+        }
+        fprintf(fp, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%s\","
+                "\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"trace_id\":\"%016llx\"}}",
+                first ? "" : ",\n",
+                b->track,
+                pez_trace_span[b->ev.kind].name,
+                (a->ev.ts_ns - base) / 1000.0,
+                (b->ev.ts_ns - a->ev.ts_ns) / 1000.0,
+                (unsigned long long)b->ev.trace_id);
+        first = 0;
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    free(items);
+    if (fclose(fp) != 0) {
+        return errno;
+    }
+    return EOK;
+}
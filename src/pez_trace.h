@@ -0,0 +1,69 @@
+#ifndef PEZ_TRACE_H
+#define PEZ_TRACE_H
+#include <stdint.h>
+#include "pez_ipc.h"
+
+/*
+ * Trace event rings.
+ *
+ * Each thread records events of sampled msgs into its own ring, so no
+ * lock or atomic rmw is needed. The ring keeps the latest
+ * PEZ_TRACE_RING_SIZE events. Any thread can take a snapshot meanwhile,
+ * events overwritten while copying are left out.
+ *
+ * pez_trace_dump() joins events of all rings by trace id and writes them
+ * as Chrome trace JSON(chrome://tracing, ui.perfetto.dev). Time between
+ * two steps of a msg is shown as a span on the track of the later one,
+ * named after where the msg was: queued at router, held by router, queued
+ * at receiver, waiting for handler or in handler.
+ */
+
+#define PEZ_TRACE_RING_SIZE         (8192)      /* power of 2 */
+
+typedef enum {
+    PEZ_TRACE_SEND,                 /* sender handed it to zmq */
+    PEZ_TRACE_RT_RECV,              /* router took it off its socket */
+    PEZ_TRACE_RT_SEND,              /* router sent it to trgt */
+    PEZ_TRACE_RX,                   /* receiver took it off its socket */
+    PEZ_TRACE_HANDLER_BEGIN,
+    PEZ_TRACE_HANDLER_END,
+    PEZ_TRACE_KIND_NUM,
+} pez_trace_kind_t;
+
+typedef struct {
+    uint64_t            ts_ns;          /* CLOCK_MONOTONIC */
+    uint64_t            trace_id;
+    uint32_t            kind;
+    uint32_t            reserved;
+} pez_trace_event_t;
+
+typedef struct {
+    uint64_t            head;           /* events ever recorded */
+    pez_trace_event_t   ev[PEZ_TRACE_RING_SIZE];
+} pez_trace_ring_t;
+
+/*
+ * Only the owner thread records into ring.
+ */
+static inline void
+pez_trace_record(pez_trace_ring_t *ring,
+                 uint32_t kind,
+                 uint64_t trace_id,
+                 uint64_t ts_ns) {
+    uint64_t            head = ring->head;
+    pez_trace_event_t   *ev = &ring->ev[head & (PEZ_TRACE_RING_SIZE - 1)];
+
+    ev->ts_ns = ts_ns;
+    ev->trace_id = trace_id;
+    ev->kind = kind;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t pez_trace_snapshot(const pez_trace_ring_t *ring,
+                            pez_trace_event_t *ev);
+
+pez_status pez_trace_dump(const char *path,
+                          pez_trace_ring_t *const *rings,
+                          const char *const *names,
+                          int ring_num);
+#endif /* PEZ_TRACE_H */
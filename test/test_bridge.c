@@ -0,0 +1,81 @@
+#include <assert.h>
+#include <stdio.h>
+#include "pez_ipc.h"
+
+/*
+ * Declare names in dom until it's full, returns how many it took.
+ */
+static int
+test_fill(pez_domain_t *dom, int max) {
+    char    name[32];
+    int     i;
+
+    for (i = 0; i < max || max < 0; i ++) {
+        snprintf(name, sizeof(name), "n%d", i);
+        if (pez_domain_thread_declare(dom, name) != EOK) {
+            break;
+        }
+    }
+    return i;
+}
+
+/*
+ * Bridges failing for want of room give back names they took, in both
+ * domains.
+ */
+static void
+test_bridge_no_room(void) {
+    pez_config_t    cfg;
+    pez_domain_t    *a, *b, *c, *d;
+    int             max;
+
+    pez_ipc_config_init(&cfg);
+    a = pez_domain_create("a", &cfg);
+    b = pez_domain_create("b", &cfg);
+    c = pez_domain_create("c", &cfg);
+    d = pez_domain_create("d", &cfg);
+    assert(a && b && c && d);
+
+    /* no room for via, trgt taken in a is given back */
+    max = test_fill(b, -1);
+    assert(max > 1);
+    assert(pez_domain_bridge(a, "t", b, "via") == ENOMEM);
+    assert(test_fill(a, -1) == max);
+
+    /* via taken in c, then no room for trgt there */
+    assert(test_fill(c, max - 1) == max - 1);
+    assert(pez_domain_bridge(d, "t", c, "via") == ENOMEM);
+    assert(pez_domain_thread_declare(c, "via") == EOK);
+    assert(test_fill(d, -1) == max);
+}
+
+/*
+ * trgt declared in advance stays declared when bridge fails.
+ */
+static void
+test_bridge_declared(void) {
+    pez_config_t    cfg;
+    pez_domain_t    *e, *f;
+
+    pez_ipc_config_init(&cfg);
+    e = pez_domain_create("e", &cfg);
+    f = pez_domain_create("f", &cfg);
+    assert(e && f);
+
+    assert(pez_domain_thread_declare(e, "t") == EOK);
+    assert(pez_domain_thread_declare(f, "busy") == EOK);
+    assert(pez_domain_bridge(e, "t", f, "busy") == EEXIST);
+    test_fill(f, -1);
+    assert(pez_domain_bridge(e, "t", f, "via") == ENOMEM);
+    assert(pez_domain_bridge(e, "t", pez_domain_default(), "via") == EOK);
+    assert(pez_domain_bridge(e, "t", pez_domain_default(), "via2") == EEXIST);
+}
+
+int
+main(void) {
+    pez_ipc_init();
+    test_bridge_no_room();
+    test_bridge_declared();
+    printf("test_bridge: ok\n");
+    return 0;
+}
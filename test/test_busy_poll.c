@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Endpoint busy-polling its inbox shares its loop with another endpoint and
+ * a timer. Neither of them is held up by the spinning.
+ */
+
+#define TEST_MSG_NUM        (200)
+#define TEST_TICK_MS        (1)
+#define TEST_GAP_MAX_NS     (20000000ULL)
+
+static uint32_t             spin_cnt, other_cnt, tick_cnt;
+static unsigned long long   tick_last, tick_gap_max;
+static unsigned long        spin_hit, spin_miss;
+static volatile int         ready;
+
+static unsigned long long
+test_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+test_spin_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    uint32_t    m;
+    size_t      size;
+
+    if (pez_ipc_msg_recv(wz->zsock, &m, sizeof(m), &size) == EOK) {
+        __atomic_add_fetch(&spin_cnt, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void
+test_other_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    int32_t     m;
+    size_t      size;
+
+    if (pez_ipc_msg_recv(wz->zsock, &m, sizeof(m), &size) != EOK) {
+        return;
+    }
+    if (m < 0) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    __atomic_add_fetch(&other_cnt, 1, __ATOMIC_RELEASE);
+}
+
+static void
+test_tick_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+    unsigned long long now = test_now_ns();
+
+    if (tick_last && now - tick_last > tick_gap_max) {
+        tick_gap_max = now - tick_last;
+    }
+    tick_last = now;
+    tick_cnt ++;
+}
+
+static void *
+test_loop_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *spin, *other;
+    ev_timer        tick;
+
+    spin = pez_ipc_endpoint_open(loop, "spin", test_spin_cb, NULL);
+    other = pez_ipc_endpoint_open(loop, "other", test_other_cb, NULL);
+    assert(spin && other);
+
+    assert(pez_ipc_busy_poll_set("spin", PEZ_BUSY_POLL_MAX_US + 1) == EINVAL);
+    assert(pez_ipc_busy_poll_set("spin", PEZ_BUSY_POLL_MAX_US) == EOK);
+    ev_timer_init(&tick, test_tick_cb, TEST_TICK_MS / 1000.,
+                  TEST_TICK_MS / 1000.);
+    ev_timer_start(loop, &tick);
+    ready = 1;
+    ev_run(loop, 0);
+
+    spin_hit = pez_ipc_endpoint_zsock(spin)->spin_hit_cnt;
+    spin_miss = pez_ipc_endpoint_zsock(spin)->spin_miss_cnt;
+    ev_timer_stop(loop, &tick);
+    assert(pez_ipc_endpoint_close(spin) == EOK);
+    assert(pez_ipc_endpoint_close(other) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+int
+main(void) {
+    pthread_t   tid;
+    int32_t     m;
+    int         i, n;
+
+    pez_ipc_init();
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    pthread_create(&tid, NULL, test_loop_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+
+    /* trickle to spin keeps it spinning, every 10th msg goes to other */
+    for (i = 0; i < TEST_MSG_NUM * 10; i ++) {
+        m = i;
+        assert(pez_ipc_msg_send(i % 10 ? "spin" : "other", "snd",
+                                &m, sizeof(m)) == EOK);
+        usleep(50);
+    }
+    for (n = 0; n < 5000; n ++) {
+        if (__atomic_load_n(&other_cnt, __ATOMIC_ACQUIRE) == TEST_MSG_NUM &&
+            __atomic_load_n(&spin_cnt, __ATOMIC_ACQUIRE) ==
+            TEST_MSG_NUM * 9) {
+            break;
+        }
+        usleep(1000);
+    }
+    /* nothing comes in, spin misses */
+    usleep(100000);
+    m = -1;
+    assert(pez_ipc_msg_send("other", "snd", &m, sizeof(m)) == EOK);
+    pthread_join(tid, NULL);
+
+    assert(other_cnt == TEST_MSG_NUM && spin_cnt == TEST_MSG_NUM * 9);
+    assert(spin_hit + spin_miss > 0);
+    assert(tick_cnt > 10 && tick_gap_max < TEST_GAP_MAX_NS);
+    printf("test_busy_poll: ok\n");
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+#include "pez_codec.h"
+
+#define TEST_FOO_TYPE       (21)
+#define TEST_MSG_NUM        (100)
+
+#define FOREACH_FOO_FIELD(FIELD, ARRAY)     \
+        FIELD(int32_t, value)               \
+        FIELD(uint32_t, flags)              \
+        FIELD(uint64_t, stamp)              \
+        ARRAY(char, name, 24)
+
+PEZ_CODEC_DEFINE(foo, TEST_FOO_TYPE, 1, FOREACH_FOO_FIELD)
+
+/* foo of a newer sender, a field appended */
+#define FOREACH_FOO2_FIELD(FIELD, ARRAY)    \
+        FOREACH_FOO_FIELD(FIELD, ARRAY)     \
+        FIELD(uint64_t, extra)
+
+PEZ_CODEC_DEFINE(foo2, TEST_FOO_TYPE, 2, FOREACH_FOO2_FIELD)
+
+typedef struct {
+    int32_t             last;
+    uint32_t            err;
+    volatile int        ready;
+} test_rcv_t;
+
+/*
+ * Init fills hdr and zeroes fields, only on a buffer big and aligned enough.
+ */
+static void
+test_init(void) {
+    uint8_t     buf[sizeof(foo2_t) + PEZ_CODEC_ALIGN] PEZ_CODEC_ALIGNED;
+    foo_t       *foo;
+
+    assert(foo_init(buf, sizeof(foo_t) - 1) == NULL);
+    assert(foo_init(buf + 1, sizeof(buf) - 1) == NULL);
+    assert(foo_init(NULL, sizeof(buf)) == NULL);
+
+    memset(buf, 0xFF, sizeof(buf));
+    foo = foo_init_sub(buf, sizeof(buf), 3);
+    assert(foo == (foo_t *)buf);
+    assert(foo->hdr.tag == PEZ_CODEC_TAG && foo->hdr.magic == PEZ_CODEC_MAGIC);
+    assert(foo->hdr.type == TEST_FOO_TYPE && foo->hdr.version == 1);
+    assert(foo->hdr.size == sizeof(foo_t) && foo->hdr.subtype == 3);
+    assert(foo->value == 0 && foo->stamp == 0 && foo->name[0] == '\0');
+    assert(buf[sizeof(foo_t)] == 0xFF);
+    assert(pez_codec_type(buf, sizeof(foo_t)) == TEST_FOO_TYPE);
+}
+
+/*
+ * View takes the same or a newer version, nothing truncated, misaligned
+ * or of another type. Protobuf encodings are never taken as fixed ones.
+ */
+static void
+test_view(void) {
+    uint8_t         buf[sizeof(foo2_t) + PEZ_CODEC_ALIGN] PEZ_CODEC_ALIGNED;
+    const uint8_t   pb[] = {0x08, 0x96, 0x01, 0x12, 0x02, 'h', 'i', 0, 0, 0,
+                            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    foo2_t          *foo2;
+    foo_t           *foo;
+
+    foo2 = foo2_init(buf, sizeof(buf));
+    foo2->value = 7;
+    foo2->extra = 9;
+    assert(foo_view(buf, sizeof(foo2_t)) == (const foo_t *)buf);
+    assert(foo_view(buf, sizeof(foo2_t))->value == 7);
+    assert(foo2_view(buf, sizeof(foo2_t))->extra == 9);
+    assert(foo2_view(buf, sizeof(foo2_t) - 1) == NULL);
+
+    foo = foo_init(buf, sizeof(buf));
+    assert(foo_view(buf, sizeof(foo_t)));
+    assert(foo2_view(buf, sizeof(foo_t)) == NULL);
+    foo->hdr.type ++;
+    assert(foo_view(buf, sizeof(foo_t)) == NULL);
+    foo->hdr.type --;
+
+    memmove(buf + 1, buf, sizeof(foo_t));
+    assert(foo_view(buf + 1, sizeof(foo_t)) == NULL);
+
+    assert(!pez_codec_is_fixed(pb, sizeof(pb)));
+    assert(pez_codec_type(pb, sizeof(pb)) == -1);
+    assert(!pez_codec_is_fixed(buf, sizeof(pez_codec_hdr_t) - 1));
+}
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    test_rcv_t      *r = wz->data;
+    uint8_t         buf[INPROC_MAX_MSG_SIZE] PEZ_CODEC_ALIGNED;
+    const foo_t     *foo;
+    size_t          size;
+    char            name[24];
+
+    if (pez_ipc_msg_recv(wz->zsock, buf, sizeof(buf), &size) != EOK) {
+        r->err ++;
+        return;
+    }
+    foo = foo_view(buf, size);
+    if (!foo) {
+        r->err ++;
+        return;
+    }
+    snprintf(name, sizeof(name), "foo%d", foo->value);
+    if (foo->value != r->last + 1 || foo->stamp != (uint64_t)foo->value * 3 ||
+        strcmp(foo->name, name)) {
+        r->err ++;
+    }
+    r->last = foo->value;
+    if (foo->value == TEST_MSG_NUM - 1) {
+        ev_break(loop, EVBREAK_ALL);
+    }
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    test_rcv_t      *r = arg;
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+
+    ep = pez_ipc_endpoint_open(loop, "rcv", test_rcv_cb, r);
+    assert(ep);
+    r->ready = 1;
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+/*
+ * Filled in place by sender, read in place by receiver.
+ */
+static void
+test_send_recv(void) {
+    uint8_t     buf[sizeof(foo_t)] PEZ_CODEC_ALIGNED;
+    test_rcv_t  r = {-1, 0, 0};
+    pthread_t   tid;
+    foo_t       *foo;
+    int32_t     i;
+
+    pthread_create(&tid, NULL, test_rcv_thread, &r);
+    while (!r.ready) {
+        usleep(1000);
+    }
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        foo = foo_init(buf, sizeof(buf));
+        foo->value = i;
+        foo->stamp = (uint64_t)i * 3;
+        snprintf(foo->name, sizeof(foo->name), "foo%d", i);
+        assert(pez_ipc_msg_send("rcv", "snd", foo, sizeof(*foo)) == EOK);
+    }
+    pthread_join(tid, NULL);
+    assert(r.err == 0 && r.last == TEST_MSG_NUM - 1);
+}
+
+int
+main(void) {
+    test_init();
+    test_view();
+
+    assert(pez_ipc_init() == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    test_send_recv();
+    printf("test_codec: ok\n");
+    return 0;
+}
@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include "pez_ipc.h"
+
+/*
+ * zmq ctx is shared by all domains and set up by the 1st one. Later ones
+ * must leave zmq options default or ask for the same.
+ */
+static void
+test_zmq_ctx_conflict(void) {
+    pez_config_t    cfg;
+
+    pez_ipc_config_init(&cfg);
+    cfg.zmq_io_threads = 2;
+    cfg.zmq_max_sockets = 256;
+    assert(pez_ipc_init_config(&cfg) == EOK);
+
+    assert(pez_domain_create("same", &cfg));
+
+    pez_ipc_config_init(&cfg);
+    assert(pez_domain_create("dflt", &cfg));
+
+    cfg.zmq_io_threads = 3;
+    assert(pez_domain_create("io", &cfg) == NULL);
+
+    pez_ipc_config_init(&cfg);
+    cfg.zmq_thread_cpu_mask = 1;
+    assert(pez_domain_create("mask", &cfg) == NULL);
+
+    pez_ipc_config_init(&cfg);
+    cfg.zmq_thread_sched_policy = 0;
+    assert(pez_domain_create("sched", &cfg) == NULL);
+
+    /* name isn't taken by failed ones */
+    pez_ipc_config_init(&cfg);
+    assert(pez_domain_create("io", &cfg));
+}
+
+/*
+ * Pinning a thread which fails leaves its affinity as it was.
+ */
+static void
+test_affinity(void) {
+    cpu_set_t   was, set;
+    int         cpu;
+
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    assert(pthread_getaffinity_np(pthread_self(), sizeof(was), &was) == 0);
+    for (cpu = 0; !CPU_ISSET(cpu, &was); cpu ++) {
+    }
+
+    assert(pez_ipc_thread_affinity_set("nobody", cpu, PEZ_NUMA_ANY) != EOK);
+    assert(pez_ipc_thread_affinity_set("snd", PEZ_CPU_ANY,
+                                       PEZ_NUMA_ANY) == EINVAL);
+    assert(pez_ipc_thread_affinity_set("snd", CPU_SETSIZE - 1,
+                                       PEZ_NUMA_ANY) != EOK);
+    assert(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+    assert(CPU_EQUAL(&set, &was));
+
+    assert(pez_ipc_thread_affinity_set("snd", cpu, PEZ_NUMA_ANY) == EOK);
+    assert(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+    assert(CPU_COUNT(&set) == 1 && CPU_ISSET(cpu, &set));
+    assert(pthread_setaffinity_np(pthread_self(), sizeof(was), &was) == 0);
+}
+
+int
+main(void) {
+    test_zmq_ctx_conflict();
+    test_affinity();
+    printf("test_config: ok\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Several slow trgts get conflated msgs at once. Each gets the latest value
+ * of every key, in order, and fewer msgs than were sent.
+ */
+
+#define TEST_RCV_NUM        (3)
+#define TEST_KEY_NUM        (8)
+#define TEST_VAL_NUM        (200)
+
+typedef struct {
+    char                id[8];
+    int32_t             last[TEST_KEY_NUM];
+    uint32_t            done_num;       /* keys at their last value */
+    uint32_t            cnt;
+    uint32_t            err;
+    pthread_t           tid;
+    volatile int        ready;
+} test_rcv_t;
+
+static test_rcv_t   rcv[TEST_RCV_NUM];
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    test_rcv_t  *r = wz->data;
+    int32_t     m[2];
+    size_t      size;
+
+    if (pez_ipc_msg_recv(wz->zsock, m, sizeof(m), &size) != EOK ||
+        size != sizeof(m) || m[0] < 0 || m[0] >= TEST_KEY_NUM ||
+        m[1] <= r->last[m[0]]) {
+        r->err ++;
+        return;
+    }
+    r->last[m[0]] = m[1];
+    r->cnt ++;
+    if (m[1] == TEST_VAL_NUM - 1 && ++ r->done_num == TEST_KEY_NUM) {
+        ev_break(loop, EVBREAK_ALL);
+    }
+    /* slow, so that router holds msgs for it */
+    usleep(1000);
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    test_rcv_t      *r = arg;
+    struct ev_loop  *loop = ev_loop_new(0);
+
+    assert(pez_ipc_thread_init_rx_ex(loop, r->id, test_rcv_cb, r) == EOK);
+    r->ready = 1;
+    ev_run(loop, 0);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+int
+main(int argc, char **argv) {
+    int32_t     m[2];
+    int         i, k, v;
+
+    pez_ipc_init();
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    for (i = 0; i < TEST_RCV_NUM; i ++) {
+        snprintf(rcv[i].id, sizeof(rcv[i].id), "rcv%d", i);
+        memset(rcv[i].last, 0xFF, sizeof(rcv[i].last));
+        pthread_create(&rcv[i].tid, NULL, test_rcv_thread, &rcv[i]);
+        while (!rcv[i].ready) {
+            usleep(1000);
+        }
+    }
+
+    for (v = 0; v < TEST_VAL_NUM; v ++) {
+        for (k = 0; k < TEST_KEY_NUM; k ++) {
+            for (i = 0; i < TEST_RCV_NUM; i ++) {
+                m[0] = k;
+                m[1] = v;
+                assert(pez_ipc_msg_send_conflate(rcv[i].id, "snd", k, m,
+                                                 sizeof(m)) == EOK);
+            }
+        }
+        usleep(200);
+    }
+    for (i = 0; i < TEST_RCV_NUM; i ++) {
+        pthread_join(rcv[i].tid, NULL);
+        assert(rcv[i].err == 0);
+        assert(rcv[i].cnt < TEST_KEY_NUM * TEST_VAL_NUM);
+    }
+    printf("test_conflate: ok\n");
+    return 0;
+}
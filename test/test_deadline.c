@@ -0,0 +1,195 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Msgs with deadline are dropped by router or by recv once they're late,
+ * and shed by router while trgt is overloaded. Plain msgs never are.
+ */
+
+#define TEST_MSG_NUM        (100)
+#define TEST_SHED_DEPTH     (5)
+#define TEST_TTL_LONG_US    (10000000)
+
+enum {
+    TEST_PLAIN,
+    TEST_TTL,
+    TEST_HOLD,          /* handler waits until hold is cleared */
+    TEST_SYNC,
+    TEST_STOP,
+    TEST_KIND_NUM,
+};
+
+static uint32_t         got[TEST_KIND_NUM];
+static uint32_t         late;   /* recv said ETIMEDOUT */
+static volatile int     hold;
+static volatile int     ready;
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    int32_t     m;
+    size_t      size;
+    pez_status  rc;
+
+    rc = pez_ipc_msg_recv(wz->zsock, &m, sizeof(m), &size);
+    if (rc == ETIMEDOUT) {
+        __atomic_add_fetch(&late, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    assert(rc == EOK && size == sizeof(m) && m >= 0 && m < TEST_KIND_NUM);
+    if (m == TEST_STOP) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    while (m == TEST_HOLD && hold) {
+        usleep(1000);
+    }
+    __atomic_add_fetch(&got[m], 1, __ATOMIC_RELEASE);
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+
+    ep = pez_ipc_endpoint_open(loop, "rcv", test_rcv_cb, NULL);
+    assert(ep);
+    ready = 1;
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+static void
+test_send(int32_t kind, uint32_t ttl_us) {
+    if (ttl_us) {
+        assert(pez_ipc_msg_send_ttl("rcv", "snd", &kind, sizeof(kind),
+                                    ttl_us) == EOK);
+    } else {
+        assert(pez_ipc_msg_send("rcv", "snd", &kind, sizeof(kind)) == EOK);
+    }
+}
+
+static uint32_t
+test_got(int kind) {
+    return __atomic_load_n(&got[kind], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Wait for a sync msg sent last, all before it are in or gone by then.
+ */
+static void
+test_sync(void) {
+    uint32_t    was = test_got(TEST_SYNC);
+    int         n;
+
+    test_send(TEST_SYNC, 0);
+    for (n = 0; n < 5000 && test_got(TEST_SYNC) == was; n ++) {
+        usleep(1000);
+    }
+    assert(test_got(TEST_SYNC) == was + 1);
+}
+
+static void
+test_clear(void) {
+    test_sync();
+    memset(got, 0, sizeof(got));
+    late = 0;
+}
+
+/*
+ * Msgs late already when router or recv gets them are never handed out.
+ */
+static void
+test_late(void) {
+    int i;
+
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        test_send(TEST_TTL, 1);
+    }
+    test_sync();
+    assert(test_got(TEST_TTL) == 0);
+    test_clear();
+
+    /* handler is held up while they're queued, they're late by recv */
+    hold = 1;
+    test_send(TEST_HOLD, 0);
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        test_send(TEST_TTL, 20000);
+    }
+    usleep(50000);
+    hold = 0;
+    test_sync();
+    assert(test_got(TEST_TTL) == 0 && late == TEST_MSG_NUM);
+    test_clear();
+}
+
+/*
+ * While trgt has more than shed depth msgs in queue, msgs with deadline
+ * are shed, plain ones still go through. Once it catches up nothing is.
+ */
+static void
+test_shed(void) {
+    int i;
+
+    assert(pez_ipc_shed_set("nobody", TEST_SHED_DEPTH) == EINVAL);
+    assert(pez_ipc_shed_set("rcv", TEST_SHED_DEPTH) == EOK);
+
+    hold = 1;
+    test_send(TEST_HOLD, 0);
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        test_send(TEST_PLAIN, 0);
+        test_send(TEST_TTL, TEST_TTL_LONG_US);
+    }
+    usleep(50000);
+    hold = 0;
+    test_sync();
+    assert(test_got(TEST_PLAIN) == TEST_MSG_NUM);
+    assert(test_got(TEST_TTL) > 0 && test_got(TEST_TTL) <= TEST_SHED_DEPTH);
+    assert(late == 0);
+    test_clear();
+
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        test_send(TEST_TTL, TEST_TTL_LONG_US);
+        usleep(100);
+    }
+    test_sync();
+    assert(test_got(TEST_TTL) == TEST_MSG_NUM);
+    test_clear();
+
+    /* off, nothing is shed however deep */
+    assert(pez_ipc_shed_set("rcv", 0) == EOK);
+    hold = 1;
+    test_send(TEST_HOLD, 0);
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        test_send(TEST_TTL, TEST_TTL_LONG_US);
+    }
+    usleep(50000);
+    hold = 0;
+    test_sync();
+    assert(test_got(TEST_TTL) == TEST_MSG_NUM);
+}
+
+int
+main(void) {
+    pthread_t   tid;
+
+    assert(pez_ipc_init() == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+
+    test_late();
+    test_shed();
+
+    test_send(TEST_STOP, 0);
+    pthread_join(tid, NULL);
+    printf("test_deadline: ok\n");
+    return 0;
+}
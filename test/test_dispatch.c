@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pez_codec.h"
+#include "pez_dispatch.h"
+
+#define FOREACH_TEST_MSG_FIELD(FIELD, ARRAY)    \
+        FIELD(int32_t, value)
+
+PEZ_CODEC_DEFINE(test_msg, 7, 1, FOREACH_TEST_MSG_FIELD)
+
+#define FOREACH_TEST_BIG_FIELD(FIELD, ARRAY)    \
+        FIELD(int32_t, value)                   \
+        ARRAY(uint8_t, data, 2 * INPROC_MAX_MSG_SIZE)
+
+PEZ_CODEC_DEFINE(test_big, 8, 1, FOREACH_TEST_BIG_FIELD)
+
+static int handled;
+static int misaligned;
+
+static void
+test_handler(pez_dispatch_msg_t *msg, void *arg) {
+    handled ++;
+    if (((uintptr_t)msg->buf % PEZ_CODEC_ALIGN) != 0) {
+        misaligned ++;
+    }
+}
+
+static void
+test_codec_handler(pez_dispatch_msg_t *msg, void *arg) {
+    (*(int *)arg) ++;
+    if (((uintptr_t)msg->buf % PEZ_CODEC_ALIGN) != 0) {
+        misaligned ++;
+    }
+}
+
+/*
+ * Type of protobuf envelope, field 1 varint.
+ */
+static void
+test_peek_type(void) {
+    uint8_t small[] = {0x08, 0x05};
+    uint8_t multi[] = {0x08, 0x96, 0x01};                   /* 150 */
+    uint8_t max[] = {0x08, 0xFF, 0xFF, 0xFF, 0xFF, 0x07};   /* INT32_MAX */
+    uint8_t int_min[] = {0x08, 0x80, 0x80, 0x80, 0x80, 0x08};
+    uint8_t over[] = {0x08, 0x80, 0x80, 0x80, 0x80, 0x10};
+    /* -1 as int32 field, sign extended to 10 bytes */
+    uint8_t neg[] = {0x08, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                     0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    uint8_t neg2[] = {0x08, 0xFE, 0xFF, 0xFF, 0xFF, 0xFF,
+                      0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    uint8_t unterm[] = {0x08, 0x80, 0x80};
+    uint8_t too_long[] = {0x08, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+                          0x80, 0x80, 0x80, 0x80, 0x00};
+    uint8_t other[] = {0x10, 0x05};
+    uint8_t buf[sizeof(test_msg_t)] PEZ_CODEC_ALIGNED;
+
+    assert(pez_dispatch_peek_type(small, sizeof(small)) == 5);
+    assert(pez_dispatch_peek_type(multi, sizeof(multi)) == 150);
+    assert(pez_dispatch_peek_type(max, sizeof(max)) == INT32_MAX);
+    assert(pez_dispatch_peek_type(int_min, sizeof(int_min)) ==
+           PEZ_DISPATCH_TYPE_INVAL);
+    assert(pez_dispatch_peek_type(over, sizeof(over)) ==
+           PEZ_DISPATCH_TYPE_INVAL);
+    assert(pez_dispatch_peek_type(neg, sizeof(neg)) ==
+           PEZ_DISPATCH_TYPE_INVAL);
+    assert(pez_dispatch_peek_type(neg2, sizeof(neg2)) ==
+           PEZ_DISPATCH_TYPE_INVAL);
+    assert(pez_dispatch_peek_type(unterm, sizeof(unterm)) ==
+           PEZ_DISPATCH_TYPE_INVAL);
+    assert(pez_dispatch_peek_type(too_long, sizeof(too_long)) ==
+           PEZ_DISPATCH_TYPE_INVAL);
+    assert(pez_dispatch_peek_type(other, sizeof(other)) ==
+           PEZ_DISPATCH_TYPE_INVAL);
+    assert(pez_dispatch_peek_type(NULL, 0) == PEZ_DISPATCH_TYPE_INVAL);
+
+    assert(test_msg_init(buf, sizeof(buf)));
+    assert(pez_dispatch_peek_type(buf, sizeof(buf)) == 7);
+    assert(((test_msg_t *)buf)->hdr.subtype == 0);
+    assert(test_msg_init_sub(buf, sizeof(buf), 9)->hdr.subtype == 9);
+    assert(pez_dispatch_peek_type(buf, sizeof(buf)) == 7);
+}
+
+/*
+ * Bad types are counted as errors, never looked up.
+ */
+static void
+test_dispatch_msg(void) {
+    static pez_dispatch_t   d;
+    uint8_t small[] = {0x08, 0x05};
+    uint8_t big[] = {0x08, 0x80, 0x02};                     /* 256 */
+    uint8_t int_min[] = {0x08, 0x80, 0x80, 0x80, 0x80, 0x08};
+    uint8_t neg[] = {0x08, 0xFE, 0xFF, 0xFF, 0xFF, 0xFF,
+                     0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+
+    assert(pez_dispatch_init(&d, "test") == EOK);
+    assert(pez_dispatch_register(&d, PEZ_DISPATCH_FMT_PROTOBUF, 5,
+                                 test_handler, NULL, NULL, NULL) == EOK);
+    assert(pez_dispatch_register(&d, PEZ_DISPATCH_FMT_PROTOBUF, -1,
+                                 test_handler, NULL, NULL, NULL) == EINVAL);
+    assert(pez_dispatch_register(&d, PEZ_DISPATCH_FMT_NUM, 5,
+                                 test_handler, NULL, NULL, NULL) == EINVAL);
+
+    pez_dispatch_msg(&d, small, sizeof(small));
+    assert(handled == 1 && d.entry[PEZ_DISPATCH_FMT_PROTOBUF][5].cnt == 1);
+
+    pez_dispatch_msg(&d, big, sizeof(big));
+    assert(d.drop_cnt == 1);
+
+    pez_dispatch_msg(&d, int_min, sizeof(int_min));
+    pez_dispatch_msg(&d, neg, sizeof(neg));
+    assert(d.err_cnt == 2 && handled == 1);
+}
+
+/*
+ * Codec and protobuf msgs of same type go to handlers of their own format.
+ */
+static void
+test_format(void) {
+    static pez_dispatch_t   d;
+    uint8_t                 pb[] = {0x08, 0x07};
+    uint8_t                 buf[sizeof(test_msg_t)] PEZ_CODEC_ALIGNED;
+    pez_dispatch_format_t   format;
+    int                     codec_cnt = 0;
+
+    handled = 0;
+    assert(test_msg_init(buf, sizeof(buf)));
+    assert(pez_dispatch_peek(buf, sizeof(buf), &format) == 7 &&
+           format == PEZ_DISPATCH_FMT_CODEC);
+    assert(pez_dispatch_peek(pb, sizeof(pb), &format) == 7 &&
+           format == PEZ_DISPATCH_FMT_PROTOBUF);
+
+    /* only codec one is handled */
+    assert(pez_dispatch_init(&d, "format") == EOK);
+    assert(pez_dispatch_register(&d, PEZ_DISPATCH_FMT_CODEC, 7,
+                                 test_codec_handler, NULL, NULL,
+                                 &codec_cnt) == EOK);
+    pez_dispatch_msg(&d, pb, sizeof(pb));
+    assert(codec_cnt == 0 && d.drop_cnt == 1);
+    pez_dispatch_msg(&d, buf, sizeof(buf));
+    assert(codec_cnt == 1);
+
+    /* both, each to its own */
+    assert(pez_dispatch_register(&d, PEZ_DISPATCH_FMT_PROTOBUF, 7,
+                                 test_handler, NULL, NULL, NULL) == EOK);
+    pez_dispatch_msg(&d, pb, sizeof(pb));
+    pez_dispatch_msg(&d, buf, sizeof(buf));
+    assert(handled == 1 && codec_cnt == 2);
+
+    assert(pez_dispatch_unregister(&d, PEZ_DISPATCH_FMT_CODEC, 7) == EOK);
+    pez_dispatch_msg(&d, buf, sizeof(buf));
+    pez_dispatch_msg(&d, pb, sizeof(pb));
+    assert(handled == 2 && codec_cnt == 2 && d.drop_cnt == 2);
+}
+
+/*
+ * Misaligned fixed-layout msgs reach handlers aligned, small or big.
+ */
+static void
+test_misaligned(void) {
+    static pez_dispatch_t   d;
+    uint8_t                 *buf;
+    int                     codec_cnt = 0;
+
+    buf = aligned_alloc(PEZ_CODEC_ALIGN, sizeof(test_big_t) + PEZ_CODEC_ALIGN);
+    assert(buf);
+    assert(pez_dispatch_init(&d, "align") == EOK);
+    assert(pez_dispatch_register(&d, PEZ_DISPATCH_FMT_CODEC, 7,
+                                 test_codec_handler, NULL, NULL,
+                                 &codec_cnt) == EOK);
+    assert(pez_dispatch_register(&d, PEZ_DISPATCH_FMT_CODEC, 8,
+                                 test_codec_handler, NULL, NULL,
+                                 &codec_cnt) == EOK);
+
+    misaligned = 0;
+    assert(test_msg_init(buf, sizeof(test_msg_t)));
+    memmove(buf + 1, buf, sizeof(test_msg_t));
+    pez_dispatch_msg(&d, buf + 1, sizeof(test_msg_t));
+
+    assert(sizeof(test_big_t) > INPROC_MAX_MSG_SIZE);
+    assert(test_big_init(buf, sizeof(test_big_t)));
+    memmove(buf + 1, buf, sizeof(test_big_t));
+    pez_dispatch_msg(&d, buf + 1, sizeof(test_big_t));
+
+    assert(codec_cnt == 2 && misaligned == 0 && d.err_cnt == 0);
+    free(buf);
+}
+
+int
+main(int argc, char **argv) {
+    test_peek_type();
+    test_dispatch_msg();
+    test_format();
+    test_misaligned();
+    printf("test_dispatch: ok\n");
+    return 0;
+}
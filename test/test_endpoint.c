@@ -0,0 +1,195 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * One thread owns several endpoints on one loop: "a" and "b" receive, "c"
+ * only sends, and another "a" receives in a domain of its own. Each msg
+ * must come in at the endpoint it was sent to. "b" forwards what it gets
+ * to "a" by "c".
+ */
+
+#define TEST_MSG_NUM        (100)
+#define TEST_STOP           (-1)
+
+enum {
+    TEST_A,
+    TEST_B,
+    TEST_OTHER_A,
+    TEST_EP_NUM,
+};
+
+typedef struct {
+    int                 idx;
+    int32_t             last;
+    uint32_t            got;
+    uint32_t            fwd;    /* got from "c" */
+} test_ep_t;
+
+static test_ep_t        eps[TEST_EP_NUM];
+static pez_endpoint_t   *ep_c;
+static pez_domain_t     *other;
+static uint32_t         err;
+static volatile int     ready;
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    test_ep_t       *e = wz->data;
+    pez_endpoint_t  *ep = pez_ipc_endpoint_of(wz);
+    int32_t         m;
+    size_t          size;
+
+    if (pez_ipc_msg_recv(wz->zsock, &m, sizeof(m), &size) != EOK ||
+        size != sizeof(m)) {
+        err ++;
+        return;
+    }
+    if (m == TEST_STOP) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+
+    /* msg is for endpoint its cb data belongs to */
+    if (!ep || pez_ipc_endpoint_zsock(ep) != wz ||
+        strcmp(pez_ipc_endpoint_name(ep), e->idx == TEST_B ? "b" : "a") ||
+        (pez_ipc_endpoint_domain(ep) == other) != (e->idx == TEST_OTHER_A)) {
+        err ++;
+    }
+    if (m >= TEST_MSG_NUM) {
+        e->fwd ++;
+        __atomic_add_fetch(&e->got, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    if (m != e->last + 1) {
+        err ++;
+    }
+    e->last = m;
+    if (e->idx == TEST_B) {
+        m += TEST_MSG_NUM;
+        if (pez_ipc_endpoint_send(ep_c, "a", &m, sizeof(m)) != EOK) {
+            err ++;
+        }
+    }
+    __atomic_add_fetch(&e->got, 1, __ATOMIC_RELEASE);
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep[TEST_EP_NUM];
+    int             i;
+
+    for (i = 0; i < TEST_EP_NUM; i ++) {
+        eps[i].idx = i;
+        eps[i].last = -1;
+    }
+    ep[TEST_A] = pez_ipc_endpoint_open(loop, "a", test_rcv_cb, &eps[TEST_A]);
+    ep[TEST_B] = pez_ipc_endpoint_open(loop, "b", test_rcv_cb, &eps[TEST_B]);
+    ep[TEST_OTHER_A] = pez_domain_endpoint_open(other, loop, "a", test_rcv_cb,
+                                                &eps[TEST_OTHER_A]);
+    ep_c = pez_ipc_endpoint_open(NULL, "c", NULL, NULL);
+    assert(ep[TEST_A] && ep[TEST_B] && ep[TEST_OTHER_A] && ep_c);
+    assert(ep[TEST_A] != ep[TEST_OTHER_A]);
+    assert(pez_ipc_endpoint_open(loop, "b", test_rcv_cb, NULL) == NULL);
+    assert(pez_ipc_endpoint_get("b") == ep[TEST_B]);
+    assert(pez_ipc_endpoint_get("c") == ep_c);
+    assert(pez_ipc_endpoint_zsock(ep_c) == NULL);
+    assert(pez_ipc_endpoint_domain(ep_c) == pez_domain_default());
+    ready = 1;
+    ev_run(loop, 0);
+
+    for (i = 0; i < TEST_EP_NUM; i ++) {
+        assert(pez_ipc_endpoint_close(ep[i]) == EOK);
+    }
+    assert(pez_ipc_endpoint_close(ep_c) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+static uint32_t
+test_got(int idx) {
+    return __atomic_load_n(&eps[idx].got, __ATOMIC_ACQUIRE);
+}
+
+static void
+test_wait(int idx, uint32_t num) {
+    int n;
+
+    for (n = 0; n < 5000 && test_got(idx) < num; n ++) {
+        usleep(1000);
+    }
+    assert(test_got(idx) == num);
+}
+
+/*
+ * Msgs to each endpoint come in there in order, also those forwarded by
+ * a send only endpoint of the same thread.
+ */
+static void
+test_route(void) {
+    pez_endpoint_t  *snd2;
+    int32_t         i;
+
+    snd2 = pez_domain_endpoint_open(other, NULL, "snd", NULL, NULL);
+    assert(snd2);
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        assert(pez_ipc_msg_send("a", "snd", &i, sizeof(i)) == EOK);
+        assert(pez_ipc_msg_send("b", "snd", &i, sizeof(i)) == EOK);
+        assert(pez_ipc_endpoint_send(snd2, "a", &i, sizeof(i)) == EOK);
+    }
+    test_wait(TEST_A, TEST_MSG_NUM * 2);
+    test_wait(TEST_B, TEST_MSG_NUM);
+    test_wait(TEST_OTHER_A, TEST_MSG_NUM);
+    assert(err == 0);
+    assert(eps[TEST_A].last == TEST_MSG_NUM - 1 &&
+           eps[TEST_A].fwd == TEST_MSG_NUM);
+    assert(eps[TEST_B].last == TEST_MSG_NUM - 1 && eps[TEST_B].fwd == 0);
+    assert(eps[TEST_OTHER_A].last == TEST_MSG_NUM - 1 &&
+           eps[TEST_OTHER_A].fwd == 0);
+    assert(pez_ipc_endpoint_close(snd2) == EOK);
+}
+
+/*
+ * Endpoints of another thread can't be used by name or got by it.
+ */
+static void
+test_owner(void) {
+    int32_t m = 0;
+
+    assert(pez_ipc_msg_send("b", "a", &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_msg_send("a", "c", &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_endpoint_get("a") == NULL);
+    assert(pez_ipc_endpoint_get("c") == NULL);
+    assert(pez_ipc_endpoint_close(ep_c) == EINVAL);
+    assert(pez_ipc_endpoint_close(NULL) == EINVAL);
+    assert(pez_ipc_endpoint_send(NULL, "a", &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_endpoint_of(NULL) == NULL);
+}
+
+int
+main(void) {
+    pez_config_t    cfg;
+    pthread_t       tid;
+    int32_t         m = TEST_STOP;
+
+    assert(pez_ipc_init() == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    pez_ipc_config_init(&cfg);
+    other = pez_domain_create("other", &cfg);
+    assert(other);
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+
+    test_owner();
+    test_route();
+
+    assert(pez_ipc_msg_send("a", "snd", &m, sizeof(m)) == EOK);
+    pthread_join(tid, NULL);
+    printf("test_endpoint: ok\n");
+    return 0;
+}
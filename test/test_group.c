@@ -0,0 +1,229 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Members of groups of each policy, one of them goes away half way.
+ */
+
+#define TEST_MEMBER_NUM     (3)
+#define TEST_MSG_NUM        (300)
+#define TEST_KEY_NUM        (64)
+
+enum {
+    TEST_RR,
+    TEST_LD,
+    TEST_KEY,
+    TEST_GROUP_NUM,
+};
+
+static const char   *group[TEST_GROUP_NUM] = {"rr", "ld", "key"};
+
+typedef struct {
+    char                id[8];
+    int                 idx;
+    uint32_t            cnt[TEST_GROUP_NUM];
+    uint32_t            err;
+    pthread_t           tid;
+    volatile int        ready;
+} test_member_t;
+
+static test_member_t    member[TEST_MEMBER_NUM];
+static int              owner[TEST_KEY_NUM];    /* member keys go to */
+static volatile int     hold;                   /* member 0 is stuck */
+
+static void
+test_member_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    test_member_t   *mb = wz->data;
+    int32_t         m[2];
+    size_t          size;
+    int             prev = -1;
+
+    if (pez_ipc_msg_recv(wz->zsock, m, sizeof(m), &size) != EOK ||
+        size != sizeof(m) || m[0] >= TEST_GROUP_NUM) {
+        mb->err ++;
+        return;
+    }
+    if (m[0] < 0) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    while (mb->idx == 0 && hold) {
+        usleep(100);
+    }
+    if (m[0] == TEST_KEY &&
+        !__atomic_compare_exchange_n(&owner[m[1]], &prev, mb->idx, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+        prev != mb->idx) {
+        mb->err ++;
+    }
+    __atomic_add_fetch(&mb->cnt[m[0]], 1, __ATOMIC_RELEASE);
+}
+
+static void *
+test_member_thread(void *arg) {
+    test_member_t   *mb = arg;
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+    int             g;
+
+    ep = pez_ipc_endpoint_open(loop, mb->id, test_member_cb, mb);
+    assert(ep);
+    for (g = 0; g < TEST_GROUP_NUM; g ++) {
+        assert(pez_ipc_group_join(group[g], mb->id) == EOK);
+    }
+    mb->ready = 1;
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+static void
+test_member_stop(int i) {
+    int32_t m[2] = {-1, 0};
+
+    assert(pez_ipc_msg_send(member[i].id, "snd", m, sizeof(m)) == EOK);
+    pthread_join(member[i].tid, NULL);
+}
+
+/*
+ * Wait until members got num msgs sent to group g in all.
+ */
+static void
+test_wait(int g, uint32_t num) {
+    uint32_t    sum;
+    int         i, n;
+
+    for (n = 0; n < 5000; n ++) {
+        sum = 0;
+        for (i = 0; i < TEST_MEMBER_NUM; i ++) {
+            sum += __atomic_load_n(&member[i].cnt[g], __ATOMIC_ACQUIRE);
+        }
+        if (sum >= num) {
+            break;
+        }
+        usleep(1000);
+    }
+    assert(sum == num);
+}
+
+static void
+test_send(int g, int num, int delay_us) {
+    int32_t m[2];
+    int     i;
+
+    for (i = 0; i < num; i ++) {
+        m[0] = g;
+        m[1] = i % TEST_KEY_NUM;
+        if (g == TEST_KEY) {
+            assert(pez_ipc_msg_send_key(group[g], "snd", m[1], m,
+                                        sizeof(m)) == EOK);
+        } else {
+            assert(pez_ipc_msg_send(group[g], "snd", m, sizeof(m)) == EOK);
+        }
+        if (delay_us) {
+            usleep(delay_us);
+        }
+    }
+}
+
+static void
+test_cnt_clear(void) {
+    int i;
+
+    for (i = 0; i < TEST_MEMBER_NUM; i ++) {
+        memset(member[i].cnt, 0, sizeof(member[i].cnt));
+    }
+}
+
+/*
+ * All members are online. Round robin spreads msgs evenly, least depth
+ * keeps away from the stuck member, and each key sticks to one member.
+ */
+static void
+test_all_online(void) {
+    int i, used = 0;
+
+    hold = 1;
+    test_send(TEST_LD, TEST_MSG_NUM, 100);
+    hold = 0;
+    test_wait(TEST_LD, TEST_MSG_NUM);
+    assert(member[0].cnt[TEST_LD] < TEST_MSG_NUM / 10);
+
+    test_send(TEST_RR, TEST_MSG_NUM, 0);
+    test_wait(TEST_RR, TEST_MSG_NUM);
+    for (i = 0; i < TEST_MEMBER_NUM; i ++) {
+        assert(member[i].cnt[TEST_RR] == TEST_MSG_NUM / TEST_MEMBER_NUM);
+    }
+
+    test_send(TEST_KEY, TEST_MSG_NUM, 0);
+    test_wait(TEST_KEY, TEST_MSG_NUM);
+    for (i = 0; i < TEST_MEMBER_NUM; i ++) {
+        used += member[i].cnt[TEST_KEY] != 0;
+    }
+    assert(used > 1);
+}
+
+/*
+ * Last member closes its endpoint. Nothing is routed to it any more, and
+ * keys of other members stay where they are.
+ */
+static void
+test_member_gone(void) {
+    int i, g;
+
+    test_member_stop(TEST_MEMBER_NUM - 1);
+    usleep(50000);
+    test_cnt_clear();
+    for (i = 0; i < TEST_KEY_NUM; i ++) {
+        if (owner[i] == TEST_MEMBER_NUM - 1) {
+            owner[i] = -1;
+        }
+    }
+
+    for (g = 0; g < TEST_GROUP_NUM; g ++) {
+        test_send(g, TEST_MSG_NUM, 0);
+        test_wait(g, TEST_MSG_NUM);
+        assert(member[TEST_MEMBER_NUM - 1].cnt[g] == 0);
+    }
+    assert(member[0].cnt[TEST_RR] == member[1].cnt[TEST_RR]);
+}
+
+int
+main(void) {
+    int i;
+
+    pez_ipc_init();
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    assert(pez_ipc_group_create("rr", PEZ_GROUP_POLICY_RR) == EOK);
+    assert(pez_ipc_group_create("ld", PEZ_GROUP_POLICY_LEAST_DEPTH) == EOK);
+    assert(pez_ipc_group_create("key", PEZ_GROUP_POLICY_KEY) == EOK);
+    memset(owner, 0xFF, sizeof(owner));
+
+    for (i = 0; i < TEST_MEMBER_NUM; i ++) {
+        snprintf(member[i].id, sizeof(member[i].id), "m%d", i);
+        member[i].idx = i;
+        pthread_create(&member[i].tid, NULL, test_member_thread, &member[i]);
+        while (!member[i].ready) {
+            usleep(1000);
+        }
+    }
+    /* joins reach router by members' sockets */
+    usleep(50000);
+
+    test_all_online();
+    test_member_gone();
+
+    for (i = 0; i < TEST_MEMBER_NUM - 1; i ++) {
+        test_member_stop(i);
+    }
+    for (i = 0; i < TEST_MEMBER_NUM; i ++) {
+        assert(member[i].err == 0);
+    }
+    printf("test_group: ok\n");
+    return 0;
+}
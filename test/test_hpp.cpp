@@ -0,0 +1,209 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez.hpp"
+
+/*
+ * C++ binding: msgs sent before anybody consumes stay queued, a coroutine
+ * gets them by co_await, then typed handlers and the fallback take the
+ * rest. Receiver reads fixed-layout msgs in place.
+ */
+
+#define TEST_FOO_TYPE       (31)
+#define TEST_BAR_TYPE       (32)
+#define TEST_MSG_NUM        (100)
+#define TEST_STOP           (-1)
+
+#define FOREACH_FOO_FIELD(FIELD, ARRAY)     \
+        FIELD(int32_t, seq)                 \
+        FIELD(uint32_t, flags)
+
+PEZ_CODEC_DEFINE(foo_old, TEST_FOO_TYPE, 1, FOREACH_FOO_FIELD)
+
+/* receiver takes only foo of version 2 or newer */
+#define FOREACH_FOO2_FIELD(FIELD, ARRAY)    \
+        FOREACH_FOO_FIELD(FIELD, ARRAY)     \
+        FIELD(uint64_t, stamp)
+
+PEZ_CODEC_DEFINE(foo, TEST_FOO_TYPE, 2, FOREACH_FOO2_FIELD)
+
+#define FOREACH_BAR_FIELD(FIELD, ARRAY)     \
+        FIELD(int32_t, seq)                 \
+        ARRAY(char, name, 40)
+
+PEZ_CODEC_DEFINE(bar, TEST_BAR_TYPE, 1, FOREACH_BAR_FIELD)
+
+static int32_t          last_foo = -1;
+static int32_t          last_raw = -1;
+static uint32_t         parts_cnt;
+static uint64_t         drop_cnt;
+static uint32_t         err;
+static volatile int     ready;
+static volatile int     sent;
+static volatile int     coro_done;
+
+/*
+ * Handlers set up by coroutine once it's done. Fallback takes raw msgs,
+ * joined parts and stop.
+ */
+static void
+test_handlers_on(pez::endpoint &ep, struct ev_loop *loop) {
+    ep.on<foo_t>([](const foo_t &foo) {
+        if (foo.seq != last_foo + 1 || foo.stamp != (uint64_t)foo.seq * 3) {
+            err ++;
+        }
+        last_foo = foo.seq;
+    });
+    ep.on_message([loop](pez::message &&msg) {
+        int32_t m[2];
+
+        if (msg.size() == sizeof(m)) {
+            memcpy(m, msg.data(), sizeof(m));
+            if (m[0] != 7 || m[1] != 9) {
+                err ++;
+            }
+            parts_cnt ++;
+            return;
+        }
+        if (msg.size() != sizeof(m[0]) || msg.type() != -1) {
+            err ++;
+            return;
+        }
+        memcpy(m, msg.data(), sizeof(m[0]));
+        if (m[0] == TEST_STOP) {
+            ev_break(loop, EVBREAK_ALL);
+            return;
+        }
+        if (m[0] != last_raw + 1) {
+            err ++;
+        }
+        last_raw = m[0];
+    });
+}
+
+/*
+ * Get bars queued before it started, keep a share of the first beyond
+ * its msg.
+ */
+static pez::task
+test_serve(pez::endpoint &ep, struct ev_loop *loop) {
+    pez::message    first;
+    char            name[40];
+    int32_t         i;
+
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        pez::message    msg = co_await ep.recv();
+        const bar_t     *bar = msg.as<bar_t>();
+
+        snprintf(name, sizeof(name), "bar%d", i);
+        if (!bar || bar->seq != i || strcmp(bar->name, name)) {
+            err ++;
+        }
+        if (i == 0) {
+            first = msg.share();
+        }
+    }
+    if (!first || !first.as<bar_t>() || first.as<bar_t>()->seq != 0 ||
+        first.type() != TEST_BAR_TYPE) {
+        err ++;
+    }
+    test_handlers_on(ep, loop);
+    coro_done = 1;
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+
+    {
+        pez::endpoint   ep(loop, "rcv");
+
+        assert(strcmp(ep.name(), "rcv") == 0);
+        ready = 1;
+        while (!sent) {
+            usleep(1000);
+        }
+        test_serve(ep, loop);
+        ev_run(loop, 0);
+        drop_cnt = ep.drop_count();
+    }
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+static void
+test_wait(volatile int *flag) {
+    int n;
+
+    for (n = 0; n < 5000 && !*flag; n ++) {
+        usleep(1000);
+    }
+    assert(*flag);
+}
+
+/*
+ * Endpoint can't be opened twice, the constructor throws.
+ */
+static void
+test_open_twice(void) {
+    try {
+        pez::endpoint   ep("snd");
+
+        assert(0);
+    } catch (const pez::error &e) {
+        assert(e.code().value() == EINVAL);
+    }
+}
+
+/*
+ * Typed, raw and multi-part sends, each to the consumer for it.
+ */
+static void
+test_send_recv(pez::endpoint &snd) {
+    pthread_t   tid;
+    int32_t     i, a = 7, b = 9;
+
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    test_wait(&ready);
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        assert(snd.send<bar_t>("rcv", [i](bar_t &bar) {
+            bar.seq = i;
+            snprintf(bar.name, sizeof(bar.name), "bar%d", i);
+        }) == EOK);
+    }
+    sent = 1;
+    test_wait(&coro_done);
+
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        assert(snd.send<foo_t>("rcv", [i](foo_t &foo) {
+            foo.seq = i;
+            foo.stamp = (uint64_t)i * 3;
+        }) == EOK);
+        assert(snd.send("rcv", i) == EOK);
+    }
+    assert(snd.send<foo_old_t>("rcv", [](foo_old_t &foo) {
+        foo.seq = TEST_MSG_NUM;
+    }) == EOK);
+    assert(snd.send_parts("rcv", a, b) == EOK);
+    assert(snd.send("rcv", (int32_t)TEST_STOP) == EOK);
+    pthread_join(tid, NULL);
+
+    assert(err == 0);
+    assert(last_foo == TEST_MSG_NUM - 1 && last_raw == TEST_MSG_NUM - 1);
+    assert(parts_cnt == 1 && drop_cnt == 1);
+}
+
+int
+main(void) {
+    assert(pez_ipc_init() == EOK);
+    {
+        pez::endpoint   snd("snd");
+
+        test_open_twice();
+        test_send_recv(snd);
+    }
+    printf("test_hpp: ok\n");
+    return 0;
+}
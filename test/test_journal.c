@@ -0,0 +1,270 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pez_ipc.h"
+#include "pez_journal.h"
+
+/*
+ * Layout of segments, as pez_journal.c writes them: 32 bytes hdr, then
+ * records of 8 bytes hdr(len first), frame lens and frames, 8 bytes aligned.
+ */
+#define TEST_SEG_HDR_SIZE   (32)
+#define TEST_REC_LEN        (1000)
+#define TEST_REC_SIZE       ((8 + 4 + TEST_REC_LEN + 7) & ~7)
+#define TEST_SEG_REC_NUM    \
+    ((PEZ_JOURNAL_SEG_SIZE - TEST_SEG_HDR_SIZE) / TEST_REC_SIZE)
+#define TEST_POST_NUM       (100)
+
+static char dir[] = "/tmp/test_journal.XXXXXX";
+
+static void
+test_seg_path(const char *name, uint64_t seq, char *path) {
+    snprintf(path, PEZ_JOURNAL_PATH_MAX_LEN, "%s/%s.%016llx.pezj",
+             dir, name, (unsigned long long)seq);
+}
+
+static void
+test_append(pez_journal_t *j, uint32_t from, uint32_t num) {
+    uint8_t         buf[TEST_REC_LEN];
+    struct iovec    iov = {buf, sizeof(buf)};
+    uint32_t        i;
+
+    for (i = from; i < from + num; i ++) {
+        memset(buf, (uint8_t)i, sizeof(buf));
+        memcpy(buf, &i, sizeof(i));
+        assert(pez_journal_append(j, &iov, 1) == EOK);
+    }
+}
+
+/*
+ * Replay all pending records, they must be from, from + 1, ...
+ */
+static uint32_t
+test_replay(pez_journal_t *j, uint32_t from) {
+    struct iovec    iov[PEZ_JOURNAL_FRAME_MAX];
+    uint32_t        seq, num = 0;
+    int             cnt;
+
+    for (;;) {
+        cnt = PEZ_JOURNAL_FRAME_MAX;
+        if (pez_journal_peek(j, iov, &cnt) != EOK) {
+            break;
+        }
+        assert(cnt == 1 && iov[0].iov_len == TEST_REC_LEN);
+        memcpy(&seq, iov[0].iov_base, sizeof(seq));
+        assert(seq == from + num);
+        assert(((uint8_t *)iov[0].iov_base)[TEST_REC_LEN - 1] == (uint8_t)seq);
+        pez_journal_pop(j);
+        num ++;
+    }
+    assert(pez_journal_empty(j));
+    return num;
+}
+
+/*
+ * Overwrite len of record idx of segment seq.
+ */
+static void
+test_rec_len_set(const char *name, uint64_t seq, uint32_t idx, uint32_t len) {
+    char    path[PEZ_JOURNAL_PATH_MAX_LEN];
+    int     fd;
+
+    test_seg_path(name, seq, path);
+    fd = open(path, O_RDWR);
+    assert(fd >= 0);
+    assert(pwrite(fd, &len, sizeof(len),
+                  TEST_SEG_HDR_SIZE + idx * TEST_REC_SIZE) == sizeof(len));
+    close(fd);
+}
+
+/*
+ * Pending records survive close, read ones don't come back.
+ */
+static void
+test_reopen(void) {
+    pez_journal_t   j;
+
+    assert(pez_journal_open(&j, dir, "reopen") == EOK);
+    test_append(&j, 0, 10);
+    assert(pez_journal_commit(&j) == EOK);
+    assert(test_replay(&j, 0) == 10);
+    test_append(&j, 10, 10);
+    pez_journal_close(&j);
+
+    assert(pez_journal_open(&j, dir, "reopen") == EOK);
+    assert(j.rec_num == 10);
+    assert(test_replay(&j, 10) == 10);
+    pez_journal_close(&j);
+}
+
+/*
+ * Record torn by a crash, its len never made it to disk, or is garbage.
+ * Records before it are replayed, the ones appended next overwrite it.
+ */
+static void
+test_torn_record(void) {
+    pez_journal_t   j;
+
+    assert(pez_journal_open(&j, dir, "torn") == EOK);
+    test_append(&j, 0, 20);
+    pez_journal_close(&j);
+
+    test_rec_len_set("torn", 0, 15, 0);
+    assert(pez_journal_open(&j, dir, "torn") == EOK);
+    assert(j.rec_num == 15);
+    test_append(&j, 15, 5);
+    pez_journal_close(&j);
+
+    assert(pez_journal_open(&j, dir, "torn") == EOK);
+    assert(test_replay(&j, 0) == 20);
+    pez_journal_close(&j);
+
+    assert(pez_journal_open(&j, dir, "torn2") == EOK);
+    test_append(&j, 0, 20);
+    pez_journal_close(&j);
+
+    test_rec_len_set("torn2", 0, 19, 0xFFFFFFF0);
+    assert(pez_journal_open(&j, dir, "torn2") == EOK);
+    assert(test_replay(&j, 0) == 19);
+    pez_journal_close(&j);
+}
+
+/*
+ * Truncated segment file or broken segment hdr, only that segment is lost.
+ */
+static void
+test_truncated_seg(void) {
+    pez_journal_t   j;
+    char            path[PEZ_JOURNAL_PATH_MAX_LEN];
+    uint32_t        magic = 0;
+    int             fd;
+
+    assert(pez_journal_open(&j, dir, "trunc") == EOK);
+    test_append(&j, 0, TEST_SEG_REC_NUM * 3);
+    assert(j.next_seq == 3);
+    pez_journal_close(&j);
+
+    test_seg_path("trunc", 2, path);
+    assert(truncate(path, PEZ_JOURNAL_SEG_SIZE / 2) == 0);
+    assert(pez_journal_open(&j, dir, "trunc") == EOK);
+    assert(j.rec_num == TEST_SEG_REC_NUM * 2);
+    pez_journal_close(&j);
+
+    test_seg_path("trunc", 0, path);
+    fd = open(path, O_RDWR);
+    assert(fd >= 0);
+    assert(pwrite(fd, &magic, sizeof(magic), 0) == sizeof(magic));
+    close(fd);
+    assert(pez_journal_open(&j, dir, "trunc") == EOK);
+    assert(test_replay(&j, TEST_SEG_REC_NUM) == TEST_SEG_REC_NUM);
+    pez_journal_close(&j);
+}
+
+/*
+ * Crash while a read segment was renamed for recycling, before its hdr got
+ * the new seq. Its name wins, new segments don't collide with old ones.
+ */
+static void
+test_recycle_crash(void) {
+    pez_journal_t   j;
+    char            from[PEZ_JOURNAL_PATH_MAX_LEN];
+    char            to[PEZ_JOURNAL_PATH_MAX_LEN];
+
+    assert(pez_journal_open(&j, dir, "recycle") == EOK);
+    test_append(&j, 0, TEST_SEG_REC_NUM + 1);
+    assert(test_replay(&j, 0) == TEST_SEG_REC_NUM + 1);
+    assert(j.free_num == 1 && j.next_seq == 2);
+    pez_journal_close(&j);
+
+    test_seg_path("recycle", 0, from);
+    test_seg_path("recycle", 2, to);
+    assert(rename(from, to) == 0);
+    assert(pez_journal_open(&j, dir, "recycle") == EOK);
+    assert(j.rec_num == 0 && j.next_seq == 3);
+    test_append(&j, 0, TEST_SEG_REC_NUM * 2);
+    assert(test_replay(&j, 0) == TEST_SEG_REC_NUM * 2);
+    pez_journal_close(&j);
+}
+
+/*
+ * Async commit, and close waiting for it.
+ */
+static void
+test_commit_async(void) {
+    pez_journal_t   j;
+    pez_status      rc;
+
+    assert(pez_journal_open(&j, dir, "async") == EOK);
+    test_append(&j, 0, 10);
+    assert(pez_journal_commit_async(&j) == EOK);
+    test_append(&j, 10, 10);
+    rc = pez_journal_commit_async(&j);
+    assert(rc == EOK || rc == EBUSY);
+    pez_journal_close(&j);
+    assert(__atomic_load_n(&j.commit_cnt, __ATOMIC_RELAXED) >= 2);
+
+    assert(pez_journal_open(&j, dir, "async") == EOK);
+    assert(test_replay(&j, 0) == 20);
+    pez_journal_close(&j);
+}
+
+/*
+ * Msgs journaled by router are on disk once the domain is finished.
+ */
+static void
+test_domain_fini(void) {
+    pez_config_t    cfg;
+    pez_domain_t    *dom;
+    pez_journal_t   j;
+    uint8_t         buf[TEST_REC_LEN];
+    uint32_t        i, seq;
+    struct iovec    iov[PEZ_JOURNAL_FRAME_MAX];
+    int             cnt;
+
+    pez_ipc_config_init(&cfg);
+    dom = pez_domain_create("journal", &cfg);
+    assert(dom);
+    assert(pez_domain_thread_declare(dom, "src") == EOK);
+    assert(pez_domain_journal_enable(dom, "sink", dir, 0) == EOK);
+    for (i = 0; i < TEST_POST_NUM; i ++) {
+        memcpy(buf, &i, sizeof(i));
+        assert(pez_domain_msg_post(dom, "sink", "src", buf,
+                                   sizeof(buf)) == EOK);
+    }
+    assert(pez_domain_fini(dom) == EOK);
+    assert(pez_domain_fini(dom) == EALREADY);
+
+    assert(pez_journal_open(&j, dir, "sink") == EOK);
+    assert(j.rec_num == TEST_POST_NUM);
+    for (i = 0; i < TEST_POST_NUM; i ++) {
+        cnt = PEZ_JOURNAL_FRAME_MAX;
+        assert(pez_journal_peek(&j, iov, &cnt) == EOK);
+        assert(iov[cnt - 1].iov_len == sizeof(buf));
+        memcpy(&seq, iov[cnt - 1].iov_base, sizeof(seq));
+        assert(seq == i);
+        pez_journal_pop(&j);
+    }
+    pez_journal_close(&j);
+}
+
+int
+main(void) {
+    char cmd[64];
+
+    assert(mkdtemp(dir));
+    test_reopen();
+    test_torn_record();
+    test_truncated_seg();
+    test_recycle_crash();
+    test_commit_async();
+    test_domain_fini();
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    assert(system(cmd) == 0);
+    printf("test_journal: ok\n");
+    return 0;
+}
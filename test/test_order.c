@@ -0,0 +1,121 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Msgs from one src to one trgt are received in the order they're sent,
+ * whether they're coalesced or not, and whether they're traced or not.
+ */
+
+#define TEST_MSG_NUM        (20000)     /* per round */
+#define TEST_ROUND_NUM      (2)
+#define TEST_WINDOW         (200)       /* below hwm, router never drops */
+
+static volatile uint32_t    rcv_cnt;
+static volatile int         rcv_ready;
+static uint32_t             rcv_err;
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    uint8_t     buf[INPROC_MAX_MSG_SIZE * 2];
+    uint32_t    seq;
+    size_t      size;
+
+    if (pez_ipc_msg_recv(wz->zsock, buf, sizeof(buf), &size) != EOK ||
+        size < sizeof(seq)) {
+        rcv_err ++;
+        return;
+    }
+    memcpy(&seq, buf, sizeof(seq));
+    if (seq != rcv_cnt) {
+        if (rcv_err ++ == 0) {
+            printf("test_order: got %u, expected %u\n", seq, rcv_cnt);
+        }
+    }
+    __atomic_store_n(&rcv_cnt, rcv_cnt + 1, __ATOMIC_RELEASE);
+    if (rcv_cnt == TEST_MSG_NUM * TEST_ROUND_NUM) {
+        ev_break(loop, EVBREAK_ALL);
+    }
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop *loop = ev_loop_new(0);
+
+    assert(pez_ipc_thread_init_rx(loop, "rcv", test_rcv_cb) == EOK);
+    rcv_ready = 1;
+    ev_run(loop, 0);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+/*
+ * Mix coalesced msgs with ones that aren't: with hdr, too big for a batch
+ * or of several frames.
+ */
+static void
+test_send_mixed(uint32_t from) {
+    uint8_t         buf[INPROC_MAX_MSG_SIZE * 2] = {0};
+    struct iovec    iov[2];
+    uint32_t        seq;
+    pez_status      rc;
+
+    for (seq = from; seq < from + TEST_MSG_NUM; seq ++) {
+        while (seq - __atomic_load_n(&rcv_cnt, __ATOMIC_ACQUIRE) >=
+               TEST_WINDOW) {
+            assert(pez_ipc_msg_flush("snd") == EOK);
+            usleep(100);
+        }
+        memcpy(buf, &seq, sizeof(seq));
+        switch (seq % 7) {
+        case 3:
+            rc = pez_ipc_msg_send_key("rcv", "snd", seq, buf, 16);
+            break;
+        case 4:
+            rc = pez_ipc_msg_send_ttl("rcv", "snd", buf, 16, 10000000);
+            break;
+        case 5:
+            rc = pez_ipc_msg_send("rcv", "snd", buf, sizeof(buf));
+            break;
+        case 6:
+            iov[0].iov_base = buf;
+            iov[0].iov_len = sizeof(seq);
+            iov[1].iov_base = buf + sizeof(seq);
+            iov[1].iov_len = 12;
+            rc = pez_ipc_msg_sendv("rcv", "snd", iov, 2);
+            break;
+        default:
+            rc = pez_ipc_msg_send("rcv", "snd", buf, 16);
+            break;
+        }
+        assert(rc == EOK);
+    }
+    assert(pez_ipc_msg_flush("snd") == EOK);
+}
+
+int
+main(int argc, char **argv) {
+    pthread_t   rcv;
+
+    pez_ipc_init();
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    /* batches are sent only when full or flushed */
+    assert(pez_ipc_coalesce_enable("snd", 512, 1000000000) == EOK);
+    pthread_create(&rcv, NULL, test_rcv_thread, NULL);
+    while (!rcv_ready) {
+        usleep(1000);
+    }
+
+    test_send_mixed(0);
+    /* sampled msgs get a hdr, which mustn't let them overtake */
+    pez_ipc_trace_enable(3);
+    test_send_mixed(TEST_MSG_NUM);
+    pez_ipc_trace_enable(0);
+    pthread_join(rcv, NULL);
+    assert(rcv_cnt == TEST_MSG_NUM * TEST_ROUND_NUM && rcv_err == 0);
+    printf("test_order: ok\n");
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+#include "pez_dispatch.h"
+#include "pez_pool.h"
+
+#define TEST_THREAD_NUM     (8)
+#define TEST_LOOP_NUM       (200000)
+#define TEST_OBJ_NUM        (16)        /* fewer than threads want at once */
+#define TEST_PTR_NUM        (500)
+
+typedef struct {
+    uint32_t            owner;
+    uint32_t            seq;
+} test_obj_t;
+
+static pez_pool_t       pool;
+static volatile int     start;
+static uint64_t         got_cnt[TEST_THREAD_NUM];
+
+/*
+ * Each object got is owned by one thread only, until it's put back.
+ */
+static void *
+test_contend_thread(void *arg) {
+    uint32_t    me = (uint32_t)(uintptr_t)arg;
+    test_obj_t  *obj;
+    uint32_t    i;
+
+    while (!start) {
+    }
+    for (i = 0; i < TEST_LOOP_NUM; i ++) {
+        obj = pez_pool_get(&pool);
+        if (!obj) {
+            continue;
+        }
+        obj->owner = me;
+        obj->seq = i;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        assert(obj->owner == me && obj->seq == i);
+        got_cnt[me] ++;
+        pez_pool_put(obj);
+    }
+    return NULL;
+}
+
+static void
+test_contend(void) {
+    pthread_t   tid[TEST_THREAD_NUM];
+    void        *obj[TEST_OBJ_NUM];
+    uint64_t    total = 0;
+    int         i, j;
+
+    assert(pez_pool_init(&pool, "contend", sizeof(test_obj_t),
+                         TEST_OBJ_NUM) == EOK);
+    for (i = 0; i < TEST_THREAD_NUM; i ++) {
+        pthread_create(&tid[i], NULL, test_contend_thread,
+                       (void *)(uintptr_t)i);
+    }
+    start = 1;
+    for (i = 0; i < TEST_THREAD_NUM; i ++) {
+        pthread_join(tid[i], NULL);
+        total += got_cnt[i];
+    }
+    assert(total > 0);
+    assert(pool.get_cnt == total && pool.put_cnt == total);
+
+    /* nothing lost or handed out twice */
+    for (i = 0; i < TEST_OBJ_NUM; i ++) {
+        obj[i] = pez_pool_get(&pool);
+        assert(obj[i]);
+        for (j = 0; j < i; j ++) {
+            assert(obj[j] != obj[i]);
+        }
+    }
+    assert(pez_pool_get(&pool) == NULL);
+    for (i = 0; i < TEST_OBJ_NUM; i ++) {
+        pez_pool_put(obj[i]);
+    }
+    pez_pool_put(obj[0]);               /* twice, ignored */
+    assert(pool.put_cnt == pool.get_cnt);
+    pez_pool_fini(&pool);
+}
+
+static volatile uint32_t    ptr_rcv_cnt;
+static volatile int         ptr_ready;
+
+static void
+test_plain_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    uint8_t buf[INPROC_MAX_MSG_SIZE];
+    size_t  size;
+
+    assert(pez_ipc_msg_recv(wz->zsock, buf, sizeof(buf), &size) == EBADMSG);
+    __atomic_add_fetch(&ptr_rcv_cnt, 1, __ATOMIC_RELEASE);
+}
+
+static void
+test_owner_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    pez_ptr_t   ptr;
+
+    assert(pez_ipc_msg_recv_ptr(wz->zsock, &ptr) == EOK);
+    pez_ipc_ptr_release(&ptr);
+    __atomic_add_fetch(&ptr_rcv_cnt, 1, __ATOMIC_RELEASE);
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    pez_dispatch_t  *d = arg;
+    struct ev_loop  *loop = ev_loop_new(0);
+
+    assert(pez_ipc_thread_init_rx(loop, "plain", test_plain_cb) == EOK);
+    assert(pez_ipc_thread_init_rx(loop, "owner", test_owner_cb) == EOK);
+    assert(pez_dispatch_attach(d, loop, "dispatch") == EOK);
+    ptr_ready = 1;
+    while (ptr_ready) {
+        ev_run(loop, EVRUN_NOWAIT);
+        /* dispatch doesn't tell the test, so its drops are counted */
+        if (d->drop_cnt) {
+            __atomic_add_fetch(&ptr_rcv_cnt, d->drop_cnt, __ATOMIC_RELEASE);
+            d->drop_cnt = 0;
+        }
+    }
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+/*
+ * Objects of pointer msgs are released whoever receives them.
+ */
+static void
+test_ptr_release(void) {
+    static pez_dispatch_t   d;
+    static const char       *trgt[] = {"plain", "owner", "dispatch"};
+    pthread_t               rcv;
+    pez_ptr_t               ptr;
+    uint32_t                i;
+
+    assert(pez_pool_init(&pool, "ptr", sizeof(test_obj_t),
+                         TEST_OBJ_NUM) == EOK);
+    assert(pez_dispatch_init(&d, "dispatch") == EOK);
+    pthread_create(&rcv, NULL, test_rcv_thread, &d);
+    while (!ptr_ready) {
+        usleep(1000);
+    }
+
+    for (i = 0; i < TEST_PTR_NUM; i ++) {
+        /* pool is tiny, objects must come back to send more */
+        while (!(ptr.obj = pez_pool_get(&pool))) {
+            usleep(100);
+        }
+        ptr.release = pez_pool_release;
+        ptr.arg = NULL;
+        ptr.type = 0;
+        assert(pez_ipc_msg_send_ptr(trgt[i % 3], "ptr_snd", &ptr) == EOK);
+    }
+    while (__atomic_load_n(&ptr_rcv_cnt, __ATOMIC_ACQUIRE) < TEST_PTR_NUM) {
+        usleep(1000);
+    }
+    ptr_ready = 0;
+    pthread_join(rcv, NULL);
+    assert(pool.get_cnt == TEST_PTR_NUM && pool.put_cnt == TEST_PTR_NUM);
+    pez_pool_fini(&pool);
+}
+
+int
+main(int argc, char **argv) {
+    test_contend();
+
+    pez_ipc_init();
+    assert(pez_ipc_thread_init_tx("ptr_snd") == EOK);
+    test_ptr_release();
+    printf("test_pool: ok\n");
+    return 0;
+}
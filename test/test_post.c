@@ -0,0 +1,194 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Worker threads without endpoint post msgs under one logical src. Msgs
+ * carry who posted them and a seq, receiver checks each poster's msgs come
+ * in order.
+ */
+
+#define TEST_WORKER_NUM     (4)
+#define TEST_MAIN           (TEST_WORKER_NUM)
+#define TEST_MSG_NUM        (200)
+#define TEST_STOP           (-1)
+#define TEST_SYNC           (-2)    /* rcv to itself by group, once joined */
+#define TEST_ID_LONG        (64)    /* longer than any thread id */
+
+typedef struct {
+    int32_t             who;
+    int32_t             seq;
+} test_msg_t;
+
+static int32_t          last[TEST_WORKER_NUM + 1];
+static uint32_t         got;
+static uint32_t         err;
+static volatile int     ready;
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    test_msg_t  m;
+    size_t      size;
+
+    if (pez_ipc_msg_recv(wz->zsock, &m, sizeof(m), &size) != EOK ||
+        size != sizeof(m) || m.who < TEST_SYNC || m.who > TEST_MAIN) {
+        err ++;
+        return;
+    }
+    if (m.who == TEST_SYNC) {
+        ready = 1;
+        return;
+    }
+    if (m.who == TEST_STOP) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    if (m.seq != last[m.who] + 1) {
+        err ++;
+    }
+    last[m.who] = m.seq;
+    __atomic_add_fetch(&got, 1, __ATOMIC_RELEASE);
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+    test_msg_t      m = {TEST_SYNC, 0};
+
+    ep = pez_ipc_endpoint_open(loop, "rcv", test_rcv_cb, NULL);
+    assert(ep);
+    assert(pez_ipc_group_join("grp", "rcv") == EOK);
+    assert(pez_ipc_msg_send("grp", "rcv", &m, sizeof(m)) == EOK);
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+static void *
+test_worker(void *arg) {
+    test_msg_t  m;
+
+    m.who = (int32_t)(intptr_t)arg;
+    for (m.seq = 0; m.seq < TEST_MSG_NUM; m.seq ++) {
+        /* half by name of a group rcv is the only member of */
+        if (pez_ipc_msg_post(m.seq % 2 ? "grp" : "rcv", "pool", &m,
+                             sizeof(m)) != EOK) {
+            __atomic_add_fetch(&err, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+static void
+test_wait(uint32_t num) {
+    int n;
+
+    for (n = 0; n < 5000 && __atomic_load_n(&got, __ATOMIC_ACQUIRE) < num;
+         n ++) {
+        usleep(1000);
+    }
+    assert(__atomic_load_n(&got, __ATOMIC_ACQUIRE) == num);
+}
+
+static void
+test_reset(void) {
+    int i;
+
+    for (i = 0; i <= TEST_MAIN; i ++) {
+        last[i] = -1;
+    }
+    __atomic_store_n(&got, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Workers post at once, all their msgs get in, each one's in order. A
+ * new round of workers gets sockets anew, old ones closed as they exited.
+ */
+static void
+test_workers(void) {
+    pthread_t   tid[TEST_WORKER_NUM];
+    int         round, i;
+
+    for (round = 0; round < 2; round ++) {
+        test_reset();
+        for (i = 0; i < TEST_WORKER_NUM; i ++) {
+            pthread_create(&tid[i], NULL, test_worker, (void *)(intptr_t)i);
+        }
+        for (i = 0; i < TEST_WORKER_NUM; i ++) {
+            pthread_join(tid[i], NULL);
+        }
+        test_wait(TEST_WORKER_NUM * TEST_MSG_NUM);
+        assert(err == 0);
+        for (i = 0; i < TEST_WORKER_NUM; i ++) {
+            assert(last[i] == TEST_MSG_NUM - 1);
+        }
+    }
+}
+
+/*
+ * Posting under a src the caller owns is sending by it, in order with
+ * msgs it coalesces.
+ */
+static void
+test_owner(void) {
+    test_msg_t  m = {TEST_MAIN, 0};
+
+    test_reset();
+    assert(pez_ipc_coalesce_enable("snd", 4096, 1000) == EOK);
+    for (m.seq = 0; m.seq < TEST_MSG_NUM; m.seq ++) {
+        if (m.seq % 3) {
+            assert(pez_ipc_msg_send("rcv", "snd", &m, sizeof(m)) == EOK);
+        } else {
+            assert(pez_ipc_msg_post("rcv", "snd", &m, sizeof(m)) == EOK);
+        }
+    }
+    assert(pez_ipc_msg_flush("snd") == EOK);
+    assert(pez_ipc_coalesce_disable("snd") == EOK);
+    test_wait(TEST_MSG_NUM);
+    assert(err == 0 && last[TEST_MAIN] == TEST_MSG_NUM - 1);
+}
+
+static void
+test_inval(void) {
+    char        src[TEST_ID_LONG + 1];
+    test_msg_t  m = {0, 0};
+
+    memset(src, 'x', TEST_ID_LONG);
+    src[TEST_ID_LONG] = '\0';
+    assert(pez_ipc_msg_post(NULL, "pool", &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_msg_post("", "pool", &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_msg_post("nobody", "pool", &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_msg_post("rcv", NULL, &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_msg_post("rcv", "", &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_msg_post("rcv", src, &m, sizeof(m)) == EINVAL);
+    assert(pez_ipc_msg_post("rcv", "pool", NULL, sizeof(m)) == EINVAL);
+    assert(pez_domain_msg_post(NULL, "rcv", "pool", &m, sizeof(m)) == EINVAL);
+}
+
+int
+main(void) {
+    pthread_t   tid;
+    test_msg_t  m = {TEST_STOP, 0};
+
+    assert(pez_ipc_init() == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    assert(pez_ipc_group_create("grp", PEZ_GROUP_POLICY_RR) == EOK);
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+
+    test_inval();
+    test_workers();
+    test_owner();
+
+    assert(pez_ipc_msg_post("rcv", "pool", &m, sizeof(m)) == EOK);
+    pthread_join(tid, NULL);
+    printf("test_post: ok\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+#define TEST_MSG_NUM        (10)
+#define TEST_EP_MAX         (16)
+
+typedef struct {
+    int32_t             last;
+    uint32_t            err;
+    pthread_t           tid;
+} test_rcv_t;
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    test_rcv_t  *r = wz->data;
+    int32_t     m;
+    size_t      size;
+
+    if (pez_ipc_msg_recv(wz->zsock, &m, sizeof(m), &size) != EOK ||
+        size != sizeof(m) || m != r->last + 1) {
+        r->err ++;
+        return;
+    }
+    r->last = m;
+    if (m == TEST_MSG_NUM - 1) {
+        ev_break(loop, EVBREAK_ALL);
+    }
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    test_rcv_t      *r = arg;
+    struct ev_loop  *loop = ev_loop_new(0);
+
+    assert(pez_ipc_thread_init_rx_ex(loop, "late", test_rcv_cb, r) == EOK);
+    ev_run(loop, 0);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+/*
+ * Msgs sent to a declared thread are held until it registers, in order.
+ * wait_ready() times out until then.
+ */
+static void
+test_hold_until_ready(void) {
+    const char  *ids[] = {"late", NULL};
+    test_rcv_t  r = {-1, 0};
+    int32_t     m;
+
+    assert(pez_ipc_thread_declare("late") == EOK);
+    for (m = 0; m < TEST_MSG_NUM; m ++) {
+        assert(pez_ipc_msg_send("late", "snd", &m, sizeof(m)) == EOK);
+    }
+    assert(pez_ipc_wait_ready(ids, 10) == ETIMEDOUT);
+
+    pthread_create(&r.tid, NULL, test_rcv_thread, &r);
+    assert(pez_ipc_wait_ready(ids, -1) == EOK);
+    pthread_join(r.tid, NULL);
+    assert(r.err == 0 && r.last == TEST_MSG_NUM - 1);
+}
+
+/*
+ * Open tx endpoint once zmq has reaped sockets closed before, which it does
+ * in the background.
+ */
+static pez_endpoint_t *
+test_open_retry(const char *name) {
+    pez_endpoint_t  *ep = NULL;
+    int             n;
+
+    for (n = 0; n < 1000 && !ep; n ++) {
+        if (n) {
+            usleep(1000);
+        }
+        ep = pez_ipc_endpoint_open(NULL, name, NULL, NULL);
+    }
+    return ep;
+}
+
+/*
+ * Open failing for want of zmq sockets gives the name back, declared or
+ * free as it was, so it can be opened once there is room again.
+ */
+static void
+test_open_fail(void) {
+    pez_endpoint_t  *ep[TEST_EP_MAX];
+    char            name[16];
+    int             i, num;
+
+    for (num = 0; num < TEST_EP_MAX; num ++) {
+        snprintf(name, sizeof(name), "ep%d", num);
+        ep[num] = pez_ipc_endpoint_open(NULL, name, NULL, NULL);
+        if (!ep[num]) {
+            break;
+        }
+    }
+    assert(num > 0 && num < TEST_EP_MAX);
+
+    /* twice, as the 1st failure used to keep the name */
+    assert(pez_ipc_endpoint_open(NULL, name, NULL, NULL) == NULL);
+    assert(pez_ipc_thread_declare("decl") == EOK);
+    assert(pez_ipc_endpoint_open(NULL, "decl", NULL, NULL) == NULL);
+    assert(pez_ipc_endpoint_open(NULL, "decl", NULL, NULL) == NULL);
+
+    assert(pez_ipc_endpoint_close(ep[-- num]) == EOK);
+    ep[num] = test_open_retry(name);
+    assert(ep[num]);
+    assert(pez_ipc_endpoint_close(ep[num]) == EOK);
+    ep[num] = test_open_retry("decl");
+    assert(ep[num]);
+
+    for (i = 0; i <= num; i ++) {
+        assert(pez_ipc_endpoint_close(ep[i]) == EOK);
+    }
+}
+
+/*
+ * Group names can't be opened as endpoints.
+ */
+static void
+test_open_group_name(void) {
+    assert(pez_ipc_group_create("grp", PEZ_GROUP_POLICY_RR) == EOK);
+    assert(pez_ipc_endpoint_open(NULL, "grp", NULL, NULL) == NULL);
+    assert(pez_ipc_thread_declare("grp") == EINVAL);
+}
+
+int
+main(void) {
+    pez_config_t    cfg;
+
+    /* few sockets, so that opening endpoints runs out of them */
+    pez_ipc_config_init(&cfg);
+    cfg.zmq_max_sockets = 8;
+    assert(pez_ipc_init_config(&cfg) == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+
+    test_hold_until_ready();
+    test_open_fail();
+    test_open_group_name();
+    printf("test_ready: ok\n");
+    return 0;
+}
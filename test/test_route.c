@@ -0,0 +1,244 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+#include "pez_codec.h"
+
+/*
+ * Routing rules, most specific one wins, mirror and drop. Msgs are all sent
+ * to "orig", rules move them elsewhere.
+ */
+
+enum {
+    TEST_ORIG,
+    TEST_A,
+    TEST_B,
+    TEST_C,
+    TEST_D,
+    TEST_M,
+    TEST_EP_NUM,
+};
+
+static const char   *ep_name[TEST_EP_NUM] = {"orig", "a", "b", "c", "d", "m"};
+
+#define TEST_TYPE_BASE      (7)
+#define TEST_TYPE_PROBE     (11)
+#define TEST_TYPE_STOP      (12)
+#define TEST_TYPE_NUM       (TEST_TYPE_STOP - TEST_TYPE_BASE + 1)
+
+typedef struct {
+    pez_codec_hdr_t hdr;
+    int32_t         seq;
+} __attribute__((aligned(PEZ_CODEC_ALIGN))) test_rmsg_t;
+
+/* msgs each endpoint got, per type and subtype 0/2 */
+static uint32_t         cnt[TEST_EP_NUM][TEST_TYPE_NUM][2];
+static volatile int     ready;
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    int             ep = (int)(intptr_t)wz->data;
+    test_rmsg_t     m;
+    size_t          size;
+
+    if (pez_ipc_msg_recv(wz->zsock, &m, sizeof(m), &size) != EOK ||
+        size != sizeof(m) || !pez_codec_is_fixed(&m, size)) {
+        return;
+    }
+    if (m.hdr.type == TEST_TYPE_STOP) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    __atomic_add_fetch(&cnt[ep][m.hdr.type - TEST_TYPE_BASE]
+                          [m.hdr.subtype ? 1 : 0], 1, __ATOMIC_RELEASE);
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep[TEST_EP_NUM];
+    int             i;
+
+    for (i = 0; i < TEST_EP_NUM; i ++) {
+        ep[i] = pez_ipc_endpoint_open(loop, ep_name[i], test_rcv_cb,
+                                      (void *)(intptr_t)i);
+        assert(ep[i]);
+    }
+    ready = 1;
+    ev_run(loop, 0);
+    for (i = 0; i < TEST_EP_NUM; i ++) {
+        assert(pez_ipc_endpoint_close(ep[i]) == EOK);
+    }
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+static void
+test_send(uint16_t type, uint32_t subtype, int has_key, uint64_t key) {
+    test_rmsg_t m;
+
+    assert(pez_codec_init(&m, sizeof(m), type, 1, sizeof(m)));
+    m.hdr.subtype = subtype;
+    m.seq = 0;
+    if (has_key) {
+        assert(pez_ipc_msg_send_key("orig", "snd", key, &m,
+                                    sizeof(m)) == EOK);
+    } else {
+        assert(pez_ipc_msg_send("orig", "snd", &m, sizeof(m)) == EOK);
+    }
+}
+
+static uint32_t
+test_cnt(int ep, uint16_t type, uint32_t subtype) {
+    return __atomic_load_n(&cnt[ep][type - TEST_TYPE_BASE][subtype ? 1 : 0],
+                           __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Endpoints get msgs by sockets of their own, wait until ep got num.
+ */
+static uint32_t
+test_cnt_wait(int ep, uint16_t type, uint32_t subtype, uint32_t num) {
+    int n;
+
+    for (n = 0; n < 5000 && test_cnt(ep, type, subtype) < num; n ++) {
+        usleep(1000);
+    }
+    return test_cnt(ep, type, subtype);
+}
+
+/*
+ * Rules are swapped in by router, not in order with msgs of this thread.
+ * Probe until a probe msg is routed by the new rules.
+ */
+static void
+test_route_wait(int ep) {
+    uint32_t    was = test_cnt(ep, TEST_TYPE_PROBE, 0);
+    int         n;
+
+    for (n = 0; n < 5000; n ++) {
+        test_send(TEST_TYPE_PROBE, 0, 0, 0);
+        usleep(1000);
+        if (test_cnt(ep, TEST_TYPE_PROBE, 0) != was) {
+            return;
+        }
+    }
+    assert(0);
+}
+
+/*
+ * Wait until msgs sent to orig are all in. The last one is sent to orig.
+ */
+static void
+test_flush(void) {
+    uint32_t    was = test_cnt(TEST_ORIG, 10, 0);
+    int         n;
+
+    test_send(10, 0, 0, 0);
+    for (n = 0; n < 5000 && test_cnt(TEST_ORIG, 10, 0) == was; n ++) {
+        usleep(1000);
+    }
+    assert(test_cnt(TEST_ORIG, 10, 0) == was + 1);
+}
+
+static void
+test_bad_rules(void) {
+    pez_route_rule_t    r[2];
+
+    memset(r, 0, sizeof(r));
+    r[0].type = r[1].type = 7;
+    r[0].action = r[1].action = PEZ_ROUTE_DROP;
+    assert(pez_ipc_route_set(r, -1) == EINVAL);
+    assert(pez_ipc_route_set(r, PEZ_ROUTE_RULE_MAX + 1) == EINVAL);
+    assert(pez_ipc_route_set(r, (1 << 30) + 1) == EINVAL);
+    assert(pez_ipc_route_set(NULL, 1) == EINVAL);
+    /* both match type 7 only */
+    assert(pez_ipc_route_set(r, 2) == EINVAL);
+    r[1].action = PEZ_ROUTE_REDIRECT;
+    r[1].match = PEZ_ROUTE_M_KEY;
+    assert(pez_ipc_route_set(r, 2) == EINVAL);
+}
+
+/*
+ * subtype and key, subtype, key, then type only.
+ */
+static void
+test_precedence(void) {
+    pez_route_rule_t r[] = {
+        {0, 7, 0, 0, PEZ_ROUTE_REDIRECT, "a"},
+        {PEZ_ROUTE_M_KEY, 7, 0, 1, PEZ_ROUTE_REDIRECT, "b"},
+        {PEZ_ROUTE_M_SUBTYPE, 7, 2, 0, PEZ_ROUTE_REDIRECT, "c"},
+        {PEZ_ROUTE_M_SUBTYPE | PEZ_ROUTE_M_KEY, 7, 2, 1,
+         PEZ_ROUTE_REDIRECT, "d"},
+        {0, 8, 0, 0, PEZ_ROUTE_MIRROR, "m"},
+        {0, 9, 0, 0, PEZ_ROUTE_DROP, NULL},
+        {0, TEST_TYPE_PROBE, 0, 0, PEZ_ROUTE_REDIRECT, "a"},
+    };
+
+    assert(pez_ipc_route_set(r, sizeof(r) / sizeof(r[0])) == EOK);
+    test_route_wait(TEST_A);
+
+    test_send(7, 0, 0, 0);          /* type only */
+    test_send(7, 0, 1, 1);          /* key */
+    test_send(7, 0, 1, 5);          /* other key, type only */
+    test_send(7, 2, 0, 0);          /* subtype */
+    test_send(7, 2, 1, 5);          /* subtype, other key */
+    test_send(7, 2, 1, 1);          /* subtype and key */
+    test_send(8, 0, 0, 0);          /* mirrored */
+    test_send(9, 0, 0, 0);          /* dropped */
+    test_flush();
+
+    assert(test_cnt_wait(TEST_A, 7, 0, 2) == 2);
+    assert(test_cnt_wait(TEST_B, 7, 0, 1) == 1);
+    assert(test_cnt_wait(TEST_C, 7, 2, 2) == 2);
+    assert(test_cnt_wait(TEST_D, 7, 2, 1) == 1);
+    assert(test_cnt_wait(TEST_M, 8, 0, 1) == 1);
+    assert(test_cnt(TEST_ORIG, 7, 0) == 0 && test_cnt(TEST_ORIG, 7, 2) == 0);
+    assert(test_cnt(TEST_ORIG, 8, 0) == 1 && test_cnt(TEST_ORIG, 9, 0) == 0);
+}
+
+/*
+ * No rules, msgs go where they're sent.
+ */
+static void
+test_clear(void) {
+    pez_route_rule_t r[] = {
+        {0, TEST_TYPE_PROBE, 0, 0, PEZ_ROUTE_REDIRECT, "b"},
+    };
+
+    assert(pez_ipc_route_set(r, 1) == EOK);
+    test_route_wait(TEST_B);
+    assert(pez_ipc_route_set(NULL, 0) == EOK);
+    test_route_wait(TEST_ORIG);
+
+    test_send(8, 0, 0, 0);
+    test_send(9, 0, 0, 0);
+    test_flush();
+    assert(test_cnt(TEST_ORIG, 8, 0) == 2 && test_cnt(TEST_M, 8, 0) == 1);
+    assert(test_cnt(TEST_ORIG, 9, 0) == 1);
+}
+
+int
+main(void) {
+    pthread_t   tid;
+    test_rmsg_t m;
+
+    pez_ipc_init();
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+
+    test_bad_rules();
+    test_precedence();
+    test_clear();
+
+    assert(pez_codec_init(&m, sizeof(m), TEST_TYPE_STOP, 1, sizeof(m)));
+    assert(pez_ipc_msg_send("orig", "snd", &m, sizeof(m)) == EOK);
+    pthread_join(tid, NULL);
+    printf("test_route: ok\n");
+    return 0;
+}
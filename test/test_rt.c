@@ -0,0 +1,172 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+#include "pez_rtcheck.h"
+
+/*
+ * Real-time domain, built with PEZ_RT_CHECK: any malloc in a hot path of
+ * sender, router or receiver aborts the test.
+ */
+
+#define TEST_POOL_SIZE      (4)
+#define TEST_BURST          (64)
+#define TEST_WARM_NUM       (32)        /* bursts, zmq pipes grow meanwhile */
+#define TEST_ARMED_NUM      (200)
+#define TEST_LATE_NUM       (TEST_POOL_SIZE * 3)
+
+typedef struct {
+    int32_t             last;
+    uint32_t            cnt;
+    uint32_t            err;
+} test_rcv_t;
+
+static test_rcv_t       rcv = {-1};
+static test_rcv_t       late = {-1};
+static volatile int     ready;
+
+/*
+ * Small msgs only, zmq keeps them inline. Each one is next of the last.
+ */
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    test_rcv_t  *r = wz->data;
+    int32_t     m[4];
+    size_t      size;
+
+    if (pez_ipc_msg_recv(wz->zsock, m, sizeof(m), &size) != EOK ||
+        size != sizeof(m)) {
+        r->err ++;
+        return;
+    }
+    if (m[0] < 0) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    if (m[0] != r->last + 1) {
+        r->err ++;
+    }
+    r->last = m[0];
+    __atomic_add_fetch(&r->cnt, 1, __ATOMIC_RELEASE);
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+
+    ep = pez_ipc_endpoint_open(loop, "rcv", test_rcv_cb, &rcv);
+    assert(ep);
+    ready = 1;
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+static void
+test_send(const char *trgt, int32_t from, int32_t num) {
+    int32_t m[4] = {0};
+    int32_t i;
+
+    for (i = from; i < from + num; i ++) {
+        m[0] = i;
+        assert(pez_ipc_msg_send(trgt, "snd", m, sizeof(m)) == EOK);
+    }
+}
+
+static void
+test_wait(test_rcv_t *r, uint32_t num) {
+    int n;
+
+    for (n = 0; n < 5000 &&
+         __atomic_load_n(&r->cnt, __ATOMIC_ACQUIRE) < num; n ++) {
+        usleep(1000);
+    }
+    assert(__atomic_load_n(&r->cnt, __ATOMIC_ACQUIRE) == num);
+}
+
+/*
+ * Bursts as deep as warm up ones go through sender, router and receiver
+ * without any malloc.
+ */
+static void
+test_hot_path(void) {
+    int32_t seq = 0;
+    int     i;
+
+    pez_rtcheck_arm(0);
+    for (i = 0; i < TEST_WARM_NUM; i ++, seq += TEST_BURST) {
+        test_send("rcv", seq, TEST_BURST);
+        test_wait(&rcv, seq + TEST_BURST);
+    }
+    pez_rtcheck_arm(1);
+    for (i = 0; i < TEST_ARMED_NUM; i ++, seq += TEST_BURST) {
+        test_send("rcv", seq, TEST_BURST);
+        test_wait(&rcv, seq + TEST_BURST);
+    }
+    assert(rcv.err == 0);
+}
+
+/*
+ * Msgs to a thread not online yet are held in the defer pool. Once it's
+ * used up the rest are dropped rather than allocated for.
+ */
+static void
+test_defer_pool(void) {
+    struct ev_loop  *loop;
+    pez_endpoint_t  *ep;
+    int32_t         m[4] = {-1};
+    int             n;
+
+    assert(pez_ipc_thread_declare("late") == EOK);
+    test_send("late", 0, TEST_LATE_NUM);
+    /* router takes them in order with msgs to rcv */
+    test_send("rcv", rcv.last + 1, 1);
+    test_wait(&rcv, rcv.cnt + 1);
+    pez_rtcheck_arm(0);
+
+    loop = ev_loop_new(0);
+    ep = pez_ipc_endpoint_open(loop, "late", test_rcv_cb, &late);
+    assert(ep);
+    for (n = 0; n < 5000 &&
+         __atomic_load_n(&late.cnt, __ATOMIC_ACQUIRE) < TEST_POOL_SIZE;
+         n ++) {
+        ev_run(loop, EVRUN_NOWAIT);
+        usleep(1000);
+    }
+    /* nothing else is coming */
+    assert(pez_ipc_msg_send("late", "snd", m, sizeof(m)) == EOK);
+    ev_run(loop, 0);
+    assert(late.err == 0 && late.cnt == TEST_POOL_SIZE &&
+           late.last == TEST_POOL_SIZE - 1);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+}
+
+int
+main(void) {
+    pez_config_t    cfg;
+    pthread_t       tid;
+    int32_t         m[4] = {-1};
+
+    pez_ipc_config_init(&cfg);
+    cfg.rt_flags = PEZ_RT_PREALLOC;
+    cfg.rt_pool_size = TEST_POOL_SIZE;
+    assert(pez_ipc_init_config(&cfg) == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+
+    test_hot_path();
+    test_defer_pool();
+
+    assert(pez_ipc_msg_send("rcv", "snd", m, sizeof(m)) == EOK);
+    pthread_join(tid, NULL);
+    printf("test_rt: ok\n");
+    return 0;
+}
@@ -0,0 +1,269 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Msgs of several parts: a hdr, a body of varying size and a tail. Every
+ * 5th msg is a plain one of hdr only. Receiver takes them by
+ * pez_ipc_msg_recvv() or joined by pez_ipc_msg_recv(), as main tells it.
+ */
+
+#define TEST_MSG_NUM        (100)
+#define TEST_BODY_MAX       (1000)
+#define TEST_TAIL           "tail"
+
+enum {
+    TEST_PARTS,
+    TEST_JOINED,
+    TEST_SHORT,         /* room for fewer parts than sent */
+};
+
+typedef struct {
+    int32_t             seq;
+    uint32_t            body_size;
+} test_hdr_t;
+
+static uint8_t          body[TEST_BODY_MAX];
+static volatile int     mode;
+static int32_t          last = -1;
+static uint32_t         got;
+static uint32_t         err;
+static volatile int     ready;
+
+static uint32_t
+test_body_size(int32_t seq) {
+    return seq * 37 % TEST_BODY_MAX + 1;
+}
+
+static int
+test_is_plain(int32_t seq) {
+    return seq % 5 == 0;
+}
+
+/*
+ * Check hdr is next in order and rest is what was sent along with it.
+ */
+static int
+test_check(const uint8_t *data, size_t size,
+           const uint8_t *rest, size_t rest_size) {
+    test_hdr_t  hdr;
+    uint32_t    body_size;
+
+    if (size != sizeof(hdr)) {
+        return 0;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+    /* msgs of parts are dropped when there is too little room for them */
+    if (mode == TEST_SHORT ? hdr.seq <= last : hdr.seq != last + 1) {
+        return 0;
+    }
+    last = hdr.seq;
+    if (test_is_plain(hdr.seq)) {
+        return hdr.body_size == 0 && rest_size == 0;
+    }
+    body_size = test_body_size(hdr.seq);
+    return hdr.body_size == body_size &&
+           rest_size == body_size + sizeof(TEST_TAIL) &&
+           memcmp(rest, body, body_size) == 0 &&
+           memcmp(rest + body_size, TEST_TAIL, sizeof(TEST_TAIL)) == 0;
+}
+
+static void
+test_recv_parts(void *socket) {
+    pez_msg_view_t  parts[PEZ_IPC_IOV_MAX];
+    uint8_t         rest[TEST_BODY_MAX + sizeof(TEST_TAIL)];
+    int             cnt = mode == TEST_SHORT ? 2 : PEZ_IPC_IOV_MAX, i;
+    pez_status      rc;
+
+    rc = pez_ipc_msg_recvv(socket, parts, &cnt);
+    if (mode == TEST_SHORT && rc == EMSGSIZE && cnt == 0) {
+        __atomic_add_fetch(&got, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    if (rc != EOK) {
+        err ++;
+        return;
+    }
+    if (cnt == 1) {
+        if (!test_check(parts[0].data, parts[0].size, NULL, 0)) {
+            err ++;
+        }
+    } else if (mode == TEST_SHORT || cnt != 3 ||
+               parts[1].size + parts[2].size > sizeof(rest)) {
+        err ++;
+    } else {
+        memcpy(rest, parts[1].data, parts[1].size);
+        memcpy(rest + parts[1].size, parts[2].data, parts[2].size);
+        if (!test_check(parts[0].data, parts[0].size, rest,
+                        parts[1].size + parts[2].size)) {
+            err ++;
+        }
+    }
+    for (i = 0; i < cnt; i ++) {
+        pez_ipc_msg_release(&parts[i]);
+    }
+    __atomic_add_fetch(&got, 1, __ATOMIC_RELEASE);
+}
+
+static void
+test_recv_joined(void *socket) {
+    uint8_t     buf[sizeof(test_hdr_t) + TEST_BODY_MAX + sizeof(TEST_TAIL)];
+    size_t      size;
+
+    if (pez_ipc_msg_recv(socket, buf, sizeof(buf), &size) != EOK ||
+        size < sizeof(test_hdr_t) ||
+        !test_check(buf, sizeof(test_hdr_t), buf + sizeof(test_hdr_t),
+                    size - sizeof(test_hdr_t))) {
+        err ++;
+    }
+    __atomic_add_fetch(&got, 1, __ATOMIC_RELEASE);
+}
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    if (mode == TEST_JOINED) {
+        test_recv_joined(wz->zsock);
+    } else {
+        test_recv_parts(wz->zsock);
+    }
+    if (mode == TEST_JOINED && last == TEST_MSG_NUM - 1) {
+        ev_break(loop, EVBREAK_ALL);
+    }
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+
+    ep = pez_ipc_endpoint_open(loop, "rcv", test_rcv_cb, NULL);
+    assert(ep);
+    ready = 1;
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+/*
+ * Send all msgs, half of them by endpoint handle.
+ */
+static void
+test_send_all(void) {
+    pez_endpoint_t  *ep = pez_ipc_endpoint_get("snd");
+    struct iovec    iov[3];
+    test_hdr_t      hdr;
+    int32_t         i;
+
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        hdr.seq = i;
+        hdr.body_size = test_is_plain(i) ? 0 : test_body_size(i);
+        iov[0].iov_base = &hdr;
+        iov[0].iov_len = sizeof(hdr);
+        if (hdr.body_size == 0) {
+            assert(pez_ipc_msg_send("rcv", "snd", &hdr, sizeof(hdr)) == EOK);
+            continue;
+        }
+        iov[1].iov_base = body;
+        iov[1].iov_len = hdr.body_size;
+        iov[2].iov_base = TEST_TAIL;
+        iov[2].iov_len = sizeof(TEST_TAIL);
+        if (i % 2) {
+            assert(pez_ipc_endpoint_sendv(ep, "rcv", iov, 3) == EOK);
+        } else {
+            assert(pez_ipc_msg_sendv("rcv", "snd", iov, 3) == EOK);
+        }
+    }
+    assert(pez_ipc_msg_flush("snd") == EOK);
+}
+
+static void
+test_wait(uint32_t num) {
+    int n;
+
+    for (n = 0; n < 5000 && __atomic_load_n(&got, __ATOMIC_ACQUIRE) < num;
+         n ++) {
+        usleep(1000);
+    }
+    assert(__atomic_load_n(&got, __ATOMIC_ACQUIRE) == num);
+}
+
+/*
+ * Bad iovs are refused before anything is sent.
+ */
+static void
+test_inval(void) {
+    struct iovec    iov[PEZ_IPC_IOV_MAX + 1];
+    int32_t         m = 0;
+    int             i;
+
+    for (i = 0; i < PEZ_IPC_IOV_MAX + 1; i ++) {
+        iov[i].iov_base = &m;
+        iov[i].iov_len = sizeof(m);
+    }
+    assert(pez_ipc_msg_sendv("rcv", "snd", iov, 0) == EINVAL);
+    assert(pez_ipc_msg_sendv("rcv", "snd", iov, PEZ_IPC_IOV_MAX + 1) ==
+           EINVAL);
+    assert(pez_ipc_msg_sendv("rcv", NULL, iov, 1) == EINVAL);
+    assert(pez_ipc_msg_sendv("nobody", "snd", iov, 2) == EINVAL);
+    iov[1].iov_base = NULL;
+    assert(pez_ipc_msg_sendv("rcv", "snd", iov, 2) == EINVAL);
+    assert(pez_ipc_endpoint_sendv(NULL, "rcv", iov, 1) == EINVAL);
+}
+
+/*
+ * Parts come as sent, in order with plain msgs coalesced in between.
+ * Joined they're one msg, and with too little room none of them.
+ */
+static void
+test_parts(void) {
+    uint32_t    i;
+
+    for (i = 0; i < TEST_BODY_MAX; i ++) {
+        body[i] = (uint8_t)(i * 7);
+    }
+    assert(pez_ipc_coalesce_enable("snd", 4096, 1000) == EOK);
+
+    mode = TEST_PARTS;
+    test_send_all();
+    test_wait(TEST_MSG_NUM);
+    assert(err == 0 && last == TEST_MSG_NUM - 1);
+
+    mode = TEST_SHORT;
+    last = -1;
+    test_send_all();
+    test_wait(TEST_MSG_NUM * 2);
+    assert(err == 0 && last == TEST_MSG_NUM - 5);
+
+    mode = TEST_JOINED;
+    last = -1;
+    test_send_all();
+    test_wait(TEST_MSG_NUM * 3);
+    assert(err == 0 && last == TEST_MSG_NUM - 1);
+    assert(pez_ipc_coalesce_disable("snd") == EOK);
+}
+
+int
+main(void) {
+    pez_msg_view_t  parts[1];
+    pthread_t       tid;
+    int             cnt = 0;
+
+    assert(pez_ipc_init() == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    assert(pez_ipc_msg_recvv(NULL, parts, &cnt) == EINVAL);
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+
+    test_inval();
+    test_parts();
+    pthread_join(tid, NULL);
+    printf("test_sendv: ok\n");
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+#include "pez_task.h"
+
+#define TEST_POOL_SIZE      (2)
+#define TEST_TASK_NUM       (100)
+#define TEST_SUB_NUM        (16)
+
+typedef struct {
+    pez_domain_t        *dom;       /* of endpoint "rcv" */
+    uint32_t            sum;
+    uint32_t            cnt;
+    uint32_t            err;
+    volatile int        ready;
+} test_rcv_t;
+
+static size_t
+test_square(void *arg, void *result, size_t result_size) {
+    uint32_t v = (uint32_t)(uintptr_t)arg;
+
+    v *= v;
+    memcpy(result, &v, sizeof(v));
+    return sizeof(v);
+}
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    test_rcv_t  *r = wz->data;
+    uint32_t    v;
+    size_t      size;
+
+    if (pez_ipc_msg_recv(wz->zsock, &v, sizeof(v), &size) != EOK ||
+        size != sizeof(v)) {
+        r->err ++;
+        return;
+    }
+    r->sum += v;
+    if (++ r->cnt == TEST_TASK_NUM) {
+        ev_break(loop, EVBREAK_ALL);
+    }
+}
+
+/*
+ * Submits tasks from its loop, gets results by its endpoint.
+ */
+static void *
+test_rcv_thread(void *arg) {
+    test_rcv_t      *r = arg;
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+    uint32_t        i;
+
+    ep = pez_domain_endpoint_open(r->dom, loop, "rcv", test_rcv_cb, r);
+    assert(ep);
+    assert(!strcmp(pez_ipc_identity_get(), "rcv"));
+    assert(pez_ipc_endpoint_domain(pez_ipc_endpoint_get("rcv")) == r->dom);
+    for (i = 0; i < TEST_TASK_NUM; i ++) {
+        assert(pez_task_submit(test_square, (void *)(uintptr_t)i) == EOK);
+    }
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+/*
+ * Results of tasks reach the submitter, in default domain or another one.
+ */
+static void
+test_submit_reply(pez_domain_t *dom) {
+    test_rcv_t  r;
+    pthread_t   tid;
+    uint32_t    i, sum = 0;
+
+    memset(&r, 0, sizeof(r));
+    r.dom = dom;
+    pthread_create(&tid, NULL, test_rcv_thread, &r);
+    pthread_join(tid, NULL);
+    for (i = 0; i < TEST_TASK_NUM; i ++) {
+        sum += i * i;
+    }
+    assert(r.err == 0 && r.cnt == TEST_TASK_NUM && r.sum == sum);
+}
+
+static pthread_t        blocker;
+static uint32_t         sub_done;
+static uint32_t         sub_stolen;
+
+static size_t
+test_sub(void *arg, void *result, size_t result_size) {
+    if (!pthread_equal(pthread_self(), blocker)) {
+        __atomic_add_fetch(&sub_stolen, 1, __ATOMIC_RELEASE);
+    }
+    __atomic_add_fetch(&sub_done, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Pushes sub tasks onto deque of its pool thread, then keeps the thread
+ * busy until they're done. Only stealing gets them done.
+ */
+static size_t
+test_block(void *arg, void *result, size_t result_size) {
+    int i, n;
+
+    blocker = pthread_self();
+    for (i = 0; i < TEST_SUB_NUM; i ++) {
+        assert(pez_task_submit_to(test_sub, NULL, NULL) == EOK);
+    }
+    /* a pool thread must name where results go */
+    assert(pez_task_submit(test_sub, NULL) == EINVAL);
+    for (n = 0; n < 5000 &&
+         __atomic_load_n(&sub_done, __ATOMIC_ACQUIRE) < TEST_SUB_NUM; n ++) {
+        usleep(1000);
+    }
+    return 0;
+}
+
+static void
+test_steal(void) {
+    int n;
+
+    assert(pez_task_submit_to(test_block, NULL, NULL) == EOK);
+    for (n = 0; n < 10000 &&
+         __atomic_load_n(&sub_done, __ATOMIC_ACQUIRE) < TEST_SUB_NUM; n ++) {
+        usleep(1000);
+    }
+    assert(sub_done == TEST_SUB_NUM && sub_stolen == TEST_SUB_NUM);
+}
+
+int
+main(void) {
+    pez_config_t    cfg;
+    pez_domain_t    *dom;
+
+    pez_ipc_init();
+    assert(pez_task_pool_init(0) == EINVAL);
+    assert(pez_task_pool_init(TEST_POOL_SIZE) == EOK);
+    assert(pez_task_pool_init(TEST_POOL_SIZE) == EINVAL);
+    assert(pez_task_submit_to(test_square, NULL, "pez_task0") == EINVAL);
+    assert(pez_task_submit(NULL, NULL) == EINVAL);
+
+    test_submit_reply(pez_domain_default());
+    pez_ipc_config_init(&cfg);
+    dom = pez_domain_create("other", &cfg);
+    assert(dom);
+    test_submit_reply(dom);
+    test_steal();
+    printf("test_task: ok\n");
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Delayed and periodic msgs held by router. Msgs carry an id, receiver
+ * keeps when each id came in and how many times.
+ */
+
+#define TEST_ID_NUM         (8)
+#define TEST_MS             (1000000ULL)
+
+enum {
+    TEST_NOW,
+    TEST_SHORT,
+    TEST_MID,
+    TEST_LONG,          /* beyond 1st level of wheel */
+    TEST_CANCELLED,
+    TEST_PERIODIC,
+    TEST_STOP,
+};
+
+static uint64_t         got_ns[TEST_ID_NUM];
+static uint32_t         got_cnt[TEST_ID_NUM];
+static volatile int     ready;
+
+static uint64_t
+test_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    int32_t m;
+    size_t  size;
+
+    if (pez_ipc_msg_recv(wz->zsock, &m, sizeof(m), &size) != EOK ||
+        size != sizeof(m) || m < 0 || m >= TEST_ID_NUM) {
+        return;
+    }
+    if (m == TEST_STOP) {
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    if (got_cnt[m] == 0) {
+        got_ns[m] = test_now_ns();
+    }
+    __atomic_add_fetch(&got_cnt[m], 1, __ATOMIC_RELEASE);
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+
+    ep = pez_ipc_endpoint_open(loop, "rcv", test_rcv_cb, NULL);
+    assert(ep);
+    ready = 1;
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+    return NULL;
+}
+
+static uint32_t
+test_cnt(int id) {
+    return __atomic_load_n(&got_cnt[id], __ATOMIC_ACQUIRE);
+}
+
+static void
+test_wait(int id, uint32_t num, int max_ms) {
+    int n;
+
+    for (n = 0; n < max_ms && test_cnt(id) < num; n ++) {
+        usleep(1000);
+    }
+}
+
+/*
+ * Each msg comes once, not before its delay, in order of delays. One
+ * cancelled before it's due never comes.
+ */
+static void
+test_delay(void) {
+    uint64_t    start, timer_id;
+    int32_t     m;
+
+    start = test_now_ns();
+    m = TEST_LONG;
+    assert(pez_ipc_msg_send_after("rcv", "snd", &m, sizeof(m), 300,
+                                  NULL) == EOK);
+    m = TEST_MID;
+    assert(pez_ipc_msg_send_after("rcv", "snd", &m, sizeof(m), 50,
+                                  NULL) == EOK);
+    m = TEST_CANCELLED;
+    assert(pez_ipc_msg_send_after("rcv", "snd", &m, sizeof(m), 100,
+                                  &timer_id) == EOK);
+    m = TEST_SHORT;
+    assert(pez_ipc_msg_send_after("rcv", "snd", &m, sizeof(m), 20,
+                                  NULL) == EOK);
+    m = TEST_NOW;
+    assert(pez_ipc_msg_send_after("rcv", "snd", &m, sizeof(m), 0,
+                                  NULL) == EOK);
+    assert(pez_ipc_timer_cancel("snd", timer_id) == EOK);
+
+    test_wait(TEST_LONG, 1, 5000);
+    usleep(50000);
+    assert(test_cnt(TEST_NOW) == 1 && test_cnt(TEST_SHORT) == 1);
+    assert(test_cnt(TEST_MID) == 1 && test_cnt(TEST_LONG) == 1);
+    assert(test_cnt(TEST_CANCELLED) == 0);
+    assert(got_ns[TEST_SHORT] - start >= 20 * TEST_MS);
+    assert(got_ns[TEST_MID] - start >= 50 * TEST_MS);
+    assert(got_ns[TEST_LONG] - start >= 300 * TEST_MS);
+    assert(got_ns[TEST_NOW] < got_ns[TEST_SHORT] &&
+           got_ns[TEST_SHORT] < got_ns[TEST_MID] &&
+           got_ns[TEST_MID] < got_ns[TEST_LONG]);
+}
+
+/*
+ * Periodic msg keeps coming until cancelled, then stops.
+ */
+static void
+test_period(void) {
+    uint64_t    timer_id;
+    uint32_t    num;
+    int32_t     m = TEST_PERIODIC;
+
+    assert(pez_ipc_msg_send_every("rcv", "snd", &m, sizeof(m), 10, 0,
+                                  &timer_id) == EINVAL);
+    assert(pez_ipc_msg_send_every("rcv", "snd", &m, sizeof(m), 0, 10,
+                                  &timer_id) == EOK);
+    test_wait(TEST_PERIODIC, 5, 5000);
+    assert(test_cnt(TEST_PERIODIC) >= 5);
+    assert(pez_ipc_timer_cancel("snd", timer_id) == EOK);
+
+    /* one may be on its way already */
+    usleep(50000);
+    num = test_cnt(TEST_PERIODIC);
+    usleep(100000);
+    assert(test_cnt(TEST_PERIODIC) == num);
+}
+
+int
+main(void) {
+    pthread_t   tid;
+    int32_t     m = TEST_STOP;
+
+    assert(pez_ipc_init() == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+
+    test_delay();
+    test_period();
+
+    assert(pez_ipc_msg_send("rcv", "snd", &m, sizeof(m)) == EOK);
+    pthread_join(tid, NULL);
+    printf("test_timer: ok\n");
+    return 0;
+}
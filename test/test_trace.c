@@ -0,0 +1,126 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_trace.h"
+
+#define TEST_TRACK_NUM      (3)
+#define TEST_MSG_NUM        (10)
+#define TEST_JSON_MAX       (1 << 20)
+
+static char path[] = "/tmp/test_trace.XXXXXX";
+
+/*
+ * Read dump back, whole.
+ */
+static char *
+test_json_read(void) {
+    char    *json = malloc(TEST_JSON_MAX);
+    FILE    *fp = fopen(path, "r");
+    size_t  len;
+
+    assert(json && fp);
+    len = fread(json, 1, TEST_JSON_MAX - 1, fp);
+    assert(len > 0 && len < TEST_JSON_MAX - 1);
+    json[len] = '\0';
+    fclose(fp);
+    return json;
+}
+
+/*
+ * Strings end where they should and brackets match outside of them.
+ */
+static void
+test_json_check(const char *json) {
+    char        stack[16];
+    int         depth = 0, in_str = 0;
+    const char  *c;
+
+    for (c = json; *c; c ++) {
+        if (in_str) {
+            assert((unsigned char)*c >= 0x20);
+            if (*c == '\\') {
+                c ++;
+                assert(*c && strchr("\"\\/bfnrtu", *c));
+            } else if (*c == '"') {
+                in_str = 0;
+            }
+        } else if (*c == '"') {
+            in_str = 1;
+        } else if (*c == '{' || *c == '[') {
+            assert(depth < (int)sizeof(stack));
+            stack[depth ++] = *c;
+        } else if (*c == '}' || *c == ']') {
+            assert(depth > 0 && stack[-- depth] == (*c == '}' ? '{' : '['));
+        }
+    }
+    assert(!in_str && depth == 0);
+}
+
+static int
+test_count(const char *json, const char *what) {
+    const char  *c = json;
+    int         num = 0;
+
+    while ((c = strstr(c, what))) {
+        num ++;
+        c += strlen(what);
+    }
+    return num;
+}
+
+/*
+ * Sender, router and receiver tracks. Each msg gets all its spans, and
+ * names are escaped so that the dump stays valid JSON.
+ */
+static void
+test_dump(void) {
+    static pez_trace_ring_t ring[TEST_TRACK_NUM];
+    pez_trace_ring_t        *rings[TEST_TRACK_NUM + 1];
+    const char              *names[TEST_TRACK_NUM + 1] = {
+        "snd \"a\"", "router", "rcv\\b\n", "none",
+    };
+    uint64_t                ts = 1000, id;
+    char                    *json;
+
+    for (id = 1; id <= TEST_MSG_NUM; id ++) {
+        pez_trace_record(&ring[0], PEZ_TRACE_SEND, id, ts ++);
+        pez_trace_record(&ring[1], PEZ_TRACE_RT_RECV, id, ts ++);
+        pez_trace_record(&ring[1], PEZ_TRACE_RT_SEND, id, ts ++);
+        pez_trace_record(&ring[2], PEZ_TRACE_RX, id, ts ++);
+        pez_trace_record(&ring[2], PEZ_TRACE_HANDLER_BEGIN, id, ts ++);
+        pez_trace_record(&ring[2], PEZ_TRACE_HANDLER_END, id, ts ++);
+    }
+    rings[0] = &ring[0];
+    rings[1] = &ring[1];
+    rings[2] = &ring[2];
+    rings[3] = NULL;
+
+    assert(pez_trace_dump(path, rings, names, 0) == EINVAL);
+    assert(pez_trace_dump("/nonexistent/x", rings, names,
+                          TEST_TRACK_NUM + 1) == ENOENT);
+    assert(pez_trace_dump(path, rings, names, TEST_TRACK_NUM + 1) == EOK);
+    json = test_json_read();
+    test_json_check(json);
+    assert(strstr(json, "\"snd \\\"a\\\"\""));
+    assert(strstr(json, "\"rcv\\\\b\\u000a\""));
+    assert(!strstr(json, "none"));
+    assert(test_count(json, "\"ph\":\"M\"") == TEST_TRACK_NUM);
+    assert(test_count(json, "\"ph\":\"X\"") == TEST_MSG_NUM * 5);
+    assert(test_count(json, "\"name\":\"handler\"") == TEST_MSG_NUM);
+    free(json);
+}
+
+int
+main(void) {
+    int fd;
+
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    test_dump();
+    unlink(path);
+    printf("test_trace: ok\n");
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pez_ipc.h"
+
+/*
+ * Borrowed views of received msgs stay valid until they're released, by
+ * any thread, whatever is received meanwhile.
+ */
+
+#define TEST_MSG_NUM        (64)
+#define TEST_BIG_SIZE       (4096)
+#define TEST_SMALL_SIZE     (16)
+
+typedef struct {
+    int32_t             seq;
+    uint8_t             fill[TEST_BIG_SIZE - sizeof(int32_t)];
+} test_msg_t;
+
+static pez_msg_view_t   view[TEST_MSG_NUM + 1];  /* and one of stop msg */
+static pez_msg_view_t   kept[TEST_MSG_NUM];     /* retained copies */
+static uint32_t         view_num;
+static uint32_t         err;
+static volatile int     ready;
+
+static size_t
+test_size(int32_t seq) {
+    return seq % 2 ? TEST_SMALL_SIZE : TEST_BIG_SIZE;
+}
+
+static void
+test_fill(test_msg_t *m, int32_t seq) {
+    m->seq = seq;
+    memset(m->fill, (uint8_t)seq, test_size(seq) - sizeof(m->seq));
+}
+
+static int
+test_check(const pez_msg_view_t *v, int32_t seq) {
+    test_msg_t  m;
+
+    if (!v->data || v->size != test_size(seq)) {
+        return 0;
+    }
+    test_fill(&m, seq);
+    return memcmp(v->data, &m, v->size) == 0;
+}
+
+/*
+ * Keep a view of each msg and a retained copy of it, check none of them
+ * until all are in.
+ */
+static void
+test_rcv_cb(struct ev_loop *loop, ev_zsock_t *wz, int revents) {
+    pez_msg_view_t  *v = &view[view_num];
+
+    if (pez_ipc_msg_recv_view(wz->zsock, v) != EOK) {
+        err ++;
+        return;
+    }
+    if (v->size == sizeof(int32_t)) {
+        pez_ipc_msg_release(v);
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+    if (pez_ipc_msg_retain(v, &kept[view_num]) != EOK) {
+        err ++;
+    }
+    view_num ++;
+}
+
+static void *
+test_rcv_thread(void *arg) {
+    struct ev_loop  *loop = ev_loop_new(0);
+    pez_endpoint_t  *ep;
+    uint32_t        i;
+
+    ep = pez_ipc_endpoint_open(loop, "rcv", test_rcv_cb, NULL);
+    assert(ep);
+    ready = 1;
+    ev_run(loop, 0);
+    assert(pez_ipc_endpoint_close(ep) == EOK);
+    ev_loop_destroy(loop);
+
+    /* views outlive endpoint, copies still hold the frames */
+    for (i = 0; i < view_num; i ++) {
+        if (!test_check(&view[i], i)) {
+            err ++;
+        }
+        pez_ipc_msg_release(&view[i]);
+        if (view[i].data || view[i].size) {
+            err ++;
+        }
+    }
+    return NULL;
+}
+
+static void
+test_send_all(void) {
+    test_msg_t  m;
+    int32_t     i, stop = -1;
+
+    for (i = 0; i < TEST_MSG_NUM; i ++) {
+        test_fill(&m, i);
+        assert(pez_ipc_msg_send("rcv", "snd", &m, test_size(i)) == EOK);
+    }
+    assert(pez_ipc_msg_send("rcv", "snd", &stop, sizeof(stop)) == EOK);
+}
+
+/*
+ * Views of small and big msgs, released by receiver after all are in,
+ * copies released by another thread after that.
+ */
+static void
+test_views(void) {
+    pthread_t   tid;
+    uint32_t    i;
+
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+    test_send_all();
+    pthread_join(tid, NULL);
+    assert(err == 0 && view_num == TEST_MSG_NUM);
+
+    for (i = 0; i < view_num; i ++) {
+        assert(test_check(&kept[i], i));
+        pez_ipc_msg_release(&kept[i]);
+    }
+}
+
+/*
+ * Coalesced msgs share one frame, each view still sees its own msg.
+ */
+static void
+test_coalesced(void) {
+    pthread_t   tid;
+    uint32_t    i;
+
+    view_num = 0;
+    ready = 0;
+    assert(pez_ipc_coalesce_enable("snd", TEST_BIG_SIZE * 4, 1000) == EOK);
+    pthread_create(&tid, NULL, test_rcv_thread, NULL);
+    while (!ready) {
+        usleep(1000);
+    }
+    test_send_all();
+    assert(pez_ipc_msg_flush("snd") == EOK);
+    pthread_join(tid, NULL);
+    assert(pez_ipc_coalesce_disable("snd") == EOK);
+    assert(err == 0 && view_num == TEST_MSG_NUM);
+
+    for (i = 0; i < view_num; i ++) {
+        assert(test_check(&kept[i], i));
+        pez_ipc_msg_release(&kept[i]);
+    }
+}
+
+int
+main(void) {
+    pez_msg_view_t  v;
+
+    assert(pez_ipc_init() == EOK);
+    assert(pez_ipc_thread_init_tx("snd") == EOK);
+    assert(pez_ipc_msg_recv_view(NULL, &v) == EINVAL);
+    assert(pez_ipc_msg_retain(NULL, &v) == EINVAL);
+    assert(pez_ipc_msg_retain(&v, &v) == EINVAL);
+    pez_ipc_msg_release(NULL);
+
+    test_views();
+    test_coalesced();
+    printf("test_view: ok\n");
+    return 0;
+}